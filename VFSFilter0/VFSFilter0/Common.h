@@ -86,144 +86,37 @@ extern "C" {
 //--------------------------------------------------------------------
 
 //
-// Double linked list manipulation functions, the same as on Windows
+// the list functions and CONTAINING_RECORD
 //
+#include "ListEntry.h"
 
-typedef struct _LIST_ENTRY {
-    struct _LIST_ENTRY *Flink;
-    struct _LIST_ENTRY *Blink;
-} LIST_ENTRY, *PLIST_ENTRY;
 
-inline
-void
-InitializeListHead(
-                   __inout PLIST_ENTRY ListHead
-                   )
-{
-    ListHead->Flink = ListHead->Blink = ListHead;
-}
-
-inline
-bool
-IsListEmpty(
-            __in const LIST_ENTRY * ListHead
-            )
-{
-    return (bool)(ListHead->Flink == ListHead);
-}
-
-inline
-bool
-RemoveEntryList(
-                __in PLIST_ENTRY Entry
-                )
-{
-    PLIST_ENTRY Blink;
-    PLIST_ENTRY Flink;
-    
-    Flink = Entry->Flink;
-    Blink = Entry->Blink;
-    Blink->Flink = Flink;
-    Flink->Blink = Blink;
-    return (bool)(Flink == Blink);
-}
-
-inline
-PLIST_ENTRY
-RemoveHeadList(
-               __in PLIST_ENTRY ListHead
-               )
-{
-    PLIST_ENTRY Flink;
-    PLIST_ENTRY Entry;
-    
-    Entry = ListHead->Flink;
-    Flink = Entry->Flink;
-    ListHead->Flink = Flink;
-    Flink->Blink = ListHead;
-    return Entry;
-}
-
-inline
-PLIST_ENTRY
-RemoveTailList(
-               __in PLIST_ENTRY ListHead
-               )
-{
-    PLIST_ENTRY Blink;
-    PLIST_ENTRY Entry;
-    
-    Entry = ListHead->Blink;
-    Blink = Entry->Blink;
-    ListHead->Blink = Blink;
-    Blink->Flink = ListHead;
-    return Entry;
-}
+#define __countof( X )  ( sizeof( X ) / sizeof( X[0] ) )
 
-inline
-void
-InsertTailList(
-               __in PLIST_ENTRY ListHead,
-               __in PLIST_ENTRY Entry
-               )
-{
-    PLIST_ENTRY Blink;
-    
-    Blink = ListHead->Blink;
-    Entry->Flink = ListHead;
-    Entry->Blink = Blink;
-    Blink->Flink = Entry;
-    ListHead->Blink = Entry;
-}
+//
+// used to place data accessed concurrently on separate cache lines
+//
+#define QVR_CACHE_LINE_SIZE  64
 
+//
+// per-CPU data is placed in QVR_CPU_SLOTS slots indexed by a CPU number,
+// a thread can be preempted and moved to another CPU after the slot has been
+// chosen so the per-CPU data still needs a synchronization, the slots only
+// reduce the cache lines sharing
+//
+#define QVR_CPU_SLOTS  32 // must be a power of 2
 
-inline
-void
-InsertHeadList(
-               __in PLIST_ENTRY ListHead,
-               __in PLIST_ENTRY Entry
-               )
-{
-    PLIST_ENTRY Flink;
-    
-    Flink = ListHead->Flink;
-    Entry->Flink = Flink;
-    Entry->Blink = ListHead;
-    Flink->Blink = Entry;
-    ListHead->Flink = Entry;
-}
+extern "C" int cpu_number(void);
 
 inline
-void
-AppendTailList(
-               __in PLIST_ENTRY ListHead,
-               __in PLIST_ENTRY ListToAppend
-               )
+unsigned int
+QvrCurrentCpuSlot()
 {
-    PLIST_ENTRY ListEnd = ListHead->Blink;
-    
-    ListHead->Blink->Flink = ListToAppend;
-    ListHead->Blink = ListToAppend->Blink;
-    ListToAppend->Blink->Flink = ListHead;
-    ListToAppend->Blink = ListEnd;
+    return (unsigned int)cpu_number() & ( QVR_CPU_SLOTS - 1 );
 }
 
 //---------------------------------------------------------------------
 
-//
-// Calculate the address of the base of the structure given its type, and an
-// address of a field within the structure.
-//
-
-#define CONTAINING_RECORD(address, type, field) ((type *)( \
-    (char*)(address) - \
-    reinterpret_cast<vm_address_t>(&((type *)0)->field)))
-
-
-#define __countof( X )  ( sizeof( X ) / sizeof( X[0] ) )
-
-//---------------------------------------------------------------------
-
 extern vfs_context_t  gSuperUserContext; // TO DO redesign!
 
 
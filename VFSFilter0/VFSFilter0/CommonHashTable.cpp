@@ -24,25 +24,120 @@ __END_DECLS
 #define FLAGS_INTERNAL 1 /* The item is internal to the hash table */
 
 /* Prototypes */
-static inline void              transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry);
-static inline void              move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry);
+static inline void              transpose(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_entry_t *p_entry);
+static inline void              move_to_front(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_entry_t *p_entry);
 static inline void              free_entry_chain(ght_hash_table_t *p_ht, ght_hash_entry_t *p_entry);
 
 #if !defined( DBG )
 static inline
 #endif//!DBG
-ght_hash_entry_t *search_in_bucket(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_key_t *p_key, unsigned char i_heuristics);
+ght_hash_entry_t *search_in_bucket(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_key_t *p_key, ght_uint32_t l_hash, unsigned char i_heuristics, unsigned int *p_probes);
 
 static inline void              hk_fill(ght_hash_key_t *p_hk, int i_size, const void *p_key);
-static inline ght_hash_entry_t *he_create(ght_hash_table_t *p_ht, void *p_data, unsigned int i_key_size, const void *p_key_data);
+static inline ght_hash_entry_t *he_create(ght_hash_table_t *p_ht, void *p_data, unsigned int i_key_size, const void *p_key_data, ght_uint32_t l_hash);
 static inline void              he_finalize(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he);
+static inline void              rehash_start(ght_hash_table_t *p_ht, unsigned int i_size);
+static inline void              rehash_step(ght_hash_table_t *p_ht, unsigned int i_buckets);
+static bool                     rehash_full(ght_hash_table_t *p_ht, unsigned int i_size);
 
 //--------------------------------------------------------------------
 
 /* --- private methods --- */
 
+/* Find the bucket for a hash value */
+static inline void locate_bucket(ght_hash_table_t *p_ht, ght_uint32_t l_hash, ght_bucket_t *p_bucket)
+{
+    if (p_ht->pp_entries_old)
+    {
+        ght_uint32_t l_old = l_hash & p_ht->i_size_mask_old;
+        
+        /*
+         * The old bucket has not been migrated yet, for a concurrent table
+         * i_rehash_bucket can be advanced over the other groups' buckets but
+         * it passes l_old only under the lock of l_old's group
+         */
+        if (l_old >= p_ht->i_rehash_bucket)
+        {
+            p_bucket->pp_head = &p_ht->pp_entries_old[l_old];
+            p_bucket->p_nr    = &p_ht->p_nr_old[l_old];
+            return;
+        }
+    }
+    
+    p_bucket->pp_head = &p_ht->pp_entries[l_hash & p_ht->i_size_mask];
+    p_bucket->p_nr    = &p_ht->p_nr[l_hash & p_ht->i_size_mask];
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * The locks of a concurrent table, all of them do nothing for a table
+ * synchronized by its owner. A group is selected by a hash value or by
+ * a bucket index, both give the same group as i_groups <= i_size.
+ */
+static inline void lock_group_shared(ght_hash_table_t *p_ht, ght_uint32_t l_hash)
+{
+    UInt64 start;
+    
+    if (!p_ht->pp_group_locks)
+        return;
+    
+    start = QvrTableStatistics::now();
+    IORWLockRead( p_ht->pp_group_locks[ l_hash & (p_ht->i_groups - 1) ] );
+    p_ht->stats.lockAcquired( QvrTableStatistics::now() - start );
+}
+
+static inline void lock_group_exclusive(ght_hash_table_t *p_ht, ght_uint32_t l_hash)
+{
+    if (p_ht->pp_group_locks)
+        IORWLockWrite( p_ht->pp_group_locks[ l_hash & (p_ht->i_groups - 1) ] );
+}
+
+static inline void unlock_group(ght_hash_table_t *p_ht, ght_uint32_t l_hash)
+{
+    if (p_ht->pp_group_locks)
+        IORWLockUnlock( p_ht->pp_group_locks[ l_hash & (p_ht->i_groups - 1) ] );
+}
+
+/* Exclude all readers, used to switch the bucket arrays */
+static inline void lock_all_groups(ght_hash_table_t *p_ht)
+{
+    unsigned int i;
+    
+    if (!p_ht->pp_group_locks)
+        return;
+    
+    for (i = 0; i < p_ht->i_groups; i++)
+        IORWLockWrite( p_ht->pp_group_locks[i] );
+}
+
+static inline void unlock_all_groups(ght_hash_table_t *p_ht)
+{
+    unsigned int i;
+    
+    if (!p_ht->pp_group_locks)
+        return;
+    
+    for (i = p_ht->i_groups; i > 0; i--)
+        IORWLockUnlock( p_ht->pp_group_locks[i - 1] );
+}
+
+static inline void lock_writer(ght_hash_table_t *p_ht)
+{
+    if (p_ht->p_write_lock)
+        IOLockLock( p_ht->p_write_lock );
+}
+
+static inline void unlock_writer(ght_hash_table_t *p_ht)
+{
+    if (p_ht->p_write_lock)
+        IOLockUnlock( p_ht->p_write_lock );
+}
+
+//--------------------------------------------------------------------
+
 /* Move p_entry one up in its list. */
-static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry)
+static inline void transpose(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_entry_t *p_entry)
 {
     /*
      *  __    __    __    __
@@ -64,7 +159,7 @@ static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_
         }
         else /* This element is now placed first */
         {
-            p_ht->pp_entries[l_bucket] = p_entry;
+            *p_bucket->pp_head = p_entry;
         }
         
         if (p_b)
@@ -84,7 +179,7 @@ static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_
 //--------------------------------------------------------------------
 
 /* Move p_entry first */
-static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry)
+static inline void move_to_front(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_entry_t *p_entry)
 {
     /*
      *  __    __    __
@@ -94,7 +189,7 @@ static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket,
      *  __/   __    __
      * |X_|->|A_|->|B_|
      */
-    if (p_entry == p_ht->pp_entries[l_bucket])
+    if (p_entry == *p_bucket->pp_head)
     {
         return;
     }
@@ -107,15 +202,15 @@ static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket,
     }
     
     /* Place p_entry first */
-    p_entry->p_next = p_ht->pp_entries[l_bucket];
+    p_entry->p_next = *p_bucket->pp_head;
     p_entry->p_prev = NULL;
-    p_ht->pp_entries[l_bucket]->p_prev = p_entry;
-    p_ht->pp_entries[l_bucket] = p_entry;
+    (*p_bucket->pp_head)->p_prev = p_entry;
+    *p_bucket->pp_head = p_entry;
 }
 
 //--------------------------------------------------------------------
 
-static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p)
+static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_bucket_t *p_bucket, ght_hash_entry_t *p)
 {
     if (p->p_prev)
     {
@@ -123,7 +218,7 @@ static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_uint32_t l_buck
     }
     else /* first in list */
     {
-        p_ht->pp_entries[l_bucket] = p->p_next;
+        *p_bucket->pp_head = p->p_next;
     }
     if (p->p_next)
     {
@@ -157,37 +252,39 @@ static inline
 ght_hash_entry_t*
 search_in_bucket(
     __in ght_hash_table_t *p_ht,
-    __in ght_uint32_t l_bucket,
+    __in ght_bucket_t *p_bucket,
     __in ght_hash_key_t *p_key,
-    __in unsigned char i_heuristics
+    __in ght_uint32_t l_hash,
+    __in unsigned char i_heuristics,
+    __out_opt unsigned int *p_probes
     )
 {
     ght_hash_entry_t *p_e;
-#if defined( DBG )
     int   entries = 0x0;
-#endif//DBG
     
-    for (p_e = p_ht->pp_entries[l_bucket];
+    for (p_e = *p_bucket->pp_head;
          p_e;
          p_e = p_e->p_next)
     {
-#if defined( DBG )
         ++entries;
+#if defined( DBG )
         assert( p_e->key_shadow.i_size == p_e->key.i_size &&
                0x0 == memcmp( p_e->key.p_key, p_e->key_shadow.p_key, p_e->key_shadow.i_size ) );
 #endif//DBG
         
-        if( (p_e->key.i_size == p_key->i_size) &&
+        /* The stored hash rejects most of the other keys without memcmp() */
+        if( (p_e->hash == l_hash) &&
+            (p_e->key.i_size == p_key->i_size) &&
             (memcmp(p_e->key.p_key, p_key->p_key, p_e->key.i_size) == 0) )
         {
             /* Matching entry found - Apply heuristics, if any */
             switch (i_heuristics)
             {
                 case GHT_HEURISTICS_MOVE_TO_FRONT:
-                    move_to_front(p_ht, l_bucket, p_e);
+                    move_to_front(p_ht, p_bucket, p_e);
                     break;
                 case GHT_HEURISTICS_TRANSPOSE:
-                    transpose(p_ht, l_bucket, p_e);
+                    transpose(p_ht, p_bucket, p_e);
                     break;
                 default:
                     break;
@@ -196,19 +293,132 @@ search_in_bucket(
             // I do not have intention to insert NULL in the hash table
             //
             assert( p_e->p_data );
+            
+            if (p_probes)
+                *p_probes = entries;
+            
             return p_e;
         }
     }
     
 #if defined( DBG )
-    assert( entries == p_ht->p_nr[ l_bucket ] );
+    assert( entries == *p_bucket->p_nr );
 #endif//DBG
     
+    if (p_probes)
+        *p_probes = entries;
+    
     return NULL;
 }
 
 //--------------------------------------------------------------------
 
+/*
+ * The fixed size keys are read with memcpy() as the caller's key
+ * pointer might be not aligned.
+ */
+template<typename T>
+static inline T fixed_key_value(const void *p_key)
+{
+    T value;
+    
+    memcpy( &value, p_key, sizeof(value) );
+    return value;
+}
+
+//--------------------------------------------------------------------
+
+/* The MurmurHash3 64 bit finalizer */
+template<typename T>
+static inline ght_uint32_t fixed_key_hash(T key)
+{
+    UInt64 h = key;
+    
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    
+    return (ght_uint32_t)h;
+}
+
+//--------------------------------------------------------------------
+
+/* Search for a fixed size key in a bucket, the keys are compared as integers */
+template<typename T>
+static inline
+ght_hash_entry_t*
+search_in_bucket_fixed(
+    __in ght_hash_table_t *p_ht,
+    __in ght_bucket_t *p_bucket,
+    __in T key,
+    __in unsigned char i_heuristics,
+    __out_opt unsigned int *p_probes
+    )
+{
+    ght_hash_entry_t *p_e;
+    unsigned int entries = 0;
+    
+    for (p_e = *p_bucket->pp_head;
+         p_e;
+         p_e = p_e->p_next)
+    {
+        ++entries;
+        
+        /* The key is at the start of key_data, memcpy() avoids the type punning and is a single load */
+        if (fixed_key_value<T>(&p_e->key_data) == key)
+        {
+            switch (i_heuristics)
+            {
+                case GHT_HEURISTICS_MOVE_TO_FRONT:
+                    move_to_front(p_ht, p_bucket, p_e);
+                    break;
+                case GHT_HEURISTICS_TRANSPOSE:
+                    transpose(p_ht, p_bucket, p_e);
+                    break;
+                default:
+                    break;
+            }
+            
+            assert( p_e->p_data );
+            break;
+        }
+    }
+    
+    if (p_probes)
+        *p_probes = entries;
+    
+    return p_e;
+}
+
+//--------------------------------------------------------------------
+
+/* Search for a key with the search specialized for the table's key size */
+static inline
+ght_hash_entry_t*
+find_in_bucket(
+    __in ght_hash_table_t *p_ht,
+    __in ght_bucket_t *p_bucket,
+    __in ght_hash_key_t *p_key,
+    __in ght_uint32_t l_hash,
+    __in unsigned char i_heuristics,
+    __out_opt unsigned int *p_probes
+    )
+{
+    switch (p_ht->i_fixed_key_size)
+    {
+        case sizeof(UInt32):
+            return search_in_bucket_fixed<UInt32>(p_ht, p_bucket, fixed_key_value<UInt32>(p_key->p_key), i_heuristics, p_probes);
+        case sizeof(UInt64):
+            return search_in_bucket_fixed<UInt64>(p_ht, p_bucket, fixed_key_value<UInt64>(p_key->p_key), i_heuristics, p_probes);
+        default:
+            return search_in_bucket(p_ht, p_bucket, p_key, l_hash, i_heuristics, p_probes);
+    }
+}
+
+//--------------------------------------------------------------------
+
 /* Free a chain of entries (in a bucket) */
 static inline
 void
@@ -247,7 +457,8 @@ he_create(
     __in ght_hash_table_t *p_ht,
     __in void *p_data,
     __in unsigned int i_key_size,
-    __in const void *p_key_data
+    __in const void *p_key_data,
+    __in ght_uint32_t l_hash
    )
 {
     ght_hash_entry_t *p_he;
@@ -269,7 +480,7 @@ he_create(
      * This saves space since mac_kalloc only is called once and thus avoids
      * some fragmentation. Thanks to Dru Lemley for this idea.
      */
-    size = sizeof(ght_hash_entry_t)+i_key_size;
+    size = sizeof(ght_hash_entry_t) + (i_key_size > sizeof(p_he->key_data) ? i_key_size : 0);
     if( !(p_he = (ght_hash_entry_t*)p_ht->fn_alloc( size, p_ht->non_block? M_NOWAIT :M_WAITOK ) ) )
     {
         DBG_PRINT_ERROR( ( "p_he = p_ht->fn_alloc( %d, %d ) failed!\n", (int)size, p_ht->non_block? M_NOWAIT :M_WAITOK ) );
@@ -305,15 +516,26 @@ he_create(
     
     p_he->size    = size;
     p_he->p_data  = p_data;
+    p_he->hash    = l_hash;
+    p_he->referenced = 0;
     p_he->p_next  = NULL;
     p_he->p_prev  = NULL;
     p_he->p_older = NULL;
     p_he->p_newer = NULL;
     
-    /* Create the key */
+    /* Create the key, a short key is stored in the entry */
     p_he->key.i_size = i_key_size;
-    memcpy(p_he+1, p_key_data, i_key_size);
-    p_he->key.p_key = (void*)(p_he+1);
+    p_he->key_data = 0;
+    if (i_key_size <= sizeof(p_he->key_data))
+    {
+        memcpy(&p_he->key_data, p_key_data, i_key_size);
+        p_he->key.p_key = (void*)&p_he->key_data;
+    }
+    else
+    {
+        memcpy(p_he+1, p_key_data, i_key_size);
+        p_he->key.p_key = (void*)(p_he+1);
+    }
     
     return p_he;
 }
@@ -346,165 +568,1132 @@ static inline void he_finalize(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he)
 
 //--------------------------------------------------------------------
 
-#if 0
-/* Tried this to avoid recalculating hash values by caching
- * them. Overhead larger than benefits.
- */
-static inline ght_uint32_t get_hash_value(ght_hash_table_t *p_ht, ght_hash_key_t *p_key)
+/* Add a linked entry to the memory counters */
+static inline void account_entry(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he)
 {
-    int i;
-    
-    if (p_key->i_size > sizeof(uint64_t))
-        return p_ht->fn_hash(p_key);
-    
-    /* Lookup in the hash value cache */
-    for (i = 0; i < GHT_N_CACHED_HASH_KEYS; i++)
-    {
-        if ( p_key->i_size == p_ht->cached_keys[i].key.i_size &&
-             memcmp(p_key->p_key, p_ht->cached_keys[i].key.p_key, p_key->i_size) == 0)
-             return p_ht->cached_keys[i].hash_val;
-    }
-    p_ht->cur_cache_evict = (p_ht->cur_cache_evict + 1) % GHT_N_CACHED_HASH_KEYS;
-    p_ht->cached_keys[ p_ht->cur_cache_evict ].key = *p_key;
-    p_ht->cached_keys[ p_ht->cur_cache_evict ].hash_val = p_ht->fn_hash(p_key);
+    p_ht->i_bytes += p_he->size;
+    p_ht->i_key_bytes += p_he->key.i_size;
+}
+
+/* Subtract an unlinked entry from the memory counters */
+static inline void unaccount_entry(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he)
+{
+    assert( p_ht->i_bytes >= p_he->size );
     
-    return p_ht->cached_keys[ p_ht->cur_cache_evict ].hash_val;
+    p_ht->i_bytes -= p_he->size;
+    p_ht->i_key_bytes -= p_he->key.i_size;
 }
-#else
-# define get_hash_value(p_ht, p_key) ( (p_ht)->fn_hash(p_key) )
-#endif
 
 //--------------------------------------------------------------------
 
-/* --- Exported methods --- */
-/* Create a new hash table */
-ght_hash_table_t*
-ght_create(
-    __in unsigned int i_size,
-    __in bool   non_block
-    )
+/* The hash of an inserted key is stored in its entry, see ght_hash_entry_t */
+#define get_hash_value(p_ht, p_key) ( (p_ht)->i_fixed_key_size ? ght_fixed_key_hash(p_key) : (p_ht)->fn_hash(p_key) )
+
+//--------------------------------------------------------------------
+
+/* Start an incremental rehash, the current arrays become the old ones */
+static inline void rehash_start(ght_hash_table_t *p_ht, unsigned int i_size)
 {
-    ght_hash_table_t *p_ht;
-    int i=1;
+    ght_hash_entry_t **pp_entries;
+    int *p_nr;
+    unsigned int i_new_size = 1;
     
-    assert( non_block || preemption_enabled() );
-     
-    if ( !(p_ht = (ght_hash_table_t*)mac_kalloc( sizeof(ght_hash_table_t), non_block? M_NOWAIT : M_WAITOK )) )
-    {
-        DBG_PRINT_ERROR( ( "ght_create-> p_ht = mac_kalloc( %d, %d ) failed\n",
-                            (int)sizeof(ght_hash_table_t),
-                            non_block? M_NOWAIT : M_WAITOK ) );
-        return NULL;
-    }
+    assert( NULL == p_ht->pp_entries_old );
     
-    /* Set the size of the hash table to the nearest 2^i higher then i_size */
-    p_ht->i_size = 1;
-    while(p_ht->i_size < i_size)
+    while (i_new_size < i_size)
     {
-        p_ht->i_size = 1<<i++;
+        i_new_size <<= 1;
     }
     
-    p_ht->i_size_mask = (1<<(i-1))-1; /* Mask to & with */
-    p_ht->i_items = 0;
-    
-    p_ht->fn_hash = ght_one_at_a_time_hash;
-    
-    /* Standard values for allocations */
-    p_ht->fn_alloc = mac_kalloc;
-    p_ht->fn_free = mac_kfree;
-    
-    /* Set flags */
-    p_ht->i_heuristics = GHT_HEURISTICS_NONE;
-    p_ht->i_automatic_rehash = FALSE;
-    
-    p_ht->bucket_limit = 0;
-    p_ht->fn_bucket_free = NULL;
-    
-    p_ht->non_block = non_block;
-    
-    /* Create an empty bucket list. */
-    if ( !(p_ht->pp_entries = (ght_hash_entry_t**)mac_kalloc( p_ht->i_size*sizeof(ght_hash_entry_t*), non_block? M_NOWAIT : M_WAITOK ) ) )
+    /*
+     * The allocation failure is not an error, the table continues with the
+     * current arrays and the next insert tries again
+     */
+    if ( !(pp_entries = (ght_hash_entry_t**)mac_kalloc( i_new_size*sizeof(ght_hash_entry_t*), p_ht->non_block? M_NOWAIT : M_WAITOK )) )
     {
-        DBG_PRINT_ERROR( ( "ght_create-> p_ht->pp_entries = mac_kalloc( %d, %d ) failed\n",
-                           (int)(p_ht->i_size*sizeof(ght_hash_entry_t*)),
-                           non_block? M_NOWAIT : M_WAITOK ) );
-        mac_kfree( p_ht, sizeof(ght_hash_table_t) );
-        return NULL;
+        return;
     }
-    memset(p_ht->pp_entries, 0, p_ht->i_size*sizeof(ght_hash_entry_t*));
     
-    /* Initialise the number of entries in each bucket to zero */
-    if ( !(p_ht->p_nr = (int*)mac_kalloc( p_ht->i_size*sizeof(int), non_block? M_NOWAIT : M_WAITOK ) ) )
+    if ( !(p_nr = (int*)mac_kalloc( i_new_size*sizeof(int), p_ht->non_block? M_NOWAIT : M_WAITOK )) )
     {
-        DBG_PRINT_ERROR( ( "ght_create-> p_ht->p_nr = mac_kalloc( %d, %d ) failed\n",
-                           (int)(p_ht->i_size*sizeof(int)),
-                           non_block? M_NOWAIT : M_WAITOK ) );
-
-        mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
-        mac_kfree( p_ht, sizeof(ght_hash_table_t) );
-        return NULL;
+        mac_kfree( pp_entries, i_new_size*sizeof(ght_hash_entry_t*) );
+        return;
     }
     
-    memset( p_ht->p_nr, 0, p_ht->i_size*sizeof(int) );
-    
-    p_ht->p_oldest = NULL;
-    p_ht->p_newest = NULL;
+    memset( pp_entries, 0, i_new_size*sizeof(ght_hash_entry_t*) );
+    memset( p_nr, 0, i_new_size*sizeof(int) );
     
-    return p_ht;
+    lock_all_groups( p_ht );
+    {
+        p_ht->pp_entries_old  = p_ht->pp_entries;
+        p_ht->p_nr_old        = p_ht->p_nr;
+        p_ht->i_size_old      = p_ht->i_size;
+        p_ht->i_size_mask_old = p_ht->i_size_mask;
+        p_ht->i_rehash_bucket = 0;
+        
+        p_ht->pp_entries  = pp_entries;
+        p_ht->p_nr        = p_nr;
+        p_ht->i_size      = i_new_size;
+        p_ht->i_size_mask = i_new_size - 1;
+    }
+    unlock_all_groups( p_ht );
 }
 
 //--------------------------------------------------------------------
 
-/* Set the allocation/deallocation function to use */
-void ght_set_alloc(ght_hash_table_t *p_ht, ght_fn_alloc_t fn_alloc, ght_fn_free_t fn_free)
+/* Migrate up to i_buckets old buckets, the old arrays are freed after the last one */
+static inline void rehash_step(ght_hash_table_t *p_ht, unsigned int i_buckets)
 {
-    p_ht->fn_alloc = fn_alloc;
-    p_ht->fn_free = fn_free;
+    /*
+     * The old buckets of a shrink are mostly empty, they are migrated faster
+     * so the shrink is finished before the remaining items are removed
+     */
+    if (p_ht->pp_entries_old && p_ht->i_size_old > p_ht->i_size)
+    {
+        i_buckets *= p_ht->i_size_old/p_ht->i_size;
+    }
+    
+    while (p_ht->pp_entries_old && i_buckets--)
+    {
+        ght_uint32_t l_old = p_ht->i_rehash_bucket;
+        ght_hash_entry_t *p_e;
+        ght_hash_entry_t **pp_entries_old;
+        int *p_nr_old;
+        unsigned int i_size_old;
+        
+        /* The new buckets l_new have the same low bits as l_old so they are in its group */
+        lock_group_exclusive( p_ht, l_old );
+        {
+            p_e = p_ht->pp_entries_old[l_old];
+            
+            while (p_e)
+            {
+                ght_hash_entry_t *p_e_next = p_e->p_next;
+                ght_uint32_t l_new = p_e->hash & p_ht->i_size_mask;
+                
+                /* Place the entry first in the new bucket, the age list is not changed */
+                p_e->p_prev = NULL;
+                p_e->p_next = p_ht->pp_entries[l_new];
+                if (p_ht->pp_entries[l_new])
+                {
+                    p_ht->pp_entries[l_new]->p_prev = p_e;
+                }
+                p_ht->pp_entries[l_new] = p_e;
+                p_ht->p_nr[l_new]++;
+                
+                p_e = p_e_next;
+            }
+            
+            p_ht->pp_entries_old[l_old] = NULL;
+            p_ht->p_nr_old[l_old] = 0;
+            
+            ++p_ht->i_rehash_bucket;
+        }
+        unlock_group( p_ht, l_old );
+        
+        if (p_ht->i_rehash_bucket == p_ht->i_size_old)
+        {
+            pp_entries_old = p_ht->pp_entries_old;
+            p_nr_old = p_ht->p_nr_old;
+            i_size_old = p_ht->i_size_old;
+            
+            lock_all_groups( p_ht );
+            {
+                p_ht->pp_entries_old = NULL;
+                p_ht->p_nr_old = NULL;
+                p_ht->i_size_old = 0;
+                p_ht->i_size_mask_old = 0;
+                p_ht->i_rehash_bucket = 0;
+            }
+            unlock_all_groups( p_ht );
+            
+            mac_kfree( pp_entries_old, i_size_old*sizeof(ght_hash_entry_t*) );
+            mac_kfree( p_nr_old, i_size_old*sizeof(int) );
+            
+            p_ht->stats.rehash();
+        }
+    }
 }
 
 //--------------------------------------------------------------------
 
-/* Set the hash function to use */
-void ght_set_hash(ght_hash_table_t *p_ht, ght_fn_hash_t fn_hash)
-{
-    p_ht->fn_hash = fn_hash;
-}
+/* --- Robin Hood backend --- */
 
-//--------------------------------------------------------------------
+#define RH_DIST_MASK   0xff
+#define RH_MAX_DIST    (RH_DIST_MASK - 1)
 
-/* Set the heuristics to use. */
-void ght_set_heuristics(ght_hash_table_t *p_ht, int i_heuristics)
+/*
+ * The number of doublings rh_resize tries beyond the size required by the load
+ * when a cluster can't be placed, the clusters that don't shrink after a few
+ * doublings are made of colliding hashes and would not shrink at any size
+ */
+#define RH_MAX_EXTRA_DOUBLINGS  4
+
+/* The metadata of an occupied slot, see ght_hash_table_t */
+static inline UInt32 rh_meta(ght_uint32_t l_hash, unsigned int i_dist)
 {
-    p_ht->i_heuristics = i_heuristics;
+    return (l_hash & ~(UInt32)RH_DIST_MASK) | (i_dist + 1);
 }
 
-//--------------------------------------------------------------------
-
-/* Set the rehashing status of the table. */
-void ght_set_rehash(ght_hash_table_t *p_ht, int b_rehash)
+static inline unsigned int rh_dist(UInt32 meta)
 {
-    p_ht->i_automatic_rehash = b_rehash;
+    return (meta & RH_DIST_MASK) - 1;
 }
 
-//--------------------------------------------------------------------
-
-void ght_set_bounded_buckets(ght_hash_table_t *p_ht, unsigned int limit, ght_fn_bucket_free_callback_t fn)
+static inline UInt64 rh_key_value(ght_hash_table_t *p_ht, const void *p_key_data)
 {
-    p_ht->bucket_limit = limit;
-    p_ht->fn_bucket_free = fn;
+    if (sizeof(UInt32) == p_ht->i_fixed_key_size)
+        return fixed_key_value<UInt32>(p_key_data);
     
-    if( limit > 0 && fn == NULL )
-    {
-        panic( "ght_set_bounded_buckets: The bucket callback function is NULL but the limit is %d\n", limit );
-    }
+    return fixed_key_value<UInt64>(p_key_data);
 }
 
 //--------------------------------------------------------------------
 
-/* Get the number of items in the hash table */
-unsigned int ght_size(ght_hash_table_t *p_ht)
+/* Find the slot of a key, returns -1 if the key is not in the table */
+static inline int rh_find(ght_hash_table_t *p_ht, UInt64 key, ght_uint32_t l_hash, unsigned int *p_probes)
 {
-    return p_ht->i_items;
+    ght_uint32_t i = l_hash & p_ht->i_size_mask;
+    unsigned int i_dist = 0;
+    UInt32 meta = rh_meta(l_hash, 0);
+    
+    for (;; i = (i + 1) & p_ht->i_size_mask, i_dist++, meta++)
+    {
+        UInt32 m = p_ht->p_rh_meta[i];
+        
+        /* A richer entry is met before the key, the key would have displaced it */
+        if (0 == m || rh_dist(m) < i_dist)
+        {
+            if (p_probes)
+                *p_probes = i_dist + 1;
+            return -1;
+        }
+        
+        if (m == meta && p_ht->p_rh_slots[i].key == key)
+        {
+            if (p_probes)
+                *p_probes = i_dist + 1;
+            return (int)i;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Place an absent key taking the slots from the richer entries. Returns
+ * false if a probe distance exceeds RH_MAX_DIST, the entry which was being
+ * placed at that moment is returned in p_carry and the table must grow.
+ */
+static bool rh_place(UInt32 *p_meta, ght_rh_slot_t *p_slots, ght_uint32_t i_mask, ght_uint32_t l_hash, ght_rh_slot_t *p_carry)
+{
+    ght_uint32_t i = l_hash & i_mask;
+    UInt32 meta = rh_meta(l_hash, 0);
+    
+    for (;; i = (i + 1) & i_mask, meta++)
+    {
+        UInt32 m = p_meta[i];
+        
+        if (rh_dist(meta) > RH_MAX_DIST)
+            return false;
+        
+        if (0 == m)
+        {
+            p_meta[i] = meta;
+            p_slots[i] = *p_carry;
+            return true;
+        }
+        
+        if (rh_dist(m) < rh_dist(meta))
+        {
+            ght_rh_slot_t slot = p_slots[i];
+            
+            p_meta[i] = meta;
+            p_slots[i] = *p_carry;
+            
+            meta = m;
+            *p_carry = slot;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Check that rh_place would place an absent key without exceeding RH_MAX_DIST,
+ * the displacements are followed without modifying the table, a slot is not
+ * revisited as the table always has an empty slot
+ */
+static bool rh_can_place(const UInt32 *p_meta, ght_uint32_t i_mask, ght_uint32_t l_hash)
+{
+    ght_uint32_t i = l_hash & i_mask;
+    UInt32 meta = rh_meta(l_hash, 0);
+    
+    for (;; i = (i + 1) & i_mask, meta++)
+    {
+        UInt32 m = p_meta[i];
+        
+        if (rh_dist(meta) > RH_MAX_DIST)
+            return false;
+        
+        if (0 == m)
+            return true;
+        
+        if (rh_dist(m) < rh_dist(meta))
+            meta = m;
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Remove the entry in the slot i and shift the following entries of the cluster back */
+static inline void rh_erase(ght_hash_table_t *p_ht, ght_uint32_t i)
+{
+    for (;;)
+    {
+        ght_uint32_t n = (i + 1) & p_ht->i_size_mask;
+        UInt32 m = p_ht->p_rh_meta[n];
+        
+        if (0 == m || 0 == rh_dist(m))
+        {
+            p_ht->p_rh_meta[i] = 0;
+            break;
+        }
+        
+        p_ht->p_rh_meta[i] = m - 1;
+        p_ht->p_rh_slots[i] = p_ht->p_rh_slots[n];
+        i = n;
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Move all entries to new arrays of at least i_size slots, there is no per entry allocation */
+static bool rh_resize(ght_hash_table_t *p_ht, unsigned int i_size)
+{
+    unsigned int i_new_size = 1;
+    unsigned int i_doubling;
+    
+    while (i_new_size < i_size || i_new_size*7 < p_ht->i_items*8)
+    {
+        i_new_size <<= 1;
+    }
+    
+    for (i_doubling = 0; i_doubling <= RH_MAX_EXTRA_DOUBLINGS; i_doubling++, i_new_size <<= 1)
+    {
+        UInt32 *p_meta;
+        ght_rh_slot_t *p_slots;
+        unsigned int i;
+        bool placed = true;
+        
+        if ( !(p_meta = (UInt32*)mac_kalloc( i_new_size*sizeof(UInt32), p_ht->non_block? M_NOWAIT : M_WAITOK )) )
+        {
+            return false;
+        }
+        
+        if ( !(p_slots = (ght_rh_slot_t*)mac_kalloc( i_new_size*sizeof(ght_rh_slot_t), p_ht->non_block? M_NOWAIT : M_WAITOK )) )
+        {
+            mac_kfree( p_meta, i_new_size*sizeof(UInt32) );
+            return false;
+        }
+        
+        memset( p_meta, 0, i_new_size*sizeof(UInt32) );
+        
+        for (i = 0; i < p_ht->i_size && placed; i++)
+        {
+            ght_rh_slot_t carry;
+            
+            if (0 == p_ht->p_rh_meta[i])
+                continue;
+            
+            carry = p_ht->p_rh_slots[i];
+            placed = rh_place( p_meta, p_slots, i_new_size - 1, fixed_key_hash<UInt64>(carry.key), &carry );
+        }
+        
+        if (!placed)
+        {
+            /* A pathological cluster, try a bigger table */
+            mac_kfree( p_meta, i_new_size*sizeof(UInt32) );
+            mac_kfree( p_slots, i_new_size*sizeof(ght_rh_slot_t) );
+            continue;
+        }
+        
+        mac_kfree( p_ht->p_rh_meta, p_ht->i_size*sizeof(UInt32) );
+        mac_kfree( p_ht->p_rh_slots, p_ht->i_size*sizeof(ght_rh_slot_t) );
+        
+        p_ht->p_rh_meta = p_meta;
+        p_ht->p_rh_slots = p_slots;
+        p_ht->i_size = i_new_size;
+        p_ht->i_size_mask = i_new_size - 1;
+        
+        p_ht->stats.rehash();
+        
+        return true;
+    }
+    
+    DBG_PRINT_ERROR( ( "rh_resize-> a cluster can't be placed in %u slots\n", i_new_size >> 1 ) );
+    return false;
+}
+
+//--------------------------------------------------------------------
+
+static GHT_STATUS_CODE rh_insert(ght_hash_table_t *p_ht, void *p_entry_data, const void *p_key_data)
+{
+    ght_rh_slot_t carry;
+    
+    carry.key = rh_key_value(p_ht, p_key_data);
+    carry.p_data = p_entry_data;
+    
+    if (rh_find(p_ht, carry.key, fixed_key_hash<UInt64>(carry.key), NULL) >= 0)
+    {
+        /* Don't insert if the key is already present. */
+        return GHT_ALREADY_IN_HASH;
+    }
+    
+    /* Keep the load under 7/8 so the probe sequences stay short */
+    if ((p_ht->i_items + 1)*8 > p_ht->i_size*7)
+    {
+        if (!rh_resize( p_ht, 2*p_ht->i_size ))
+        {
+            DBG_PRINT_ERROR( ( "ght_insert-> rh_resize failed\n" ) );
+            return GHT_ERROR;
+        }
+    }
+    
+    /*
+     * Grow the table before the first displacement, so a failed allocation
+     * leaves the table unchanged and no displaced entry is in flight
+     */
+    while (!rh_can_place( p_ht->p_rh_meta, p_ht->i_size_mask, fixed_key_hash<UInt64>(carry.key) ))
+    {
+        if (!rh_resize( p_ht, 2*p_ht->i_size ))
+        {
+            DBG_PRINT_ERROR( ( "ght_insert-> rh_resize failed for a long cluster\n" ) );
+            return GHT_ERROR;
+        }
+    }
+    
+    if (!rh_place( p_ht->p_rh_meta, p_ht->p_rh_slots, p_ht->i_size_mask, fixed_key_hash<UInt64>(carry.key), &carry ))
+    {
+        /* rh_can_place has checked the same displacements */
+        assert( !"rh_place failed after rh_can_place" );
+        return GHT_ERROR;
+    }
+    
+    p_ht->i_items++;
+    
+    return GHT_OK;
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * The counters of the lookups of a batch, a batch accounts a chunk at once as
+ * an atomic update per key would wait for the prefetched cache misses
+ */
+typedef struct
+{
+    unsigned int i_lookups;
+    unsigned int i_probes;
+    unsigned int i_max_probes;
+    unsigned int i_misses;
+} ght_lookup_counters_t;
+
+/* Account a lookup in the table statistics or in the batch counters if p_counters is not NULL */
+static inline void count_lookup(ght_hash_table_t *p_ht, ght_lookup_counters_t *p_counters, unsigned int probes, bool b_found)
+{
+    if (!p_counters)
+    {
+        p_ht->stats.lookup(probes);
+        if (!b_found)
+        {
+            p_ht->stats.miss();
+        }
+        return;
+    }
+    
+    p_counters->i_lookups++;
+    p_counters->i_probes += probes;
+    if (p_counters->i_max_probes < probes)
+        p_counters->i_max_probes = probes;
+    if (!b_found)
+        p_counters->i_misses++;
+}
+
+//--------------------------------------------------------------------
+
+static inline void *rh_get(ght_hash_table_t *p_ht, const void *p_key_data, bool b_reference, ght_lookup_counters_t *p_counters)
+{
+    UInt64 key = rh_key_value(p_ht, p_key_data);
+    unsigned int probes;
+    void *p_data = NULL;
+    int i;
+    
+    i = rh_find(p_ht, key, fixed_key_hash<UInt64>(key), &probes);
+    if (i >= 0)
+    {
+        p_data = p_ht->p_rh_slots[i].p_data;
+        if (b_reference)
+            p_ht->fn_data_reference(p_data);
+    }
+    
+    count_lookup(p_ht, p_counters, probes, i >= 0);
+    
+    return p_data;
+}
+
+//--------------------------------------------------------------------
+
+static void *rh_replace(ght_hash_table_t *p_ht, void *p_entry_data, const void *p_key_data)
+{
+    UInt64 key = rh_key_value(p_ht, p_key_data);
+    void *p_old;
+    int i;
+    
+    if ((i = rh_find(p_ht, key, fixed_key_hash<UInt64>(key), NULL)) < 0)
+        return NULL;
+    
+    p_old = p_ht->p_rh_slots[i].p_data;
+    p_ht->p_rh_slots[i].p_data = p_entry_data;
+    
+    return p_old;
+}
+
+//--------------------------------------------------------------------
+
+static void *rh_remove(ght_hash_table_t *p_ht, const void *p_key_data)
+{
+    UInt64 key = rh_key_value(p_ht, p_key_data);
+    void *p_data;
+    int i;
+    
+    if ((i = rh_find(p_ht, key, fixed_key_hash<UInt64>(key), NULL)) < 0)
+        return NULL;
+    
+    p_data = p_ht->p_rh_slots[i].p_data;
+    rh_erase(p_ht, (ght_uint32_t)i);
+    p_ht->i_items--;
+    
+    return p_data;
+}
+
+//--------------------------------------------------------------------
+
+/* Return the entry at or after the iterator's offset */
+static void *rh_iterate(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, const void **pp_key, unsigned int *size)
+{
+    for (; p_iterator->i_offset < p_ht->i_size; p_iterator->i_offset++)
+    {
+        ght_uint32_t i = (p_iterator->i_start + p_iterator->i_offset) & p_ht->i_size_mask;
+        
+        if (0 == p_ht->p_rh_meta[i])
+            continue;
+        
+        p_iterator->key = p_ht->p_rh_slots[i].key;
+        
+        *pp_key = &p_ht->p_rh_slots[i].key;
+        if (size != NULL)
+            *size = p_ht->i_fixed_key_size;
+        
+        return p_ht->p_rh_slots[i].p_data;
+    }
+    
+    *pp_key = NULL;
+    if (size != NULL)
+        *size = 0;
+    
+    return NULL;
+}
+
+/*
+ * The iteration starts at a slot which is empty or holds an entry at its
+ * home position, the backward shift never moves an entry over such a slot
+ */
+static void *rh_first(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, const void **pp_key, unsigned int *size)
+{
+    ght_uint32_t i;
+    
+    for (i = 0; i < p_ht->i_size; i++)
+    {
+        if (0 == p_ht->p_rh_meta[i] || 0 == rh_dist(p_ht->p_rh_meta[i]))
+            break;
+    }
+    
+    p_iterator->p_entry = NULL;
+    p_iterator->p_next = NULL;
+    p_iterator->i_start = i;
+    p_iterator->i_offset = 0;
+    
+    return rh_iterate(p_ht, p_iterator, pp_key, size);
+}
+
+static void *rh_next(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, const void **pp_key, unsigned int *size)
+{
+    ght_uint32_t i = (p_iterator->i_start + p_iterator->i_offset) & p_ht->i_size_mask;
+    
+    /* The slot is checked again if the current entry has been removed and the next one shifted in */
+    if (p_iterator->i_offset < p_ht->i_size &&
+        0 != p_ht->p_rh_meta[i] &&
+        p_ht->p_rh_slots[i].key == p_iterator->key)
+    {
+        p_iterator->i_offset++;
+    }
+    
+    return rh_iterate(p_ht, p_iterator, pp_key, size);
+}
+
+//--------------------------------------------------------------------
+
+/* --- Exported methods --- */
+/* Create a new hash table */
+ght_hash_table_t*
+ght_create(
+    __in unsigned int i_size,
+    __in bool   non_block
+    )
+{
+    ght_hash_table_t *p_ht;
+    int i=1;
+    
+    assert( non_block || preemption_enabled() );
+     
+    if ( !(p_ht = (ght_hash_table_t*)mac_kalloc( sizeof(ght_hash_table_t), non_block? M_NOWAIT : M_WAITOK )) )
+    {
+        DBG_PRINT_ERROR( ( "ght_create-> p_ht = mac_kalloc( %d, %d ) failed\n",
+                            (int)sizeof(ght_hash_table_t),
+                            non_block? M_NOWAIT : M_WAITOK ) );
+        return NULL;
+    }
+    
+    /* Set the size of the hash table to the nearest 2^i higher then i_size */
+    p_ht->i_size = 1;
+    while(p_ht->i_size < i_size)
+    {
+        p_ht->i_size = 1<<i++;
+    }
+    
+    p_ht->i_size_mask = (1<<(i-1))-1; /* Mask to & with */
+    p_ht->i_items = 0;
+    
+    p_ht->fn_hash = ght_word_hash;
+    
+    /* Standard values for allocations */
+    p_ht->fn_alloc = mac_kalloc;
+    p_ht->fn_free = mac_kfree;
+    
+    /* Set flags */
+    p_ht->i_heuristics = GHT_HEURISTICS_NONE;
+    p_ht->i_automatic_rehash = FALSE;
+    
+    p_ht->bucket_limit = 0;
+    p_ht->fn_bucket_free = NULL;
+    
+    p_ht->non_block = non_block;
+    
+    /* Create an empty bucket list. */
+    if ( !(p_ht->pp_entries = (ght_hash_entry_t**)mac_kalloc( p_ht->i_size*sizeof(ght_hash_entry_t*), non_block? M_NOWAIT : M_WAITOK ) ) )
+    {
+        DBG_PRINT_ERROR( ( "ght_create-> p_ht->pp_entries = mac_kalloc( %d, %d ) failed\n",
+                           (int)(p_ht->i_size*sizeof(ght_hash_entry_t*)),
+                           non_block? M_NOWAIT : M_WAITOK ) );
+        mac_kfree( p_ht, sizeof(ght_hash_table_t) );
+        return NULL;
+    }
+    memset(p_ht->pp_entries, 0, p_ht->i_size*sizeof(ght_hash_entry_t*));
+    
+    /* Initialise the number of entries in each bucket to zero */
+    if ( !(p_ht->p_nr = (int*)mac_kalloc( p_ht->i_size*sizeof(int), non_block? M_NOWAIT : M_WAITOK ) ) )
+    {
+        DBG_PRINT_ERROR( ( "ght_create-> p_ht->p_nr = mac_kalloc( %d, %d ) failed\n",
+                           (int)(p_ht->i_size*sizeof(int)),
+                           non_block? M_NOWAIT : M_WAITOK ) );
+
+        mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
+        mac_kfree( p_ht, sizeof(ght_hash_table_t) );
+        return NULL;
+    }
+    
+    memset( p_ht->p_nr, 0, p_ht->i_size*sizeof(int) );
+    
+    p_ht->p_oldest = NULL;
+    p_ht->p_newest = NULL;
+    
+    p_ht->pp_entries_old = NULL;
+    p_ht->p_nr_old = NULL;
+    p_ht->i_size_old = 0;
+    p_ht->i_size_mask_old = 0;
+    p_ht->i_rehash_bucket = 0;
+    p_ht->i_rehash_step = GHT_REHASH_STEP;
+    
+    p_ht->i_fixed_key_size = 0;
+    
+    p_ht->pp_group_locks = NULL;
+    p_ht->i_groups = 0;
+    p_ht->p_write_lock = NULL;
+    p_ht->fn_data_reference = NULL;
+    
+    p_ht->p_rh_meta = NULL;
+    p_ht->p_rh_slots = NULL;
+    
+    p_ht->i_cache_entries = 0;
+    p_ht->i_cache_bytes = 0;
+    p_ht->i_bytes = 0;
+    p_ht->fn_evict = NULL;
+    
+    p_ht->i_key_bytes = 0;
+    p_ht->i_shrink_min = 0;
+    
+    p_ht->stats.reset();
+    
+    return p_ht;
+}
+
+//--------------------------------------------------------------------
+
+/* Create a new hash table for fixed size keys */
+ght_hash_table_t*
+ght_create_fixed(
+    __in unsigned int i_size,
+    __in bool   non_block,
+    __in unsigned int i_key_size
+    )
+{
+    ght_hash_table_t *p_ht;
+    
+    assert( sizeof(UInt32) == i_key_size || sizeof(UInt64) == i_key_size );
+    if( sizeof(UInt32) != i_key_size && sizeof(UInt64) != i_key_size )
+        return NULL;
+    
+    if( !(p_ht = ght_create( i_size, non_block )) )
+        return NULL;
+    
+    p_ht->i_fixed_key_size = i_key_size;
+    p_ht->fn_hash = ght_fixed_key_hash;
+    
+    return p_ht;
+}
+
+//--------------------------------------------------------------------
+
+/* Create a new Robin Hood open addressing table for fixed size keys */
+ght_hash_table_t*
+ght_create_open(
+    __in unsigned int i_size,
+    __in bool   non_block,
+    __in unsigned int i_key_size
+    )
+{
+    ght_hash_table_t *p_ht;
+    
+    if( !(p_ht = ght_create_fixed( i_size, non_block, i_key_size )) )
+        return NULL;
+    
+    /* The bucket arrays are replaced with the slot arrays of the same size */
+    mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
+    mac_kfree( p_ht->p_nr, p_ht->i_size*sizeof(int) );
+    p_ht->pp_entries = NULL;
+    p_ht->p_nr = NULL;
+    
+    p_ht->p_rh_meta = (UInt32*)mac_kalloc( p_ht->i_size*sizeof(UInt32), non_block? M_NOWAIT : M_WAITOK );
+    p_ht->p_rh_slots = (ght_rh_slot_t*)mac_kalloc( p_ht->i_size*sizeof(ght_rh_slot_t), non_block? M_NOWAIT : M_WAITOK );
+    if( !p_ht->p_rh_meta || !p_ht->p_rh_slots )
+    {
+        DBG_PRINT_ERROR( ( "ght_create_open-> mac_kalloc( %d ) failed\n",
+                           (int)(p_ht->i_size*sizeof(ght_rh_slot_t)) ) );
+        ght_finalize( p_ht );
+        return NULL;
+    }
+    
+    memset( p_ht->p_rh_meta, 0, p_ht->i_size*sizeof(UInt32) );
+    
+    return p_ht;
+}
+
+//--------------------------------------------------------------------
+
+/* Set the allocation/deallocation function to use */
+void ght_set_alloc(ght_hash_table_t *p_ht, ght_fn_alloc_t fn_alloc, ght_fn_free_t fn_free)
+{
+    p_ht->fn_alloc = fn_alloc;
+    p_ht->fn_free = fn_free;
+}
+
+//--------------------------------------------------------------------
+
+/* Set the hash function to use */
+void ght_set_hash(ght_hash_table_t *p_ht, ght_fn_hash_t fn_hash)
+{
+    /* A fixed size key table always uses the integer mixer */
+    assert( 0 == p_ht->i_fixed_key_size || ght_fixed_key_hash == fn_hash );
+    if( p_ht->i_fixed_key_size )
+        return;
+    
+    p_ht->fn_hash = fn_hash;
+}
+
+//--------------------------------------------------------------------
+
+/* Set the heuristics to use. */
+void ght_set_heuristics(ght_hash_table_t *p_ht, int i_heuristics)
+{
+    /* The heuristics change the chains on lookup that is made under a shared lock */
+    assert( !p_ht->pp_group_locks || GHT_HEURISTICS_NONE == i_heuristics );
+    if( p_ht->pp_group_locks || p_ht->p_rh_meta )
+        return;
+    
+    p_ht->i_heuristics = i_heuristics;
+}
+
+//--------------------------------------------------------------------
+
+/* Set the rehashing status of the table. */
+void ght_set_rehash(ght_hash_table_t *p_ht, int b_rehash)
+{
+    p_ht->i_automatic_rehash = b_rehash;
+}
+
+//--------------------------------------------------------------------
+
+/* Set the number of buckets migrated by an operation */
+void ght_set_rehash_step(ght_hash_table_t *p_ht, unsigned int i_buckets)
+{
+    assert( 0 != i_buckets );
+    p_ht->i_rehash_step = i_buckets ? i_buckets : 1;
+}
+
+//--------------------------------------------------------------------
+
+void ght_set_bounded_buckets(ght_hash_table_t *p_ht, unsigned int limit, ght_fn_bucket_free_callback_t fn)
+{
+    assert( !p_ht->p_rh_meta || 0 == limit );
+    if( p_ht->p_rh_meta )
+        return;
+    
+    p_ht->bucket_limit = limit;
+    p_ht->fn_bucket_free = fn;
+    
+    if( limit > 0 && fn == NULL )
+    {
+        panic( "ght_set_bounded_buckets: The bucket callback function is NULL but the limit is %d\n", limit );
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Allocate the group locks so that no two of them share a cache line */
+static bool alloc_group_locks(IORWLock **pp_locks, unsigned int i_groups)
+{
+    IORWLock **pp_spare;
+    unsigned int i_spare_size = 4*i_groups;
+    unsigned int i_spare = 0;
+    unsigned int i_locks = 0;
+    unsigned int i, j;
+    
+    /*
+     * The locks sharing a cache line with an accepted one are kept until the
+     * end, otherwise the allocator returns the same memory again
+     */
+    if ( !(pp_spare = (IORWLock**)mac_kalloc( i_spare_size*sizeof(IORWLock*), M_WAITOK )) )
+        return false;
+    
+    while (i_locks < i_groups && i_spare < i_spare_size)
+    {
+        IORWLock *p_lock;
+        vm_offset_t line;
+        
+        if ( !(p_lock = IORWLockAlloc()) )
+            break;
+        
+        line = (vm_offset_t)p_lock / QVR_CACHE_LINE_SIZE;
+        
+        for (j = 0; j < i_locks; j++)
+        {
+            if ( (vm_offset_t)pp_locks[j] / QVR_CACHE_LINE_SIZE == line )
+                break;
+        }
+        
+        if (j == i_locks)
+            pp_locks[i_locks++] = p_lock;
+        else
+            pp_spare[i_spare++] = p_lock;
+    }
+    
+    /* Give up the cache line separation rather than the concurrent mode */
+    for (i = 0; i < i_spare; i++)
+    {
+        if (i_locks < i_groups)
+            pp_locks[i_locks++] = pp_spare[i];
+        else
+            IORWLockFree( pp_spare[i] );
+    }
+    
+    mac_kfree( pp_spare, i_spare_size*sizeof(IORWLock*) );
+    
+    if (i_locks < i_groups)
+    {
+        DBG_PRINT_ERROR( ( "alloc_group_locks-> IORWLockAlloc failed\n" ) );
+        
+        for (i = 0; i < i_locks; i++)
+            IORWLockFree( pp_locks[i] );
+        
+        return false;
+    }
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+/* Make the table synchronize itself with the bucket group locks */
+bool ght_set_concurrent(ght_hash_table_t *p_ht, unsigned int i_groups, ght_fn_data_reference_t fn_reference)
+{
+    IORWLock **pp_locks;
+    unsigned int i_new_groups = 1;
+    
+    assert( preemption_enabled() );
+    assert( !p_ht->pp_group_locks );
+    assert( 0 == p_ht->bucket_limit );
+    
+    /* A probe sequence of an open addressing table crosses the groups */
+    assert( !p_ht->p_rh_meta );
+    if (p_ht->p_rh_meta)
+        return false;
+    
+    if (p_ht->pp_group_locks)
+        return true;
+    
+    while (i_new_groups < i_groups)
+    {
+        i_new_groups <<= 1;
+    }
+    
+    /* A bucket must not contain keys of different groups */
+    if (p_ht->i_size < i_new_groups && !rehash_full( p_ht, i_new_groups ))
+    {
+        return false;
+    }
+    
+    if ( !(pp_locks = (IORWLock**)mac_kalloc( i_new_groups*sizeof(IORWLock*), M_WAITOK )) )
+    {
+        DBG_PRINT_ERROR( ( "ght_set_concurrent-> mac_kalloc( %d ) failed\n",
+                           (int)(i_new_groups*sizeof(IORWLock*)) ) );
+        return false;
+    }
+    
+    if ( !(p_ht->p_write_lock = IOLockAlloc()) )
+    {
+        DBG_PRINT_ERROR( ( "ght_set_concurrent-> IOLockAlloc failed\n" ) );
+        mac_kfree( pp_locks, i_new_groups*sizeof(IORWLock*) );
+        return false;
+    }
+    
+    if (!alloc_group_locks( pp_locks, i_new_groups ))
+    {
+        IOLockFree( p_ht->p_write_lock );
+        p_ht->p_write_lock = NULL;
+        mac_kfree( pp_locks, i_new_groups*sizeof(IORWLock*) );
+        return false;
+    }
+    
+    p_ht->i_heuristics = GHT_HEURISTICS_NONE;
+    p_ht->fn_data_reference = fn_reference;
+    p_ht->i_groups = i_new_groups;
+    p_ht->pp_group_locks = pp_locks;
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+/* TRUE if the table has a global capacity */
+static inline bool is_cache(ght_hash_table_t *p_ht)
+{
+    return (0 != p_ht->i_cache_entries || 0 != p_ht->i_cache_bytes);
+}
+
+//--------------------------------------------------------------------
+
+static inline bool cache_over_limit(ght_hash_table_t *p_ht)
+{
+    return ((0 != p_ht->i_cache_entries && p_ht->i_items > p_ht->i_cache_entries) ||
+            (0 != p_ht->i_cache_bytes && p_ht->i_bytes > p_ht->i_cache_bytes));
+}
+
+//--------------------------------------------------------------------
+
+/* Move an entry to the newest end of the age list */
+static inline void age_list_move_to_newest(ght_hash_table_t *p_ht, ght_hash_entry_t *p_e)
+{
+    if (p_ht->p_newest == p_e)
+        return;
+    
+    /* p_e is not the newest so p_e->p_newer is not NULL */
+    if (p_e->p_older)
+    {
+        p_e->p_older->p_newer = p_e->p_newer;
+    }
+    else
+    {
+        p_ht->p_oldest = p_e->p_newer;
+    }
+    p_e->p_newer->p_older = p_e->p_older;
+    
+    p_e->p_older = p_ht->p_newest;
+    p_e->p_newer = NULL;
+    p_ht->p_newest->p_newer = p_e;
+    p_ht->p_newest = p_e;
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Evict the entries with the CLOCK algorithm until the table is within its
+ * limits, p_keep is the entry being inserted or NULL, the caller holds the
+ * writer lock of a concurrent table
+ */
+static void cache_evict(ght_hash_table_t *p_ht, ght_hash_entry_t *p_keep)
+{
+    ght_hash_entry_t *p_e;
+    ght_bucket_t bucket;
+    unsigned int i_moves = 0;
+    
+    while (cache_over_limit(p_ht) && p_ht->i_items > (p_keep ? 1 : 0))
+    {
+        p_e = p_ht->p_oldest;
+        assert(p_e);
+        
+        /*
+         * A second chance for a referenced entry, the lookups of a concurrent
+         * table can set the bits again so the number of chances is limited
+         * by the number of items, the inserted entry is always skipped
+         */
+        if (p_e == p_keep || (p_e->referenced && i_moves < p_ht->i_items))
+        {
+            p_e->referenced = 0;
+            age_list_move_to_newest( p_ht, p_e );
+            i_moves++;
+            continue;
+        }
+        
+        /* The entry is either in the old or in the new bucket array */
+        locate_bucket(p_ht, p_e->hash, &bucket);
+        
+        lock_group_exclusive( p_ht, p_e->hash );
+        {
+            remove_from_chain(p_ht, &bucket, p_e);
+            (*bucket.p_nr)--;
+        }
+        unlock_group( p_ht, p_e->hash );
+        
+        p_ht->i_items--;
+        unaccount_entry(p_ht, p_e);
+        p_ht->stats.eviction();
+        
+        /* No reader can find the entry after the group lock has been released */
+        if (p_ht->fn_evict)
+        {
+            p_ht->fn_evict(p_e->p_data, p_e->key.p_key);
+        }
+        
+        he_finalize(p_ht, p_e);
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Set a global capacity of the table */
+void ght_set_cache(ght_hash_table_t *p_ht, unsigned int i_max_entries, vm_size_t i_max_bytes, ght_fn_bucket_free_callback_t fn)
+{
+    /* The open addressing backend has no age list */
+    assert( !p_ht->p_rh_meta );
+    if (p_ht->p_rh_meta)
+        return;
+    
+    lock_writer( p_ht );
+    {
+        p_ht->i_cache_entries = i_max_entries;
+        p_ht->i_cache_bytes = i_max_bytes;
+        p_ht->fn_evict = fn;
+        
+        /* The limits can be lower than the current contents */
+        cache_evict( p_ht, NULL );
+    }
+    unlock_writer( p_ht );
+}
+
+//--------------------------------------------------------------------
+
+/* Let the table shrink on a remove, i_min_size is rounded up to a power of 2 */
+void ght_set_shrink(ght_hash_table_t *p_ht, unsigned int i_min_size)
+{
+    unsigned int i_new_min = 1;
+    
+    while (i_new_min < i_min_size)
+    {
+        i_new_min <<= 1;
+    }
+    
+    p_ht->i_shrink_min = (0 == i_min_size ? 0 : i_new_min);
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Shrink the table to a quarter when the load falls under 1/GHT_SHRINK_LOAD,
+ * the load after a shrink is far from both the shrink and the grow thresholds
+ * so a table with a steady number of items is not resized again and again,
+ * the caller holds the writer lock of a concurrent table
+ */
+static void shrink_check(ght_hash_table_t *p_ht)
+{
+    unsigned int i_new_size;
+    
+    if (0 == p_ht->i_shrink_min || p_ht->i_size <= p_ht->i_shrink_min)
+        return;
+    
+    /* An incremental rehash in progress is finished by the next operations first */
+    if (p_ht->pp_entries_old || p_ht->i_items*GHT_SHRINK_LOAD >= p_ht->i_size)
+        return;
+    
+    i_new_size = p_ht->i_size/4;
+    if (i_new_size < p_ht->i_shrink_min)
+    {
+        i_new_size = p_ht->i_shrink_min;
+    }
+    
+    /* A concurrent table never has less buckets than group locks */
+    if (p_ht->pp_group_locks && i_new_size < p_ht->i_groups)
+    {
+        i_new_size = p_ht->i_groups;
+    }
+    
+    if (i_new_size >= p_ht->i_size)
+        return;
+    
+    if (p_ht->p_rh_meta)
+    {
+        /* The table continues with the current arrays if there is no memory */
+        if (!rh_resize( p_ht, i_new_size ))
+        {
+            DBG_PRINT_ERROR( ( "ght_remove-> rh_resize failed\n" ) );
+        }
+    }
+    else if (GHT_REHASH_INCREMENTAL == p_ht->i_automatic_rehash)
+    {
+        rehash_start( p_ht, i_new_size );
+    }
+    else
+    {
+        rehash_full( p_ht, i_new_size );
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Get the number of items in the hash table */
+unsigned int ght_size(ght_hash_table_t *p_ht)
+{
+    return p_ht->i_items;
 }
 
 //--------------------------------------------------------------------
@@ -512,131 +1701,451 @@ unsigned int ght_size(ght_hash_table_t *p_ht)
 /* Get the size of the hash table */
 unsigned int ght_table_size(ght_hash_table_t *p_ht)
 {
-    return p_ht->i_size;
+    return p_ht->i_size;
+}
+
+//--------------------------------------------------------------------
+
+/* Add a chain or a probe sequence length to the histogram */
+static inline void count_chain(VFSTableStatistics *p_report, unsigned int i_length)
+{
+    if (p_report->maxChain < i_length)
+        p_report->maxChain = i_length;
+    
+    if (i_length >= VFS_CHAIN_LENGTHS)
+        i_length = VFS_CHAIN_LENGTHS - 1;
+    
+    p_report->chainLengths[i_length]++;
+}
+
+//--------------------------------------------------------------------
+
+/* Get the counters of the hash table */
+void ght_get_statistics(ght_hash_table_t *p_ht, VFSTableStatistics *p_report)
+{
+    p_report->entries = p_ht->i_items;
+    p_report->buckets = p_ht->i_size;
+    
+    p_report->maxChain = 0;
+    bzero(p_report->chainLengths, sizeof(p_report->chainLengths));
+    
+    /*
+     * The memory counters are snapshots, the caller doesn't exclude the modifications,
+     * the bucket arrays are scanned under the writer lock as a rehash frees them, a
+     * table that is not concurrent must be protected by the caller
+     */
+    lock_writer( p_ht );
+    
+    if (p_ht->p_rh_meta)
+    {
+        p_report->bucketBytes = p_ht->i_size*(sizeof(UInt32) + sizeof(ght_rh_slot_t));
+        p_report->entryBytes  = 0;
+        p_report->keyBytes    = p_ht->i_items*p_ht->i_fixed_key_size;
+        
+        for (unsigned int i = 0; i < p_ht->i_size; i++)
+        {
+            UInt32 m = p_ht->p_rh_meta[i];
+            
+            count_chain(p_report, m ? rh_dist(m) + 1 : 0);
+        }
+    }
+    else
+    {
+        p_report->bucketBytes = (p_ht->i_size + p_ht->i_size_old)*(sizeof(ght_hash_entry_t*) + sizeof(int));
+        p_report->entryBytes  = p_ht->i_bytes;
+        p_report->keyBytes    = p_ht->i_key_bytes;
+        
+        for (unsigned int i = 0; i < p_ht->i_size; i++)
+        {
+            count_chain(p_report, p_ht->p_nr[i]);
+        }
+        
+        /* The old buckets below i_rehash_bucket have been migrated and are empty */
+        for (unsigned int i = p_ht->i_rehash_bucket; p_ht->p_nr_old && i < p_ht->i_size_old; i++)
+        {
+            count_chain(p_report, p_ht->p_nr_old[i]);
+        }
+    }
+    
+    unlock_writer( p_ht );
+    
+    p_ht->stats.getReport(p_report);
+}
+
+//--------------------------------------------------------------------
+
+/* Insert an entry with a known hash value */
+static GHT_STATUS_CODE insert_hashed(ght_hash_table_t *p_ht, void *p_entry_data, ght_hash_key_t *p_key, ght_uint32_t l_hash)
+{
+    ght_hash_entry_t *p_entry;
+    ght_bucket_t bucket;
+    
+    if (p_ht->p_rh_meta)
+    {
+        return rh_insert( p_ht, p_entry_data, p_key->p_key );
+    }
+    
+    /*
+     * The writer lock excludes other modifications, the readers of a concurrent
+     * table don't change the chains so the bucket is searched without a group lock
+     */
+    lock_writer( p_ht );
+    
+    /* Rehash before the bucket is located if the number of items inserted is too high */
+    if (GHT_REHASH_INCREMENTAL == p_ht->i_automatic_rehash)
+    {
+        if (!p_ht->pp_entries_old && p_ht->i_items > 2*p_ht->i_size)
+        {
+            rehash_start( p_ht, 2*p_ht->i_size );
+        }
+        
+        rehash_step( p_ht, p_ht->i_rehash_step );
+    }
+    else if( TRUE == p_ht->i_automatic_rehash && ( p_ht->i_items > 2*p_ht->i_size ) )
+    {
+        rehash_full( p_ht, 2*p_ht->i_size );
+    }
+    
+    locate_bucket(p_ht, l_hash, &bucket);
+    if (find_in_bucket(p_ht, &bucket, p_key, l_hash, 0, NULL))
+    {
+        unlock_writer( p_ht );
+        
+        /* Don't insert if the key is already present. */
+        return GHT_ALREADY_IN_HASH;
+    }
+    if (!(p_entry = he_create( p_ht, p_entry_data,
+                               p_key->i_size, p_key->p_key, l_hash)))
+    {
+        unlock_writer( p_ht );
+        
+        DBG_PRINT_ERROR( ( "ght_insert-> he_create failed\n" ) );
+        return GHT_ERROR;
+    }
+    
+    lock_group_exclusive( p_ht, l_hash );
+    {
+        /* Place the entry first in the list. */
+        p_entry->p_next = *bucket.pp_head;
+        p_entry->p_prev = NULL;
+        if (*bucket.pp_head)
+        {
+            (*bucket.pp_head)->p_prev = p_entry;
+        }
+        *bucket.pp_head = p_entry;
+        
+        /* If this is a limited bucket hash table, potentially remove the last item */
+        if( p_ht->bucket_limit != 0 &&
+            *bucket.p_nr >= p_ht->bucket_limit)
+        {
+            ght_hash_entry_t *p;
+            
+            /* Loop through entries until the last
+             *
+             * FIXME: Better with a pointer to the last entry
+             */
+            for (p = *bucket.pp_head;
+                 p->p_next != NULL;
+                 p = p->p_next);
+            
+            assert(p && p->p_next == NULL);
+            
+            remove_from_chain(p_ht, &bucket, p); /* To allow it to be reinserted in fn_bucket_free */
+            unaccount_entry(p_ht, p);
+            p_ht->fn_bucket_free(p->p_data, p->key.p_key);
+            
+            he_finalize( p_ht, p );
+        }
+        else
+        {
+            (*bucket.p_nr)++;
+            
+            assert( *bucket.pp_head?(*bucket.pp_head)->p_prev == NULL:1 );
+            
+            p_ht->i_items++;
+        }
+    }
+    unlock_group( p_ht, l_hash );
+    
+    if (p_ht->p_oldest == NULL)
+    {
+        p_ht->p_oldest = p_entry;
+    }
+    p_entry->p_older = p_ht->p_newest;
+    
+    if (p_ht->p_newest != NULL)
+    {
+        p_ht->p_newest->p_newer = p_entry;
+    }
+    
+    p_ht->p_newest = p_entry;
+    
+    account_entry(p_ht, p_entry);
+    if (is_cache(p_ht))
+    {
+        cache_evict( p_ht, p_entry );
+    }
+    
+    unlock_writer( p_ht );
+    
+    return GHT_OK;
+}
+
+//--------------------------------------------------------------------
+
+/* Insert an entry into the hash table */
+GHT_STATUS_CODE
+ght_insert(
+    __in ght_hash_table_t *p_ht,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    )
+{
+    ght_hash_key_t key;
+    
+    assert(p_ht);
+    
+    assert( 0 == p_ht->i_fixed_key_size || i_key_size == p_ht->i_fixed_key_size );
+    if( 0 != p_ht->i_fixed_key_size && i_key_size != p_ht->i_fixed_key_size )
+    {
+        return GHT_ERROR;
+    }
+    
+    hk_fill(&key, i_key_size, p_key_data);
+    
+    return insert_hashed( p_ht, p_entry_data, &key, get_hash_value(p_ht, &key) );
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Get an entry with a known hash value, the found data is referenced if b_reference is true,
+ * the lookup is accounted in p_counters if it is not NULL
+ */
+static inline void *get_hashed(ght_hash_table_t *p_ht, ght_hash_key_t *p_key, ght_uint32_t l_hash, bool b_reference, ght_lookup_counters_t *p_counters)
+{
+    ght_hash_entry_t *p_e;
+    ght_bucket_t bucket;
+    unsigned int probes;
+    void *p_data;
+    
+    if (p_ht->p_rh_meta)
+    {
+        return rh_get( p_ht, p_key->p_key, b_reference, p_counters );
+    }
+    
+    lock_group_shared( p_ht, l_hash );
+    {
+        locate_bucket(p_ht, l_hash, &bucket);
+        
+        /* Check that the first element in the list really is the first. */
+        assert( *bucket.pp_head?(*bucket.pp_head)->p_prev == NULL:1 );
+        
+        p_e = find_in_bucket(p_ht, &bucket, p_key, l_hash, p_ht->i_heuristics, &probes);
+        
+        p_data = (p_e?p_e->p_data:NULL);
+        if (p_data && b_reference)
+        {
+            p_ht->fn_data_reference(p_data);
+        }
+        
+        /* The bit is only set, a store is avoided if it is already set */
+        if (p_e && is_cache(p_ht) && !p_e->referenced)
+        {
+            p_e->referenced = 1;
+        }
+    }
+    unlock_group( p_ht, l_hash );
+    
+    count_lookup(p_ht, p_counters, probes, NULL != p_e);
+    
+    return p_data;
+}
+
+//--------------------------------------------------------------------
+
+/* Get an entry from the hash table, the found data is referenced if b_reference is true */
+static inline void *get_data(ght_hash_table_t *p_ht, unsigned int i_key_size, const void *p_key_data, bool b_reference)
+{
+    ght_hash_key_t key;
+    
+    assert(p_ht);
+    assert( 0 == p_ht->i_fixed_key_size || i_key_size == p_ht->i_fixed_key_size );
+    
+    hk_fill(&key, i_key_size, p_key_data);
+    
+    return get_hashed( p_ht, &key, get_hash_value(p_ht, &key), b_reference, NULL );
+}
+
+//--------------------------------------------------------------------
+
+/* Get an entry from the hash table. The entry is returned, or NULL if it wasn't found */
+void*
+ght_get(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    )
+{
+    return get_data( p_ht, i_key_size, p_key_data, false );
 }
 
 //--------------------------------------------------------------------
 
-/* Insert an entry into the hash table */
-GHT_STATUS_CODE
-ght_insert(
+/* Get an entry from the hash table and reference it before the group lock is released */
+void*
+ght_get_and_reference(
     __in ght_hash_table_t *p_ht,
-    __in void *p_entry_data,
     __in unsigned int i_key_size,
     __in const void *p_key_data
     )
 {
-    ght_hash_entry_t *p_entry;
-    ght_uint32_t l_key;
-    ght_hash_key_t key;
+    assert( p_ht->fn_data_reference );
     
-    assert(p_ht);
-    
-    hk_fill(&key, i_key_size, p_key_data);
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
-    if (search_in_bucket(p_ht, l_key, &key, 0))
-    {
-        /* Don't insert if the key is already present. */
-        return GHT_ALREADY_IN_HASH;
-    }
-    if (!(p_entry = he_create( p_ht, p_entry_data,
-                               i_key_size, p_key_data)))
+    return get_data( p_ht, i_key_size, p_key_data, NULL != p_ht->fn_data_reference );
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Prefetch the memory read first by a lookup, the bucket head or the slot.
+ * The arrays of a concurrent table can be switched by a rehash, a prefetch
+ * of a stale address is harmless as a prefetch never faults.
+ */
+static inline void prefetch_bucket(ght_hash_table_t *p_ht, ght_uint32_t l_hash)
+{
+    if (p_ht->p_rh_meta)
     {
-        DBG_PRINT_ERROR( ( "ght_insert-> he_create failed\n" ) );
-        return GHT_ERROR;
+        __builtin_prefetch( &p_ht->p_rh_meta[l_hash & p_ht->i_size_mask] );
+        __builtin_prefetch( &p_ht->p_rh_slots[l_hash & p_ht->i_size_mask] );
+        return;
     }
     
-    /* Rehash if the number of items inserted is too high. */
-    if( p_ht->i_automatic_rehash && ( p_ht->i_items > 2*p_ht->i_size ) )
+    __builtin_prefetch( &p_ht->pp_entries[l_hash & p_ht->i_size_mask] );
+    if (p_ht->pp_entries_old)
     {
-        ght_rehash( p_ht, 2*p_ht->i_size );
-        /* Recalculate l_key after ght_rehash has updated i_size_mask */
-        l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+        __builtin_prefetch( &p_ht->pp_entries_old[l_hash & p_ht->i_size_mask_old] );
     }
+}
+
+/* Prefetch the first entry of a bucket, the bucket head is read without a lock */
+static inline void prefetch_chain(ght_hash_table_t *p_ht, ght_uint32_t l_hash)
+{
+    ght_bucket_t bucket;
     
-    /* Place the entry first in the list. */
-    p_entry->p_next = p_ht->pp_entries[l_key];
-    p_entry->p_prev = NULL;
-    if (p_ht->pp_entries[l_key])
+    /* A concurrent table's chain can be freed by a writer */
+    if (p_ht->p_rh_meta || p_ht->pp_group_locks)
+        return;
+    
+    locate_bucket(p_ht, l_hash, &bucket);
+    if (*bucket.pp_head)
     {
-        p_ht->pp_entries[l_key]->p_prev = p_entry;
+        __builtin_prefetch( *bucket.pp_head );
     }
-    p_ht->pp_entries[l_key] = p_entry;
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Get a batch of entries, the keys are processed in chunks of GHT_BATCH_CHUNK,
+ * for a chunk all hashes are calculated and the buckets are prefetched, then
+ * the first chain entries are prefetched and then the keys are resolved, so
+ * the cache misses of the keys in a chunk overlap
+ */
+void
+ght_get_batch(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_count,
+    __in unsigned int i_key_size,
+    __in const void *p_keys,
+    __out void **pp_data
+    )
+{
+    ght_hash_key_t keys[GHT_BATCH_CHUNK];
+    ght_uint32_t hashes[GHT_BATCH_CHUNK];
+    unsigned int i_first, i_chunk, i;
+    ght_lookup_counters_t counters;
+    
+    assert(p_ht);
+    assert( 0 == p_ht->i_fixed_key_size || i_key_size == p_ht->i_fixed_key_size );
     
-    /* If this is a limited bucket hash table, potentially remove the last item */
-    if( p_ht->bucket_limit != 0 &&
-        p_ht->p_nr[l_key] >= p_ht->bucket_limit)
+    for (i_first = 0; i_first < i_count; i_first += i_chunk)
     {
-        ght_hash_entry_t *p;
-        
-        /* Loop through entries until the last
-         *
-         * FIXME: Better with a pointer to the last entry
-         */
-        for (p = p_ht->pp_entries[l_key];
-             p->p_next != NULL;
-             p = p->p_next);
+        i_chunk = (i_count - i_first < GHT_BATCH_CHUNK) ? (i_count - i_first) : GHT_BATCH_CHUNK;
         
-        assert(p && p->p_next == NULL);
+        for (i = 0; i < i_chunk; i++)
+        {
+            hk_fill(&keys[i], i_key_size, (const char*)p_keys + (i_first + i)*i_key_size);
+            hashes[i] = get_hash_value(p_ht, &keys[i]);
+            prefetch_bucket(p_ht, hashes[i]);
+        }
         
-        remove_from_chain(p_ht, l_key, p); /* To allow it to be reinserted in fn_bucket_free */
-        p_ht->fn_bucket_free(p->p_data, p->key.p_key);
+        for (i = 0; i < i_chunk; i++)
+        {
+            prefetch_chain(p_ht, hashes[i]);
+        }
         
-        he_finalize( p_ht, p );
-    }
-    else
-    {
-        p_ht->p_nr[l_key]++;
+        bzero(&counters, sizeof(counters));
         
-        assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
+        for (i = 0; i < i_chunk; i++)
+        {
+            pp_data[i_first + i] = get_hashed(p_ht, &keys[i], hashes[i], false, &counters);
+        }
         
-        p_ht->i_items++;
+        p_ht->stats.lookups(counters.i_lookups, counters.i_probes, counters.i_max_probes, counters.i_misses);
     }
-    
-    if (p_ht->p_oldest == NULL)
-    {
-        p_ht->p_oldest = p_entry;
-    }
-    p_entry->p_older = p_ht->p_newest;
-    
-    if (p_ht->p_newest != NULL)
-    {
-        p_ht->p_newest->p_newer = p_entry;
-    }
-    
-    p_ht->p_newest = p_entry;
-    
-    return GHT_OK;
 }
 
 //--------------------------------------------------------------------
 
-/* Get an entry from the hash table. The entry is returned, or NULL if it wasn't found */
-void*
-ght_get(
+/* Insert a batch of entries, the buckets of a chunk are prefetched before the inserts */
+unsigned int
+ght_insert_batch(
     __in ght_hash_table_t *p_ht,
+    __in unsigned int i_count,
+    __in void **pp_entry_data,
     __in unsigned int i_key_size,
-    __in const void *p_key_data
+    __in const void *p_keys,
+    __out_opt GHT_STATUS_CODE *p_status
     )
 {
-    ght_hash_entry_t *p_e;
-    ght_hash_key_t key;
-    ght_uint32_t l_key;
+    ght_hash_key_t keys[GHT_BATCH_CHUNK];
+    ght_uint32_t hashes[GHT_BATCH_CHUNK];
+    unsigned int i_first, i_chunk, i;
+    unsigned int i_inserted = 0;
+    GHT_STATUS_CODE RC;
     
     assert(p_ht);
+    assert( 0 == p_ht->i_fixed_key_size || i_key_size == p_ht->i_fixed_key_size );
     
-    hk_fill(&key, i_key_size, p_key_data);
-    
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
-    
-    /* Check that the first element in the list really is the first. */
-    assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
-    
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_e = search_in_bucket(p_ht, l_key, &key, p_ht->i_heuristics);
-    /* UNLOCK: p_ht->pp_entries[l_key] */
+    for (i_first = 0; i_first < i_count; i_first += i_chunk)
+    {
+        i_chunk = (i_count - i_first < GHT_BATCH_CHUNK) ? (i_count - i_first) : GHT_BATCH_CHUNK;
+        
+        for (i = 0; i < i_chunk; i++)
+        {
+            hk_fill(&keys[i], i_key_size, (const char*)p_keys + (i_first + i)*i_key_size);
+            hashes[i] = get_hash_value(p_ht, &keys[i]);
+            prefetch_bucket(p_ht, hashes[i]);
+        }
+        
+        for (i = 0; i < i_chunk; i++)
+        {
+            if( 0 != p_ht->i_fixed_key_size && i_key_size != p_ht->i_fixed_key_size )
+                RC = GHT_ERROR;
+            else
+                RC = insert_hashed(p_ht, pp_entry_data[i_first + i], &keys[i], hashes[i]);
+            
+            if (GHT_OK == RC)
+                i_inserted++;
+            
+            if (p_status)
+                p_status[i_first + i] = RC;
+        }
+    }
     
-    return (p_e?p_e->p_data:NULL);
+    return i_inserted;
 }
 
 //--------------------------------------------------------------------
@@ -648,27 +2157,46 @@ void *ght_replace(ght_hash_table_t *p_ht,
 {
     ght_hash_entry_t *p_e;
     ght_hash_key_t key;
-    ght_uint32_t l_key;
+    ght_bucket_t bucket;
+    ght_uint32_t l_hash;
     void *p_old;
     
     assert(p_ht);
     
+    if (p_ht->p_rh_meta)
+    {
+        assert( i_key_size == p_ht->i_fixed_key_size );
+        return rh_replace( p_ht, p_entry_data, p_key_data );
+    }
+    
     hk_fill(&key, i_key_size, p_key_data);
+    l_hash = get_hash_value(p_ht, &key);
+    
+    lock_writer( p_ht );
     
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+    locate_bucket(p_ht, l_hash, &bucket);
     
     /* Check that the first element in the list really is the first. */
-    assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
+    assert( *bucket.pp_head?(*bucket.pp_head)->p_prev == NULL:1 );
     
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_e = search_in_bucket(p_ht, l_key, &key, p_ht->i_heuristics);
-    /* UNLOCK: p_ht->pp_entries[l_key] */
+    /* LOCK: *bucket.pp_head */
+    p_e = find_in_bucket(p_ht, &bucket, &key, l_hash, p_ht->i_heuristics, NULL);
+    /* UNLOCK: *bucket.pp_head */
     
     if ( !p_e )
+    {
+        unlock_writer( p_ht );
         return NULL;
+    }
+    
+    lock_group_exclusive( p_ht, l_hash );
+    {
+        p_old = p_e->p_data;
+        p_e->p_data = p_entry_data;
+    }
+    unlock_group( p_ht, l_hash );
     
-    p_old = p_e->p_data;
-    p_e->p_data = p_entry_data;
+    unlock_writer( p_ht );
     
     return p_old;
 }
@@ -682,39 +2210,61 @@ void *ght_remove(ght_hash_table_t *p_ht,
 {
     ght_hash_entry_t *p_out;
     ght_hash_key_t key;
-    ght_uint32_t l_key;
+    ght_bucket_t bucket;
+    ght_uint32_t l_hash;
     void *p_ret=NULL;
     
     assert(p_ht);
     
+    if (p_ht->p_rh_meta)
+    {
+        assert( i_key_size == p_ht->i_fixed_key_size );
+        p_ret = rh_remove( p_ht, p_key_data );
+        shrink_check( p_ht );
+        return p_ret;
+    }
+    
+    lock_writer( p_ht );
+    
+    /* Continue an incremental rehash before the bucket is located */
+    rehash_step( p_ht, p_ht->i_rehash_step );
+    
     hk_fill(&key, i_key_size, p_key_data);
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+    l_hash = get_hash_value(p_ht, &key);
+    locate_bucket(p_ht, l_hash, &bucket);
     
     /* Check that the first element really is the first */
-    assert( (p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1) );
+    assert( (*bucket.pp_head?(*bucket.pp_head)->p_prev == NULL:1) );
     
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_out = search_in_bucket(p_ht, l_key, &key, 0);
+    p_out = find_in_bucket(p_ht, &bucket, &key, l_hash, 0, NULL);
     
     /* Link p_out out of the list. */
     if (p_out)
     {
-        remove_from_chain(p_ht, l_key, p_out);
+        lock_group_exclusive( p_ht, l_hash );
+        {
+            remove_from_chain(p_ht, &bucket, p_out);
+            (*bucket.p_nr)--;
+        }
+        unlock_group( p_ht, l_hash );
         
         /* This should ONLY be done for normal items (for now all items) */
         p_ht->i_items--;
+        unaccount_entry(p_ht, p_out);
         
-        p_ht->p_nr[l_key]--;
-        /* UNLOCK: p_ht->pp_entries[l_key] */
 #if !defined(NDEBUG)
         p_out->p_next = NULL;
         p_out->p_prev = NULL;
 #endif /* NDEBUG */
         
+        /* No reader can find the entry after the group lock has been released */
         p_ret = p_out->p_data;
         he_finalize(p_ht, p_out);
+        
+        shrink_check( p_ht );
     }
-    /* else: UNLOCK: p_ht->pp_entries[l_key] */
+    
+    unlock_writer( p_ht );
     
     return p_ret;
 }
@@ -725,6 +2275,9 @@ static inline void *first_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_iter
 {
     assert(p_ht && p_iterator);
     
+    if (p_ht->p_rh_meta)
+        return rh_first(p_ht, p_iterator, pp_key, size);
+    
     /* Fill the iterator */
     p_iterator->p_entry = p_ht->p_oldest;
     
@@ -767,6 +2320,9 @@ static inline void *next_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_itera
 {
     assert(p_ht && p_iterator);
     
+    if (p_ht->p_rh_meta)
+        return rh_next(p_ht, p_iterator, pp_key, size);
+    
     if (p_iterator->p_next)
     {
         /* More entries */
@@ -819,6 +2375,32 @@ ght_finalize(
     
     assert(p_ht);
     
+    if (p_ht->p_rh_meta)
+    {
+        mac_kfree( p_ht->p_rh_meta, p_ht->i_size*sizeof(UInt32) );
+        p_ht->p_rh_meta = NULL;
+    }
+    if (p_ht->p_rh_slots)
+    {
+        mac_kfree( p_ht->p_rh_slots, p_ht->i_size*sizeof(ght_rh_slot_t) );
+        p_ht->p_rh_slots = NULL;
+    }
+    
+    if (p_ht->pp_entries_old)
+    {
+        /* The buckets of an unfinished incremental rehash */
+        for (i=0; i<p_ht->i_size_old; i++)
+        {
+            free_entry_chain( p_ht, p_ht->pp_entries_old[i] );
+            p_ht->pp_entries_old[i] = NULL;
+        }
+        
+        mac_kfree( p_ht->pp_entries_old, p_ht->i_size_old*sizeof(ght_hash_entry_t*) );
+        mac_kfree( p_ht->p_nr_old, p_ht->i_size_old*sizeof(int) );
+        p_ht->pp_entries_old = NULL;
+        p_ht->p_nr_old = NULL;
+    }
+    
     if (p_ht->pp_entries)
     {
         /* For each bucket, free all entries */
@@ -838,6 +2420,20 @@ ght_finalize(
         p_ht->p_nr = NULL;
     }
     
+    if (p_ht->pp_group_locks)
+    {
+        for (i=0; i<p_ht->i_groups; i++)
+        {
+            IORWLockFree( p_ht->pp_group_locks[i] );
+        }
+        
+        mac_kfree( p_ht->pp_group_locks, p_ht->i_groups*sizeof(IORWLock*) );
+        p_ht->pp_group_locks = NULL;
+        
+        IOLockFree( p_ht->p_write_lock );
+        p_ht->p_write_lock = NULL;
+    }
+    
     mac_kfree( p_ht, sizeof(ght_hash_table_t) );
 }
 
@@ -851,6 +2447,32 @@ ght_rehash(
     __in ght_hash_table_t *p_ht,
     __in unsigned int i_size
     )
+{
+    assert(p_ht);
+    
+    if (p_ht->p_rh_meta)
+    {
+        if (!rh_resize( p_ht, i_size ))
+        {
+            DBG_PRINT_ERROR( ( "ght_rehash-> rh_resize failed\n" ) );
+        }
+        return;
+    }
+    
+    lock_writer( p_ht );
+    {
+        rehash_full( p_ht, i_size );
+    }
+    unlock_writer( p_ht );
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Rehash the whole table, the caller holds the writer lock of a concurrent table,
+ * returns false if there is no memory, the table is not changed in that case
+ */
+static bool rehash_full(ght_hash_table_t *p_ht, unsigned int i_size)
 {
     ght_hash_table_t *p_tmp;
     ght_iterator_t iterator;
@@ -858,11 +2480,30 @@ ght_rehash(
     void *p;
     int i;
     
-    assert(p_ht);
+    /* Finish an incremental rehash so all entries are in the current arrays */
+    while (p_ht->pp_entries_old)
+    {
+        rehash_step( p_ht, p_ht->i_size_old );
+    }
+    
+    /* A concurrent table never has less buckets than group locks */
+    if (p_ht->pp_group_locks && i_size < p_ht->i_groups)
+    {
+        i_size = p_ht->i_groups;
+    }
     
-    /* Recreate the hash table with the new size */
+    /*
+     * Recreate the hash table with the new size, the new table is built before
+     * the readers are excluded as the writer lock keeps the entries unchanged
+     */
     p_tmp = ght_create(i_size, p_ht->non_block );
-    assert(p_tmp);
+    if (!p_tmp)
+    {
+        DBG_PRINT_ERROR( ( "rehash_full-> ght_create( %u ) failed\n", i_size ) );
+        return false;
+    }
+    
+    p_tmp->i_fixed_key_size = p_ht->i_fixed_key_size;
     
     /* Set the flags for the new hash table */
     ght_set_hash(p_tmp, p_ht->fn_hash);
@@ -875,16 +2516,23 @@ ght_rehash(
     {
         assert(iterator.p_entry);
         
-        /* Insert the entry into the new table */
-        if (ght_insert(p_tmp,
-                       iterator.p_entry->p_data,
-                       iterator.p_entry->key.i_size, iterator.p_entry->key.p_key) < 0)
+        /* Insert the entry into the new table, the stored hash is not recalculated */
+        if (insert_hashed(p_tmp,
+                          iterator.p_entry->p_data,
+                          &iterator.p_entry->key, iterator.p_entry->hash) < 0)
         {
             DBG_PRINT_ERROR( ( "DldCommonHashTable.cpp ERROR: Out of memory error or entry already in hash table\n"
                                 "when rehashing (internal error)\n" ) );
+            
+            /* Keep the current arrays, the copies of the entries are freed with the new table */
+            ght_finalize( p_tmp );
+            return false;
         }
     }
     
+    /* The entries are reallocated, exclude all readers */
+    lock_all_groups( p_ht );
+    
     /* Remove the old table... */
     for (i=0; i<p_ht->i_size; i++)
     {
@@ -909,10 +2557,16 @@ ght_rehash(
     p_ht->p_oldest = p_tmp->p_oldest;
     p_ht->p_newest = p_tmp->p_newest;
     
+    p_ht->stats.rehash();
+    
+    unlock_all_groups( p_ht );
+    
     /* Clean up */
     p_tmp->pp_entries = NULL;
     p_tmp->p_nr = NULL;
     mac_kfree( p_tmp, sizeof(ght_hash_table_t) );
+    
+    return true;
 }
 
 //--------------------------------------------------------------------
@@ -955,6 +2609,45 @@ static ght_uint32_t crc32_table[256] =
 
 //--------------------------------------------------------------------
 
+/* The reflected CRC-32C (Castagnoli) table for the CPUs without the crc32 instruction */
+static ght_uint32_t crc32c_table[256] =
+{
+    0x00000000,0xf26b8303,0xe13b70f7,0x1350f3f4,0xc79a971f,0x35f1141c,0x26a1e7e8,0xd4ca64eb,
+    0x8ad958cf,0x78b2dbcc,0x6be22838,0x9989ab3b,0x4d43cfd0,0xbf284cd3,0xac78bf27,0x5e133c24,
+    0x105ec76f,0xe235446c,0xf165b798,0x030e349b,0xd7c45070,0x25afd373,0x36ff2087,0xc494a384,
+    0x9a879fa0,0x68ec1ca3,0x7bbcef57,0x89d76c54,0x5d1d08bf,0xaf768bbc,0xbc267848,0x4e4dfb4b,
+    0x20bd8ede,0xd2d60ddd,0xc186fe29,0x33ed7d2a,0xe72719c1,0x154c9ac2,0x061c6936,0xf477ea35,
+    0xaa64d611,0x580f5512,0x4b5fa6e6,0xb93425e5,0x6dfe410e,0x9f95c20d,0x8cc531f9,0x7eaeb2fa,
+    0x30e349b1,0xc288cab2,0xd1d83946,0x23b3ba45,0xf779deae,0x05125dad,0x1642ae59,0xe4292d5a,
+    0xba3a117e,0x4851927d,0x5b016189,0xa96ae28a,0x7da08661,0x8fcb0562,0x9c9bf696,0x6ef07595,
+    0x417b1dbc,0xb3109ebf,0xa0406d4b,0x522bee48,0x86e18aa3,0x748a09a0,0x67dafa54,0x95b17957,
+    0xcba24573,0x39c9c670,0x2a993584,0xd8f2b687,0x0c38d26c,0xfe53516f,0xed03a29b,0x1f682198,
+    0x5125dad3,0xa34e59d0,0xb01eaa24,0x42752927,0x96bf4dcc,0x64d4cecf,0x77843d3b,0x85efbe38,
+    0xdbfc821c,0x2997011f,0x3ac7f2eb,0xc8ac71e8,0x1c661503,0xee0d9600,0xfd5d65f4,0x0f36e6f7,
+    0x61c69362,0x93ad1061,0x80fde395,0x72966096,0xa65c047d,0x5437877e,0x4767748a,0xb50cf789,
+    0xeb1fcbad,0x197448ae,0x0a24bb5a,0xf84f3859,0x2c855cb2,0xdeeedfb1,0xcdbe2c45,0x3fd5af46,
+    0x7198540d,0x83f3d70e,0x90a324fa,0x62c8a7f9,0xb602c312,0x44694011,0x5739b3e5,0xa55230e6,
+    0xfb410cc2,0x092a8fc1,0x1a7a7c35,0xe811ff36,0x3cdb9bdd,0xceb018de,0xdde0eb2a,0x2f8b6829,
+    0x82f63b78,0x709db87b,0x63cd4b8f,0x91a6c88c,0x456cac67,0xb7072f64,0xa457dc90,0x563c5f93,
+    0x082f63b7,0xfa44e0b4,0xe9141340,0x1b7f9043,0xcfb5f4a8,0x3dde77ab,0x2e8e845f,0xdce5075c,
+    0x92a8fc17,0x60c37f14,0x73938ce0,0x81f80fe3,0x55326b08,0xa759e80b,0xb4091bff,0x466298fc,
+    0x1871a4d8,0xea1a27db,0xf94ad42f,0x0b21572c,0xdfeb33c7,0x2d80b0c4,0x3ed04330,0xccbbc033,
+    0xa24bb5a6,0x502036a5,0x4370c551,0xb11b4652,0x65d122b9,0x97baa1ba,0x84ea524e,0x7681d14d,
+    0x2892ed69,0xdaf96e6a,0xc9a99d9e,0x3bc21e9d,0xef087a76,0x1d63f975,0x0e330a81,0xfc588982,
+    0xb21572c9,0x407ef1ca,0x532e023e,0xa145813d,0x758fe5d6,0x87e466d5,0x94b49521,0x66df1622,
+    0x38cc2a06,0xcaa7a905,0xd9f75af1,0x2b9cd9f2,0xff56bd19,0x0d3d3e1a,0x1e6dcdee,0xec064eed,
+    0xc38d26c4,0x31e6a5c7,0x22b65633,0xd0ddd530,0x0417b1db,0xf67c32d8,0xe52cc12c,0x1747422f,
+    0x49547e0b,0xbb3ffd08,0xa86f0efc,0x5a048dff,0x8ecee914,0x7ca56a17,0x6ff599e3,0x9d9e1ae0,
+    0xd3d3e1ab,0x21b862a8,0x32e8915c,0xc083125f,0x144976b4,0xe622f5b7,0xf5720643,0x07198540,
+    0x590ab964,0xab613a67,0xb831c993,0x4a5a4a90,0x9e902e7b,0x6cfbad78,0x7fab5e8c,0x8dc0dd8f,
+    0xe330a81a,0x115b2b19,0x020bd8ed,0xf0605bee,0x24aa3f05,0xd6c1bc06,0xc5914ff2,0x37faccf1,
+    0x69e9f0d5,0x9b8273d6,0x88d28022,0x7ab90321,0xae7367ca,0x5c18e4c9,0x4f48173d,0xbd23943e,
+    0xf36e6f75,0x0105ec76,0x12551f82,0xe03e9c81,0x34f4f86a,0xc69f7b69,0xd5cf889d,0x27a40b9e,
+    0x79b737ba,0x8bdcb4b9,0x988c474d,0x6ae7c44e,0xbe2da0a5,0x4c4623a6,0x5f16d052,0xad7d5351
+};
+
+//--------------------------------------------------------------------
+
 /* One-at-a-time hash (found in a web article from ddj), this is the
  * standard hash function.
  *
@@ -1006,6 +2699,173 @@ ght_uint32_t ght_crc_hash(ght_hash_key_t *p_key)
 
 //--------------------------------------------------------------------
 
+/* An integer mixer for 4 or 8 byte keys. */
+ght_uint32_t ght_fixed_key_hash(ght_hash_key_t *p_key)
+{
+    assert(p_key);
+    assert(sizeof(UInt32) == p_key->i_size || sizeof(UInt64) == p_key->i_size);
+    
+    if (sizeof(UInt32) == p_key->i_size)
+        return fixed_key_hash<UInt64>(fixed_key_value<UInt32>(p_key->p_key));
+    
+    return fixed_key_hash<UInt64>(fixed_key_value<UInt64>(p_key->p_key));
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * A multiply-xorshift hash for integer keys, a key of up to 8 bytes is
+ * hashed as a zero extended integer, a longer key with ght_word_hash().
+ */
+ght_uint32_t ght_mix64_hash(ght_hash_key_t *p_key)
+{
+    UInt64 value = 0;
+    
+    assert(p_key);
+    
+    if (p_key->i_size > sizeof(UInt64))
+        return ght_word_hash(p_key);
+    
+    memcpy( &value, p_key->p_key, p_key->i_size );
+    
+    /* the size is mixed in so the keys 0x0 of different sizes differ */
+    return fixed_key_hash<UInt64>(value ^ ((UInt64)p_key->i_size << 56));
+}
+
+//--------------------------------------------------------------------
+
+static inline UInt64 rotl64(UInt64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * A word-at-a-time hash, the key is consumed in 8 byte words with the
+ * MurmurHash3 x64 block mixing and the tail is read as a zero padded
+ * word, the loads are done with memcpy() as the key might be not aligned.
+ */
+ght_uint32_t ght_word_hash(ght_hash_key_t *p_key)
+{
+    const UInt64 c1 = 0x87c37b91114253d5ULL;
+    const UInt64 c2 = 0x4cf5ad432745937fULL;
+    const unsigned char *p;
+    unsigned int i_left;
+    UInt64 h;
+    UInt64 k;
+    
+    assert(p_key);
+    
+    p = (const unsigned char *)p_key->p_key;
+    i_left = p_key->i_size;
+    h = 0x9e3779b97f4a7c15ULL ^ i_left;
+    
+    while (i_left >= sizeof(UInt64))
+    {
+        memcpy( &k, p, sizeof(k) );
+        
+        k *= c1; k = rotl64(k, 31); k *= c2;
+        h ^= k;
+        h = rotl64(h, 27); h = h*5 + 0x52dce729;
+        
+        p += sizeof(UInt64);
+        i_left -= sizeof(UInt64);
+    }
+    
+    if (i_left)
+    {
+        k = 0;
+        memcpy( &k, p, i_left );
+        
+        k *= c1; k = rotl64(k, 31); k *= c2;
+        h ^= k;
+    }
+    
+    return fixed_key_hash<UInt64>(h);
+}
+
+//--------------------------------------------------------------------
+
+/* Returns true if the CPU has the crc32 instruction, the check is made once */
+static bool crc32c_instruction_present()
+{
+#if defined(__x86_64__)
+    static int s_present = -1;
+    
+    if (s_present < 0)
+    {
+        UInt32 eax = 1, ebx, ecx = 0, edx;
+        
+        /* CPUID.01H:ECX.SSE4_2[bit 20] */
+        __asm__ __volatile__( "cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx) );
+        s_present = (ecx & (1 << 20)) ? 1 : 0;
+    }
+    
+    return (1 == s_present);
+#elif defined(__arm64__) || defined(__aarch64__)
+    /* the CRC32 extension is present on all arm64 CPUs supported by the system */
+    return true;
+#else
+    return false;
+#endif
+}
+
+static inline ght_uint32_t crc32c_u64(ght_uint32_t crc, UInt64 value)
+{
+#if defined(__x86_64__)
+    UInt64 crc64 = crc;
+    
+    __asm__( "crc32q %1, %0" : "+r"(crc64) : "rm"(value) );
+    return (ght_uint32_t)crc64;
+#elif defined(__arm64__) || defined(__aarch64__)
+    __asm__( "crc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(value) );
+    return crc;
+#else
+    int i;
+    
+    for (i = 0; i < sizeof(UInt64); ++i, value >>= 8)
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ value) & 0xff];
+    
+    return crc;
+#endif
+}
+
+/*
+ * CRC-32C hash, the crc32 instruction consumes 8 bytes per instruction,
+ * the table is used on the CPUs without the instruction.
+ */
+ght_uint32_t ght_crc32c_hash(ght_hash_key_t *p_key)
+{
+    const unsigned char *p;
+    unsigned int i_left;
+    ght_uint32_t crc = 0xffffffff;
+    
+    assert(p_key);
+    
+    p = (const unsigned char *)p_key->p_key;
+    i_left = p_key->i_size;
+    
+    if (crc32c_instruction_present())
+    {
+        UInt64 k;
+        
+        while (i_left >= sizeof(UInt64))
+        {
+            memcpy( &k, p, sizeof(k) );
+            crc = crc32c_u64(crc, k);
+            
+            p += sizeof(UInt64);
+            i_left -= sizeof(UInt64);
+        }
+    }
+    
+    while (i_left--)
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *(p++)) & 0xff];
+    
+    return ~crc;
+}
+
+//--------------------------------------------------------------------
+
 /* Rotating hash function. */
 ght_uint32_t ght_rotating_hash(ght_hash_key_t *p_key)
 {
@@ -4,7 +4,10 @@ Copyright (C) 2001-2005,  Simon Kagstrom
 Modified by  Slava Imameev
 */
 
+#if defined( KERNEL )
+
 #include "Common.h"
+#include "TableStatistics.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +20,13 @@ extern "C" {
 }
 #endif
 
+#else // KERNEL
+
+/* a user mode build for the tests and benchmarks, see VFSFilter0Bench */
+#include "ConcurrentMapPlatform.h"
+
+#endif // KERNEL
+
 /**
 * @file
 * libghthash is a generic hash table used for storing arbitrary
@@ -59,6 +69,21 @@ extern "C" {
 #define GHT_HEURISTICS_MOVE_TO_FRONT 2
 #define GHT_AUTOMATIC_REHASH         4
 
+/* A value for ght_set_rehash(), the table is rehashed incrementally */
+#define GHT_REHASH_INCREMENTAL       2
+
+/* The default number of buckets migrated by an insert or remove during an incremental rehash */
+#define GHT_REHASH_STEP              4
+
+/* The number of keys hashed and prefetched together by ght_get_batch() and ght_insert_batch() */
+#define GHT_BATCH_CHUNK              16
+
+/* The default number of bucket group locks of a concurrent table, see ght_set_concurrent() */
+#define GHT_LOCK_GROUPS              32
+
+/* A table with the shrink enabled shrinks when the load falls under 1/GHT_SHRINK_LOAD, see ght_set_shrink() */
+#define GHT_SHRINK_LOAD              8
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -108,11 +133,27 @@ typedef struct s_hash_entry
     ght_hash_key_t       key;
     void*                p_data;
     
+    //
+    // the full hash of the key, compared before the key and used by a rehash
+    //
+    ght_uint32_t         hash;
+    
+    //
+    // the CLOCK reference bit of a table in the cache mode, set by a lookup
+    //
+    UInt32               referenced;
+    
+    //
+    // a key of up to 8 bytes is stored here and key.p_key points to this field,
+    // a longer key is stored after the entry
+    //
+    UInt64               key_data;
+    
     struct s_hash_entry* p_older;
     struct s_hash_entry* p_newer;
     
     //
-    // size of the alocation = sizeof(ght_hash_entry_t) + key_size
+    // size of the alocation = sizeof(ght_hash_entry_t) + key_size for keys longer than key_data
     //
     size_t               size;
     
@@ -127,8 +168,23 @@ typedef struct
 {
     ght_hash_entry_t *p_entry; /* The current entry */
     ght_hash_entry_t *p_next;  /* The next entry */
+    
+    /* An iteration over an open addressing table */
+    unsigned int i_start;      /* The first slot, an empty slot or a slot at its home position */
+    unsigned int i_offset;     /* The current slot is (i_start + i_offset) & i_size_mask */
+    UInt64 key;                /* The current key, the slot is checked again if the key has been removed */
 } ght_iterator_t;
 
+/*
+ * A slot of an open addressing table created by ght_create_open(),
+ * the key is stored zero extended to 64 bits
+ */
+typedef struct
+{
+    UInt64 key;
+    void*  p_data;
+} ght_rh_slot_t;
+
 /**
  * Definition of the hash function pointers. @c ght_fn_hash_t should be
  * used when implementing new hash functions. Look at the supplied
@@ -139,8 +195,8 @@ typedef struct
  *
  * @return a 32 bit hash value.
  *
- * @see @c ght_one_at_a_time_hash(), @c ght_rotating_hash(),
- *      @c ght_crc_hash()
+ * @see @c ght_word_hash(), @c ght_crc32c_hash(), @c ght_mix64_hash(),
+ *      @c ght_one_at_a_time_hash(), @c ght_rotating_hash(), @c ght_crc_hash()
  */
 typedef ght_uint32_t (*ght_fn_hash_t)(ght_hash_key_t *p_key);
 
@@ -181,6 +237,13 @@ __END_DECLS
  */
 typedef void (*ght_fn_bucket_free_callback_t)(void *data, const void *key);
 
+/**
+ * Definition of the data reference callback function pointers, the
+ * function is called by ght_get_and_reference() for the found data
+ * before the bucket group lock of a concurrent table is released.
+ */
+typedef void (*ght_fn_data_reference_t)(void *data);
+
 /**
  * The hash table structure.
  */
@@ -193,7 +256,7 @@ typedef struct
     ght_fn_free_t fn_free;             /**< The function used for freeing entries */
     ght_fn_bucket_free_callback_t fn_bucket_free; /**< The function called when a bucket overflows */
     int i_heuristics;                  /**< The type of heuristics used */
-    int i_automatic_rehash;            /**< TRUE if automatic rehashing is used */
+    int i_automatic_rehash;            /**< TRUE or GHT_REHASH_INCREMENTAL if automatic rehashing is used */
     
     /* private: */
     ght_hash_entry_t **pp_entries;
@@ -205,15 +268,70 @@ typedef struct
     
     ght_hash_entry_t *p_oldest;        /* The entry inserted the earliest. */
     ght_hash_entry_t *p_newest;        /* The entry inserted the latest. */
+    
+    /*
+     * An incremental rehash, pp_entries and p_nr are the new arrays, the old
+     * buckets below i_rehash_bucket have been migrated to the new arrays
+     */
+    ght_hash_entry_t **pp_entries_old; /* NULL if there is no rehash in progress */
+    int *p_nr_old;
+    unsigned int i_size_old;
+    int i_size_mask_old;
+    unsigned int i_rehash_bucket;      /* The next old bucket to migrate */
+    unsigned int i_rehash_step;        /* The number of old buckets migrated by an insert or remove */
+    
+    unsigned int i_fixed_key_size;     /* 4 or 8 for a table created by ght_create_fixed(), 0 otherwise */
+    
+    QvrTableStatistics stats;          /* Lookup and rehash counters, a lock owner can add the lock counters */
+    
+    /*
+     * The concurrent mode, the bucket i of the new or the old array is protected
+     * by the group lock i & (i_groups-1), the number of buckets is never less
+     * than i_groups so a bucket and its rehash destinations are in the same group
+     */
+    IORWLock **pp_group_locks;         /* NULL if the table is not concurrent */
+    unsigned int i_groups;             /* The number of group locks, a power of 2 */
+    IOLock *p_write_lock;              /* Serializes the modifications of a concurrent table */
+    ght_fn_data_reference_t fn_data_reference;
+    
+    /*
+     * The Robin Hood open addressing backend, the slot metadata is the upper
+     * 24 bits of the hash and the distance from the home slot plus one, 0 for
+     * an empty slot, pp_entries and p_nr are not allocated
+     */
+    UInt32 *p_rh_meta;                 /* NULL for the chained backend */
+    ght_rh_slot_t *p_rh_slots;
+    
+    /*
+     * The cache mode, the age list is the CLOCK and p_oldest is its hand,
+     * a zero limit is not checked
+     */
+    unsigned int i_cache_entries;      /* The maximum number of items */
+    vm_size_t i_cache_bytes;           /* The maximum size of the entries */
+    vm_size_t i_bytes;                 /* The size of all entries, the sum of ght_hash_entry_t::size */
+    ght_fn_bucket_free_callback_t fn_evict; /* The function called for an evicted entry */
+    
+    vm_size_t i_key_bytes;             /* The size of all keys, the long keys are included in i_bytes too */
+    unsigned int i_shrink_min;         /* The minimal number of buckets of a shrinking table, 0 if the table doesn't shrink */
 } ght_hash_table_t;
 
+/*
+ * A bucket chain and its entries counter, the bucket is either in the old
+ * or in the new array when an incremental rehash is in progress.
+ */
+typedef struct
+{
+    ght_hash_entry_t **pp_head;
+    int *p_nr;
+} ght_bucket_t;
+
 /**
  * Create a new hash table. The number of buckets should be about as
  * big as the number of elements you wish to store in the table for
  * good performance. The number of buckets is rounded to the next
  * higher power of two.
  *
- * The hash table is created with @c ght_one_at_a_time_hash() as hash
+ * The hash table is created with @c ght_word_hash() as hash
  * function, automatic rehashing disabled, @c malloc() as the memory
  * allocator and no heuristics.
  *
@@ -232,6 +350,50 @@ ght_create(
     __in bool   non_block
     );
 
+/**
+ * Create a new hash table for keys of a fixed size of 4 or 8 bytes,
+ * e.g. pointers. The lookups hash the key with an integer mixer and
+ * compare the keys as integers instead of calling the hash function
+ * and memcmp(), all keys passed to the table must be of i_key_size.
+ * The hash function can't be changed with ght_set_hash().
+ *
+ * @param i_size the number of buckets in the hash table, see ght_create().
+ * @param i_key_size the key size, 4 or 8.
+ *
+ * @return a pointer to the hash table or NULL upon error.
+ */
+ght_hash_table_t*
+ght_create_fixed(
+    __in unsigned int i_size,
+    __in bool   non_block,
+    __in unsigned int i_key_size
+    );
+
+/**
+ * Create a new open addressing hash table for keys of a fixed size of
+ * 4 or 8 bytes. The table uses Robin Hood probing, the keys and the
+ * data are stored in a slot array and the hash fragments and the probe
+ * distances are stored in a separate compact metadata array, so a
+ * lookup usually reads one metadata line and one slot and an insert
+ * doesn't allocate memory unless the table grows.
+ *
+ * The table grows when it is 7/8 full regardless of ght_set_rehash(),
+ * heuristics, bounded buckets and the concurrent mode are not
+ * supported. The iteration is in the slot order, not in the insertion
+ * order, and only the current entry can be removed during an iteration.
+ *
+ * @param i_size the initial number of slots, see ght_create().
+ * @param i_key_size the key size, 4 or 8.
+ *
+ * @return a pointer to the hash table or NULL upon error.
+ */
+ght_hash_table_t*
+ght_create_open(
+    __in unsigned int i_size,
+    __in bool   non_block,
+    __in unsigned int i_key_size
+    );
+
 /**
  * Set the allocation/freeing functions to use for a hash table. The
  * allocation function will only be called when a new entry is
@@ -294,12 +456,28 @@ void ght_set_heuristics(ght_hash_table_t *p_ht, int i_heuristics);
  * might happen at times when you need speed), you should therefore be
  * careful with this in time-constrainted applications.
  *
+ * With <TT>GHT_REHASH_INCREMENTAL</TT> the table allocates the new bucket
+ * array and then each ght_insert() and ght_remove() migrates a bounded
+ * number of old buckets, see ght_set_rehash_step(), a key is looked up
+ * in the old or in the new array depending on whether its old bucket
+ * has been migrated. ght_get() doesn't migrate buckets as it can be
+ * called under a shared lock.
+ *
  * @param p_ht the hash table to set rehashing for.
- * @param b_rehash TRUE if rehashing should be used or FALSE if it
- *        should not be used.
+ * @param b_rehash TRUE or GHT_REHASH_INCREMENTAL if rehashing should
+ *        be used or FALSE if it should not be used.
  */
 void ght_set_rehash(ght_hash_table_t *p_ht, int b_rehash);
 
+/**
+ * Set the number of old buckets migrated by an insert or remove
+ * during an incremental rehash, the default is <TT>GHT_REHASH_STEP</TT>.
+ *
+ * @param p_ht the hash table to set the step for.
+ * @param i_buckets the number of buckets, must not be zero.
+ */
+void ght_set_rehash_step(ght_hash_table_t *p_ht, unsigned int i_buckets);
+
 /**
  * Enable or disable bounded buckets.
  *
@@ -322,6 +500,81 @@ void ght_set_rehash(ght_hash_table_t *p_ht, int b_rehash);
  */
 void ght_set_bounded_buckets(ght_hash_table_t *p_ht, unsigned int limit, ght_fn_bucket_free_callback_t fn);
 
+/**
+ * Make the table concurrent, the table synchronizes the access itself
+ * and doesn't need an external lock.
+ *
+ * The buckets are split into i_groups groups, each group has its own
+ * reader-writer lock and the locks are allocated on different cache
+ * lines. ght_get() and ght_get_and_reference() take only the lock of
+ * the key's group as shared, so the lookups of keys in different
+ * groups don't touch a common cache line. The modifications are
+ * serialized by a table mutex, a modification takes the group lock
+ * as exclusive only to change a bucket chain, an incremental rehash
+ * takes all group locks only to switch the bucket arrays.
+ *
+ * The heuristics are disabled as they change the chains on lookup,
+ * bounded buckets are not supported. The iteration with ght_first()
+ * and ght_next() must be serialized with the modifications by the
+ * caller. All functions of a concurrent table can block.
+ *
+ * @warning Always call this function <I>before</I> the table is shared.
+ *
+ * @param p_ht the hash table to make concurrent.
+ * @param i_groups the number of group locks, rounded up to a power of 2,
+ *        the table is rehashed to have at least i_groups buckets.
+ * @param fn_reference the function called by ght_get_and_reference(),
+ *        can be NULL.
+ *
+ * @return TRUE if the table is concurrent, FALSE if the locks can't
+ *         be allocated.
+ */
+bool ght_set_concurrent(ght_hash_table_t *p_ht, unsigned int i_groups, ght_fn_data_reference_t fn_reference);
+
+/**
+ * Make the table a cache with a global capacity.
+ *
+ * Unlike bounded buckets the limit is for the whole table, an insert
+ * that exceeds the number of items or the size of the entries evicts
+ * the entries with the CLOCK (second chance) algorithm. A lookup sets
+ * the reference bit of the found entry, the hand moves from the oldest
+ * entry, a referenced entry is cleared and moved to the newest end of
+ * the age list, an unreferenced entry is removed and passed to @a fn.
+ * The entry being inserted is never evicted. The size of an entry is
+ * the size of its allocation including a long key, the data is not
+ * accounted. The iteration order is the CLOCK order.
+ *
+ * The evictions and the lookups that have not found a key are counted
+ * in the table statistics. The callback is called with the writer lock
+ * of a concurrent table held, it must not call the table. The data
+ * found by ght_get() on a concurrent table can be evicted at any time,
+ * use ght_get_and_reference() if the data is used after the lookup.
+ *
+ * @param p_ht the hash table, the open addressing backend is not supported.
+ * @param i_max_entries the maximum number of items, 0 for no limit.
+ * @param i_max_bytes the maximum size of the entries, 0 for no limit.
+ * @param fn the function called for an evicted entry, can be NULL.
+ */
+void ght_set_cache(ght_hash_table_t *p_ht, unsigned int i_max_entries, vm_size_t i_max_bytes, ght_fn_bucket_free_callback_t fn);
+
+/**
+ * Enable or disable the shrink on low load.
+ *
+ * A table only grows by default, so a burst of items leaves the buckets
+ * allocated after the items have been removed. With the shrink enabled
+ * ght_remove() shrinks the table to a quarter of its size when the load
+ * falls under 1/GHT_SHRINK_LOAD. The table grows at the load of 2 (7/8
+ * for the open addressing backend), the load after a shrink is under
+ * 1/2 so the thresholds are apart and a table with a steady number of
+ * items is not resized back and forth. The shrink is incremental if the
+ * table is rehashed incrementally.
+ *
+ * @param p_ht the hash table.
+ * @param i_min_size the table doesn't shrink under this number of
+ *        buckets, rounded up to a power of 2, 0 disables the shrink.
+ */
+void ght_set_shrink(ght_hash_table_t *p_ht, unsigned int i_min_size);
+
 
 /**
  * Get the size (the number of items) of the hash table.
@@ -341,6 +594,16 @@ unsigned int ght_size(ght_hash_table_t *p_ht);
  */
 unsigned int ght_table_size(ght_hash_table_t *p_ht);
 
+/**
+ * Get the lookup and rehash counters of the hash table.
+ *
+ * @param p_ht the hash table to get the counters for.
+ * @param p_report receives the counters, the number of items,
+ *        the number of buckets and the memory used by the bucket
+ *        arrays, the entries and the keys.
+ */
+void ght_get_statistics(ght_hash_table_t *p_ht, VFSTableStatistics *p_report);
+
 
 /**
  * Insert an entry into the hash table. Prior to inserting anything,
@@ -422,6 +685,73 @@ ght_get(
     __in const void *p_key_data
     );
 
+/**
+ * Lookup an entry in the hash table and call the data reference function
+ * set by ght_set_concurrent() for the found data. For a concurrent table
+ * the function is called under the bucket group lock so the data can't
+ * be removed and released by a concurrent ght_remove() before it is
+ * referenced.
+ *
+ * @param p_ht the hash table to search in.
+ * @param i_key_size the size of the key to search with (in bytes).
+ * @param p_key_data the key to search for.
+ *
+ * @return a pointer to the referenced data or NULL if no entry could be found.
+ */
+void*
+ght_get_and_reference(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    );
+
+/**
+ * Lookup a batch of keys of the same size. The keys are hashed and their
+ * buckets are prefetched in chunks of <TT>GHT_BATCH_CHUNK</TT> keys before
+ * they are looked up, so the cache misses of the keys in a chunk overlap
+ * instead of being taken one after another. Use it when several keys are
+ * in hand, the result is the same as calling ght_get() for each key.
+ *
+ * @param p_ht the hash table to search in.
+ * @param i_count the number of keys.
+ * @param i_key_size the size of each key (in bytes).
+ * @param p_keys the array of i_count keys.
+ * @param pp_data receives i_count pointers to the found entries or NULL
+ *        for the keys that could not be found.
+ */
+void
+ght_get_batch(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_count,
+    __in unsigned int i_key_size,
+    __in const void *p_keys,
+    __out void **pp_data
+    );
+
+/**
+ * Insert a batch of entries with the keys of the same size, the buckets
+ * are prefetched as for ght_get_batch(). The result is the same as calling
+ * ght_insert() for each key.
+ *
+ * @param p_ht the hash table to insert into.
+ * @param i_count the number of entries.
+ * @param pp_entry_data the array of i_count data pointers.
+ * @param i_key_size the size of each key (in bytes).
+ * @param p_keys the array of i_count keys, the keys are copied.
+ * @param p_status receives i_count ght_insert() return codes, can be NULL.
+ *
+ * @return the number of inserted entries.
+ */
+unsigned int
+ght_insert_batch(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_count,
+    __in void **pp_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_keys,
+    __out_opt GHT_STATUS_CODE *p_status
+    );
+
 /**
  * Remove an entry from the hash table. The entry is removed from the
  * table, but not freed (that is, the data stored is not freed).
@@ -597,9 +927,8 @@ void ght_finalize(ght_hash_table_t *p_ht);
 /* exported hash functions */
 
 /**
- * One-at-a-time-hash. One-at-a-time-hash is a good hash function, and
- * is the default when ght_create() is called with NULL as the
- * fn_hash parameter. This was found in a DrDobbs article, see
+ * One-at-a-time-hash. One-at-a-time-hash is a good hash function but
+ * it consumes the key a byte at a time. This was found in a DrDobbs article, see
  * http://burtleburtle.net/bob/hash/doobs.html
  *
  * @warning Don't call this function directly, it is only meant to be
@@ -634,6 +963,44 @@ ght_uint32_t ght_rotating_hash(ght_hash_key_t *p_key);
  */
 ght_uint32_t ght_crc_hash(ght_hash_key_t *p_key);
 
+/**
+ * An integer mixer for 4 or 8 byte keys, the hash function of the
+ * tables created by ght_create_fixed().
+ *
+ * @see ght_fn_hash_t
+ */
+ght_uint32_t ght_fixed_key_hash(ght_hash_key_t *p_key);
+
+/**
+ * Word-at-a-time hash, the key is consumed in 8 byte words. This is
+ * the default hash function of ght_create(), a good choice for the
+ * string keys like paths.
+ *
+ * @see ght_fn_hash_t
+ * @see ght_crc32c_hash(), ght_mix64_hash()
+ */
+ght_uint32_t ght_word_hash(ght_hash_key_t *p_key);
+
+/**
+ * CRC-32C hash, uses the crc32 instruction if the CPU has it and a
+ * table otherwise. Fast for long keys on the CPUs with the instruction.
+ *
+ * @see ght_fn_hash_t
+ * @see ght_word_hash()
+ */
+ght_uint32_t ght_crc32c_hash(ght_hash_key_t *p_key);
+
+/**
+ * Multiply-xorshift hash for integer keys of up to 8 bytes of any
+ * size, a longer key is hashed with ght_word_hash(). Use
+ * ght_create_fixed() for a table with keys of a single size of 4 or
+ * 8 bytes.
+ *
+ * @see ght_fn_hash_t
+ * @see ght_fixed_key_hash()
+ */
+ght_uint32_t ght_mix64_hash(ght_hash_key_t *p_key);
+
 #ifdef USE_PROFILING
 /**
  * Print some statistics about the table. Only available if the
@@ -0,0 +1,725 @@
+//
+//  ConcurrentMap.h
+//  VFSFilter0
+//
+//  Created by slava on 27/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__ConcurrentMap__
+#define __VFSFilter0__ConcurrentMap__
+
+#include "ConcurrentMapPlatform.h"
+
+//--------------------------------------------------------------------
+
+//
+// a map split into shards, each shard is an open addressing table with
+// linear probing and a backward shift deletion, so there are no tombstones
+// and a lookup stops at the first empty slot,
+// the key traits define hashing and the key storage,
+// the policy defines the shards number and the shard's lock,
+// only DataMap is built on the map, ght_hash_table_t and
+// QvrVnodeHooksHashTable have not been migrated
+//
+
+//--------------------------------------------------------------------
+
+//
+// a finalizer from the 64 bit MurmurHash3, it mixes all key bits,
+// the low bits are used for a slot and the high bits for a shard
+//
+inline uint64_t QvrMapMix64( __in uint64_t h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    
+    return h;
+}
+
+//--------------------------------------------------------------------
+
+template< typename Key > class QvrMapKeyTraits;
+
+//
+// pointer keys are stored in slots, NULL is an empty slot
+//
+template< typename T > class QvrMapKeyTraits< T* >{
+    
+public:
+    
+    enum{ InlineKey = true };
+    
+    static uint64_t hash( __in T* key ) { return QvrMapMix64( (uint64_t)key ); }
+    static bool isEmpty( __in T* key ) { return NULL == key; }
+    static bool equal( __in T* k1, __in T* k2 ) { return k1 == k2; }
+    static bool clone( __in T* key, __out T** copy ) { *copy = key; return true; }
+    static void release( __in T* ) {}
+    static uint32_t copySize( __in T* ) { return 0x0; }
+};
+
+//--------------------------------------------------------------------
+
+//
+// a byte string key, the map stores a copy of the string
+//
+class QvrMapByteString{
+    
+public:
+    const void*  data;  // NULL for an empty slot
+    uint32_t     size;
+    
+    QvrMapByteString() : data( NULL ), size( 0x0 ) {}
+    QvrMapByteString( __in const void* data, __in uint32_t size ) : data( data ), size( size ) {}
+};
+
+template<> class QvrMapKeyTraits< QvrMapByteString >{
+    
+public:
+    
+    enum{ InlineKey = false };
+    
+    static uint64_t hash( __in const QvrMapByteString& key )
+    {
+        //
+        // FNV-1a, mixed at the end as the shard is selected by the high bits
+        //
+        uint64_t h = 0xcbf29ce484222325ULL;
+        const uint8_t* p = (const uint8_t*)key.data;
+        
+        for( uint32_t i = 0x0; i < key.size; ++i ){
+            
+            h ^= p[ i ];
+            h *= 0x100000001b3ULL;
+        }
+        
+        return QvrMapMix64( h );
+    }
+    
+    static bool isEmpty( __in const QvrMapByteString& key ) { return NULL == key.data; }
+    
+    static bool equal( __in const QvrMapByteString& k1, __in const QvrMapByteString& k2 )
+    {
+        return k1.size == k2.size && 0x0 == memcmp( k1.data, k2.data, k1.size );
+    }
+    
+    static bool clone( __in const QvrMapByteString& key, __out QvrMapByteString* copy )
+    {
+        //
+        // a zero length key still needs a non NULL pointer
+        //
+        void* data = QvrMapAllocate( key.size ? key.size : 0x1 );
+        if( ! data )
+            return false;
+        
+        memcpy( data, key.data, key.size );
+        
+        copy->data = data;
+        copy->size = key.size;
+        return true;
+    }
+    
+    static void release( __in const QvrMapByteString& key )
+    {
+        if( key.data )
+            QvrMapFree( (void*)key.data, key.size ? key.size : 0x1 );
+    }
+    
+    //
+    // the size of the allocation made by clone()
+    //
+    static uint32_t copySize( __in const QvrMapByteString& key ) { return key.size ? key.size : 0x1; }
+};
+
+//--------------------------------------------------------------------
+
+//
+// the locking policies, the shards number must be a power of 2
+//
+
+//
+// no locking, for a single threaded use or an external synchronization
+//
+class QvrMapPolicyNone{
+public:
+    typedef QvrMapNoLock  Lock;
+    enum{ ShardsNumber = 1 };
+};
+
+//
+// a mutex per shard, for a mixed load
+//
+class QvrMapPolicyStriped{
+public:
+    typedef QvrMapMutex  Lock;
+    enum{ ShardsNumber = 16 };
+};
+
+//
+// a read-write lock per shard, lookups run concurrently
+//
+class QvrMapPolicyReadMostly{
+public:
+    typedef QvrMapRWLock  Lock;
+    enum{ ShardsNumber = 4 };
+};
+
+//--------------------------------------------------------------------
+
+template< typename Key,
+          typename Value,
+          typename Policy,
+          typename KeyTraits = QvrMapKeyTraits< Key > >
+class QvrConcurrentMap{
+    
+protected:
+    
+    //
+    // must be a power of 2
+    //
+    enum{
+        ShardInitialSize = 16
+    };
+    
+private:
+    
+    class Slot{
+    public:
+        Key          key;  // an empty key for an empty slot
+        Value        value;
+    };
+    
+    //
+    // place each shard on its own cache line as
+    // the shards are accessed concurrently
+    //
+    class Shard{
+    public:
+        typename Policy::Lock  lock;
+        Slot*                  slots;
+        uint32_t               size;  // 0 or a power of 2
+        uint32_t               count;
+        uint64_t               keyBytes;  // the size of the key copies
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+private:
+    
+    Shard    shards[ Policy::ShardsNumber ];
+    
+    QvrMapStatistics   statistics;
+    
+private:
+    
+    Shard* shardByHash( __in uint64_t hash )
+    {
+        return &shards[ ( hash >> 32 ) & ( Policy::ShardsNumber - 1 ) ];
+    }
+    
+    //--------------------------------------------------------------------
+    
+    void lockShared( __in Shard* shard )
+    {
+        if( shard->lock.tryLockShared() ){
+            
+            statistics.lockAcquired( 0x0 );
+            return;
+        }
+        
+        uint64_t start = QvrMapStatistics::now();
+        shard->lock.lockShared();
+        statistics.lockAcquired( QvrMapStatistics::now() - start );
+    }
+    
+    void lockExclusive( __in Shard* shard )
+    {
+        if( shard->lock.tryLockExclusive() ){
+            
+            statistics.lockAcquired( 0x0 );
+            return;
+        }
+        
+        uint64_t start = QvrMapStatistics::now();
+        shard->lock.lockExclusive();
+        statistics.lockAcquired( QvrMapStatistics::now() - start );
+    }
+    
+    //--------------------------------------------------------------------
+    
+    static Slot* findSlot( __in Shard* shard, __in const Key& key, __in uint64_t hash, __out_opt uint32_t* probes = NULL )
+    /*
+     the shard's lock must be held,
+     probes receives the number of visited slots
+     */
+    {
+        Slot*     found = NULL;
+        uint32_t  visited = 0x0;
+        
+        if( 0x0 != shard->size ){
+            
+            uint32_t mask = shard->size - 1;
+            
+            for( uint32_t i = (uint32_t)hash & mask; ! KeyTraits::isEmpty( shard->slots[ i ].key ); i = ( i + 1 ) & mask ){
+                
+                ++visited;
+                
+                if( KeyTraits::equal( key, shard->slots[ i ].key ) ){
+                    
+                    found = &shard->slots[ i ];
+                    break;
+                }
+            } // end for
+        }
+        
+        if( probes )
+            *probes = visited;
+        
+        return found;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    static void insertSlot( __in Shard* shard, __in const Key& key, __in const Value& value, __in uint64_t hash )
+    /*
+     the shard's lock must be held, the key must not be in the shard
+     and there must be at least one empty slot
+     */
+    {
+        QVR_MAP_ASSERT( shard->count < shard->size );
+        
+        uint32_t mask = shard->size - 1;
+        uint32_t i;
+        
+        for( i = (uint32_t)hash & mask; ! KeyTraits::isEmpty( shard->slots[ i ].key ); i = ( i + 1 ) & mask ){
+            
+            QVR_MAP_ASSERT( ! KeyTraits::equal( key, shard->slots[ i ].key ) );
+        }
+        
+        shard->slots[ i ].key   = key;
+        shard->slots[ i ].value = value;
+        shard->count += 1;
+        shard->keyBytes += KeyTraits::copySize( key );
+    }
+    
+    //--------------------------------------------------------------------
+    
+    static void removeSlot( __in Shard* shard, __in Slot* slot )
+    /*
+     the shard's lock must be held,
+     the entries that follow the removed one in the same cluster
+     are shifted back to keep the probe sequences unbroken,
+     the key is not released
+     */
+    {
+        uint32_t mask = shard->size - 1;
+        uint32_t hole = (uint32_t)( slot - shard->slots );
+        
+        //
+        // the slot is overwritten by the shift
+        //
+        uint32_t keySize = KeyTraits::copySize( slot->key );
+        
+        QVR_MAP_ASSERT( shard->count > 0x0 );
+        
+        for( uint32_t i = ( hole + 1 ) & mask; ! KeyTraits::isEmpty( shard->slots[ i ].key ); i = ( i + 1 ) & mask ){
+            
+            uint32_t home = (uint32_t)KeyTraits::hash( shard->slots[ i ].key ) & mask;
+            
+            //
+            // the entry can't be moved if its home slot is cyclically in (hole, i]
+            //
+            bool stays = ( hole < i ) ? ( hole < home && home <= i ) : ( hole < home || home <= i );
+            if( stays )
+                continue;
+            
+            shard->slots[ hole ] = shard->slots[ i ];
+            hole = i;
+        }
+        
+        shard->keyBytes -= keySize;
+        
+        memset( (void*)&shard->slots[ hole ], 0x0, sizeof( Slot ) );
+        shard->count -= 1;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    bool growShard( __in Shard* shard )
+    /*
+     the function is called without the shard's lock being held,
+     the memory is allocated outside of the lock as the map is accessed
+     from the paging path, the function returns false if there is no memory
+     */
+    {
+        uint32_t  size;
+        uint32_t  newSize;
+        Slot*     newSlots;
+        Slot*     slotsToFree = NULL;
+        uint32_t  sizeToFree = 0x0;
+        
+        lockShared( shard );
+        {// start of the lock
+            size = shard->size;
+        }// end of the lock
+        shard->lock.unlockShared();
+        
+        newSize = size ? 2*size : (uint32_t)ShardInitialSize;
+        
+        newSlots = (Slot*)QvrMapAllocate( newSize * sizeof( Slot ) );
+        QVR_MAP_ASSERT( newSlots );
+        if( ! newSlots )
+            return false;
+        
+        //
+        // an empty key is all zero bits
+        //
+        memset( (void*)newSlots, 0x0, newSize * sizeof( Slot ) );
+        
+        lockExclusive( shard );
+        {// start of the lock
+            
+            if( shard->size == size ){
+                
+                //
+                // move the entries to the new array
+                //
+                Slot*   oldSlots = shard->slots;
+                
+                shard->slots = newSlots;
+                shard->size  = newSize;
+                shard->count = 0x0;
+                shard->keyBytes = 0x0;
+                
+                for( uint32_t i = 0x0; i < size; ++i ){
+                    
+                    if( ! KeyTraits::isEmpty( oldSlots[ i ].key ) )
+                        insertSlot( shard, oldSlots[ i ].key, oldSlots[ i ].value, KeyTraits::hash( oldSlots[ i ].key ) );
+                }
+                
+                slotsToFree = oldSlots;
+                sizeToFree  = size;
+                
+                statistics.rehash();
+                
+            } else {
+                
+                //
+                // a concurrent thread has already grown the shard
+                //
+                slotsToFree = newSlots;
+                sizeToFree  = newSize;
+            }
+            
+        }// end of the lock
+        shard->lock.unlockExclusive();
+        
+        if( slotsToFree )
+            QvrMapFree( slotsToFree, sizeToFree * sizeof( Slot ) );
+        
+        return true;
+    }
+    
+public:
+    
+    QvrConcurrentMap()
+    {
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i ){
+            
+            shards[ i ].slots = NULL;
+            shards[ i ].size  = 0x0;
+            shards[ i ].count = 0x0;
+            shards[ i ].keyBytes = 0x0;
+        }
+        
+        statistics.reset();
+    }
+    
+    //
+    // must be called before the map is used, returns false if
+    // the shard locks can't be allocated, the destructor
+    // can be called after a failed init()
+    //
+    bool init()
+    {
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i ){
+            
+            if( ! shards[ i ].lock.init() )
+                return false;
+        }
+        
+        return true;
+    }
+    
+    ~QvrConcurrentMap()
+    {
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i ){
+            
+            if( ! shards[ i ].slots )
+                continue;
+            
+            for( uint32_t j = 0x0; j < shards[ i ].size; ++j )
+                KeyTraits::release( shards[ i ].slots[ j ].key );
+            
+            QvrMapFree( shards[ i ].slots, shards[ i ].size * sizeof( Slot ) );
+        }
+    }
+    
+    //--------------------------------------------------------------------
+    
+    //
+    // the key can't be empty, the function checks for duplicate entries
+    // and updates the value, returns false if there is no memory
+    //
+    bool insert( __in const Key& key, __in const Value& value )
+    {
+        QVR_MAP_ASSERT( ! KeyTraits::isEmpty( key ) );
+        
+        uint64_t  hash = KeyTraits::hash( key );
+        Shard*    shard = shardByHash( hash );
+        Key       storedKey;
+        bool      keyConsumed = false;
+        bool      added = false;
+        
+        //
+        // a key copy is allocated outside of the lock
+        //
+        if( ! KeyTraits::clone( key, &storedKey ) )
+            return false;
+        
+        while( ! added ){
+            
+            lockExclusive( shard );
+            {// start of the lock
+                
+                Slot* existingSlot = findSlot( shard, key, hash );
+                if( existingSlot ){
+                    
+                    existingSlot->value = value;
+                    added = true;
+                    
+                } else if( 4*( shard->count + 1 ) <= 3*shard->size ){
+                    
+                    //
+                    // the load factor is kept under 3/4
+                    //
+                    insertSlot( shard, storedKey, value, hash );
+                    keyConsumed = true;
+                    added = true;
+                }
+                
+            }// end of the lock
+            shard->lock.unlockExclusive();
+            
+            if( ! added && ! growShard( shard ) )
+                break;
+            
+        } // end while
+        
+        if( ! keyConsumed )
+            KeyTraits::release( storedKey );
+        
+        return added;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    bool get( __in const Key& key, __out_opt Value* value )
+    {
+        bool      found = false;
+        uint64_t  hash = KeyTraits::hash( key );
+        Shard*    shard = shardByHash( hash );
+        
+        uint32_t  probes;
+        
+        lockShared( shard );
+        {// start of the lock
+            
+            Slot* slot = findSlot( shard, key, hash, &probes );
+            if( slot ){
+                
+                found = true;
+                if( value )
+                    *value = slot->value;
+            }
+            
+        }// end of the lock
+        shard->lock.unlockShared();
+        
+        statistics.lookup( probes );
+        if( !found )
+            statistics.miss();
+        
+        return found;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    bool remove( __in const Key& key, __out_opt Value* value = NULL )
+    {
+        bool      found = false;
+        Key       keyToRelease = Key();
+        uint64_t  hash = KeyTraits::hash( key );
+        Shard*    shard = shardByHash( hash );
+        
+        lockExclusive( shard );
+        {// start of the lock
+            
+            Slot* slot = findSlot( shard, key, hash );
+            if( slot ){
+                
+                found = true;
+                keyToRelease = slot->key;
+                if( value )
+                    *value = slot->value;
+                
+                removeSlot( shard, slot );
+            }
+            
+        }// end of the lock
+        shard->lock.unlockExclusive();
+        
+        //
+        // the key copy is freed outside of the lock
+        //
+        if( found )
+            KeyTraits::release( keyToRelease );
+        
+        return found;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    //
+    // removes an arbitrary entry, the key can be returned only for
+    // inline keys as a key copy is freed by the function
+    //
+    bool removeFirst( __out_opt Value* value, __out_opt Key* key = NULL )
+    {
+        bool  found = false;
+        Key   keyToRelease = Key();
+        
+        QVR_MAP_ASSERT( KeyTraits::InlineKey || NULL == key );
+        
+        for( int i = 0x0; i < Policy::ShardsNumber && ! found; ++i ){
+            
+            Shard* shard = &shards[ i ];
+            
+            lockExclusive( shard );
+            {// start of the lock
+                
+                for( uint32_t j = 0x0; j < shard->size && 0x0 != shard->count; ++j ){
+                    
+                    if( KeyTraits::isEmpty( shard->slots[ j ].key ) )
+                        continue;
+                    
+                    found = true;
+                    keyToRelease = shard->slots[ j ].key;
+                    if( value )
+                        *value = shard->slots[ j ].value;
+                    if( key )
+                        *key = shard->slots[ j ].key;
+                    
+                    removeSlot( shard, &shard->slots[ j ] );
+                    break;
+                } // end for
+                
+            }// end of the lock
+            shard->lock.unlockExclusive();
+        } // end for
+        
+        if( found )
+            KeyTraits::release( keyToRelease );
+        
+        return found;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    //
+    // the values are snapshots, the map can change as soon as the functions return
+    //
+    bool isEmpty()
+    {
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i ){
+            
+            if( 0x0 != shards[ i ].count )
+                return false;
+        }
+        
+        return true;
+    }
+    
+    uint32_t getCount()
+    {
+        uint32_t count = 0x0;
+        
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i )
+            count += shards[ i ].count;
+        
+        return count;
+    }
+    
+    //--------------------------------------------------------------------
+    
+    void getStatistics( __out QvrMapStatisticsReport* report )
+    {
+        report->entries = 0x0;
+        report->buckets = 0x0;
+        report->bucketBytes = 0x0;
+        report->entryBytes  = 0x0;
+        report->keyBytes    = 0x0;
+        
+        for( int i = 0x0; i < Policy::ShardsNumber; ++i ){
+            
+            report->entries += shards[ i ].count;
+            report->buckets += shards[ i ].size;
+            report->bucketBytes += shards[ i ].size * sizeof( Slot );
+            
+            //
+            // an inline key is in a slot, a key copy is the only allocation per entry
+            //
+            report->entryBytes += shards[ i ].keyBytes;
+            report->keyBytes   += KeyTraits::InlineKey ? shards[ i ].count * sizeof( Key ) : shards[ i ].keyBytes;
+        }
+        
+        statistics.getReport( report );
+    }
+    
+    //--------------------------------------------------------------------
+    
+    //
+    // returns the number of copied keys, only for inline keys
+    //
+    uint32_t copyKeys( __out Key* keys, __in uint32_t maxKeys )
+    {
+        uint32_t copied = 0x0;
+        
+        QVR_MAP_ASSERT( KeyTraits::InlineKey );
+        
+        for( int i = 0x0; i < Policy::ShardsNumber && copied < maxKeys; ++i ){
+            
+            Shard* shard = &shards[ i ];
+            
+            lockShared( shard );
+            {// start of the lock
+                
+                for( uint32_t j = 0x0; j < shard->size && copied < maxKeys; ++j ){
+                    
+                    if( ! KeyTraits::isEmpty( shard->slots[ j ].key ) )
+                        keys[ copied++ ] = shard->slots[ j ].key;
+                } // end for
+                
+            }// end of the lock
+            shard->lock.unlockShared();
+        } // end for
+        
+        return copied;
+    }
+    
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__ConcurrentMap__) */
@@ -0,0 +1,645 @@
+//
+//  ConcurrentMapPlatform.h
+//  VFSFilter0
+//
+//  Created by slava on 27/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__ConcurrentMapPlatform__
+#define __VFSFilter0__ConcurrentMapPlatform__
+
+//
+// the platform shim for QvrConcurrentMap, the same map code is compiled
+// in the kernel with IOKit primitives and in user mode with pthreads,
+// the user mode part also provides the subset of the kernel API used by
+// the ght hash table so both can be built and benchmarked on a workstation,
+// see VFSFilter0Bench
+//
+
+#if defined( KERNEL )
+
+#include "Common.h"
+#include "TableStatistics.h"
+
+#define QVR_MAP_ASSERT( _X_ )  assert( _X_ )
+
+typedef QvrTableStatistics  QvrMapStatistics;
+typedef VFSTableStatistics  QvrMapStatisticsReport;
+
+//--------------------------------------------------------------------
+
+class QvrMapMutex{
+    
+private:
+    IOLock*  lock;
+    
+public:
+    
+    QvrMapMutex() : lock( NULL ) {}
+    
+    ~QvrMapMutex()
+    {
+        if( lock )
+            IOLockFree( lock );
+    }
+    
+    //
+    // must be called before the lock is used, returns false if there is no memory
+    //
+    bool init()
+    {
+        assert( ! lock );
+        
+        lock = IOLockAlloc();
+        assert( lock );
+        
+        return NULL != lock;
+    }
+    
+    void lockExclusive()   { IOLockLock( lock ); }
+    void unlockExclusive() { IOLockUnlock( lock ); }
+    void lockShared()      { IOLockLock( lock ); }
+    void unlockShared()    { IOLockUnlock( lock ); }
+    
+    bool tryLockExclusive() { return IOLockTryLock( lock ); }
+    bool tryLockShared()    { return IOLockTryLock( lock ); }
+};
+
+//--------------------------------------------------------------------
+
+class QvrMapRWLock{
+    
+private:
+    IORWLock*  lock;
+    
+public:
+    
+    QvrMapRWLock() : lock( NULL ) {}
+    
+    ~QvrMapRWLock()
+    {
+        if( lock )
+            IORWLockFree( lock );
+    }
+    
+    bool init()
+    {
+        assert( ! lock );
+        
+        lock = IORWLockAlloc();
+        assert( lock );
+        
+        return NULL != lock;
+    }
+    
+    void lockExclusive()   { IORWLockWrite( lock ); }
+    void unlockExclusive() { IORWLockUnlock( lock ); }
+    void lockShared()      { IORWLockRead( lock ); }
+    void unlockShared()    { IORWLockUnlock( lock ); }
+    
+    //
+    // IOKit has no try functions for IORWLock,
+    // every acquisition is timed
+    //
+    bool tryLockExclusive() { return false; }
+    bool tryLockShared()    { return false; }
+};
+
+//--------------------------------------------------------------------
+
+inline void* QvrMapAllocate( __in size_t size ) { return IOMalloc( size ); }
+inline void  QvrMapFree( __in void* ptr, __in size_t size ) { IOFree( ptr, size ); }
+
+#else // KERNEL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/cdefs.h>
+
+#ifndef __in
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __out_opt
+#define __opt
+#endif
+
+#ifndef QVR_CACHE_LINE_SIZE
+#define QVR_CACHE_LINE_SIZE  64
+#endif
+
+#define QVR_MAP_ASSERT( _X_ )  assert( _X_ )
+
+//--------------------------------------------------------------------
+
+//
+// the kernel types and functions used by the ght hash table
+//
+
+typedef uint8_t    UInt8;
+typedef uint16_t   UInt16;
+typedef uint32_t   UInt32;
+typedef uint64_t   UInt64;
+typedef int32_t    SInt32;
+typedef int64_t    SInt64;
+
+typedef size_t     vm_size_t;
+typedef uintptr_t  vm_offset_t;
+typedef uintptr_t  vm_address_t;
+
+#define M_WAITOK   0x0000
+#define M_NOWAIT   0x0001
+
+#define DBG_PRINT_ERROR( _S_ )  do{ printf _S_ ; }while( 0 )
+
+//
+// compiled out as in the kernel build without _DLD_LOG
+//
+#define DBG_PRINT( _S_ )  do{ void(0); }while( 0 )
+
+#define panic( ... )  do{ fprintf( stderr, __VA_ARGS__ ); abort(); }while( 0 )
+
+inline bool preemption_enabled() { return true; }
+
+//
+// the per-CPU slots as in Common.h, the atomics return the value before the operation
+//
+#define QVR_CPU_SLOTS  32 // must be a power of 2
+
+inline unsigned int QvrCurrentCpuSlot() { return (unsigned int)sched_getcpu() & ( QVR_CPU_SLOTS - 1 ); }
+
+inline SInt32 OSIncrementAtomic( __in volatile SInt32* address ) { return __sync_fetch_and_add( address, 1 ); }
+inline SInt32 OSDecrementAtomic( __in volatile SInt32* address ) { return __sync_fetch_and_sub( address, 1 ); }
+inline SInt64 OSIncrementAtomic64( __in volatile SInt64* address ) { return __sync_fetch_and_add( address, 1 ); }
+
+inline bool OSCompareAndSwap( __in UInt32 oldValue, __in UInt32 newValue, __in volatile UInt32* address )
+{
+    return __sync_bool_compare_and_swap( address, oldValue, newValue );
+}
+
+inline bool OSCompareAndSwapPtr( __in void* oldValue, __in void* newValue, __in void* volatile* address )
+{
+    return __sync_bool_compare_and_swap( address, oldValue, newValue );
+}
+
+inline void* IOMalloc( __in vm_size_t size ) { return malloc( size ); }
+inline void  IOFree( __in void* address, __in vm_size_t ) { free( address ); }
+
+//
+// LIST_ENTRY and CONTAINING_RECORD as in the kernel build
+//
+#include "ListEntry.h"
+
+//
+// a thread is identified by the address of a thread local variable,
+// the addresses are as far apart as the kernel's thread structures
+//
+typedef struct thread*  thread_t;
+
+inline thread_t current_thread()
+{
+    static __thread char  thread;
+    return (thread_t)&thread;
+}
+
+typedef pthread_mutex_t   IOLock;
+typedef pthread_rwlock_t  IORWLock;
+
+inline IOLock* IOLockAlloc()
+{
+    IOLock* lock = (IOLock*)malloc( sizeof( IOLock ) );
+    if( lock && 0x0 != pthread_mutex_init( lock, NULL ) ){
+        
+        free( lock );
+        lock = NULL;
+    }
+    
+    return lock;
+}
+
+inline void IOLockFree( __in IOLock* lock ) { pthread_mutex_destroy( lock ); free( lock ); }
+inline void IOLockLock( __in IOLock* lock ) { pthread_mutex_lock( lock ); }
+inline void IOLockUnlock( __in IOLock* lock ) { pthread_mutex_unlock( lock ); }
+inline bool IOLockTryLock( __in IOLock* lock ) { return 0x0 == pthread_mutex_trylock( lock ); }
+
+inline IORWLock* IORWLockAlloc()
+{
+    IORWLock* lock = (IORWLock*)malloc( sizeof( IORWLock ) );
+    if( lock && 0x0 != pthread_rwlock_init( lock, NULL ) ){
+        
+        free( lock );
+        lock = NULL;
+    }
+    
+    return lock;
+}
+
+inline void IORWLockFree( __in IORWLock* lock ) { pthread_rwlock_destroy( lock ); free( lock ); }
+inline void IORWLockRead( __in IORWLock* lock ) { pthread_rwlock_rdlock( lock ); }
+inline void IORWLockWrite( __in IORWLock* lock ) { pthread_rwlock_wrlock( lock ); }
+inline void IORWLockUnlock( __in IORWLock* lock ) { pthread_rwlock_unlock( lock ); }
+
+typedef pthread_spinlock_t  IOSimpleLock;
+
+inline IOSimpleLock* IOSimpleLockAlloc()
+{
+    IOSimpleLock* lock = (IOSimpleLock*)malloc( sizeof( IOSimpleLock ) );
+    if( lock && 0x0 != pthread_spin_init( lock, PTHREAD_PROCESS_PRIVATE ) ){
+        
+        free( (void*)lock );
+        lock = NULL;
+    }
+    
+    return lock;
+}
+
+inline void IOSimpleLockFree( __in IOSimpleLock* lock ) { pthread_spin_destroy( lock ); free( (void*)lock ); }
+inline void IOSimpleLockLock( __in IOSimpleLock* lock ) { pthread_spin_lock( lock ); }
+inline void IOSimpleLockUnlock( __in IOSimpleLock* lock ) { pthread_spin_unlock( lock ); }
+
+//--------------------------------------------------------------------
+
+//
+// the thread calls used by QvrEpoch, a call has its own thread that runs
+// the function once for any number of thread_call_enter calls made before
+// it starts, the deadlines are CLOCK_MONOTONIC nanoseconds
+//
+
+#define kMillisecondScale  1000000
+
+inline void IOSleep( __in unsigned int milliseconds ) { usleep( milliseconds * 1000 ); }
+
+inline uint64_t QvrUptimeNs()
+{
+    struct timespec  ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+inline void clock_interval_to_deadline( __in uint32_t interval, __in uint32_t scale, __out uint64_t* deadline )
+{
+    *deadline = QvrUptimeNs() + (uint64_t)interval * scale;
+}
+
+typedef void*  thread_call_param_t;
+typedef void (*thread_call_func_t)( __in thread_call_param_t param0, __in thread_call_param_t param1 );
+
+class QvrThreadCall{
+    
+public:
+    pthread_t            thread;
+    pthread_mutex_t      lock;
+    pthread_cond_t       wakeup;
+    thread_call_func_t   func;
+    thread_call_param_t  param;
+    uint64_t             deadline;
+    bool                 pending;
+    bool                 stop;
+    
+    static void* routine( __in void* context )
+    {
+        QvrThreadCall* call = (QvrThreadCall*)context;
+        
+        pthread_mutex_lock( &call->lock );
+        while( ! call->stop ){
+            
+            if( ! call->pending ){
+                
+                pthread_cond_wait( &call->wakeup, &call->lock );
+                continue;
+            }
+            
+            uint64_t now = QvrUptimeNs();
+            if( call->deadline > now ){
+                
+                struct timespec  ts;
+                
+                clock_gettime( CLOCK_REALTIME, &ts );
+                ts.tv_sec  += ( call->deadline - now ) / 1000000000ULL;
+                ts.tv_nsec += ( call->deadline - now ) % 1000000000ULL;
+                if( ts.tv_nsec >= 1000000000L ){
+                    
+                    ts.tv_sec  += 1;
+                    ts.tv_nsec -= 1000000000L;
+                }
+                
+                pthread_cond_timedwait( &call->wakeup, &call->lock, &ts );
+                continue;
+            }
+            
+            call->pending = false;
+            
+            pthread_mutex_unlock( &call->lock );
+            call->func( call->param, NULL );
+            pthread_mutex_lock( &call->lock );
+        }
+        pthread_mutex_unlock( &call->lock );
+        
+        return NULL;
+    }
+};
+
+typedef QvrThreadCall*  thread_call_t;
+
+inline thread_call_t thread_call_allocate( __in thread_call_func_t func, __in thread_call_param_t param )
+{
+    QvrThreadCall* call = new QvrThreadCall();
+    
+    call->func = func;
+    call->param = param;
+    call->deadline = 0x0;
+    call->pending = false;
+    call->stop = false;
+    pthread_mutex_init( &call->lock, NULL );
+    pthread_cond_init( &call->wakeup, NULL );
+    
+    if( 0x0 != pthread_create( &call->thread, NULL, QvrThreadCall::routine, call ) ){
+        
+        pthread_cond_destroy( &call->wakeup );
+        pthread_mutex_destroy( &call->lock );
+        delete call;
+        return NULL;
+    }
+    
+    return call;
+}
+
+inline bool thread_call_enter_delayed( __in thread_call_t call, __in uint64_t deadline )
+{
+    bool wasPending;
+    
+    pthread_mutex_lock( &call->lock );
+    {// start of the lock
+        wasPending = call->pending;
+        call->pending = true;
+        call->deadline = deadline;
+        pthread_cond_signal( &call->wakeup );
+    }// end of the lock
+    pthread_mutex_unlock( &call->lock );
+    
+    return wasPending;
+}
+
+inline bool thread_call_enter( __in thread_call_t call ) { return thread_call_enter_delayed( call, 0x0 ); }
+
+//
+// cancels a pending call and waits for a running one, the call can't be entered again
+//
+inline bool thread_call_cancel_wait( __in thread_call_t call )
+{
+    bool wasPending;
+    
+    pthread_mutex_lock( &call->lock );
+    {// start of the lock
+        wasPending = call->pending;
+        call->pending = false;
+        call->stop = true;
+        pthread_cond_signal( &call->wakeup );
+    }// end of the lock
+    pthread_mutex_unlock( &call->lock );
+    
+    pthread_join( call->thread, NULL );
+    
+    return wasPending;
+}
+
+inline bool thread_call_free( __in thread_call_t call )
+{
+    pthread_cond_destroy( &call->wakeup );
+    pthread_mutex_destroy( &call->lock );
+    delete call;
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+class QvrMapMutex{
+    
+private:
+    pthread_mutex_t  lock;
+    bool             initialized;
+    
+public:
+    
+    QvrMapMutex() : initialized( false ) {}
+    ~QvrMapMutex() { if( initialized ) pthread_mutex_destroy( &lock ); }
+    
+    bool init() { initialized = ( 0x0 == pthread_mutex_init( &lock, NULL ) ); return initialized; }
+    
+    void lockExclusive()   { pthread_mutex_lock( &lock ); }
+    void unlockExclusive() { pthread_mutex_unlock( &lock ); }
+    void lockShared()      { pthread_mutex_lock( &lock ); }
+    void unlockShared()    { pthread_mutex_unlock( &lock ); }
+    
+    bool tryLockExclusive() { return 0x0 == pthread_mutex_trylock( &lock ); }
+    bool tryLockShared()    { return 0x0 == pthread_mutex_trylock( &lock ); }
+};
+
+//--------------------------------------------------------------------
+
+class QvrMapRWLock{
+    
+private:
+    pthread_rwlock_t  lock;
+    bool              initialized;
+    
+public:
+    
+    QvrMapRWLock() : initialized( false ) {}
+    ~QvrMapRWLock() { if( initialized ) pthread_rwlock_destroy( &lock ); }
+    
+    bool init() { initialized = ( 0x0 == pthread_rwlock_init( &lock, NULL ) ); return initialized; }
+    
+    void lockExclusive()   { pthread_rwlock_wrlock( &lock ); }
+    void unlockExclusive() { pthread_rwlock_unlock( &lock ); }
+    void lockShared()      { pthread_rwlock_rdlock( &lock ); }
+    void unlockShared()    { pthread_rwlock_unlock( &lock ); }
+    
+    bool tryLockExclusive() { return 0x0 == pthread_rwlock_trywrlock( &lock ); }
+    bool tryLockShared()    { return 0x0 == pthread_rwlock_tryrdlock( &lock ); }
+};
+
+//--------------------------------------------------------------------
+
+inline void* QvrMapAllocate( __in size_t size ) { return malloc( size ); }
+inline void  QvrMapFree( __in void* ptr, __in size_t ) { free( ptr ); }
+
+//--------------------------------------------------------------------
+
+#define VFS_CHAIN_LENGTHS  8
+
+//
+// the user mode counterpart of QvrTableStatistics, the counters
+// are shared by all threads
+//
+class QvrMapStatisticsReport{
+    
+public:
+    uint64_t    entries;
+    uint64_t    buckets;
+    uint64_t    lookups;
+    uint64_t    lookupProbes;
+    uint64_t    maxProbes;
+    uint64_t    lockAcquisitions;
+    uint64_t    lockWaitNs;
+    uint64_t    rehashes;
+    uint64_t    misses;
+    uint64_t    evictions;
+    uint64_t    bucketBytes;
+    uint64_t    entryBytes;
+    uint64_t    keyBytes;
+    uint64_t    maxChain;
+    uint64_t    chainLengths[ VFS_CHAIN_LENGTHS ];
+};
+
+//
+// the counters are in per-CPU slots on separate cache lines as in the kernel
+// QvrTableStatistics, so the threads of a benchmark don't contend for a counter
+//
+class QvrMapStatistics{
+    
+private:
+    
+    class CpuCounters{
+    public:
+        uint64_t volatile   lookups;
+        uint64_t volatile   lookupProbes;
+        uint64_t volatile   maxProbes;
+        uint64_t volatile   lockAcquisitions;
+        uint64_t volatile   lockWaitNs;
+        uint64_t volatile   rehashes;
+        uint64_t volatile   misses;
+        uint64_t volatile   evictions;
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+    CpuCounters   cpus[ QVR_CPU_SLOTS ];
+    
+    CpuCounters* current() { return &cpus[ QvrCurrentCpuSlot() ]; }
+    
+public:
+    
+    void reset() { memset( cpus, 0x0, sizeof( cpus ) ); }
+    
+    static uint64_t now()
+    {
+        struct timespec  ts;
+        
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    
+    void lookup( __in uint32_t probes )
+    {
+        CpuCounters*  counters = current();
+        
+        __sync_fetch_and_add( &counters->lookups, 1 );
+        __sync_fetch_and_add( &counters->lookupProbes, probes );
+        
+        if( counters->maxProbes < probes )
+            counters->maxProbes = probes;
+    }
+    
+    void lookups( __in uint32_t count, __in uint32_t probes, __in uint32_t maxProbes, __in uint32_t misses )
+    {
+        CpuCounters*  counters = current();
+        
+        if( 0x0 == count )
+            return;
+        
+        __sync_fetch_and_add( &counters->lookups, count );
+        __sync_fetch_and_add( &counters->lookupProbes, probes );
+        if( misses )
+            __sync_fetch_and_add( &counters->misses, misses );
+        
+        if( counters->maxProbes < maxProbes )
+            counters->maxProbes = maxProbes;
+    }
+    
+    void lockAcquired( __in uint64_t waitTime )
+    {
+        CpuCounters*  counters = current();
+        
+        __sync_fetch_and_add( &counters->lockAcquisitions, 1 );
+        if( waitTime )
+            __sync_fetch_and_add( &counters->lockWaitNs, waitTime );
+    }
+    
+    void rehash() { __sync_fetch_and_add( &current()->rehashes, 1 ); }
+    
+    void miss() { __sync_fetch_and_add( &current()->misses, 1 ); }
+    
+    void eviction() { __sync_fetch_and_add( &current()->evictions, 1 ); }
+    
+    //
+    // sums the slots and sets only the counters, the sizes are set
+    // by the table as in the kernel version
+    //
+    void getReport( __out QvrMapStatisticsReport* report )
+    {
+        report->lookups          = 0x0;
+        report->lookupProbes     = 0x0;
+        report->maxProbes        = 0x0;
+        report->lockAcquisitions = 0x0;
+        report->lockWaitNs       = 0x0;
+        report->rehashes         = 0x0;
+        report->misses           = 0x0;
+        report->evictions        = 0x0;
+        
+        for( int i = 0x0; i < QVR_CPU_SLOTS; ++i ){
+            
+            report->lookups          += cpus[ i ].lookups;
+            report->lookupProbes     += cpus[ i ].lookupProbes;
+            report->lockAcquisitions += cpus[ i ].lockAcquisitions;
+            report->lockWaitNs       += cpus[ i ].lockWaitNs;
+            report->rehashes         += cpus[ i ].rehashes;
+            report->misses           += cpus[ i ].misses;
+            report->evictions        += cpus[ i ].evictions;
+            
+            if( report->maxProbes < cpus[ i ].maxProbes )
+                report->maxProbes = cpus[ i ].maxProbes;
+        }
+    }
+};
+
+//
+// the names used by the ght hash table
+//
+typedef QvrMapStatistics        QvrTableStatistics;
+typedef QvrMapStatisticsReport  VFSTableStatistics;
+
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+//
+// a lock for a single threaded use or an external synchronization
+//
+class QvrMapNoLock{
+    
+public:
+    bool init() { return true; }
+    
+    void lockExclusive()   {}
+    void unlockExclusive() {}
+    void lockShared()      {}
+    void unlockShared()    {}
+    
+    bool tryLockExclusive() { return true; }
+    bool tryLockShared()    { return true; }
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__ConcurrentMapPlatform__) */
@@ -0,0 +1,119 @@
+//
+//  DataMap.cpp
+//  VFSFilter0
+//
+//  Created by slava on 6/13/15.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "DataMap.h"
+
+//--------------------------------------------------------------------
+
+DataMap::DataMap()
+{
+}
+
+//--------------------------------------------------------------------
+
+DataMap::~DataMap()
+{
+    assert( isEmpty() );
+}
+
+//--------------------------------------------------------------------
+
+bool
+DataMap::init()
+{
+    return map.init();
+}
+
+//--------------------------------------------------------------------
+
+bool
+DataMap::addDataByKey( __in void* key, __in void* data )
+{
+    assert( data );
+    assert( key );
+
+    return map.insert( key, data );
+}
+
+//--------------------------------------------------------------------
+
+void
+DataMap::removeKey( __in void* key )
+{
+    map.remove( key );
+}
+
+//--------------------------------------------------------------------
+
+void*
+DataMap::removeKeyAndReturnItsData( __in void* key )
+{
+    void* data = NULL;
+
+    map.remove( key, &data );
+    return data;
+}
+
+//--------------------------------------------------------------------
+
+void*
+DataMap::removeFirstEntryAndReturnItsData( __out_opt void** key )
+{
+    void* data = NULL;
+
+    map.removeFirst( &data, key );
+    return data;
+}
+
+//--------------------------------------------------------------------
+
+void*
+DataMap::getDataByKey( __in void* key )
+{
+    void* data = NULL;
+
+    map.get( key, &data );
+    return data;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DataMap::isEmpty()
+{
+    return map.isEmpty();
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+DataMap::getCount()
+{
+    return map.getCount();
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+DataMap::copyKeys(
+    __out void** keys,
+    __in UInt32 maxKeys
+    )
+{
+    return map.copyKeys( keys, maxKeys );
+}
+
+//--------------------------------------------------------------------
+
+void
+DataMap::getStatistics( __out VFSTableStatistics* report )
+{
+    map.getStatistics( report );
+}
+
+//--------------------------------------------------------------------
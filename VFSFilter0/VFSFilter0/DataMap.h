@@ -0,0 +1,71 @@
+//
+//  DataMap.h
+//  VFSFilter0
+//
+//  Created by slava on 6/13/15.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__DataMap__
+#define __VFSFilter0__DataMap__
+
+#if defined( KERNEL )
+#include "Common.h"
+#endif // KERNEL
+#include "ConcurrentMap.h"
+
+//--------------------------------------------------------------------
+
+//
+// a map for pointer keys, the map is a lock-striped QvrConcurrentMap
+//
+class DataMap{
+
+private:
+
+    QvrConcurrentMap< void*, void*, QvrMapPolicyStriped >  map;
+
+public:
+
+    DataMap();
+    virtual ~DataMap();
+
+    //
+    // must be called before the map is used, returns false if there is no memory
+    //
+    virtual bool init();
+
+    //
+    // both key and data can't be NULL,
+    // the function checks for duplicate entries
+    // and updates the data field
+    //
+    virtual bool addDataByKey( __in void* key, __in void* data );
+
+    virtual void removeKey( __in void* key );
+
+    virtual void* removeKeyAndReturnItsData( __in void* key );
+
+    virtual void* removeFirstEntryAndReturnItsData( __out_opt void** key = NULL);
+
+    //
+    // returns NULL if a key is not found, the validite of the returned pointer is a caller's responsibility
+    //
+    virtual void* getDataByKey( __in void* key );
+
+    virtual bool isEmpty();
+
+    //
+    // the values are snapshots, the map can change as soon as the functions return,
+    // copyKeys returns the number of copied keys
+    //
+    virtual UInt32 getCount();
+    virtual UInt32 copyKeys( __out void** keys, __in UInt32 maxKeys );
+
+    virtual void getStatistics( __out VFSTableStatistics* report );
+
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__DataMap__) */
@@ -0,0 +1,290 @@
+//
+//  Epoch.cpp
+//  VFSFilter0
+//
+//  Created by slava on 26/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "Epoch.h"
+
+//--------------------------------------------------------------------
+
+QvrEpoch::QvrEpoch() : entriesPool( sizeof( RetiredEntry ), 256 )
+{
+    bzero( counters, sizeof( counters ) );
+    
+    phase = 0x0;
+    retired = NULL;
+    retiredCount = 0x0;
+    gracePeriods = 0x0;
+    
+    syncLock = NULL;
+    retireLock = NULL;
+    reclaimCall = NULL;
+}
+
+//--------------------------------------------------------------------
+
+QvrEpoch::~QvrEpoch()
+{
+    if( reclaimCall ){
+        
+        //
+        // waits for the callback if it is being executed
+        //
+        thread_call_cancel_wait( reclaimCall );
+        thread_call_free( reclaimCall );
+    }
+    
+    reclaim();
+    assert( NULL == retired );
+    
+    if( retireLock )
+        IOLockFree( retireLock );
+    
+    if( syncLock )
+        IOLockFree( syncLock );
+}
+
+//--------------------------------------------------------------------
+
+bool
+QvrEpoch::init()
+/*
+ the epoch must not be used if the function failed
+ */
+{
+    assert( ! syncLock && ! retireLock && ! reclaimCall );
+    
+    syncLock = IOLockAlloc();
+    assert( syncLock );
+    if( ! syncLock ){
+        
+        DBG_PRINT_ERROR(( "QvrEpoch::init()->IOLockAlloc() failed\n" ));
+        return false;
+    }
+    
+    retireLock = IOLockAlloc();
+    assert( retireLock );
+    if( ! retireLock ){
+        
+        DBG_PRINT_ERROR(( "QvrEpoch::init()->IOLockAlloc() failed\n" ));
+        return false;
+    }
+    
+    reclaimCall = thread_call_allocate( reclaimCallback, this );
+    assert( reclaimCall );
+    if( ! reclaimCall ){
+        
+        DBG_PRINT_ERROR(( "QvrEpoch::init()->thread_call_allocate() failed\n" ));
+        return false;
+    }
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+QvrEpoch::enter()
+{
+    while( true ){
+        
+        UInt32        index = (UInt32)phase & 0x1;
+        CpuCounters*  cpuCounters = &counters[ QvrCurrentCpuSlot() ];
+        
+        OSIncrementAtomic( &cpuCounters->readers[ index ] );
+        
+        //
+        // the atomic operation is a full barrier, so either a writer that has
+        // flipped the phase sees the incremented counter or the reader sees
+        // the new phase and retries with the new counter
+        //
+        if( index == ( (UInt32)phase & 0x1 ) )
+            return index;
+        
+        OSDecrementAtomic( &cpuCounters->readers[ index ] );
+    } // end while
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::leave( __in UInt32 token )
+{
+    assert( token < 0x2 );
+    
+    //
+    // a thread might have been moved to another CPU, only a sum
+    // over all CPUs is meaningful
+    //
+    OSDecrementAtomic( &counters[ QvrCurrentCpuSlot() ].readers[ token ] );
+}
+
+//--------------------------------------------------------------------
+
+SInt32
+QvrEpoch::readersCount( __in UInt32 index )
+{
+    SInt32 count = 0x0;
+    
+    for( int i = 0x0; i < QVR_CPU_SLOTS; ++i )
+        count += counters[ i ].readers[ index ];
+    
+    return count;
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::waitForReaders( __in UInt32 index )
+{
+    while( 0x0 != readersCount( index ) ){
+        
+        //
+        // readers are short, so a millisecond sleep doesn't delay a grace period much
+        //
+        IOSleep( 1 );
+    }
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::synchronize()
+{
+    assert( preemption_enabled() );
+    
+    IOLockLock( syncLock );
+    {// start of the lock
+        
+        //
+        // the phase is flipped twice, the first wait drains the readers
+        // of the current phase, the second one drains the readers that
+        // fetched the phase before the first flip but incremented
+        // the counter after it
+        //
+        for( int i = 0x0; i < 0x2; ++i ){
+            
+            UInt32 index = (UInt32)phase & 0x1;
+            
+            OSIncrementAtomic( &phase );
+            waitForReaders( index );
+        }
+        
+        OSIncrementAtomic64( &gracePeriods );
+        
+    }// end of the lock
+    IOLockUnlock( syncLock );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::retire(
+    __in QvrEpochCallback callback,
+    __in void* context
+    )
+{
+    RetiredEntry*  entry;
+    UInt32         count;
+    
+    entry = (RetiredEntry*)entriesPool.allocate();
+    assert( entry );
+    if( ! entry ){
+        
+        DBG_PRINT_ERROR(( "QvrEpoch::retire()->entriesPool.allocate() failed\n" ));
+        
+        synchronize();
+        callback( context );
+        return;
+    }
+    
+    entry->callback = callback;
+    entry->context  = context;
+    
+    IOLockLock( retireLock );
+    {// start of the lock
+        
+        entry->next = retired;
+        retired = entry;
+        count = ++retiredCount;
+        
+    }// end of the lock
+    IOLockUnlock( retireLock );
+    
+    if( ! reclaimCall )
+        return;
+    
+    if( 0x1 == count ){
+        
+        //
+        // the first entry schedules a delayed reclaim so the following
+        // entries accumulate and a grace period serves many of them
+        //
+        uint64_t deadline;
+        
+        clock_interval_to_deadline( 10, kMillisecondScale, &deadline );
+        thread_call_enter_delayed( reclaimCall, deadline );
+        
+    } else if( ReclaimThreshold == count ){
+        
+        thread_call_enter( reclaimCall );
+    }
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::reclaim()
+{
+    RetiredEntry*  entries;
+    
+    //
+    // nothing could have been retired if init() failed
+    //
+    if( ! retireLock )
+        return;
+    
+    IOLockLock( retireLock );
+    {// start of the lock
+        
+        entries = retired;
+        retired = NULL;
+        retiredCount = 0x0;
+        
+    }// end of the lock
+    IOLockUnlock( retireLock );
+    
+    if( ! entries )
+        return;
+    
+    //
+    // all entries have been unpublished before they were retired
+    //
+    synchronize();
+    
+    while( entries ){
+        
+        RetiredEntry*  next = entries->next;
+        
+        entries->callback( entries->context );
+        entriesPool.free( entries );
+        
+        entries = next;
+    } // end while
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrEpoch::reclaimCallback(
+    __in thread_call_param_t epoch,
+    __in thread_call_param_t
+    )
+{
+    ((QvrEpoch*)epoch)->reclaim();
+}
+
+//--------------------------------------------------------------------
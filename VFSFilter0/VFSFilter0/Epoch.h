@@ -0,0 +1,146 @@
+//
+//  Epoch.h
+//  VFSFilter0
+//
+//  Created by slava on 26/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__Epoch__
+#define __VFSFilter0__Epoch__
+
+#if defined( KERNEL )
+
+#include "Common.h"
+#include "ObjectPool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+#include <kern/thread_call.h>
+    
+#ifdef __cplusplus
+}
+#endif
+
+#else // KERNEL
+
+//
+// a user mode build for the tests and benchmarks, ConcurrentMapPlatform.h
+// provides the thread calls, see VFSFilter0Bench
+//
+#include "ObjectPool.h"
+
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+typedef void (*QvrEpochCallback)( __in void* context );
+
+//--------------------------------------------------------------------
+
+//
+// an epoch based reclamation for read-mostly data,
+// a reader brackets an access with enter()/leave() and takes no lock,
+// a reader can block inside the bracket, a writer unpublishes an object
+// and calls retire() to defer its release until all readers that might
+// have seen the object have left, the readers are counted with per-CPU
+// counters of two phases, a grace period flips the phase and waits for
+// the readers of the previous phase to drain
+//
+class QvrEpoch{
+    
+private:
+    
+    class CpuCounters{
+    public:
+        SInt32 volatile  readers[ 2 ];
+        UInt8            pad[ QVR_CACHE_LINE_SIZE - 2*sizeof(SInt32) ];
+    };
+    
+    class RetiredEntry{
+    public:
+        RetiredEntry*     next;
+        QvrEpochCallback  callback;
+        void*             context;
+    };
+    
+    enum{
+        ReclaimThreshold = 256 // the retired entries number that triggers an immediate reclaim
+    };
+    
+private:
+    
+    CpuCounters       counters[ QVR_CPU_SLOTS ];
+    
+    SInt32 volatile   phase; // the low bit selects the readers counters
+    
+    //
+    // serializes grace periods
+    //
+    IOLock*           syncLock;
+    
+    //
+    // protects the retired list
+    //
+    IOLock*           retireLock;
+    RetiredEntry*     retired;
+    UInt32            retiredCount;
+    
+    thread_call_t     reclaimCall;
+    
+    QvrObjectPool     entriesPool;
+    
+    SInt64 volatile   gracePeriods;
+    
+private:
+    
+    SInt32 readersCount( __in UInt32 index );
+    void   waitForReaders( __in UInt32 index );
+    
+    static void reclaimCallback( __in thread_call_param_t epoch, __in thread_call_param_t );
+    
+public:
+    
+    QvrEpoch();
+    ~QvrEpoch();
+    
+    //
+    // allocates the locks and the thread call, must be called before
+    // the first use, the destructor frees a partially initialized epoch
+    //
+    bool   init();
+    
+    //
+    // enter() returns a token that must be provided to leave(),
+    // the calls can be made on different CPUs
+    //
+    UInt32 enter();
+    void   leave( __in UInt32 token );
+    
+    //
+    // waits until all readers that entered before the call have left,
+    // must not be called from inside an enter()/leave() bracket
+    //
+    void   synchronize();
+    
+    //
+    // calls the callback after a grace period, the callbacks are called
+    // from a thread call, if there is no memory for the entry the function
+    // waits for a grace period and calls the callback synchronously so it
+    // must not be called from inside an enter()/leave() bracket
+    //
+    void   retire( __in QvrEpochCallback callback, __in void* context );
+    
+    //
+    // processes all retired entries, called by the thread call
+    //
+    void   reclaim();
+    
+    UInt64 getGracePeriodsCount() { return gracePeriods; }
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__Epoch__) */
@@ -0,0 +1,155 @@
+//
+//  ListEntry.h
+//  VFSFilter0
+//
+//  Created by slava on 3/06/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef VFSFilter0_ListEntry_h
+#define VFSFilter0_ListEntry_h
+
+//
+// the header has no kernel dependencies, it is included by Common.h
+// and by the user mode part of ConcurrentMapPlatform.h
+//
+
+//--------------------------------------------------------------------
+
+//
+// Double linked list manipulation functions, the same as on Windows
+//
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+inline
+void
+InitializeListHead(
+                   __inout PLIST_ENTRY ListHead
+                   )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+inline
+bool
+IsListEmpty(
+            __in const LIST_ENTRY * ListHead
+            )
+{
+    return (bool)(ListHead->Flink == ListHead);
+}
+
+inline
+bool
+RemoveEntryList(
+                __in PLIST_ENTRY Entry
+                )
+{
+    PLIST_ENTRY Blink;
+    PLIST_ENTRY Flink;
+    
+    Flink = Entry->Flink;
+    Blink = Entry->Blink;
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return (bool)(Flink == Blink);
+}
+
+inline
+PLIST_ENTRY
+RemoveHeadList(
+               __in PLIST_ENTRY ListHead
+               )
+{
+    PLIST_ENTRY Flink;
+    PLIST_ENTRY Entry;
+    
+    Entry = ListHead->Flink;
+    Flink = Entry->Flink;
+    ListHead->Flink = Flink;
+    Flink->Blink = ListHead;
+    return Entry;
+}
+
+inline
+PLIST_ENTRY
+RemoveTailList(
+               __in PLIST_ENTRY ListHead
+               )
+{
+    PLIST_ENTRY Blink;
+    PLIST_ENTRY Entry;
+    
+    Entry = ListHead->Blink;
+    Blink = Entry->Blink;
+    ListHead->Blink = Blink;
+    Blink->Flink = ListHead;
+    return Entry;
+}
+
+inline
+void
+InsertTailList(
+               __in PLIST_ENTRY ListHead,
+               __in PLIST_ENTRY Entry
+               )
+{
+    PLIST_ENTRY Blink;
+    
+    Blink = ListHead->Blink;
+    Entry->Flink = ListHead;
+    Entry->Blink = Blink;
+    Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+
+inline
+void
+InsertHeadList(
+               __in PLIST_ENTRY ListHead,
+               __in PLIST_ENTRY Entry
+               )
+{
+    PLIST_ENTRY Flink;
+    
+    Flink = ListHead->Flink;
+    Entry->Flink = Flink;
+    Entry->Blink = ListHead;
+    Flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+inline
+void
+AppendTailList(
+               __in PLIST_ENTRY ListHead,
+               __in PLIST_ENTRY ListToAppend
+               )
+{
+    PLIST_ENTRY ListEnd = ListHead->Blink;
+    
+    ListHead->Blink->Flink = ListToAppend;
+    ListHead->Blink = ListToAppend->Blink;
+    ListToAppend->Blink->Flink = ListHead;
+    ListToAppend->Blink = ListEnd;
+}
+
+//---------------------------------------------------------------------
+
+//
+// Calculate the address of the base of the structure given its type, and an
+// address of a field within the structure.
+//
+
+#define CONTAINING_RECORD(address, type, field) ((type *)( \
+    (char*)(address) - \
+    reinterpret_cast<vm_address_t>(&((type *)0)->field)))
+
+//--------------------------------------------------------------------
+
+#endif // VFSFilter0_ListEntry_h
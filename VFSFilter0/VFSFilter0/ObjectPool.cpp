@@ -0,0 +1,322 @@
+//
+//  ObjectPool.cpp
+//  VFSFilter0
+//
+//  Created by slava on 24/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "ObjectPool.h"
+
+//--------------------------------------------------------------------
+
+QvrObjectPool::QvrObjectPool(
+    __in vm_size_t _objectSize,
+    __in UInt32 _objectsPerSlab
+    )
+{
+    assert( _objectsPerSlab > 0x0 );
+    
+    if( _objectSize < sizeof( FreeObject ) )
+        _objectSize = sizeof( FreeObject );
+    
+    this->objectSize = ( _objectSize + sizeof( void* ) - 1 ) & ~( sizeof( void* ) - 1 );
+    this->objectsPerSlab = _objectsPerSlab;
+    
+    bzero( caches, sizeof( caches ) );
+    for( int i = 0x0; i < QVR_CPU_SLOTS; ++i ){
+        
+        caches[ i ].lock = IOSimpleLockAlloc();
+        assert( caches[ i ].lock );
+        // TO DO , in kernel we can't through an exception if allocation failed
+        // redesign with init() function
+    }
+    
+    lock = IOLockAlloc();
+    assert( lock );
+    
+    freeList = NULL;
+    freeCount = 0x0;
+    InitializeListHead( &slabs );
+    slabsCount = 0x0;
+    
+    inUse = 0x0;
+    highWatermark = 0x0;
+    allocations = 0x0;
+    fallbacks = 0x0;
+}
+
+//--------------------------------------------------------------------
+
+QvrObjectPool::~QvrObjectPool()
+{
+    assert( 0x0 == inUse );
+    
+    while( ! IsListEmpty( &slabs ) ){
+        
+        Slab* slab = CONTAINING_RECORD( RemoveHeadList( &slabs ), Slab, listEntry );
+        IOFree( slab, sizeof( Slab ) + objectSize * objectsPerSlab );
+    }
+    
+    for( int i = 0x0; i < QVR_CPU_SLOTS; ++i ){
+        
+        if( caches[ i ].lock )
+            IOSimpleLockFree( caches[ i ].lock );
+    }
+    
+    if( lock )
+        IOLockFree( lock );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrObjectPool::accountAllocation()
+{
+    UInt32  current = (UInt32)( OSIncrementAtomic( &inUse ) + 1 );
+    
+    OSIncrementAtomic64( &allocations );
+    
+    //
+    // update the high watermark
+    //
+    while( true ){
+        
+        UInt32 watermark = (UInt32)highWatermark;
+        
+        if( watermark >= current )
+            break;
+        
+        if( OSCompareAndSwap( watermark, current, (volatile UInt32*)&highWatermark ) )
+            break;
+    }
+}
+
+//--------------------------------------------------------------------
+
+QvrObjectPool::FreeObject*
+QvrObjectPool::allocateFromGlobalList()
+/*
+ returns an object and moves up to CacheBatch objects to the current CPU cache
+ */
+{
+    while( true ){
+        
+        FreeObject*  object = NULL;
+        FreeObject*  batchHead = NULL;
+        FreeObject*  batchTail = NULL;
+        UInt32       batchCount = 0x0;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            
+            if( freeList ){
+                
+                object = freeList;
+                freeList = object->next;
+                freeCount -= 1;
+                
+                batchHead = freeList;
+                for( batchTail = NULL; freeList && batchCount < CacheBatch; ++batchCount ){
+                    
+                    batchTail = freeList;
+                    freeList = freeList->next;
+                }
+                
+                freeCount -= batchCount;
+                
+                if( batchTail )
+                    batchTail->next = NULL;
+                else
+                    batchHead = NULL;
+            }
+            
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        if( object ){
+            
+            if( batchHead ){
+                
+                CpuCache* cache = &caches[ QvrCurrentCpuSlot() ];
+                
+                IOSimpleLockLock( cache->lock );
+                {// start of the lock
+                    batchTail->next = cache->head;
+                    cache->head = batchHead;
+                    cache->count += batchCount;
+                }// end of the lock
+                IOSimpleLockUnlock( cache->lock );
+            }
+            
+            return object;
+        }
+        
+        //
+        // the global list is empty, allocate a new slab outside of the lock
+        // as the pool is used on the paging path
+        //
+        vm_size_t  slabSize = sizeof( Slab ) + objectSize * objectsPerSlab;
+        Slab*      slab = (Slab*)IOMalloc( slabSize );
+        assert( slab );
+        if( ! slab ){
+            
+            DBG_PRINT_ERROR(( "IOMalloc( %u ) failed\n", (unsigned int)slabSize ));
+            return NULL;
+        }
+        
+        FreeObject*  head = NULL;
+        UInt8*       objects = (UInt8*)( slab + 1 );
+        
+        for( UInt32 i = 0x0; i < objectsPerSlab; ++i ){
+            
+            FreeObject* freeObject = (FreeObject*)( objects + i * objectSize );
+            
+            freeObject->next = head;
+            head = freeObject;
+        }
+        
+        //
+        // the last carved object is the list head and the first one is the tail
+        //
+        FreeObject*  tail = (FreeObject*)objects;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            
+            InsertTailList( &slabs, &slab->listEntry );
+            slabsCount += 1;
+            
+            tail->next = freeList;
+            freeList = head;
+            freeCount += objectsPerSlab;
+            
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+    } // end while
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrObjectPool::freeToGlobalList(
+    __in FreeObject* head,
+    __in FreeObject* tail,
+    __in UInt32 count
+    )
+{
+    IOLockLock( lock );
+    {// start of the lock
+        
+        tail->next = freeList;
+        freeList = head;
+        freeCount += count;
+        
+    }// end of the lock
+    IOLockUnlock( lock );
+}
+
+//--------------------------------------------------------------------
+
+void*
+QvrObjectPool::allocate()
+{
+    FreeObject*  object;
+    CpuCache*    cache = &caches[ QvrCurrentCpuSlot() ];
+    
+    IOSimpleLockLock( cache->lock );
+    {// start of the lock
+        
+        object = cache->head;
+        if( object ){
+            
+            cache->head = object->next;
+            cache->count -= 1;
+        }
+        
+    }// end of the lock
+    IOSimpleLockUnlock( cache->lock );
+    
+    if( ! object ){
+        
+        OSIncrementAtomic64( &fallbacks );
+        object = allocateFromGlobalList();
+    }
+    
+    if( object )
+        accountAllocation();
+    
+    return object;
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrObjectPool::free(
+    __in void* _object
+    )
+{
+    FreeObject*  object = (FreeObject*)_object;
+    FreeObject*  batchHead = NULL;
+    FreeObject*  batchTail = NULL;
+    CpuCache*    cache = &caches[ QvrCurrentCpuSlot() ];
+    
+    assert( object );
+    
+    IOSimpleLockLock( cache->lock );
+    {// start of the lock
+        
+        object->next = cache->head;
+        cache->head = object;
+        cache->count += 1;
+        
+        if( cache->count > CacheLimit ){
+            
+            //
+            // return a batch to the global list
+            //
+            batchHead = cache->head;
+            batchTail = batchHead;
+            for( UInt32 i = 0x1; i < CacheBatch; ++i )
+                batchTail = batchTail->next;
+            
+            cache->head = batchTail->next;
+            cache->count -= CacheBatch;
+            batchTail->next = NULL;
+        }
+        
+    }// end of the lock
+    IOSimpleLockUnlock( cache->lock );
+    
+    if( batchHead )
+        freeToGlobalList( batchHead, batchTail, CacheBatch );
+    
+    assert( inUse > 0x0 );
+    OSDecrementAtomic( &inUse );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrObjectPool::getStatistics(
+    __out QvrObjectPoolStatistics* stats
+    )
+{
+    bzero( stats, sizeof( *stats ) );
+    
+    stats->objectSize    = (UInt32)objectSize;
+    stats->inUse         = (UInt32)inUse;
+    stats->highWatermark = (UInt32)highWatermark;
+    stats->allocations   = (UInt64)allocations;
+    stats->fallbacks     = (UInt64)fallbacks;
+    
+    IOLockLock( lock );
+    {// start of the lock
+        stats->slabs = slabsCount;
+        stats->bytes = (UInt64)slabsCount * ( sizeof( Slab ) + objectSize * objectsPerSlab );
+    }// end of the lock
+    IOLockUnlock( lock );
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,115 @@
+//
+//  ObjectPool.h
+//  VFSFilter0
+//
+//  Created by slava on 24/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__ObjectPool__
+#define __VFSFilter0__ObjectPool__
+
+#if defined( KERNEL )
+#include "Common.h"
+#else
+#include "ConcurrentMapPlatform.h"
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+typedef struct _QvrObjectPoolStatistics{
+    UInt32   objectSize;
+    UInt32   inUse;          // objects allocated by the callers
+    UInt32   highWatermark;  // maximum of inUse
+    UInt32   slabs;          // slabs allocated from the system
+    UInt64   bytes;          // memory allocated from the system
+    UInt64   allocations;    // successful allocate() calls
+    UInt64   fallbacks;      // allocations that could not be served from a CPU cache
+} QvrObjectPoolStatistics;
+
+//--------------------------------------------------------------------
+
+//
+// a pool of fixed size objects, the objects are carved from slabs and
+// kept on the free lists, the allocations and frees are served by per-CPU
+// caches and only an empty or an overfilled cache goes to the global free list,
+// the memory is returned to the system when the pool is destroyed,
+// so the pool footprint is defined by its high watermark
+//
+class QvrObjectPool{
+    
+private:
+    
+    class FreeObject{
+    public:
+        FreeObject*  next;
+    };
+    
+    class Slab{
+    public:
+        LIST_ENTRY   listEntry;
+        // objects follow
+    };
+    
+    class CpuCache{
+    public:
+        IOSimpleLock*  lock;
+        FreeObject*    head;
+        UInt32         count;
+        UInt8          pad[ QVR_CACHE_LINE_SIZE - sizeof(IOSimpleLock*) - sizeof(FreeObject*) - sizeof(UInt32) ];
+    };
+    
+    enum{
+        CacheLimit = 32,  // a cache with more objects returns CacheBatch objects to the global list
+        CacheBatch = 16
+    };
+    
+private:
+    
+    vm_size_t      objectSize;
+    UInt32         objectsPerSlab;
+    
+    CpuCache       caches[ QVR_CPU_SLOTS ];
+    
+    //
+    // the global free list and the slabs are protected by the lock
+    //
+    IOLock*        lock;
+    FreeObject*    freeList;
+    UInt32         freeCount;
+    LIST_ENTRY     slabs;
+    UInt32         slabsCount;
+    
+    SInt32 volatile  inUse;
+    SInt32 volatile  highWatermark;
+    SInt64 volatile  allocations;
+    SInt64 volatile  fallbacks;
+    
+private:
+    
+    FreeObject* allocateFromGlobalList();
+    void        freeToGlobalList( __in FreeObject* head, __in FreeObject* tail, __in UInt32 count );
+    void        accountAllocation();
+    
+public:
+    
+    //
+    // objectSize is rounded up to a pointer size
+    //
+    QvrObjectPool( __in vm_size_t objectSize, __in UInt32 objectsPerSlab );
+    ~QvrObjectPool();
+    
+    //
+    // returns NULL if there is no memory, the object content is undefined
+    //
+    void* allocate();
+    void  free( __in void* object );
+    
+    vm_size_t getObjectSize() { return objectSize; }
+    
+    void getStatistics( __out QvrObjectPoolStatistics* stats );
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__ObjectPool__) */
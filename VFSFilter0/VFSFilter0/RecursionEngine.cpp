@@ -8,4 +8,204 @@
 
 #include "RecursionEngine.h"
 
-RecursionEngine   RecursionEngine::Instance;
\ No newline at end of file
+RecursionEngine   RecursionEngine::Instance;
+
+//--------------------------------------------------------------------
+
+RecursionEngine::RecursionEngine()
+{
+    bzero( (void*)threads, sizeof( threads ) );
+    bzero( states, sizeof( states ) );
+    overflowCount = 0x0;
+}
+
+//--------------------------------------------------------------------
+
+RecursionEngine::~RecursionEngine()
+{
+    assert( 0x0 == overflowCount );
+}
+
+//--------------------------------------------------------------------
+
+bool
+RecursionEngine::init()
+{
+    if( ! overflow.init() ){
+        
+        DBG_PRINT_ERROR(( "overflow.init() failed\n" ));
+        return false;
+    }
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+RecursionEngine::ThreadState*
+RecursionEngine::findState(
+    __in thread_t thread
+    )
+/*
+ only the thread itself can add or remove its state so the state
+ can't appear or disappear while the function is being executed
+ */
+{
+    UInt32 start = windowStart( thread );
+    
+    for( UInt32 i = 0x0; i < ProbeWindow; ++i ){
+        
+        UInt32 indx = ( start + i ) & ( SlotsNumber - 1 );
+        
+        if( thread == threads[ indx ] )
+            return &states[ indx ];
+    }
+    
+    if( 0x0 == overflowCount )
+        return NULL;
+    
+    return (ThreadState*)overflow.getDataByKey( thread );
+}
+
+//--------------------------------------------------------------------
+
+RecursionEngine::ThreadState*
+RecursionEngine::acquireState(
+    __in thread_t thread
+    )
+{
+    ThreadState*  state = findState( thread );
+    
+    if( state )
+        return state;
+    
+    UInt32 start = windowStart( thread );
+    
+    for( UInt32 i = 0x0; i < ProbeWindow; ++i ){
+        
+        UInt32 indx = ( start + i ) & ( SlotsNumber - 1 );
+        
+        if( NULL != threads[ indx ] )
+            continue;
+        
+        if( OSCompareAndSwapPtr( NULL, thread, (void* volatile*)&threads[ indx ] ) ){
+            
+            bzero( &states[ indx ], sizeof( states[ indx ] ) );
+            return &states[ indx ];
+        }
+    } // end for
+    
+    //
+    // the window is full, this is a rare case
+    //
+    state = (ThreadState*)IOMalloc( sizeof( *state ) );
+    assert( state );
+    if( ! state ){
+        
+        DBG_PRINT_ERROR(( "IOMalloc( sizeof( *state ) ) failed\n" ));
+        return NULL;
+    }
+    
+    bzero( state, sizeof( *state ) );
+    
+    OSIncrementAtomic( &overflowCount );
+    if( ! overflow.addDataByKey( thread, state ) ){
+        
+        OSDecrementAtomic( &overflowCount );
+        IOFree( state, sizeof( *state ) );
+        return NULL;
+    }
+    
+    return state;
+}
+
+//--------------------------------------------------------------------
+
+void
+RecursionEngine::releaseState(
+    __in thread_t thread,
+    __in ThreadState* state
+    )
+{
+    assert( 0x0 == state->depth );
+    
+    if( state >= &states[ 0 ] && state < &states[ SlotsNumber ] ){
+        
+        UInt32 indx = (UInt32)( state - &states[ 0 ] );
+        
+        assert( thread == threads[ indx ] );
+        OSCompareAndSwapPtr( thread, NULL, (void* volatile*)&threads[ indx ] );
+        
+    } else {
+        
+        overflow.removeKey( thread );
+        OSDecrementAtomic( &overflowCount );
+        IOFree( state, sizeof( *state ) );
+    }
+}
+
+//--------------------------------------------------------------------
+
+void*
+RecursionEngine::cookie()
+{
+    ThreadState*  state = findState( current_thread() );
+    
+    if( ! state || 0x0 == state->depth )
+        return NULL;
+    
+    UInt32 top = ( state->depth < CookieStackDepth ) ? state->depth : CookieStackDepth;
+    
+    return state->cookies[ top - 1 ];
+}
+
+//--------------------------------------------------------------------
+
+bool
+RecursionEngine::isRecursive()
+{
+    return NULL != findState( current_thread() );
+}
+
+//--------------------------------------------------------------------
+
+void
+RecursionEngine::enter(
+    __in void* cookie
+    )
+{
+    ThreadState*  state = acquireState( current_thread() );
+    
+    assert( state );
+    if( ! state )
+        return;
+    
+    //
+    // a deeper nesting is legitimate, the cookie is not saved
+    // and CookieForRecursiveCall() returns the deepest saved one
+    //
+    if( state->depth < CookieStackDepth )
+        state->cookies[ state->depth ] = cookie;
+    
+    state->depth += 1;
+}
+
+//--------------------------------------------------------------------
+
+void
+RecursionEngine::leave()
+{
+    thread_t      thread = current_thread();
+    ThreadState*  state = findState( thread );
+    
+    assert( state && state->depth > 0x0 );
+    if( ! state )
+        return;
+    
+    state->depth -= 1;
+    
+    if( 0x0 == state->depth )
+        releaseState( thread, state );
+}
+
+//--------------------------------------------------------------------
@@ -9,192 +9,109 @@
 #ifndef __VFSFilter0__RecursionEngine__
 #define __VFSFilter0__RecursionEngine__
 
+#if defined( KERNEL )
 #include "Common.h"
+#endif // KERNEL
+#include "DataMap.h"
 
-class DataMap{
+//--------------------------------------------------------------------
+
+//
+// the engine tracks threads that are inside the filter, a thread is found
+// by scanning a small window of a fixed array of thread pointers that starts
+// at a slot defined by the thread pointer hash, a slot is claimed by the
+// thread itself with a compare and swap and only the owning thread modifies
+// the slot's state, so the lookup is lock free and enter/leave allocate nothing,
+// a thread that can't find a free slot in its window falls back to the overflow map
+//
+class RecursionEngine{
+    
+public:
+    static RecursionEngine   Instance;
     
 private:
     
-    class Entry{
+    enum{
+        SlotsNumber      = 1024, // must be a power of 2
+        ProbeWindow      = 16,
+        CookieStackDepth = 8
+    };
+    
+    class ThreadState{
     public:
-        LIST_ENTRY   listEntry;
-        void*        key;
-        void*        data;
+        
+        //
+        // a nesting depth, can exceed CookieStackDepth in which case
+        // the cookies for the deepest calls are not saved
+        //
+        UInt32   depth;
+        void*    cookies[ CookieStackDepth ];
     };
     
 private:
     
-    LIST_ENTRY  head;
-    IOLock*     lock;
+    //
+    // NULL for a free slot, the array is separated from the states
+    // to make a window scan touch as few cache lines as possible
+    //
+    thread_t volatile  threads[ SlotsNumber ];
+    ThreadState        states[ SlotsNumber ];
+    
+    //
+    // thread_t to ThreadState* for threads that have not found a free slot
+    //
+    DataMap            overflow;
+    SInt32 volatile    overflowCount;
     
 private:
     
-    Entry* findEntryByKey( __in void* key, __in bool acquireLock )
+    static UInt32 windowStart( __in thread_t thread )
     {
-        Entry* foundEntry = NULL;
-        
-        if( acquireLock )
-            IOLockLock( lock );
-        { // start ofthe lock
-            for( LIST_ENTRY* le = head.Flink; le != &head; le = le->Flink )
-            {
-                Entry* entry = CONTAINING_RECORD( le, Entry, listEntry );
-                if( entry->key == key )
-                {
-                    foundEntry = entry;
-                    break;
-                }
-            } // end for
-        } // end of the lock
-        if( acquireLock )
-            IOLockUnlock( lock );
-        
-        return foundEntry;
+        //
+        // thread structures are large and aligned so drop the low bits
+        //
+        UInt64 h = ( (UInt64)thread >> 4 ) * 0x9E3779B97F4A7C15ULL;
+        return (UInt32)( h >> 32 ) & ( SlotsNumber - 1 );
     }
     
-public:
+    ThreadState* findState( __in thread_t thread );
+    ThreadState* acquireState( __in thread_t thread );
+    void releaseState( __in thread_t thread, __in ThreadState* state );
     
-    DataMap()
-    {
-        InitializeListHead( &head );
-        lock = IOLockAlloc();
-        assert( lock );
-        // TO DO , in kernel we can't through an exception if allocation failed
-        // redesign with init() function
-    };
+    bool  init();
+    void* cookie();
+    bool  isRecursive();
+    void  enter( __in void* cookie );
+    void  leave();
     
-    virtual ~DataMap()
-    {
-        assert( IsListEmpty( &head ) );
-        IOLockFree( lock );
-    }
+public:
+    
+    RecursionEngine();
+    ~RecursionEngine();
     
     //
-    // both key and data can't be NULL,
-    // the function checks for duplicate entries
-    // and updates the data field
+    // must be called before any other function, returns false if there is no memory
     //
-    virtual bool addDataByKey( __in void* key, __in void* data )
-    {
-        assert( data );
-        assert( key );
-        
-        bool    freeEntry = false;
-        Entry*  entry = reinterpret_cast<Entry*>( IOMalloc( sizeof(*entry) ) );
-        assert( entry );
-        if( ! entry )
-            return false;
-        
-        bzero( entry, sizeof(*entry) );
-        
-        entry->key = key;
-        entry->data = data;
-        
-        IOLockLock( lock );
-        {
-            Entry* existingEntry = findEntryByKey( key, false );
-            if( existingEntry )
-                existingEntry->data = data;
-            else
-                InsertHeadList( &head, &entry->listEntry );
-            
-            freeEntry = ( NULL != existingEntry );
-        }
-        IOLockUnlock( lock );
-        
-        if( freeEntry )
-            IOFree( entry, sizeof( *entry ) );
-        
-        return true;
-    };
-    
-    virtual void removeKey( __in void* key )
-    {
-        Entry* entryToRemove = NULL;
-        
-        IOLockLock( lock );
-        {
-            entryToRemove = findEntryByKey( key, false );
-            if( entryToRemove )
-                RemoveEntryList( &entryToRemove->listEntry );
-        }
-        IOLockUnlock( lock );
-        
-        if( entryToRemove )
-            IOFree( entryToRemove, sizeof(*entryToRemove) );
-    };
-    
-    
-    virtual void* removeFirstEntryAndReturnItsData( __out_opt void** key = NULL)
-    {
-        Entry* entryToRemove = NULL;
-        
-        IOLockLock( lock );
-        {
-            if( !IsListEmpty( &head ) ){
-                
-                entryToRemove = CONTAINING_RECORD( head.Flink, Entry, listEntry );
-                RemoveEntryList( &entryToRemove->listEntry );
-            }
-        }
-        IOLockUnlock( lock );
-        
-        void* data = NULL;
-        
-        if( entryToRemove ){
-         
-            data = entryToRemove->data;
-            if( key )
-                *key = entryToRemove->key;
-            
-            IOFree( entryToRemove, sizeof(*entryToRemove) );
-        }
-        
-        return data;
-    };
+    static bool Init() { return RecursionEngine::Instance.init(); }
     
     //
-    // returns NULL if a key is not found, the validite of the returned pointer is a caller's responsibility
+    // returns the cookie for the innermost EnterRecursiveCall
     //
-    virtual void* getDataByKey( __in void* key )
-    {
-        void* data = NULL;
-        
-        IOLockLock( lock );
-        {
-            Entry* entry = findEntryByKey( key, false );
-            if( entry )
-                data = entry->data;
-        }
-        IOLockUnlock( lock );
-        
-        return data;
-    }
-    
-    virtual bool isEmpty()
-    {
-        return IsListEmpty( &head );
-    }
+    static void* CookieForRecursiveCall() { return RecursionEngine::Instance.cookie(); }
     
-};
-
-class RecursionEngine: public DataMap{
-    
-public:
-    static RecursionEngine   Instance;
-   
-public:
-    
-    static void* CookieForRecursiveCall() { return RecursionEngine::Instance.getDataByKey( current_thread() ); }
-    
-    static bool IsRecursiveCall( __in void* cookie ) { return NULL != RecursionEngine::Instance.getDataByKey( current_thread() ); }
-    static void EnterRecursiveCall( __in void* cookie ) {  RecursionEngine::Instance.addDataByKey( current_thread(), cookie ); }
-    static void LeaveRecursiveCall( __in void* cookie ) {  RecursionEngine::Instance.removeKey( current_thread() ); }
+    static bool IsRecursiveCall( __in void* cookie ) { return RecursionEngine::Instance.isRecursive(); }
+    static void EnterRecursiveCall( __in void* cookie ) {  RecursionEngine::Instance.enter( cookie ); }
+    static void LeaveRecursiveCall( __in void* cookie ) {  RecursionEngine::Instance.leave(); }
 
     static bool IsRecursiveCall() { return IsRecursiveCall( current_thread() ); }
     static void EnterRecursiveCall() { EnterRecursiveCall( current_thread() ); }
     static void LeaveRecursiveCall() {  LeaveRecursiveCall( current_thread() ); }
 
+    //
+    // the statistics for the overflow map
+    //
+    static void GetOverflowMapStatistics( __out VFSTableStatistics* report ) { RecursionEngine::Instance.overflow.getStatistics( report ); }
+
 };
 
 #endif /* defined(__VFSFilter0__RecursionEngine__) */
@@ -0,0 +1,49 @@
+//
+//  TableStatistics.cpp
+//  VFSFilter0
+//
+//  Created by slava on 28/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "TableStatistics.h"
+
+//--------------------------------------------------------------------
+
+void
+QvrTableStatistics::getReport(
+    __out VFSTableStatistics* report
+    )
+/*
+ the counters are read without synchronization, the report is a snapshot
+ */
+{
+    UInt64  lockWaitTime = 0x0;
+    
+    report->lookups          = 0x0;
+    report->lookupProbes     = 0x0;
+    report->maxProbes        = 0x0;
+    report->lockAcquisitions = 0x0;
+    report->lockWaitNs       = 0x0;
+    report->rehashes         = 0x0;
+    report->misses           = 0x0;
+    report->evictions        = 0x0;
+    
+    for( int i = 0x0; i < QVR_CPU_SLOTS; ++i ){
+        
+        report->lookups          += cpus[ i ].lookups;
+        report->lookupProbes     += cpus[ i ].lookupProbes;
+        report->lockAcquisitions += cpus[ i ].lockAcquisitions;
+        report->rehashes         += cpus[ i ].rehashes;
+        report->misses           += cpus[ i ].misses;
+        report->evictions        += cpus[ i ].evictions;
+        lockWaitTime             += cpus[ i ].lockWaitTime;
+        
+        if( report->maxProbes < (UInt64)cpus[ i ].maxProbes )
+            report->maxProbes = cpus[ i ].maxProbes;
+    }
+    
+    absolutetime_to_nanoseconds( lockWaitTime, &report->lockWaitNs );
+}
+
+//--------------------------------------------------------------------
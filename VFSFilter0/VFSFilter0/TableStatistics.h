@@ -0,0 +1,165 @@
+//
+//  TableStatistics.h
+//  VFSFilter0
+//
+//  Created by slava on 28/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__TableStatistics__
+#define __VFSFilter0__TableStatistics__
+
+#include "Common.h"
+#include "VFSFilter0UserClientInterface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+#include <kern/clock.h>
+    
+#ifdef __cplusplus
+}
+#endif
+
+//--------------------------------------------------------------------
+
+//
+// set to 0 to compile the counters out
+//
+#ifndef QVR_TABLE_STATISTICS
+#define QVR_TABLE_STATISTICS  1
+#endif
+
+//--------------------------------------------------------------------
+
+//
+// lookup, lock, rehash and cache counters for a hash table, a counter is updated
+// in a slot of the current CPU so the updates from different CPUs do not
+// share cache lines, the slots are summed only when a report is requested,
+// the class has no constructor as it is embedded in structures allocated
+// by the C allocators, reset() must be called before the first use
+//
+class QvrTableStatistics{
+    
+private:
+    
+    class CpuCounters{
+    public:
+        SInt64 volatile   lookups;
+        SInt64 volatile   lookupProbes;
+        SInt64 volatile   maxProbes;
+        SInt64 volatile   lockAcquisitions;
+        SInt64 volatile   lockWaitTime; // in absolute time units
+        SInt64 volatile   rehashes;
+        SInt64 volatile   misses;
+        SInt64 volatile   evictions;
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+    CpuCounters   cpus[ QVR_CPU_SLOTS ];
+    
+public:
+    
+    void reset()
+    {
+        bzero( cpus, sizeof( cpus ) );
+    }
+    
+    static UInt64 now()
+    {
+#if QVR_TABLE_STATISTICS
+        return mach_absolute_time();
+#else
+        return 0x0;
+#endif
+    }
+    
+    //
+    // probes is the number of entries visited by a lookup
+    //
+    void lookup( __in UInt32 probes )
+    {
+#if QVR_TABLE_STATISTICS
+        CpuCounters*  counters = &cpus[ QvrCurrentCpuSlot() ];
+        
+        OSIncrementAtomic64( &counters->lookups );
+        OSAddAtomic64( probes, &counters->lookupProbes );
+        
+        //
+        // a lost update of the maximum is acceptable
+        //
+        if( counters->maxProbes < probes )
+            counters->maxProbes = probes;
+#endif
+    }
+    
+    //
+    // a batch of lookups accounted at once, misses are the lookups
+    // that have not found the key
+    //
+    void lookups( __in UInt32 count, __in UInt32 probes, __in UInt32 maxProbes, __in UInt32 misses )
+    {
+#if QVR_TABLE_STATISTICS
+        CpuCounters*  counters = &cpus[ QvrCurrentCpuSlot() ];
+        
+        if( 0x0 == count )
+            return;
+        
+        OSAddAtomic64( count, &counters->lookups );
+        OSAddAtomic64( probes, &counters->lookupProbes );
+        if( misses )
+            OSAddAtomic64( misses, &counters->misses );
+        
+        if( counters->maxProbes < maxProbes )
+            counters->maxProbes = maxProbes;
+#endif
+    }
+    
+    //
+    // waitTime is the difference of now() values before and after
+    // the lock acquisition, zero for an uncontended acquisition
+    //
+    void lockAcquired( __in UInt64 waitTime )
+    {
+#if QVR_TABLE_STATISTICS
+        CpuCounters*  counters = &cpus[ QvrCurrentCpuSlot() ];
+        
+        OSIncrementAtomic64( &counters->lockAcquisitions );
+        if( waitTime )
+            OSAddAtomic64( waitTime, &counters->lockWaitTime );
+#endif
+    }
+    
+    void rehash()
+    {
+#if QVR_TABLE_STATISTICS
+        OSIncrementAtomic64( &cpus[ QvrCurrentCpuSlot() ].rehashes );
+#endif
+    }
+    
+    //
+    // a lookup that has not found the key, counted in addition to lookup()
+    //
+    void miss()
+    {
+#if QVR_TABLE_STATISTICS
+        OSIncrementAtomic64( &cpus[ QvrCurrentCpuSlot() ].misses );
+#endif
+    }
+    
+    void eviction()
+    {
+#if QVR_TABLE_STATISTICS
+        OSIncrementAtomic64( &cpus[ QvrCurrentCpuSlot() ].evictions );
+#endif
+    }
+    
+    //
+    // fills the counters, the entries and buckets fields are set by the caller
+    //
+    void getReport( __out VFSTableStatistics* report );
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__TableStatistics__) */
@@ -41,7 +41,19 @@ com_VFSFilter0::start(
     
     //__asm__ volatile( "int $0x3" );
     
-    VNodeMap::Init();
+    if( ! RecursionEngine::Init() ){
+        
+        DBG_PRINT_ERROR( ( "RecursionEngine::Init() failed\n" ) );
+        goto __exit_on_error;
+    }
+    
+    if( ! VNodeMap::Init() ){
+        
+        DBG_PRINT_ERROR( ( "VNodeMap::Init() failed\n" ) );
+        goto __exit_on_error;
+    }
+    
+    QvrVnodeHookInit();
     
     if( kIOReturnSuccess != VFSHookInit() ){
         
@@ -49,7 +61,7 @@ com_VFSFilter0::start(
         goto __exit_on_error;
     }
     
-    if( ! QvrVnodeHooksHashTable::CreateStaticTableWithSize( 8, true ) ){
+    if( ! QvrVnodeHooksHashTable::CreateStaticTableWithSize( QvrVnodeHooksHashTable::EstimateStaticTableSize(), true ) ){
         
         DBG_PRINT_ERROR( ( "QvrVnodeHooksHashTable::CreateStaticTableWithSize() failed\n" ) );
         goto __exit_on_error;
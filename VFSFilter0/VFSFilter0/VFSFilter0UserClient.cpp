@@ -10,6 +10,9 @@
 #include "VFSFilter0UserClient.h"
 #include "VNode.h"
 #include "WaitingList.h"
+#include "RecursionEngine.h"
+#include "VNodeHook.h"
+#include "VopStatistics.h"
 
 //--------------------------------------------------------------------
 
@@ -42,14 +45,31 @@ static const IOExternalMethod sMethods[kt_kVnodeWatcherUserClientNMethods] =
         kIOUCVariableStructureSize,
         kIOUCVariableStructureSize
     },
+    { // kt_kVnodeWatcherUserClientGetStatistics
+        NULL,
+        (IOMethod)&VFSFilter0UserClient::getStatistics,
+        kIOUCStructIStructO,
+        kIOUCVariableStructureSize,
+        kIOUCVariableStructureSize
+    },
+    { // kt_kVnodeWatcherUserClientGetVopStatistics
+        NULL,
+        (IOMethod)&VFSFilter0UserClient::getVopStatistics,
+        kIOUCStructIStructO,
+        sizeof( int32_t ),
+        kIOUCVariableStructureSize
+    },
+    { // kt_kVnodeWatcherUserClientEnableVopStatistics
+        NULL,
+        (IOMethod)&VFSFilter0UserClient::enableVopStatistics,
+        kIOUCScalarIScalarO,
+        1,
+        0
+    },
 };
 
 //--------------------------------------------------------------------
 
-DataMap    gPreOperationDataMap;
-
-//--------------------------------------------------------------------
-
 enum { kt_kMaximumEventsToHold = 512 };
 
 //--------------------------------------------------------------------
@@ -78,8 +98,6 @@ VFSFilter0UserClient::start(IOService *provider)
         return false;
     }
     
-    fProvider->registerUserClient( this );
-    
     return true;
 }
 
@@ -118,6 +136,20 @@ VFSFilter0UserClient::open(void)
     if (!fProvider->open(this))
         return kIOReturnExclusiveAccess; // only one user client allowed
     
+    //
+    // only an opened client receives the filter's requests, a client
+    // that just reads the statistics is not registered and can coexist
+    // with the opened one
+    //
+    IOReturn  RC = fProvider->registerUserClient( this );
+    if( kIOReturnSuccess != RC ){
+        
+        fProvider->close(this);
+        return RC;
+    }
+    
+    fRegistered = true;
+    
     return startLogging();
 }
 
@@ -143,12 +175,28 @@ VFSFilter0UserClient::close(void)
     if (!fProvider)
         return kIOReturnNotAttached;
     
+    //
+    // a client that has not been opened owns neither the provider nor the vnode references
+    //
+    if (!fRegistered)
+        return kIOReturnSuccess;
+    
+    fRegistered = false;
+    
     //
     // release all vnodes to avoid stalling on system shutdown when the system
     // waits for vnode iocount drops to zero on unmount
     //
-    VNodeMap::releaseAllVnodeIO();
-    VNodeMap::releaseAllShadowReverse();
+    QvrVnodeReleaseReport  report;
+    
+    VNodeMap::releaseAllReferences( QvrVnodeInfoIORef | QvrVnodeInfoShadowReverseRef, &report );
+    
+    //
+    // the release is done once per client, its cost is logged in all builds
+    //
+    IOLog( "VFSFilter0: released %u vnode references and %u records in %llu ns, %u passes\n",
+           (unsigned int)report.references, (unsigned int)report.records,
+           (unsigned long long)report.durationNs, (unsigned int)report.passes );
     
     fProvider->unregisterUserClient( this );
     
@@ -168,9 +216,31 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
 {
     assert( preemption_enabled() );
     
-    VFSData    data;
-    void*      id = &data;
-    bool       insertedInPreOperationDataMap = false;
+    VFSData       data;
+    QvrWaitBlock  waitBlock;
+    
+    //
+    // enter in the waiting list, the block's id is sent to a client
+    // that returns it with a reply, the reply is applied to inData
+    // by the waiting list's callback
+    //
+    if( ! gFileOpenWaitingList.enter( &waitBlock, inData ) ){
+        
+        //
+        // there will be no reply, the file is not controlled
+        //
+        if( VFSOpcode_Filter == inData->op ){
+            
+            inData->Parameters.Filter.out.isControlledFile = false;
+#if	MACH_ASSERT
+            inData->Parameters.Filter.out.noClient = true;
+#endif // DBG
+        }
+        
+        return;
+    }
+    
+    int64_t    id = (int64_t)waitBlock.id;
     
     switch( inData->op ){
             
@@ -188,7 +258,7 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
             VFSInitData( &data, VFSDataType_PreOperationCallback );
             
             data.Data.PreOperationCallback.op = VFSOpcode_Lookup;
-            data.Data.PreOperationCallback.id = (int64_t)id;
+            data.Data.PreOperationCallback.id = id;
             data.Data.PreOperationCallback.Parameters.Lookup.path = pathToLookup;
             data.Data.PreOperationCallback.Parameters.Lookup.redirectedPath = redirectedFilePath;
             data.Data.PreOperationCallback.Parameters.Lookup.shadowFilePath = shadowFilePath;
@@ -206,7 +276,7 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
             VFSInitData( &data, VFSDataType_PreOperationCallback );
             
             data.Data.PreOperationCallback.op = VFSOpcode_Rename;
-            data.Data.PreOperationCallback.id = (int64_t)id;
+            data.Data.PreOperationCallback.id = id;
             data.Data.PreOperationCallback.Parameters.Rename.from = inData->Parameters.Rename.from;
             data.Data.PreOperationCallback.Parameters.Rename.to   = inData->Parameters.Rename.to;
             
@@ -222,7 +292,7 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
             VFSInitData( &data, VFSDataType_PreOperationCallback );
             
             data.Data.PreOperationCallback.op = VFSOpcode_Exchange;
-            data.Data.PreOperationCallback.id = (int64_t)id;
+            data.Data.PreOperationCallback.id = id;
             data.Data.PreOperationCallback.Parameters.Exchange.from = inData->Parameters.Exchange.from;
             data.Data.PreOperationCallback.Parameters.Exchange.to   = inData->Parameters.Exchange.to;
             
@@ -238,15 +308,10 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
             VFSInitData( &data, VFSDataType_PreOperationCallback );
             
             data.Data.PreOperationCallback.op = VFSOpcode_Filter;
-            data.Data.PreOperationCallback.id = (int64_t)id;
+            data.Data.PreOperationCallback.id = id;
             data.Data.PreOperationCallback.Parameters.Filter.op   = inData->Parameters.Filter.in.op;
             data.Data.PreOperationCallback.Parameters.Filter.path = inData->Parameters.Filter.in.path;
             
-            insertedInPreOperationDataMap = gPreOperationDataMap.addDataByKey( id, inData );
-            assert( insertedInPreOperationDataMap );
-            if( ! insertedInPreOperationDataMap )
-                inData->Parameters.Filter.out.isControlledFile = false;
-            
             break;
         }
             
@@ -256,36 +321,23 @@ VFSFilter0UserClient::preOperationCallbackAndWaitForReply(
     }
     
     //
-    // enter in the waiting list
+    // notify a user client
     //
-    if( gFileOpenWaitingList.enter( id ) ){
+    this->sendVFSDataToClient( &data );
+    
+    if( data.Status.WasEnqueued ){
         
         //
-        // notify a user client
+        // wait for a client response
         //
-        this->sendVFSDataToClient( &data );
+        gFileOpenWaitingList.wait( &waitBlock );
         
-        if( data.Status.WasEnqueued ){
-            
-            //
-            // wait for a client response
-            //
-            gFileOpenWaitingList.wait( id );
-            
-        } else {
-            
-            //
-            // just remove the waiting entry by signalling it
-            //
-            gFileOpenWaitingList.signal( id );
-        }
-    } // end if( gFileOpenWaitingList.enter
-    
-    if( insertedInPreOperationDataMap ){
+    } else {
         
-        gPreOperationDataMap.removeKey( id );
-        assert( NULL == gPreOperationDataMap.getDataByKey( id ) );
-        insertedInPreOperationDataMap = false;
+        //
+        // just remove the waiting entry
+        //
+        gFileOpenWaitingList.leave( &waitBlock );
     }
 }
 
@@ -313,6 +365,39 @@ QvrPreOperationCallbackAndWaitForReply(
 
 //--------------------------------------------------------------------
 
+static
+void
+QvrApplyClientReply(
+    __in void* blockContext, // QvrPreOperationCallback
+    __in void* signalContext // VFSClientReply
+    )
+/*
+ called by the waiting list before waking up a waiting thread,
+ the inData is valid as the thread can't return before being woken up
+ */
+{
+    QvrPreOperationCallback*  inData = (QvrPreOperationCallback*)blockContext;
+    VFSClientReply*           reply = (VFSClientReply*)signalContext;
+    
+    //
+    // we are waiting for some decision made by the daemon
+    //
+    switch( inData->op )
+    {
+        case VFSOpcode_Filter:
+            inData->Parameters.Filter.out.isControlledFile = ( 0x0 != reply->Data.Filter.isControlledFile );
+#if	MACH_ASSERT
+            inData->Parameters.Filter.out.replyWasReceived = true;
+#endif // MACH_ASSERT
+            break;
+            
+        default:
+            break;
+    } // end switch
+}
+
+//--------------------------------------------------------------------
+
 IOReturn
 VFSFilter0UserClient::reply(
                             __in  void *vInBuffer, //VFSClientReply
@@ -334,40 +419,98 @@ VFSFilter0UserClient::reply(
         return kIOReturnBadArgument;
     
     //
-    // it is safe to use a value returned by getDataByKey as it will not be deleted untill a corresponding event
-    // is set to a signal state
+    // apply the reply and wakeup a waiting thread, a stale or a duplicate
+    // reply doesn't find a waiting thread
     //
-    QvrPreOperationCallback* inData = (QvrPreOperationCallback*)gPreOperationDataMap.getDataByKey( (void*)reply->id );
-    if( inData ){
+    if( ! gFileOpenWaitingList.signal( (UInt64)reply->id, QvrApplyClientReply, reply ) ){
         
-        //
-        // we are waiting for some decision made by the daemon
-        //
-        switch( inData->op )
-        {
-            case VFSOpcode_Filter:
-                inData->Parameters.Filter.out.isControlledFile = ( 0x0 != reply->Data.Filter.isControlledFile );
-#if	MACH_ASSERT
-                inData->Parameters.Filter.out.replyWasReceived = true;
-#endif // MACH_ASSERT
-                break;
-                
-            default:
-                break;
-        } // end switch
+        DBG_PRINT_ERROR(( "a reply with a stale id 0x%llx\n", (unsigned long long)reply->id ));
+        RC = kIOReturnNotFound;
     }
     
-    //
-    // invalidate the pointer before signalling a waiting thread that will deallocate the memory
-    //
-    inData = NULL;
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+VFSFilter0UserClient::getStatistics(
+                            __in  void *vInBuffer,
+                            __out void *vOutBuffer, //VFSFilter0Statistics
+                            __in  void *vInSize,
+                            __in  void *vOutSizeP,
+                            void *, void *)
+{
+    VFSFilter0Statistics*  statistics = (VFSFilter0Statistics*)vOutBuffer;
+    IOByteCount*           outSizeP = (IOByteCount*)vOutSizeP;
     
+    if( *outSizeP < sizeof( *statistics ) )
+        return kIOReturnBadArgument;
+    
+    bzero( statistics, sizeof( *statistics ) );
+    
+    statistics->Version     = VFS_STATISTICS_VER;
+    statistics->TablesCount = VFSTable_Count;
+    
+    RecursionEngine::GetOverflowMapStatistics( &statistics->Tables[ VFSTable_RecursionOverflowMap ] );
+    QvrVnodeHooksHashTable::GetStaticTableStatistics( &statistics->Tables[ VFSTable_VnodeHooks ] );
+    
+    *outSizeP = sizeof( *statistics );
+    
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+VFSFilter0UserClient::getVopStatistics(
+                            __in  void *vInBuffer, //int32_t
+                            __out void *vOutBuffer, //VFSFilter0VopStatistics
+                            __in  void *vInSize,
+                            __in  void *vOutSizeP,
+                            void *, void *)
+{
+    VFSFilter0VopStatistics*  statistics = (VFSFilter0VopStatistics*)vOutBuffer;
+    IOByteCount*              outSizeP = (IOByteCount*)vOutSizeP;
+    int32_t                   vop = *(int32_t*)vInBuffer;
+    
+    if( *outSizeP < sizeof( *statistics ) )
+        return kIOReturnBadArgument;
+    
+    bzero( statistics, sizeof( *statistics ) );
+    
+    statistics->Version   = VFS_VOP_STATISTICS_VER;
+    statistics->Enabled   = QvrVopStatistics::IsEnabled() ? 0x1 : 0x0;
+    statistics->VopsCount = QvrHookedVop_Max;
+    statistics->Vop       = vop;
+    
+    if( ! QvrVopStatistics::GetReport( vop, &statistics->Statistics ) )
+        return kIOReturnBadArgument;
+    
+    *outSizeP = sizeof( *statistics );
+    
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+VFSFilter0UserClient::enableVopStatistics(
+                            __in void *vEnable,
+                            void *, void *, void *, void *, void *)
+{
     //
-    // wakeup a waiting thread
+    // the collection slows down the file system for all processes
     //
-    gFileOpenWaitingList.signal( (void*)reply->id );
+    if( kIOReturnSuccess != clientHasPrivilege( fClient, kIOClientPrivilegeAdministrator ) )
+        return kIOReturnNotPrivileged;
     
-    return RC;
+#if QVR_VOP_STATISTICS
+    QvrVopStatistics::Enable( 0x0 != (uintptr_t)vEnable );
+    return kIOReturnSuccess;
+#else
+    return kIOReturnUnsupported;
+#endif
 }
 
 //--------------------------------------------------------------------
@@ -421,6 +564,7 @@ VFSFilter0UserClient::initWithTask(task_t owningTask, void *securityID, UInt32 t
     fClient = owningTask;
     fClientProc = current_proc();
     fProvider = NULL;
+    fRegistered = false;
     fDataQueue = NULL;
     fSharedMemory = NULL;
     
@@ -484,6 +628,9 @@ VFSFilter0UserClient::getTargetAndMethodForIndex(IOService **target, UInt32 inde
         case kt_kVnodeWatcherUserClientOpen:
         case kt_kVnodeWatcherUserClientClose:
         case kt_kVnodeWatcherUserClientReply:
+        case kt_kVnodeWatcherUserClientGetStatistics:
+        case kt_kVnodeWatcherUserClientGetVopStatistics:
+        case kt_kVnodeWatcherUserClientEnableVopStatistics:
             *target = this;
             break;
             
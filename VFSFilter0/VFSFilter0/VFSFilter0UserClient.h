@@ -158,6 +158,7 @@ private:
     task_t                           fClient;
     proc_t                           fClientProc;
     com_VFSFilter0*           fProvider;
+    bool                             fRegistered; // open() has registered the client with the provider
     IODataQueue*                     fDataQueue;
     IOMemoryDescriptor*              fSharedMemory;
     kauth_listener_t                 fListener;
@@ -194,6 +195,21 @@ public:
                             __in  void *vOutSizeP,
                            void *, void *);
     
+    virtual IOReturn getStatistics( __in  void *vInBuffer,
+                                    __out void *vOutBuffer, //VFSFilter0Statistics
+                                    __in  void *vInSize,
+                                    __in  void *vOutSizeP,
+                                    void *, void *);
+    
+    virtual IOReturn getVopStatistics( __in  void *vInBuffer, //int32_t
+                                       __out void *vOutBuffer, //VFSFilter0VopStatistics
+                                       __in  void *vInSize,
+                                       __in  void *vOutSizeP,
+                                       void *, void *);
+    
+    virtual IOReturn enableVopStatistics( __in void *vEnable,
+                                          void *, void *, void *, void *, void *);
+    
     virtual proc_t   getProc(){ return fClientProc; }
 };
 
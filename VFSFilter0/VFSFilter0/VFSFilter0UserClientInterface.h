@@ -142,10 +142,114 @@ extern "C" {
     
     //--------------------------------------------------------------------
 
+    #define  VFS_STATISTICS_VER   0x4
+    
+    //
+    // the size of VFSTableStatistics::chainLengths
+    //
+    #define  VFS_CHAIN_LENGTHS    0x8
+    
+    typedef enum {
+        VFSTable_RecursionOverflowMap = 0,
+        VFSTable_VnodeHooks,
+        
+        VFSTable_Count // a number of tables, must be the last member of the enum
+    } VFSTable;
+    
+    //
+    // the counters are accumulated from the driver start,
+    // lookupProbes/lookups is an average chain length
+    //
+    typedef struct _VFSTableStatistics{
+        uint64_t    entries;
+        uint64_t    buckets;
+        uint64_t    lookups;
+        uint64_t    lookupProbes;
+        uint64_t    maxProbes;
+        uint64_t    lockAcquisitions;
+        uint64_t    lockWaitNs;
+        uint64_t    rehashes;
+        uint64_t    misses;     // lookups - misses is the number of hits
+        uint64_t    evictions;  // entries evicted by a table in the cache mode
+        
+        //
+        // the wired memory used by the table, keyBytes is not added to the
+        // total as the keys are stored in the buckets or in the entries
+        //
+        uint64_t    bucketBytes;
+        uint64_t    entryBytes;
+        uint64_t    keyBytes;
+        
+        //
+        // chainLengths[ i ] is the number of buckets with i entries, the last
+        // element counts the buckets with VFS_CHAIN_LENGTHS-1 or more entries,
+        // for an open addressing table it is the number of entries found with
+        // i+1 probes and chainLengths[ 0 ] is the number of empty slots,
+        // the lengths are zero if a table doesn't report them
+        //
+        uint64_t    maxChain;
+        uint64_t    chainLengths[ VFS_CHAIN_LENGTHS ];
+    } VFSTableStatistics;
+    
+    typedef struct _VFSFilter0Statistics{
+        int32_t               Version; // VFS_STATISTICS_VER
+        int32_t               TablesCount;
+        VFSTableStatistics    Tables[ VFSTable_Count ];
+    } VFSFilter0Statistics;
+    
+    //--------------------------------------------------------------------
+
+    #define  VFS_VOP_STATISTICS_VER   0x1
+    
+    //
+    // the sizes of VFSVopStatistics::name and the latency histograms,
+    // latency[ 0 ] counts the calls that took less than 2^VFS_LATENCY_SHIFT ns,
+    // latency[ i ] counts the calls that took [2^(i+VFS_LATENCY_SHIFT-1), 2^(i+VFS_LATENCY_SHIFT)) ns,
+    // the last element also counts all longer calls
+    //
+    #define  VFS_VOP_NAME_LENGTH   0x10
+    #define  VFS_LATENCY_BUCKETS   0x18
+    #define  VFS_LATENCY_SHIFT     0x7
+    
+    //
+    // the counters for a hooked VOP accumulated since the statistics collection
+    // was enabled, the time of a call is split into the time spent in the
+    // original VOP function and the rest which is the filter overhead, the
+    // filter overhead includes the nested calls to the hooked VOPs made by the filter,
+    // originalLatency counts only the calls that have called the original function
+    //
+    typedef struct _VFSVopStatistics{
+        char        name[ VFS_VOP_NAME_LENGTH ];
+        uint64_t    calls;
+        uint64_t    originalCalls;
+        uint64_t    filterNs;
+        uint64_t    originalNs;
+        uint64_t    filterLatency[ VFS_LATENCY_BUCKETS ];
+        uint64_t    originalLatency[ VFS_LATENCY_BUCKETS ];
+    } VFSVopStatistics;
+    
+    //
+    // a report for a single VOP, the whole set doesn't fit in the structure
+    // size limit for a call, a client requests the VOPs one by one
+    // with indices from 0 to VopsCount-1
+    //
+    typedef struct _VFSFilter0VopStatistics{
+        int32_t             Version;   // VFS_VOP_STATISTICS_VER
+        int32_t             Enabled;   // a bool value {0,1}
+        int32_t             VopsCount; // the number of the hooked VOPs
+        int32_t             Vop;       // the index of the reported VOP
+        VFSVopStatistics    Statistics;
+    } VFSFilter0VopStatistics;
+    
+    //--------------------------------------------------------------------
+
     enum {
         kt_kVnodeWatcherUserClientOpen,
         kt_kVnodeWatcherUserClientClose,
         kt_kVnodeWatcherUserClientReply,
+        kt_kVnodeWatcherUserClientGetStatistics,
+        kt_kVnodeWatcherUserClientGetVopStatistics,    // the input is an int32_t VOP index, the output is VFSFilter0VopStatistics
+        kt_kVnodeWatcherUserClientEnableVopStatistics, // a scalar input, 0 disables the collection, other values enable it and reset the counters
         
         kt_kVnodeWatcherUserClientNMethods,// the number of methods available to a client
         kt_kStopListeningToMessages = 0xff,
@@ -29,6 +29,7 @@ extern "C" {
 #include "VNodeHook.h"
 #include "VersionDependent.h"
 #include "ApplicationsData.h"
+#include "ObjectPool.h"
 
 //--------------------------------------------------------------------
 
@@ -37,6 +38,46 @@ static bool gRedirectionIsNullAndVoid = false; // TEST
 
 //--------------------------------------------------------------------
 
+//
+// the path buffers are allocated on every redirected lookup, create, rename
+// and exchange, the size covers a full path appended to a redirection directory
+//
+#define QVR_PATH_BUFFER_SIZE   ( 2*MAXPATHLEN )
+
+static QvrObjectPool  gPathBuffersPool( QVR_PATH_BUFFER_SIZE, 32 );
+
+//--------------------------------------------------------------------
+
+static
+void*
+QvrAllocatePathBuffer(
+    __in vm_size_t size
+    )
+/*
+ the buffer must be freed by QvrFreePathBuffer with the same size
+ */
+{
+    if( size <= QVR_PATH_BUFFER_SIZE )
+        return gPathBuffersPool.allocate();
+    
+    return IOMalloc( size );
+}
+
+static
+void
+QvrFreePathBuffer(
+    __in void*     buffer,
+    __in vm_size_t size
+    )
+{
+    if( size <= QVR_PATH_BUFFER_SIZE )
+        gPathBuffersPool.free( buffer );
+    else
+        IOFree( buffer, size );
+}
+
+//--------------------------------------------------------------------
+
 errno_t
 QvrReadInCacheFromBackingFile(
                               __in vnode_t  vnode,
@@ -88,7 +129,7 @@ QvrConvertToShadowCopyPath(
     shadowPathLen = pathLen + prefixLen;
     shadowPathSize = shadowPathLen + sizeof('\0');
     
-    shadowPath = (char*)IOMalloc( shadowPathSize );
+    shadowPath = (char*)QvrAllocatePathBuffer( shadowPathSize );
     assert( shadowPath );
     if( ! shadowPath )
         return ENOMEM;
@@ -148,7 +189,7 @@ QvrFreeShadowPath(
     __in size_t  shadowPathSize
     )
 {
-    IOFree( shadowPath, shadowPathSize );
+    QvrFreePathBuffer( shadowPath, shadowPathSize );
 }
 
 //--------------------------------------------------------------------
@@ -185,7 +226,7 @@ QvrConvertToRedirectedPath(
     bool         slashRequired = ( 0 == prefixLength || file[0] == '/' || file[0] == '\0') ?  false : true;
     size_t       slashLength = (slashRequired ? sizeof('/') : 0);
     vm_size_t    nameBufferSize = prefixLength + slashLength + strlen(file) + sizeof(L'\0');
-    char*        redirectedFilePath = (char*)IOMalloc( nameBufferSize );
+    char*        redirectedFilePath = (char*)QvrAllocatePathBuffer( nameBufferSize );
     
     assert( redirectedFilePath );
     if( ! redirectedFilePath )
@@ -248,7 +289,7 @@ QvrFreeRedirectedPath(
     __in size_t  nameBufferSize
     )
 {
-    IOFree( redirectedFilePath, nameBufferSize );
+    QvrFreePathBuffer( redirectedFilePath, nameBufferSize );
 }
 
 //--------------------------------------------------------------------
@@ -318,7 +359,7 @@ QvrGetBackingVnodeForRedirectedIO(
             goto __exit;
     }
     
-    vnodePath = (char*)IOMalloc( MAXPATHLEN );
+    vnodePath = (char*)QvrAllocatePathBuffer( MAXPATHLEN );
     assert( vnodePath );
     if( ! vnodePath )
         goto __exit;
@@ -387,11 +428,36 @@ __exit:
         QvrFreeRedirectedPath( redirectedFilePath, nameBufferSize );
     
     if( vnodePath )
-        IOFree( vnodePath, MAXPATHLEN );
+        QvrFreePathBuffer( vnodePath, MAXPATHLEN );
     
     return backingVnode;
 }
 
+//--------------------------------------------------------------------
+
+static
+vnode_t
+QvrGetBackingVnodeForRedirectedIOByInfo(
+    __in vnode_t       vn,
+    __inout QvrVnodeInfo* vnodeInfo
+    )
+/*
+ the function takes over the vnodeIO reference returned by VNodeMap::getVnodeInfo
+ so the backing vnode is looked up only if it has not been associated yet,
+ a caller must release the returned vnode with vnode_put()
+ */
+{
+    vnode_t   backingVnode = vnodeInfo->vnodeIO;
+    
+    if( backingVnode ){
+        
+        vnodeInfo->vnodeIO = NULLVP;
+        return backingVnode;
+    }
+    
+    return QvrGetBackingVnodeForRedirectedIO( vn, vnodeInfo->appData, false );
+}
+
 void
 QvrAssociateVnodeForRedirectedIO(
     __in vnode_t                vn,
@@ -413,7 +479,8 @@ QvrAssociateVnodeForRedirectedIO(
 
 int
 QvrVnopLookupHookEx2(
-    __inout struct vnop_lookup_args *ap
+    __inout struct vnop_lookup_args *ap,
+    __in QvrVopOriginal< struct vnop_lookup_args >& origVnop
     )
 /*
  struct vnop_lookup_args {
@@ -425,11 +492,6 @@ QvrVnopLookupHookEx2(
  } *ap)
  */
 {
-    int (*origVnop)(struct vnop_lookup_args *ap);
-    
-    origVnop = (int (*)(struct vnop_lookup_args*))QvrGetOriginalVnodeOp( ap->a_dvp, QvrVopEnum_lookup );
-    assert( origVnop );
-    
     //
     // the logic is as follows
     // - get an application data for ADT_CreateNew to know whether redirectIO might be employed
@@ -1088,7 +1150,8 @@ __exit:
  */
 int
 QvrVnopCreateHookEx2(
-    __inout struct vnop_create_args *ap
+    __inout struct vnop_create_args *ap,
+    __in QvrVopOriginal< struct vnop_create_args >& origVnop
     )
 
 /*
@@ -1109,18 +1172,13 @@ QvrVnopCreateHookEx2(
     char*       redirectedShadowPath = NULL;
     vm_size_t   redirectedShadowPathSize;
     
-    int (*origVnop)(struct vnop_create_args *ap);
-    
-    origVnop = (int (*)(struct vnop_create_args*))QvrGetOriginalVnodeOp( ap->a_dvp, QvrVopEnum_create );
-    assert( origVnop );
-    
     const ApplicationData* appData = QvrGetApplicationDataByContext( ap->a_context, ADT_CreateNew );
     
     if( appData ){
         //__asm__ volatile( "int $0x3" );
     }
     
-    if( !appData || RecursionEngine::IsRecursiveCall() || IsUserClient() )
+    if( !appData )
         return origVnop( ap );
 
     {
@@ -1329,7 +1387,7 @@ __exit:
 //--------------------------------------------------------------------
 
 int
-QvrVnopCloseHookEx2(struct vnop_close_args *ap)
+QvrVnopCloseHookEx2(struct vnop_close_args *ap, QvrVopOriginal< struct vnop_close_args >& origVnop)
 /*
  struct vnop_close_args {
  struct vnodeop_desc *a_desc;
@@ -1339,11 +1397,6 @@ QvrVnopCloseHookEx2(struct vnop_close_args *ap)
  } *ap;
  */
 {
-    int (*origVnop)(struct vnop_close_args *ap);
-    
-    origVnop = (int (*)(struct vnop_close_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_close );
-    assert( origVnop );
-
     vnode_t vnodeIO = VNodeMap::getVnodeIORef( ap->a_vp );
     if( vnodeIO ){
         
@@ -1364,7 +1417,7 @@ QvrVnopCloseHookEx2(struct vnop_close_args *ap)
 //--------------------------------------------------------------------
 
 int
-QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap)
+QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap, QvrVopOriginal< struct vnop_inactive_args >& origVnop)
 /*
  struct vnop_inactive_args {
  struct vnodeop_desc *a_desc;
@@ -1373,12 +1426,11 @@ QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap)
  } *ap;
  */
 {
-    int (*origVnop)(struct vnop_inactive_args *ap);
-    
-    origVnop = (int (*)(struct vnop_inactive_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_inactive );
-    assert( origVnop );
-    
-    vnode_t vnodeIO = VNodeMap::getVnodeIORef( ap->a_vp );
+    //
+    // remove an association with vnodeIO on close to avoid stalling on vnode with nonzero iocount on unmount,
+    // the map's reference is transferred to this function
+    //
+    vnode_t vnodeIO = VNodeMap::detachVnodeIO( ap->a_vp );
     if( vnodeIO ){
         
         //
@@ -1394,9 +1446,6 @@ QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap)
         //
         vnode_recycle( vnodeIO );
         
-        //
-        // remove an association with vnodeIO on close to avoid stalling on vnode with nonzero iocount on unmount
-        //
         /*
          FYI a stack when unmount waits for vnode's iocount dropping to zero
          0xffffff80cab7ba60 0xffffff802e01a30f machine_switch_context((thread_t) old = 0xffffff803acd6000, (thread_continue_t) continuation = 0x0000000000000000, (thread_t) new = 0xffffff803936c2a0)
@@ -1414,7 +1463,6 @@ QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap)
          0xffffff80cab7bf50 0xffffff802e3e9799 reboot((proc *) p = <>, , (reboot_args *) uap = 0xffffff803ac908c0, (int32_t *) retval = <>, )
          0xffffff80cab7bfb0 0xffffff802e44dcb2 unix_syscall64((x86_saved_state_t *) state = 0xffffff803acebd40)
          */
-        VNodeMap::removeVnodeIO( ap->a_vp );
         
         vnode_put( vnodeIO );
     }
@@ -1427,7 +1475,8 @@ QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap)
 
 int
 QvrVnopReadHookEx2(
-    __in struct vnop_read_args *ap
+    __in struct vnop_read_args *ap,
+    __in QvrVopOriginal< struct vnop_read_args >& origVnop
     )
 /*
  struct vnop_read_args {
@@ -1442,12 +1491,17 @@ QvrVnopReadHookEx2(
         
     int                error = ENODATA;
     bool               callOriginal = true;
-
+    bool               isRedirectable = !RecursionEngine::IsRecursiveCall() && !IsUserClient();
+    QvrVnodeInfo       vnodeInfo;
     
+    //
+    // a single lookup returns both the application data and the backing vnode
+    //
+    VNodeMap::getVnodeInfo( ap->a_vp, &vnodeInfo, isRedirectable ? QvrVnodeInfoIORef : 0x0 );
     
-    const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_vp );
+    const ApplicationData* appData = vnodeInfo.appData;
     
-    if( appData && !RecursionEngine::IsRecursiveCall() && !IsUserClient() ){
+    if( appData && isRedirectable ){
         
             //
             // just audit, a recursive entries are possible if
@@ -1459,7 +1513,7 @@ QvrVnopReadHookEx2(
             audit.Data.Audit.vn = ap->a_vp;
             gVnodeGate->sendVFSDataToClient( &audit );
             
-            vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIO( ap->a_vp, appData, false );
+            vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIOByInfo( ap->a_vp, &vnodeInfo );
             if( vnodeIO ){
                 
                 callOriginal = false;
@@ -1467,7 +1521,7 @@ QvrVnopReadHookEx2(
                 vnop_read_args  apIO = *ap;
                 apIO.a_vp = vnodeIO;
                 
-                VOPFUNC  backingVnop = QvrGetVnop( apIO.a_vp, &vnop_read_desc );
+                VOPFUNC  backingVnop = QvrGetVnodeOpByIndex( apIO.a_vp, QvrVopEnum_read );
                 assert( backingVnop );
                 
                 RecursionEngine::EnterRecursiveCall( current_thread() );
@@ -1482,14 +1536,11 @@ QvrVnopReadHookEx2(
     
     if( callOriginal ){
         
-        int (*origVnop)(struct vnop_read_args *ap);
-        
-        origVnop = (int (*)(struct vnop_read_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_read );
-        assert( origVnop );
-        
         error = origVnop( ap );
     }
     
+    VNodeMap::putVnodeInfo( &vnodeInfo );
+    
     return error;
 }
 
@@ -1513,7 +1564,8 @@ The goal of the following method is to retrieve information about the last edite
 **/
 int
 QvrVnopOpenHookEx2(
-                   __in struct vnop_open_args *ap
+                   __in struct vnop_open_args *ap,
+                   __in QvrVopOriginal< struct vnop_open_args >& origVnop
                    )
 /*
  struct vnop_open_args {
@@ -1559,11 +1611,6 @@ QvrVnopOpenHookEx2(
     
 exit:
         
-    int (*origVnop)(struct vnop_open_args *ap);
-    
-    origVnop = (int (*)(struct vnop_open_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_open );
-    assert( origVnop );
-    
     error = origVnop( ap );
     
     return error;
@@ -1665,7 +1712,8 @@ __exit_upl:
 
 int
 QvrVnopPageinHookEx2(
-                  __in struct vnop_pagein_args *ap
+                  __in struct vnop_pagein_args *ap,
+                  __in QvrVopOriginal< struct vnop_pagein_args >& origVnop
                   )
 /*
  struct vnop_pagein_args {
@@ -1682,9 +1730,16 @@ QvrVnopPageinHookEx2(
 {
     int                error = ENODATA;
     bool               isRecursiveCall = RecursionEngine::IsRecursiveCall();
+    bool               isUserClient = IsUserClient();
     bool               callOriginal;
+    QvrVnodeInfo       vnodeInfo;
     
-    const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_vp );
+    //
+    // a single lookup returns both the application data and the backing vnode
+    //
+    VNodeMap::getVnodeInfo( ap->a_vp, &vnodeInfo, ( isRecursiveCall || isUserClient ) ? 0x0 : QvrVnodeInfoIORef );
+    
+    const ApplicationData* appData = vnodeInfo.appData;
     
     //
     // Call original if a vnode is not tracked, IO is redirected or
@@ -1696,15 +1751,10 @@ QvrVnopPageinHookEx2(
     // see below comment, processing via original vnop_pagein results in a call to
     // cluster_pagein that does all required work to please vm_fault_page
     //
-    callOriginal = !appData || appData->redirectIO || isRecursiveCall || IsUserClient();
+    callOriginal = !appData || appData->redirectIO || isRecursiveCall || isUserClient;
     
     if( callOriginal ){
         
-        int (*origVnop)(struct vnop_pagein_args *ap);
-        
-        origVnop = (int (*)(struct vnop_pagein_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_pagein );
-        assert( origVnop );
-        
         error = origVnop( ap );
         
     } else {
@@ -1713,8 +1763,11 @@ QvrVnopPageinHookEx2(
         error = 0;
     }
     
-    if( error || isRecursiveCall || IsUserClient() )
+    if( error || isRecursiveCall || isUserClient ){
+        
+        VNodeMap::putVnodeInfo( &vnodeInfo );
         return error;
+    }
     
     if( appData ){
         
@@ -1726,7 +1779,7 @@ QvrVnopPageinHookEx2(
         audit.Data.Audit.vn = ap->a_vp;
         gVnodeGate->sendVFSDataToClient( &audit );
         
-        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIO( ap->a_vp, appData, false );
+        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIOByInfo( ap->a_vp, &vnodeInfo );
         if( vnodeIO ){
             
             if( ! appData->redirectIO ){
@@ -1758,7 +1811,7 @@ QvrVnopPageinHookEx2(
                 vnop_pagein_args  apIO = *ap;
                 apIO.a_vp = vnodeIO;
                 
-                VOPFUNC  backingVnop = QvrGetVnop( apIO.a_vp, &vnop_pagein_desc );
+                VOPFUNC  backingVnop = QvrGetVnodeOpByIndex( apIO.a_vp, QvrVopEnum_pagein );
                 assert( backingVnop );
                 
                 bool isPageinV2 = ( 0x0 != ( QvrGetVnodeVfsFlags( vnodeIO ) & VFC_VFSVNOP_PAGEINV2 ) );
@@ -1830,6 +1883,8 @@ QvrVnopPageinHookEx2(
         
     } //  end if( appData
     
+    VNodeMap::putVnodeInfo( &vnodeInfo );
+    
     return error;
 }
 
@@ -1846,7 +1901,8 @@ QvrVnopPageinHookEx2(
  */
 int
 QvrVnopWriteHookEx2(
-    __in struct vnop_write_args *ap
+    __in struct vnop_write_args *ap,
+    __in QvrVopOriginal< struct vnop_write_args >& origVnop
     )
 /*
  struct vnop_write_args {
@@ -1861,10 +1917,17 @@ QvrVnopWriteHookEx2(
     int                error = ENODATA;
     bool               callOriginal = true;
     vnode_t            vnode = ap->a_vp;
+    bool               isRedirectable = !RecursionEngine::IsRecursiveCall() && !IsUserClient();
+    QvrVnodeInfo       vnodeInfo;
+    
+    //
+    // a single lookup returns both the application data and the backing vnode
+    //
+    VNodeMap::getVnodeInfo( ap->a_vp, &vnodeInfo, isRedirectable ? QvrVnodeInfoIORef : 0x0 );
     
-    const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_vp );
+    const ApplicationData* appData = vnodeInfo.appData;
     
-    if( appData && !RecursionEngine::IsRecursiveCall() && !IsUserClient() ){
+    if( appData && isRedirectable ){
         
         VFSData audit;
         VFSInitData( &audit, VFSDataType_Audit );
@@ -1872,7 +1935,7 @@ QvrVnopWriteHookEx2(
         audit.Data.Audit.vn = ap->a_vp;
         gVnodeGate->sendVFSDataToClient( &audit );
         
-        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIO( ap->a_vp, appData, false );
+        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIOByInfo( ap->a_vp, &vnodeInfo );
         if( vnodeIO ){
             
             callOriginal = false;
@@ -1881,7 +1944,7 @@ QvrVnopWriteHookEx2(
             apIO.a_vp = vnodeIO;
             apIO.a_context = gSuperUserContext;
             
-            VOPFUNC  backingVnop = QvrGetVnop( apIO.a_vp, &vnop_write_desc );
+            VOPFUNC  backingVnop = QvrGetVnodeOpByIndex( apIO.a_vp, QvrVopEnum_write );
             assert( backingVnop );
             
             RecursionEngine::EnterRecursiveCall( current_thread() );
@@ -1899,14 +1962,11 @@ QvrVnopWriteHookEx2(
     
     if( callOriginal ){
         
-        int (*origVnop)(struct vnop_write_args *ap);
-        
-        origVnop = (int (*)(struct vnop_write_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_write );
-        assert( origVnop );
-        
         error = origVnop( ap );
     }
     
+    VNodeMap::putVnodeInfo( &vnodeInfo );
+    
     return error;
 }
 
@@ -1914,7 +1974,8 @@ QvrVnopWriteHookEx2(
 
 int
 QvrVnopPageoutHookEx2(
-    __in struct vnop_pageout_args *ap
+    __in struct vnop_pageout_args *ap,
+    __in QvrVopOriginal< struct vnop_pageout_args >& origVnop
     )
 /*
  struct vnop_pageout_args {
@@ -1932,10 +1993,17 @@ QvrVnopPageoutHookEx2(
     int                error = ENODATA;
     bool               callOriginal = true;
     vnode_t            vnode = ap->a_vp;
+    bool               isRedirectable = !RecursionEngine::IsRecursiveCall() && !IsUserClient();
+    QvrVnodeInfo       vnodeInfo;
+    
+    //
+    // a single lookup returns both the application data and the backing vnode
+    //
+    VNodeMap::getVnodeInfo( ap->a_vp, &vnodeInfo, isRedirectable ? QvrVnodeInfoIORef : 0x0 );
     
-    const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_vp );
+    const ApplicationData* appData = vnodeInfo.appData;
     
-    if( appData && !RecursionEngine::IsRecursiveCall() && !IsUserClient() ){
+    if( appData && isRedirectable ){
         
         VFSData audit;
         VFSInitData( &audit, VFSDataType_Audit );
@@ -1943,7 +2011,7 @@ QvrVnopPageoutHookEx2(
         audit.Data.Audit.vn = ap->a_vp;
         gVnodeGate->sendVFSDataToClient( &audit );
         
-        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIO( ap->a_vp, appData, false );
+        vnode_t vnodeIO = QvrGetBackingVnodeForRedirectedIOByInfo( ap->a_vp, &vnodeInfo );
         if( vnodeIO ){
             
             callOriginal = false;
@@ -1952,7 +2020,7 @@ QvrVnopPageoutHookEx2(
             apIO.a_vp = vnodeIO;
             apIO.a_context = gSuperUserContext;
             
-            VOPFUNC  backingVnop = QvrGetVnop( apIO.a_vp, &vnop_pageout_desc );
+            VOPFUNC  backingVnop = QvrGetVnodeOpByIndex( apIO.a_vp, QvrVopEnum_pageout );
             assert( backingVnop );
             
             bool isPageoutV2 = ( 0x0 != ( QvrGetVnodeVfsFlags( vnodeIO ) & VFC_VFSVNOP_PAGEOUTV2 ) );
@@ -2098,14 +2166,11 @@ QvrVnopPageoutHookEx2(
     
     if( callOriginal ){
         
-        int (*origVnop)(struct vnop_pageout_args *ap);
-        
-        origVnop = (int (*)(struct vnop_pageout_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_pageout );
-        assert( origVnop );
-        
         origVnop( ap );
     }
     
+    VNodeMap::putVnodeInfo( &vnodeInfo );
+    
     return error;
 }
 
@@ -2122,7 +2187,8 @@ QvrVnopPageoutHookEx2(
  */
 int
 QvrVnopRenameHookEx2(
-                    __in struct vnop_rename_args *ap
+                    __in struct vnop_rename_args *ap,
+                    __in QvrVopOriginal< struct vnop_rename_args >& origVnop
                     )
 /*
  struct vnop_rename_args {
@@ -2145,16 +2211,11 @@ QvrVnopRenameHookEx2(
     vnode_t    originalFvp = NULLVP;
     vnode_t    originalTvp = NULLVP;
     
-    int (*origVnop)(struct vnop_rename_args *ap);
-    
-    origVnop = (int (*)(struct vnop_rename_args*))QvrGetOriginalVnodeOp( ap->a_fvp, QvrVopEnum_rename );
-    assert( origVnop );
-    
     const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_fvp );
     if( !appData )
         appData =  QvrGetApplicationDataByContext( ap->a_context, ADT_OpenExisting );  // use ADT_OpenExisting, as this should be a case of path redirection
     
-    if( !appData || RecursionEngine::IsRecursiveCall() || IsUserClient() )
+    if( !appData )
         return origVnop( ap );
     
     struct vnop_rename_args apRedirected = { 0 };
@@ -2561,7 +2622,7 @@ QvrVnopRenameHookEx2(
         assert( ! redirectedTvp );
     } // end for if( ap->a_tvp ) { ... } else { ... }
     
-    redirectedRenameVnop = QvrGetVnop( apRedirected.a_fvp, &vnop_rename_desc );
+    redirectedRenameVnop = QvrGetVnodeOpByIndex( apRedirected.a_fvp, QvrVopEnum_rename );
     assert( redirectedRenameVnop );
     RecursionEngine::EnterRecursiveCall( current_thread() );
     {
@@ -2680,19 +2741,15 @@ __exit:
 
 int
 QvrVnopExchangeHookEx2(
-                       __in struct vnop_exchange_args *ap
+                       __in struct vnop_exchange_args *ap,
+                       __in QvrVopOriginal< struct vnop_exchange_args >& origVnop
                        )
 {
-    int (*origVnop)(struct vnop_exchange_args *ap);
-    
-    origVnop = (int (*)(struct vnop_exchange_args*))QvrGetOriginalVnodeOp( ap->a_fvp, QvrVopEnum_exchange );
-    assert( origVnop );
-    
     const ApplicationData* appData = VNodeMap::getVnodeAppData( ap->a_fvp );
     if( !appData )
         appData =  QvrGetApplicationDataByContext( ap->a_context, ADT_OpenExisting );  // use ADT_OpenExisting, as this should be a case of path redirection
     
-    if( !appData || (!appData->redirectIO) || RecursionEngine::IsRecursiveCall() || IsUserClient() )
+    if( !appData || (!appData->redirectIO) )
         return origVnop( ap );
     
     
@@ -2718,10 +2775,10 @@ QvrVnopExchangeHookEx2(
         if( backingTvp ){
             
             int   fromPathLen = MAXPATHLEN;
-            char* fromPath = (char*)IOMalloc( MAXPATHLEN );
+            char* fromPath = (char*)QvrAllocatePathBuffer( MAXPATHLEN );
 
             int   toPathLen = MAXPATHLEN;
-            char* toPath = (char*)IOMalloc( MAXPATHLEN );
+            char* toPath = (char*)QvrAllocatePathBuffer( MAXPATHLEN );
             
             if( !fromPath || !toPath )
                 error = ENOMEM;
@@ -2750,21 +2807,21 @@ QvrVnopExchangeHookEx2(
             } // end if( ! error )
             
             if( fromPath )
-                IOFree( fromPath, MAXPATHLEN );
+                QvrFreePathBuffer( fromPath, MAXPATHLEN );
             
             fromPath = NULL;
             
             if( toPath )
-                IOFree( toPath, MAXPATHLEN );
+                QvrFreePathBuffer( toPath, MAXPATHLEN );
             
             toPath = NULL;
             
             /*
             int (*backingVnop)(struct vnop_exchange_args *ap);
             
-            backingVnop = (int (*)(struct vnop_exchange_args *ap)) QvrGetVnop( backingFvp, &vnop_exchange_desc );
+            backingVnop = (int (*)(struct vnop_exchange_args *ap)) QvrGetVnodeOpByIndex( backingFvp, QvrVopEnum_exchange );
             assert( backingVnop );
-             assert( (void*)backingVnop == (void*)QvrGetVnop( backingTvp, &vnop_exchange_desc ));
+             assert( (void*)backingVnop == (void*)QvrGetVnodeOpByIndex( backingTvp, QvrVopEnum_exchange ));
              
              struct vnop_exchange_args backingAp = *ap;
              
@@ -2809,27 +2866,28 @@ __exit:
 
 int
 QvrVnopGetattrHookEx2(
-    __in struct vnop_getattr_args *ap
+    __in struct vnop_getattr_args *ap,
+    __in QvrVopOriginal< struct vnop_getattr_args >& origVnop
     )
 {
-    int (*origVnop)(struct vnop_getattr_args *ap);
+    //
+    // a single lookup returns both the real vnode and the backing vnode
+    //
+    QvrVnodeInfo  vnodeInfo;
     
-    origVnop = (int (*)(struct vnop_getattr_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_getattr );
-    assert( origVnop );
+    VNodeMap::getVnodeInfo( ap->a_vp, &vnodeInfo, QvrVnodeInfoShadowReverseRef | QvrVnodeInfoIORef );
     
-    vnode_t  realVnodeRef = VNodeMap::getVnodeShadowReverseRef( ap->a_vp );
+    vnode_t  realVnodeRef = vnodeInfo.shadowReverse;
     
-    if( !realVnodeRef || RecursionEngine::IsRecursiveCall() || IsUserClient() ){
-        
-        if( realVnodeRef )
-            vnode_put( realVnodeRef );
+    if( ! realVnodeRef ){
         
+        VNodeMap::putVnodeInfo( &vnodeInfo );
         return origVnop( ap );
     }
     
     errno_t   error = ENODEV;
     
-    VOPFUNC  realVnodeVnop = QvrGetVnop( realVnodeRef, &vnop_getattr_desc );
+    VOPFUNC  realVnodeVnop = QvrGetVnodeOpByIndex( realVnodeRef, QvrVopEnum_getattr );
     
     vnode_t  shadowVp = ap->a_vp;
     ap->a_vp = realVnodeRef;
@@ -2842,7 +2900,7 @@ QvrVnopGetattrHookEx2(
             //
             // adjust the size to an controlled file size
             //
-            vnode_t  backingVnodeRef = VNodeMap::getVnodeIORef( shadowVp );
+            vnode_t  backingVnodeRef = vnodeInfo.vnodeIO;
             if( backingVnodeRef ){
                 
                 struct vnode_attr	va;
@@ -2903,8 +2961,6 @@ QvrVnopGetattrHookEx2(
                     } // end if( ! attrError )
                 } // end if( queryAttributes )
                 
-                vnode_put( backingVnodeRef );
-                
             } // end if( backingVnodeRef )
             
         } // end if( ! error )
@@ -2913,8 +2969,10 @@ QvrVnopGetattrHookEx2(
     
     ap->a_vp = shadowVp;
 
-    if( realVnodeRef )
-        vnode_put( realVnodeRef );
+    //
+    // release both the real and backing vnodes
+    //
+    VNodeMap::putVnodeInfo( &vnodeInfo );
     
     return error;
 }
@@ -2922,7 +2980,7 @@ QvrVnopGetattrHookEx2(
 //--------------------------------------------------------------------
 
 int
-QvrFsdReclaimHookEx2(struct vnop_reclaim_args *ap)
+QvrFsdReclaimHookEx2(struct vnop_reclaim_args *ap, QvrVopOriginal< struct vnop_reclaim_args >& origVnop)
 /*
  struct vnop_reclaim_args {
  struct vnodeop_desc *a_desc;
@@ -2942,16 +3000,9 @@ QvrFsdReclaimHookEx2(struct vnop_reclaim_args *ap)
     //
     assert( !( VNON != vnode_vtype( ap->a_vp ) && NULL == vnode_fsnode( ap->a_vp ) ) );
     
-    int (*origVnop)(struct vnop_reclaim_args *ap);
-    
-    origVnop = (int (*)(struct vnop_reclaim_args*))QvrGetOriginalVnodeOp( ap->a_vp, QvrVopEnum_reclaim );
-    assert( origVnop );
-    
     QvrUnHookVnodeVopAndParent( ap->a_vp );
     
-    VNodeMap::removeVnodeAppData( ap->a_vp );
-    VNodeMap::removeVnodeIO( ap->a_vp );
-    VNodeMap::removeShadowReverse( ap->a_vp );
+    VNodeMap::removeVnode( ap->a_vp );
     
     return origVnop( ap );
 }
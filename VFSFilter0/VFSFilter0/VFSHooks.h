@@ -19,12 +19,14 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/mount.h>
 #include <sys/vnode.h>
+#include <kern/clock.h>
     
 #ifdef __cplusplus
 }
 #endif
 
 #include "Common.h"
+#include "VopOriginal.h"
 
 //--------------------------------------------------------------------
 
@@ -53,65 +55,103 @@ QvrHookVnodeVop(
     __in    QvrVnodeType type
     );
 
+//
+// the handlers of the hooked VOPs, a handler is called by a QvrVopTrampoline
+// instance with the original function of the vnode's v_op vector
+//
+
 int
 QvrVnopLookupHookEx2(
-                     __inout struct vnop_lookup_args *ap
+                     __inout struct vnop_lookup_args *ap,
+                     __in QvrVopOriginal< struct vnop_lookup_args >& origVnop
                      );
 
 int
 QvrVnopCreateHookEx2(
-                     __inout struct vnop_create_args *ap
+                     __inout struct vnop_create_args *ap,
+                     __in QvrVopOriginal< struct vnop_create_args >& origVnop
                      );
 
 int
 QvrVnopCloseHookEx2(
-                   __inout struct vnop_close_args *ap
+                   __inout struct vnop_close_args *ap,
+                   __in QvrVopOriginal< struct vnop_close_args >& origVnop
                    );
 
 int
 QvrVnopReadHookEx2(
-                   __in struct vnop_read_args *ap
+                   __in struct vnop_read_args *ap,
+                   __in QvrVopOriginal< struct vnop_read_args >& origVnop
                    );
 int
 QvrVnopOpenHookEx2(
-                   __in struct vnop_open_args *ap
+                   __in struct vnop_open_args *ap,
+                   __in QvrVopOriginal< struct vnop_open_args >& origVnop
                    );
 int
 QvrVnopPageinHookEx2(
-                     __in struct vnop_pagein_args *ap
+                     __in struct vnop_pagein_args *ap,
+                     __in QvrVopOriginal< struct vnop_pagein_args >& origVnop
                      );
 
 int
 QvrVnopWriteHookEx2(
-                    __in struct vnop_write_args *ap
+                    __in struct vnop_write_args *ap,
+                    __in QvrVopOriginal< struct vnop_write_args >& origVnop
                     );
 
 int
 QvrVnopPageoutHookEx2(
-                      __in struct vnop_pageout_args *ap
+                      __in struct vnop_pageout_args *ap,
+                      __in QvrVopOriginal< struct vnop_pageout_args >& origVnop
                       );
 
 int
 QvrVnopRenameHookEx2(
-                     __in struct vnop_rename_args *ap
+                     __in struct vnop_rename_args *ap,
+                     __in QvrVopOriginal< struct vnop_rename_args >& origVnop
                      );
 
 int
 QvrVnopExchangeHookEx2(
-                       __in struct vnop_exchange_args *ap
+                       __in struct vnop_exchange_args *ap,
+                       __in QvrVopOriginal< struct vnop_exchange_args >& origVnop
                        );
 
 int
-QvrFsdReclaimHookEx2(struct vnop_reclaim_args *ap);
+QvrFsdReclaimHookEx2(struct vnop_reclaim_args *ap, QvrVopOriginal< struct vnop_reclaim_args >& origVnop);
 
 int
-QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap);
+QvrVnopInactiveHookEx2(struct vnop_inactive_args *ap, QvrVopOriginal< struct vnop_inactive_args >& origVnop);
 
 int
 QvrVnopGetattrHookEx2(
-                      __in struct vnop_getattr_args *ap
+                      __in struct vnop_getattr_args *ap,
+                      __in QvrVopOriginal< struct vnop_getattr_args >& origVnop
                       );
 
+//
+// the hooked VOPs in the hooking order, the correct order is when reclaim
+// and close are hooked first and the open and create are last, see
+// gQvrVnodeVopHookEntries, an entry is
+// _X_( name, arguments structure, vnode argument, handler, passthrough policy ),
+// the vnode argument's v_op vector provides the original function
+//
+#define QVR_HOOKED_VOPS( _X_ ) \
+    _X_( reclaim,  vnop_reclaim_args,  a_vp,  QvrFsdReclaimHookEx2,   QvrVopNoPassthrough ) \
+    _X_( read,     vnop_read_args,     a_vp,  QvrVnopReadHookEx2,     QvrVopNoPassthrough ) \
+    _X_( open,     vnop_open_args,     a_vp,  QvrVnopOpenHookEx2,     QvrVopNoPassthrough ) \
+    _X_( write,    vnop_write_args,    a_vp,  QvrVnopWriteHookEx2,    QvrVopNoPassthrough ) \
+    _X_( pagein,   vnop_pagein_args,   a_vp,  QvrVnopPageinHookEx2,   QvrVopNoPassthrough ) \
+    _X_( pageout,  vnop_pageout_args,  a_vp,  QvrVnopPageoutHookEx2,  QvrVopNoPassthrough ) \
+    _X_( lookup,   vnop_lookup_args,   a_dvp, QvrVnopLookupHookEx2,   QvrVopNoPassthrough ) \
+    _X_( create,   vnop_create_args,   a_dvp, QvrVnopCreateHookEx2,   QvrVopPassthroughOnRecursion ) \
+    _X_( close,    vnop_close_args,    a_vp,  QvrVnopCloseHookEx2,    QvrVopNoPassthrough ) \
+    _X_( inactive, vnop_inactive_args, a_vp,  QvrVnopInactiveHookEx2, QvrVopNoPassthrough ) \
+    _X_( rename,   vnop_rename_args,   a_fvp, QvrVnopRenameHookEx2,   QvrVopPassthroughOnRecursion ) \
+    _X_( exchange, vnop_exchange_args, a_fvp, QvrVnopExchangeHookEx2, QvrVopPassthroughOnRecursion ) \
+    _X_( getattr,  vnop_getattr_args,  a_vp,  QvrVnopGetattrHookEx2,  QvrVopPassthroughOnRecursion )
+
 //--------------------------------------------------------------------
 
 #endif /* defined(__VFSFilter0__VFSHooks__) */
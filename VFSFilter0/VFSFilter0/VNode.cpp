@@ -7,18 +7,24 @@
 //
 
 #include "VNode.h"
+
+#if defined( KERNEL )
 #include "VersionDependent.h"
 
+#include <kern/clock.h>
+#endif // KERNEL
+
 //--------------------------------------------------------------------
 
-VNodeMap   VNodeMap::InstanceForAppData;
-VNodeMap   VNodeMap::InstanceForVnodeIO;
-VNodeMap   VNodeMap::InstanceForHookedVnodes;
-VNodeMap   VNodeMap::InstanceForShadowToVnode;
-IOLock*    VNodeMap::Lock;
+QvrVnodeRecord* volatile  VNodeMap::Buckets[ VNodeMap::BucketsNumber ];
+IOLock*                   VNodeMap::Locks[ VNodeMap::LocksNumber ];
+QvrObjectPool             VNodeMap::RecordsPool( sizeof( QvrVnodeRecord ), 128 );
+QvrEpoch                  VNodeMap::Epoch;
 
 //--------------------------------------------------------------------
 
+#if defined( KERNEL )
+
 errno_t
 QvrAdjustVnodeSizeByBackingVnode(
     __in vnode_t vnode,
@@ -44,4 +50,754 @@ QvrAdjustVnodeSizeByBackingVnode(
     return error;
 }
 
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::Init()
+{
+    for( int i = 0x0; i < LocksNumber; ++i ){
+        
+        Locks[ i ] = IOLockAlloc();
+        assert( Locks[ i ] );
+        if( ! Locks[ i ] ){
+            
+            DBG_PRINT_ERROR(( "VNodeMap::Init()->IOLockAlloc() failed\n" ));
+            return false;
+        }
+    }
+    
+    return Epoch.init();
+}
+
+//--------------------------------------------------------------------
+
+QvrVnodeRecord*
+VNodeMap::allocateRecord()
+{
+    QvrVnodeRecord* record = (QvrVnodeRecord*)RecordsPool.allocate();
+    assert( record );
+    if( record )
+        bzero( record, sizeof( *record ) );
+    
+    return record;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::freeRecord( __in QvrVnodeRecord* record )
+{
+    assert( record->isEmpty() );
+    RecordsPool.free( record );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::retiredRecordCallback( __in void* context )
+/*
+ called after a grace period, no reader can see the record
+ */
+{
+    QvrVnodeRecord* record = (QvrVnodeRecord*)context;
+    
+    //
+    // release the references taken by addVnodeIO and addVnodeShadowReverse
+    //
+    if( record->vnodeIO )
+        vnode_put( record->vnodeIO );
+    
+    if( record->shadowReverse )
+        vnode_put( record->shadowReverse );
+    
+    bzero( record, sizeof( *record ) );
+    freeRecord( record );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::retiredVnodeCallback( __in void* context )
+{
+    vnode_put( (vnode_t)context );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::retire(
+    __in_opt vnode_t vnodeToRetire,
+    __in_opt QvrVnodeRecord* recordToRetire
+    )
+/*
+ a reader might have fetched the vnode pointer from a record
+ and has not called vnode_get yet, so the map's reference is
+ dropped after a grace period, the same is true for an unlinked record,
+ the function must be called without the vnode's lock being held
+ as the epoch might call the callbacks synchronously
+ */
+{
+    if( vnodeToRetire )
+        Epoch.retire( retiredVnodeCallback, vnodeToRetire );
+    
+    if( recordToRetire )
+        Epoch.retire( retiredRecordCallback, recordToRetire );
+}
+
+//--------------------------------------------------------------------
+
+QvrVnodeRecord*
+VNodeMap::getRecord( __in vnode_t vn )
+/*
+ the caller must either hold the vnode's lock or be inside the epoch
+ */
+{
+    QvrVnodeRecord* record;
+    
+    for( record = Buckets[ bucketIndex( vn ) ]; NULL != record; record = record->next ){
+        
+        if( vn == record->vnode )
+            break;
+    }
+    
+    return record;
+}
+
+//--------------------------------------------------------------------
+
+QvrVnodeRecord*
+VNodeMap::getRecordForUpdate(
+    __in vnode_t vn,
+    __inout QvrVnodeRecord** spareRecord
+    )
+/*
+ the vnode's lock must be held, if there is no record for the vnode
+ the spare record is inserted and *spareRecord is set to NULL,
+ the spare record is allocated by a caller before acquiring the lock
+ as the map is updated on the paging path
+ */
+{
+    QvrVnodeRecord* record = getRecord( vn );
+    if( record || NULL == *spareRecord )
+        return record;
+    
+    UInt32  index = bucketIndex( vn );
+    
+    record = *spareRecord;
+    *spareRecord = NULL;
+    
+    record->vnode = vn;
+    record->next  = Buckets[ index ];
+    
+    //
+    // publish the initialized record, the atomic operation is a barrier
+    //
+    OSCompareAndSwapPtr( record->next, record, (void* volatile*)&Buckets[ index ] );
+    
+    return record;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::unlinkRecord( __in QvrVnodeRecord* record )
+/*
+ the vnode's lock must be held, the record must be retired
+ by a caller after releasing the lock
+ */
+{
+    QvrVnodeRecord* volatile* prev = &Buckets[ bucketIndex( record->vnode ) ];
+    
+    while( *prev != record ){
+        
+        assert( *prev );
+        prev = &(*prev)->next;
+    }
+    
+    //
+    // a reader that is walking the chain either sees the record or skips it,
+    // in both cases it continues with the rest of the chain
+    //
+    *prev = record->next;
+}
+
+//--------------------------------------------------------------------
+
+QvrVnodeRecord*
+VNodeMap::unlinkRecordIfEmpty( __in QvrVnodeRecord* record )
+/*
+ the vnode's lock must be held, returns the unlinked record
+ that must be retired by a caller after releasing the lock
+ */
+{
+    if( ! record->isEmpty() )
+        return NULL;
+    
+    unlinkRecord( record );
+    return record;
+}
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::getVnodeInfo(
+    __in vnode_t vn,
+    __out QvrVnodeInfo* info,
+    __in UInt32 refFlags
+    )
+{
+    QvrVnodeRecord* record;
+    UInt32          token;
+    
+    bzero( info, sizeof( *info ) );
+    
+    token = Epoch.enter();
+    {// start of the epoch
+        
+        record = getRecord( vn );
+        if( record ){
+            
+            info->appData = record->appData;
+            info->hooked  = record->hooked;
+            
+            //
+            // the map's references are released after a grace period,
+            // so the vnodes are valid here
+            //
+            if( refFlags & QvrVnodeInfoIORef ){
+                
+                info->vnodeIO = record->vnodeIO;
+                if( info->vnodeIO )
+                    vnode_get( info->vnodeIO );
+            }
+            
+            if( refFlags & QvrVnodeInfoShadowReverseRef ){
+                
+                info->shadowReverse = record->shadowReverse;
+                if( info->shadowReverse )
+                    vnode_get( info->shadowReverse );
+            }
+        } // end if( record )
+        
+    }// end of the epoch
+    Epoch.leave( token );
+    
+    return ( NULL != record );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::putVnodeInfo( __in QvrVnodeInfo* info )
+{
+    if( info->vnodeIO )
+        vnode_put( info->vnodeIO );
+    
+    if( info->shadowReverse )
+        vnode_put( info->shadowReverse );
+    
+    info->vnodeIO = NULLVP;
+    info->shadowReverse = NULLVP;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::removeVnode( __in vnode_t vn )
+{
+    QvrVnodeRecord* record;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        record = getRecord( vn );
+        if( record )
+            unlinkRecord( record );
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    //
+    // the record's vnodes are released with the record
+    //
+    retire( NULLVP, record );
+}
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::addHookedVnode( __in vnode_t vn )
+{
+    QvrVnodeRecord* spareRecord = allocateRecord();
+    QvrVnodeRecord* record;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        record = getRecordForUpdate( vn, &spareRecord );
+        if( record )
+            record->hooked = true;
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    if( spareRecord )
+        freeRecord( spareRecord );
+    
+    return ( NULL != record );
+}
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::clearHookedVnode( __in vnode_t vn )
+{
+    QvrVnodeRecord* recordToRetire = NULL;
+    bool            wasHooked = false;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecord( vn );
+        if( record ){
+            
+            wasHooked = record->hooked;
+            record->hooked = false;
+            recordToRetire = unlinkRecordIfEmpty( record );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    retire( NULLVP, recordToRetire );
+    
+    return wasHooked;
+}
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::isVnodeHooked( __in vnode_t vn )
+{
+    QvrVnodeInfo  info;
+    
+    getVnodeInfo( vn, &info, 0x0 );
+    return info.hooked;
+}
+
+//--------------------------------------------------------------------
+
+bool
+VNodeMap::addVnodeAppData(
+    __in vnode_t  vn,
+    __in const ApplicationData* data
+    )
+{
+    assert( data );
+    
+    QvrVnodeRecord* spareRecord = allocateRecord();
+    QvrVnodeRecord* record;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        record = getRecordForUpdate( vn, &spareRecord );
+        if( record )
+            record->appData = data;
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    if( spareRecord )
+        freeRecord( spareRecord );
+    
+    return ( NULL != record );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::removeVnodeAppData( __in vnode_t vn )
+{
+    QvrVnodeRecord* recordToRetire = NULL;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecord( vn );
+        if( record ){
+            
+            record->appData = NULL;
+            recordToRetire = unlinkRecordIfEmpty( record );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    retire( NULLVP, recordToRetire );
+}
+
+//--------------------------------------------------------------------
+
+const ApplicationData*
+VNodeMap::getVnodeAppData( __in vnode_t vn )
+{
+    QvrVnodeInfo  info;
+    
+    getVnodeInfo( vn, &info, 0x0 );
+    return info.appData;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::addVnodeShadowReverse(
+    __in vnode_t  vnodeShadow,
+    __in vnode_t vn
+    )
+{
+    assert( vnodeShadow != vn );
+    
+    QvrVnodeRecord* spareRecord = allocateRecord();
+    vnode_t         oldVn = NULLVP;
+    
+    IOLockLock( lockForVnode( vnodeShadow ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecordForUpdate( vnodeShadow, &spareRecord );
+        if( record && vn != record->shadowReverse ){
+            
+            oldVn = record->shadowReverse;
+            
+            vnode_get( vn );
+            record->shadowReverse = vn;
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vnodeShadow ) );
+    
+    if( spareRecord )
+        freeRecord( spareRecord );
+    
+    retire( oldVn, NULL );
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::removeShadowReverse( __in vnode_t vnodeShadow )
+{
+    QvrVnodeRecord* recordToRetire = NULL;
+    vnode_t         vn = NULLVP;
+    
+    IOLockLock( lockForVnode( vnodeShadow ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecord( vnodeShadow );
+        if( record ){
+            
+            vn = record->shadowReverse;
+            record->shadowReverse = NULLVP;
+            recordToRetire = unlinkRecordIfEmpty( record );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vnodeShadow ) );
+    
+    //
+    // release a reference taken by addVnodeShadowReverse
+    //
+    retire( vn, recordToRetire );
+}
+
+//--------------------------------------------------------------------
+
+const vnode_t
+VNodeMap::getVnodeShadowReverseRef( __in vnode_t vnodeShadow )
+{
+    QvrVnodeInfo  info;
+    
+    getVnodeInfo( vnodeShadow, &info, QvrVnodeInfoShadowReverseRef );
+    return info.shadowReverse;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::addVnodeIO(
+    __in vnode_t  vn,
+    __in vnode_t vnodeIO
+    )
+{
+    assert( vn != vnodeIO );
+    
+    QvrVnodeRecord* spareRecord = allocateRecord();
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecordForUpdate( vn, &spareRecord );
+        if( record && NULLVP == record->vnodeIO ){
+            
+            vnode_get( vnodeIO );
+            record->vnodeIO = vnodeIO;
+            
+        } else if( record ){
+            
+            assert( vnodeIO == record->vnodeIO );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    if( spareRecord )
+        freeRecord( spareRecord );
+}
+
+//--------------------------------------------------------------------
+
+vnode_t
+VNodeMap::detachVnodeIO( __in vnode_t vn )
+{
+    QvrVnodeRecord* recordToRetire = NULL;
+    vnode_t         vnodeIO = NULLVP;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecord( vn );
+        if( record ){
+            
+            vnodeIO = record->vnodeIO;
+            record->vnodeIO = NULLVP;
+            recordToRetire = unlinkRecordIfEmpty( record );
+            
+            //
+            // the caller gets its own reference as the map's one
+            // is released after a grace period
+            //
+            if( vnodeIO )
+                vnode_get( vnodeIO );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    retire( vnodeIO, recordToRetire );
+    
+    return vnodeIO;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::removeVnodeIO( __in vnode_t vn )
+{
+    QvrVnodeRecord* recordToRetire = NULL;
+    vnode_t         vnodeIO = NULLVP;
+    
+    IOLockLock( lockForVnode( vn ) );
+    {// start of the lock
+        
+        QvrVnodeRecord* record = getRecord( vn );
+        if( record ){
+            
+            vnodeIO = record->vnodeIO;
+            record->vnodeIO = NULLVP;
+            recordToRetire = unlinkRecordIfEmpty( record );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lockForVnode( vn ) );
+    
+    //
+    // release a reference taken by addVnodeIO
+    //
+    retire( vnodeIO, recordToRetire );
+}
+
+//--------------------------------------------------------------------
+
+const vnode_t
+VNodeMap::getVnodeIORef( __in vnode_t vn )
+{
+    QvrVnodeInfo  info;
+    
+    getVnodeInfo( vn, &info, QvrVnodeInfoIORef );
+    return info.vnodeIO;
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+VNodeMap::countReferences( __in UInt32 refFlags )
+/*
+ the result is an estimation as the map is not locked
+ */
+{
+    UInt32  count = 0x0;
+    UInt32  token;
+    
+    token = Epoch.enter();
+    {// start of the epoch
+        
+        for( UInt32 i = 0x0; i < BucketsNumber; ++i ){
+            
+            for( QvrVnodeRecord* record = Buckets[ i ]; NULL != record; record = record->next ){
+                
+                if( ( refFlags & QvrVnodeInfoIORef ) && record->vnodeIO )
+                    ++count;
+                
+                if( ( refFlags & QvrVnodeInfoShadowReverseRef ) && record->shadowReverse )
+                    ++count;
+            } // end for
+        } // end for
+        
+    }// end of the epoch
+    Epoch.leave( token );
+    
+    return count;
+}
+
+//--------------------------------------------------------------------
+
+void
+VNodeMap::releaseAllReferences(
+    __in UInt32 refFlags,
+    __out_opt QvrVnodeReleaseReport* report
+    )
+{
+    assert( preemption_enabled() );
+    
+    UInt64  startTime = mach_absolute_time();
+    UInt64  durationNs;
+    UInt32  references = 0x0;
+    UInt32  records = 0x0;
+    UInt32  passes = 0x0;
+    bool    full;
+    
+    do{
+        
+        //
+        // the map might grow concurrently so the arrays might
+        // be filled before the pass completes, in that case
+        // another pass is made
+        //
+        UInt32  capacity = countReferences( refFlags );
+        if( 0x0 == capacity )
+            break;
+        
+        capacity += 0x10;
+        
+        vm_size_t         vnodesSize = capacity * sizeof( vnode_t );
+        vm_size_t         recordsSize = capacity * sizeof( QvrVnodeRecord* );
+        vnode_t*          vnodes = (vnode_t*)IOMalloc( vnodesSize );
+        QvrVnodeRecord**  emptyRecords = (QvrVnodeRecord**)IOMalloc( recordsSize );
+        UInt32            vnodesCount = 0x0;
+        UInt32            recordsCount = 0x0;
+        
+        assert( vnodes && emptyRecords );
+        if( !vnodes || !emptyRecords ){
+            
+            DBG_PRINT_ERROR(( "VNodeMap::releaseAllReferences()->IOMalloc( %u ) failed\n", (unsigned int)vnodesSize ));
+            
+            if( vnodes )
+                IOFree( vnodes, vnodesSize );
+            
+            if( emptyRecords )
+                IOFree( emptyRecords, recordsSize );
+            
+            break;
+        }
+        
+        ++passes;
+        full = false;
+        
+        //
+        // a lock protects the buckets with the same low index bits
+        //
+        for( UInt32 k = 0x0; k < LocksNumber && !full; ++k ){
+            
+            IOLockLock( Locks[ k ] );
+            {// start of the lock
+                
+                for( UInt32 i = k; i < BucketsNumber && !full; i += LocksNumber ){
+                    
+                    QvrVnodeRecord* next;
+                    
+                    for( QvrVnodeRecord* record = Buckets[ i ]; NULL != record; record = next ){
+                        
+                        next = record->next;
+                        
+                        //
+                        // a record can hold two references, an emptied record
+                        // takes a slot in emptyRecords that is not larger than vnodes
+                        //
+                        if( vnodesCount + 0x2 > capacity ){
+                            
+                            full = true;
+                            break;
+                        }
+                        
+                        if( ( refFlags & QvrVnodeInfoIORef ) && record->vnodeIO ){
+                            
+                            vnodes[ vnodesCount++ ] = record->vnodeIO;
+                            record->vnodeIO = NULLVP;
+                        }
+                        
+                        if( ( refFlags & QvrVnodeInfoShadowReverseRef ) && record->shadowReverse ){
+                            
+                            vnodes[ vnodesCount++ ] = record->shadowReverse;
+                            record->shadowReverse = NULLVP;
+                        }
+                        
+                        if( record->isEmpty() ){
+                            
+                            unlinkRecord( record );
+                            emptyRecords[ recordsCount++ ] = record;
+                        }
+                    } // end for
+                } // end for
+                
+            }// end of the lock
+            IOLockUnlock( Locks[ k ] );
+        } // end for
+        
+        //
+        // a single grace period for all detached references and records,
+        // then the vnodes are released outside of any lock
+        //
+        if( vnodesCount || recordsCount )
+            Epoch.synchronize();
+        
+        for( UInt32 i = 0x0; i < vnodesCount; ++i )
+            vnode_put( vnodes[ i ] );
+        
+        for( UInt32 i = 0x0; i < recordsCount; ++i )
+            freeRecord( emptyRecords[ i ] );
+        
+        references += vnodesCount;
+        records += recordsCount;
+        
+        IOFree( vnodes, vnodesSize );
+        IOFree( emptyRecords, recordsSize );
+        
+    } while( full );
+    
+    absolutetime_to_nanoseconds( mach_absolute_time() - startTime, &durationNs );
+    
+    DBG_PRINT(( "VNodeMap::releaseAllReferences( 0x%x ) released %u references and %u records in %llu ns, %u passes\n",
+                (unsigned int)refFlags, references, records, durationNs, passes ));
+    
+    if( report ){
+        
+        report->references = references;
+        report->records    = records;
+        report->passes     = passes;
+        report->durationNs = durationNs;
+    }
+}
+
 //--------------------------------------------------------------------
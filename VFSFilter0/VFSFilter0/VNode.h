@@ -9,12 +9,23 @@
 #ifndef __VFSFilter0__VNode__
 #define __VFSFilter0__VNode__
 
+//
+// a user mode build declares vnode_t, NULLVP, vnode_get(), vnode_put(),
+// ApplicationData, mach_absolute_time() and absolutetime_to_nanoseconds()
+// before including the header, see VFSFilter0Bench/VNodeMocks.h
+//
+#if defined( KERNEL )
 #include "Common.h"
 #include "RecursionEngine.h"
 #include "ApplicationsData.h"
+#endif // KERNEL
+#include "ObjectPool.h"
+#include "Epoch.h"
 
 //--------------------------------------------------------------------
 
+#if defined( KERNEL )
+
 errno_t
 QvrAdjustVnodeSizeByBackingVnode(
                                  __in vnode_t vnode,
@@ -28,210 +39,190 @@ typedef struct{
     char dirPath[ MAXPATHLEN + 1 ];
 } VnodeData;
 
-/*
- this one should be redesigned
- */
-class VNodeMap: public DataMap{
+#endif // KERNEL
 
-public:
-    
-    static void Init()
-    {
-        Lock = IOLockAlloc();
-        assert( Lock );
-    }
+//--------------------------------------------------------------------
+
+//
+// all associations for a vnode, the vnodes are referenced by the record,
+// the fields are read without a lock so they are updated by single stores
+//
+class QvrVnodeRecord{
     
-private:
-    static VNodeMap   InstanceForAppData; // vnode to ApplicationData
-    static VNodeMap   InstanceForVnodeIO; // vnode to vnodeIO ( i.e. a backing vnode )
-    static VNodeMap   InstanceForShadowToVnode; // shadow vnode to vnode ( i.e. a reverse mappong )
-    static VNodeMap   InstanceForHookedVnodes; // vnodes for which QvrHookVnodeVop was called
-    static IOLock*    Lock;
+public:
+    QvrVnodeRecord* volatile         next;          // a bucket's chain
+    vnode_t                          vnode;         // a key
+    const ApplicationData* volatile  appData;
+    vnode_t volatile                 vnodeIO;       // a backing vnode
+    vnode_t volatile                 shadowReverse; // a vnode for which this vnode is a shadow
+    bool volatile                    hooked;        // QvrHookVnodeVop was called for the vnode
     
+public:
+    bool isEmpty() { return !appData && !vnodeIO && !shadowReverse && !hooked; }
+};
+
+//
+// a snapshot of a record returned by VNodeMap::getVnodeInfo
+//
+typedef struct _QvrVnodeInfo{
+    const ApplicationData*  appData;
+    vnode_t                 vnodeIO;       // NULL if QvrVnodeInfoIORef was not requested
+    vnode_t                 shadowReverse; // NULL if QvrVnodeInfoShadowReverseRef was not requested
+    bool                    hooked;
+} QvrVnodeInfo;
+
+//
+// flags for VNodeMap::getVnodeInfo and VNodeMap::releaseAllReferences
+//
+#define QvrVnodeInfoIORef             0x1
+#define QvrVnodeInfoShadowReverseRef  0x2
+
+//
+// returned by VNodeMap::releaseAllReferences
+//
+typedef struct _QvrVnodeReleaseReport{
+    UInt32   references;  // dropped vnode references
+    UInt32   records;     // removed records that became empty
+    UInt32   passes;      // more than one pass means the map was growing concurrently
+    UInt64   durationNs;
+} QvrVnodeReleaseReport;
+
+//--------------------------------------------------------------------
+
+//
+// a vnode to QvrVnodeRecord map, a hooked VOP finds all vnode's
+// associations with a single lookup and a reclaimed vnode
+// is removed with a single removal,
+// the map is read-mostly, the readers take no lock and walk
+// the bucket chains inside an epoch bracket, the writers are serialized
+// by striped locks, publish the initialized records and retire
+// the unlinked records and the dropped vnode references to the epoch,
+// so a reader that has fetched a record or a vnode pointer can
+// use it until it leaves the epoch
+//
+class VNodeMap{
+
 public:
     
-    //---------------------------------------------------------------------
+    static bool Init();
     
-    static bool  addHookedVnode( __in vnode_t  vn ){ return InstanceForHookedVnodes.addDataByKey( vn, (void*)vn ); }
-    static void  removeHookedVnode( __in vnode_t vn ){ InstanceForHookedVnodes.removeKey( vn ); }
-    static bool  isVnodeHooked( __in vnode_t vn ){ return 0x0 != InstanceForHookedVnodes.getDataByKey( vn ); }
+private:
     
-    //---------------------------------------------------------------------
-
-    static bool  addVnodeAppData( __in vnode_t  vn, __in const ApplicationData* data ){ return InstanceForAppData.addDataByKey( vn, (void*)data ); }
-    static void  removeVnodeAppData( __in vnode_t vn ){ InstanceForAppData.removeKey( vn ); }
-    static const ApplicationData* getVnodeAppData( __in vnode_t vn ){ return (const ApplicationData*)InstanceForAppData.getDataByKey( vn ); }
+    //
+    // both values must be a power of 2
+    //
+    enum{
+        BucketsNumber = 4096,
+        LocksNumber   = 64
+    };
     
-    //---------------------------------------------------------------------
+    static QvrVnodeRecord* volatile  Buckets[ BucketsNumber ];
+    static IOLock*                   Locks[ LocksNumber ];
+    static QvrObjectPool             RecordsPool;
+    static QvrEpoch                  Epoch;
     
-    static void addVnodeShadowReverse( __in vnode_t  vnodeShadow, __in vnode_t vn )
-    {
-        assert( vnodeShadow != vn );
-        
-        vnode_t oldVn = NULLVP;
-        
-        IOLockLock( VNodeMap::Lock );
-        {
-            vnode_t currentVnode = getVnodeShadowReverse( vnodeShadow );
-            bool    add = false;
-            
-            if( NULLVP == currentVnode ){
-                
-                add = true;
-                
-            } else if( vn != currentVnode ){
-                
-                InstanceForShadowToVnode.removeKey( vnodeShadow );
-                oldVn = currentVnode;
-                add = true;
-            }
-            
-            if( add && InstanceForShadowToVnode.addDataByKey( vnodeShadow, (void*)vn ) )
-                vnode_get( vn );
-        }
-        IOLockUnlock( VNodeMap::Lock );
-        
-        if( oldVn )
-            vnode_put( oldVn );
-    }
+private:
     
-    static void    removeShadowReverse( __in vnode_t  vnodeShadow )
+    static UInt32 bucketIndex( __in vnode_t vn )
     {
-        vnode_t vn = NULLVP;
-        
-        IOLockLock( VNodeMap::Lock );
-        {
-            vn= getVnodeShadowReverse( vnodeShadow );
-            if( vn )
-                InstanceForShadowToVnode.removeKey( vnodeShadow );
-        }
-        IOLockUnlock( VNodeMap::Lock );
-        
         //
-        // release a reference taken by addVnodeShadowReverse
+        // a finalizer from the 64 bit MurmurHash3
         //
-        if( vn )
-            vnode_put( vn );
-    }
-    
-    static const vnode_t getVnodeShadowReverseRef( __in vnode_t vnodeShadow )
-    /*the returned vnode is referenced, a caller must release it by vnode_put()*/
-    {
-        vnode_t vn;
+        UInt64 h = (UInt64)vn;
         
-        IOLockLock( VNodeMap::Lock );
-        {
-            vn = getVnodeShadowReverse( vnodeShadow );
-            if( vn )
-                vnode_get( vn );
-        }
-        IOLockUnlock( VNodeMap::Lock );
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
         
-        return vn;
+        return (UInt32)h & ( BucketsNumber - 1 );
     }
     
-    static void releaseAllShadowReverse()
+    static IOLock* lockForVnode( __in vnode_t vn )
     {
-        while( ! InstanceForShadowToVnode.isEmpty() ){
-            
-            vnode_t   vn = NULLVP;
-            
-            IOLockLock( VNodeMap::Lock );
-            {
-                vn = (vnode_t)InstanceForShadowToVnode.removeFirstEntryAndReturnItsData();
-            }
-            IOLockUnlock( VNodeMap::Lock );
-            
-            if( vn )
-                vnode_put( vn );
-        }
+        return Locks[ bucketIndex( vn ) & ( LocksNumber - 1 ) ];
     }
     
-    static void addVnodeIO( __in vnode_t  vn, __in vnode_t vnodeIO )
-    {
-        assert( vn != vnodeIO );
-        IOLockLock( VNodeMap::Lock );
-        {
-            if( NULLVP == getVnodeIO( vn ) ){
-                
-                if( InstanceForVnodeIO.addDataByKey( vn, (void*)vnodeIO ) )
-                    vnode_get( vnodeIO );
-                
-            } else {
-                
-                assert( vnodeIO == getVnodeIO( vn ) );
-            }
-        }
-        IOLockUnlock( VNodeMap::Lock );
-    }
+    static QvrVnodeRecord* allocateRecord();
+    static void            freeRecord( __in QvrVnodeRecord* record );
     
-    static void    removeVnodeIO( __in vnode_t vn )
-    {
-        vnode_t vnodeIO = NULLVP;
-        
-        IOLockLock( VNodeMap::Lock );
-        {
-            vnodeIO = getVnodeIO( vn );
-            if( vnodeIO )
-                InstanceForVnodeIO.removeKey( vn );
-        }
-        IOLockUnlock( VNodeMap::Lock );
-        
-        //
-        // release a reference taken by addVnodeIO
-        //
-        if( vnodeIO )
-            vnode_put( vnodeIO );
-    }
+    static void            retiredRecordCallback( __in void* record );
+    static void            retiredVnodeCallback( __in void* vnode );
+    static void            retire( __in_opt vnode_t vnodeToRetire, __in_opt QvrVnodeRecord* recordToRetire );
+    
+    static QvrVnodeRecord* getRecord( __in vnode_t vn );
+    static QvrVnodeRecord* getRecordForUpdate( __in vnode_t vn, __inout QvrVnodeRecord** spareRecord );
+    static void            unlinkRecord( __in QvrVnodeRecord* record );
+    static QvrVnodeRecord* unlinkRecordIfEmpty( __in QvrVnodeRecord* record );
+    
+    static UInt32 countReferences( __in UInt32 refFlags );
+    
+public:
+    
+    //---------------------------------------------------------------------
+    
+    //
+    // returns false if there is no record for the vnode, the vnodes
+    // returned in the info are referenced, a caller must release them
+    // by putVnodeInfo()
+    //
+    static bool  getVnodeInfo( __in vnode_t vn, __out QvrVnodeInfo* info, __in UInt32 refFlags );
+    static void  putVnodeInfo( __in QvrVnodeInfo* info );
+    
+    //
+    // removes all vnode associations, called when the vnode is reclaimed
+    //
+    static void  removeVnode( __in vnode_t vn );
+    
+    //---------------------------------------------------------------------
+    
+    static bool  addHookedVnode( __in vnode_t  vn );
+    static void  removeHookedVnode( __in vnode_t vn ){ clearHookedVnode( vn ); }
+    static bool  isVnodeHooked( __in vnode_t vn );
+    
+    //
+    // returns the hooked flag value before it was cleared
+    //
+    static bool  clearHookedVnode( __in vnode_t vn );
+    
+    //---------------------------------------------------------------------
+
+    static bool  addVnodeAppData( __in vnode_t  vn, __in const ApplicationData* data );
+    static void  removeVnodeAppData( __in vnode_t vn );
+    static const ApplicationData* getVnodeAppData( __in vnode_t vn );
+    
+    //---------------------------------------------------------------------
+    
+    static void addVnodeShadowReverse( __in vnode_t  vnodeShadow, __in vnode_t vn );
+    static void removeShadowReverse( __in vnode_t  vnodeShadow );
     
-    static const vnode_t getVnodeIORef( __in vnode_t vn )
     /*the returned vnode is referenced, a caller must release it by vnode_put()*/
-    {
-        vnode_t vnodeIO;
-        
-        IOLockLock( VNodeMap::Lock );
-        {
-            vnodeIO = getVnodeIO( vn );
-            if( vnodeIO )
-                vnode_get( vnodeIO );
-        }
-        IOLockUnlock( VNodeMap::Lock );
-        
-        return vnodeIO;
-    }
+    static const vnode_t getVnodeShadowReverseRef( __in vnode_t vnodeShadow );
     
-    static void releaseAllVnodeIO()
-    {
-        while( ! InstanceForVnodeIO.isEmpty() ){
-            
-            vnode_t   vnodeIO = NULLVP;
-            
-            IOLockLock( VNodeMap::Lock );
-            {
-                vnodeIO = (vnode_t)InstanceForVnodeIO.removeFirstEntryAndReturnItsData();
-            }
-            IOLockUnlock( VNodeMap::Lock );
-            
-            if( vnodeIO )
-                vnode_put( vnodeIO );
-        }
-    }
+    static void releaseAllShadowReverse() { releaseAllReferences( QvrVnodeInfoShadowReverseRef ); }
     
     //---------------------------------------------------------------------
     
-private:
+    static void addVnodeIO( __in vnode_t  vn, __in vnode_t vnodeIO );
+    static void removeVnodeIO( __in vnode_t vn );
     
-    static const vnode_t getVnodeIO( __in vnode_t vn )
-    /*the returned vnode is not referenced*/
-    {
-        return (vnode_t)InstanceForVnodeIO.getDataByKey( vn );
-    }
+    /*the returned vnode is referenced, a caller must release it by vnode_put()*/
+    static const vnode_t getVnodeIORef( __in vnode_t vn );
     
-    static const vnode_t getVnodeShadowReverse( __in vnode_t vnodeShadow )
-    /*the returned vnode is not referenced*/
-    {
-        return (vnode_t)InstanceForShadowToVnode.getDataByKey( vnodeShadow );
-    }
+    /*removes the association and returns the referenced vnode, a caller must release it by vnode_put()*/
+    static vnode_t detachVnodeIO( __in vnode_t vn );
+    
+    static void releaseAllVnodeIO() { releaseAllReferences( QvrVnodeInfoIORef ); }
+    
+    //---------------------------------------------------------------------
+    
+    //
+    // drops all references of the types defined by refFlags, the references are
+    // detached with a single locked pass over the map, the vnodes are released
+    // outside of the locks after a single grace period
+    //
+    static void releaseAllReferences( __in UInt32 refFlags, __out_opt QvrVnodeReleaseReport* report = NULL );
+    
+    //---------------------------------------------------------------------
 };
 
 //--------------------------------------------------------------------
@@ -11,14 +11,15 @@
 #include "VmPmap.h"
 #include "VFSHooks.h"
 #include "VNode.h"
+#include "VopTrampoline.h"
 
 //--------------------------------------------------------------------
 
 //
-// the following two arrays must obey the rule - for any entry in the gQvrVnodeVopHookEntries array
-// there must be a corresponding entry in the gQvrVnodeVopEnumEntries array and in the gQvrVnodeOpvOffsetDesc
-// gQvrFakeVnodeopEntries arrays, vice versa is not true - the last three mentioned arrays might contain
-// more descriptors than the gQvrVnodeVopHookEntries array, so they can be filled in advance
+// the following two arrays are generated from QVR_HOOKED_VOPS, for any entry in the gQvrVnodeVopHookEntries
+// array there must be a corresponding entry in the gQvrVnodeOpvOffsetDesc array, vice versa is not true - the
+// gQvrVnodeOpvOffsetDesc and gQvrVnodeVopEnumEntries arrays might contain more descriptors than the
+// gQvrVnodeVopHookEntries array, so they can be filled in advance
 //
 
 //
@@ -41,23 +42,18 @@
 //
 
 struct vnodeopv_entry_desc gQvrVnodeVopHookEntries[] = {
-    { &vnop_reclaim_desc,  (VOPFUNC)QvrFsdReclaimHookEx2 },             /* reclaim */
-    { &vnop_read_desc,     (VOPFUNC)QvrVnopReadHookEx2 },		        /* read */
-    { &vnop_open_desc,     (VOPFUNC)QvrVnopOpenHookEx2 },		        /* open */
-    { &vnop_write_desc,    (VOPFUNC)QvrVnopWriteHookEx2 },		        /* write */
-    { &vnop_pagein_desc,   (VOPFUNC)QvrVnopPageinHookEx2 },		        /* Pagein */
-    { &vnop_pageout_desc,  (VOPFUNC)QvrVnopPageoutHookEx2 },		    /* Pageout */
-    { &vnop_lookup_desc,   (VOPFUNC)QvrVnopLookupHookEx2 },		        /* lookup */
-    { &vnop_create_desc,   (VOPFUNC)QvrVnopCreateHookEx2 },		        /* create */
-    { &vnop_close_desc,    (VOPFUNC)QvrVnopCloseHookEx2 },		        /* close */
-    { &vnop_inactive_desc, (VOPFUNC)QvrVnopInactiveHookEx2 },	        /* inactive */
-    //{ &vnop_mmap_desc,     (VOPFUNC)QvrFsdMmapHook  },                /* mmap */
-    { &vnop_rename_desc,   (VOPFUNC)QvrVnopRenameHookEx2 },             /* rename */
-    { &vnop_exchange_desc, (VOPFUNC)QvrVnopExchangeHookEx2 },           /* exchange */
-    { &vnop_getattr_desc,  (VOPFUNC)QvrVnopGetattrHookEx2 },            /* getattr */
+    QVR_HOOKED_VOPS( QVR_VOP_HOOK_ENTRY )
     { (struct vnodeop_desc*)NULL, (VOPFUNC)(int(*)())NULL }
 };
 
+//
+// the indices of the gQvrVnodeVopHookEntries entries
+//
+static const QvrVopEnum gQvrVnodeVopHookIndices[] = {
+    QVR_HOOKED_VOPS( QVR_VOP_HOOK_INDEX )
+    QvrVopEnum_Max
+};
+
 //
 // defines a mapping from the lookup entries to indices
 //
@@ -82,9 +78,41 @@ struct vnodeopv_entry_desc gQvrVnodeVopEnumEntries[] = {
     { (struct vnodeop_desc*)NULL, (VOPFUNC)QvrVopEnum_Max }
 };
 
+//
+// the three descriptor arrays resolved by QvrVnodeHookInit() into a table
+// indexed by QvrVopEnum, so the hooking and the original VOP lookup
+// don't scan the arrays for each operation
+//
+typedef struct _QvrVopDesc{
+    struct vnodeop_desc*  opve_op;  // NULL if the operation is not in gQvrVnodeVopEnumEntries
+    vm_offset_t           offset;   // QVR_VOP_UNKNOWN_OFFSET if the v_op offset is unknown
+    VOPFUNC               hook;     // NULL if the operation is not hooked
+} QvrVopDesc;
+
+static QvrVopDesc  gQvrVopDescs[ QvrVopEnum_Max ];
+
+//
+// the hooked operations in the gQvrVnodeVopHookEntries order
+//
+static QvrVopEnum  gQvrHookedVops[ QvrVopEnum_Max ];
+static int         gQvrHookedVopsCount = 0x0;
+
+#if QVR_MOUNT_WIDE_HOOKING
+//
+// the pinned v_op vectors indexed by a file system type number, a vector is
+// set once and is never reset as a pinned vector is never unhooked, a file system
+// type with a type number out of the array range is hooked per vnode, the type
+// is used instead of a mount as a mount structure can be reused after unmount
+//
+#define QVR_MOUNT_WIDE_TYPES  64
+
+static VOPFUNC* volatile  gQvrMountWideVops[ QVR_MOUNT_WIDE_TYPES ];
+#endif // QVR_MOUNT_WIDE_HOOKING
+
 //--------------------------------------------------------------------
 
 QvrVnodeHooksHashTable* QvrVnodeHooksHashTable::sVnodeHooksHashTable = NULL;
+QvrEpoch                QvrVnodeHooksHashTable::SnapshotEpoch;
 
 //--------------------------------------------------------------------
 
@@ -124,6 +152,91 @@ QvrRetriveVnodeOpvEntryDescByVnodeOp(
 
 //--------------------------------------------------------------------
 
+void
+QvrVnodeHookInit()
+/*
+ resolves the descriptor arrays, called once at the driver start
+ before any vnode is hooked, a hook entry without the offset
+ descriptor is not hooked
+ */
+{
+    for( int i = 0x0; i < QvrVopEnum_Max; ++i ){
+        
+        gQvrVopDescs[ i ].opve_op = NULL;
+        gQvrVopDescs[ i ].offset  = QVR_VOP_UNKNOWN_OFFSET;
+        gQvrVopDescs[ i ].hook    = NULL;
+    }
+    
+    for( int i = 0x0; NULL != gQvrVnodeVopEnumEntries[ i ].opve_op; ++i ){
+        
+        QvrVnodeOpvOffsetDesc*  offsetDescEntry;
+        QvrVopEnum              indx;
+        
+        indx = *(QvrVopEnum*)(&gQvrVnodeVopEnumEntries[ i ].opve_impl);// just to calm the compiler
+        assert( QvrVopEnum_Unknown < indx && indx < QvrVopEnum_Max );
+        
+        gQvrVopDescs[ indx ].opve_op = gQvrVnodeVopEnumEntries[ i ].opve_op;
+        
+        offsetDescEntry = QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc( gQvrVnodeVopEnumEntries[ i ].opve_op );
+        if( offsetDescEntry )
+            gQvrVopDescs[ indx ].offset = offsetDescEntry->offset;
+    }// end for
+    
+    gQvrHookedVopsCount = 0x0;
+    
+    for( int i = 0x0; NULL != gQvrVnodeVopHookEntries[ i ].opve_op; ++i ){
+        
+        QvrVnodeOpvOffsetDesc*  offsetDescEntry;
+        QvrVopEnum              indx = gQvrVnodeVopHookIndices[ i ];
+        
+        assert( QvrVopEnum_Unknown < indx && indx < QvrVopEnum_Max );
+        assert( NULL == gQvrVopDescs[ indx ].opve_op || gQvrVnodeVopHookEntries[ i ].opve_op == gQvrVopDescs[ indx ].opve_op );
+        
+        //
+        // a hooked operation doesn't need an entry in gQvrVnodeVopEnumEntries
+        //
+        if( NULL == gQvrVopDescs[ indx ].opve_op ){
+            
+            gQvrVopDescs[ indx ].opve_op = gQvrVnodeVopHookEntries[ i ].opve_op;
+            
+            offsetDescEntry = QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc( gQvrVnodeVopHookEntries[ i ].opve_op );
+            if( offsetDescEntry )
+                gQvrVopDescs[ indx ].offset = offsetDescEntry->offset;
+        }
+        
+        assert( QVR_VOP_UNKNOWN_OFFSET != gQvrVopDescs[ indx ].offset );
+        if( QVR_VOP_UNKNOWN_OFFSET == gQvrVopDescs[ indx ].offset ){
+            
+            DBG_PRINT_ERROR( ( "QvrVnodeHookInit()->QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc(%d) failed\n", i ) );
+            continue;
+        }
+        
+        assert( gQvrVnodeVopHookEntries[ i ].opve_impl );
+        
+        gQvrVopDescs[ indx ].hook = gQvrVnodeVopHookEntries[ i ].opve_impl;
+        gQvrHookedVops[ gQvrHookedVopsCount++ ] = indx;
+    }// end for
+}
+
+//--------------------------------------------------------------------
+
+VOPFUNC
+QvrGetVnodeOpByIndex(
+                     __in vnode_t      vnode,
+                     __in QvrVopEnum   indx
+                     )
+{
+    assert( QvrVopEnum_Unknown < indx && indx < QvrVopEnum_Max );
+    assert( QVR_VOP_UNKNOWN_OFFSET != gQvrVopDescs[ indx ].offset );
+    
+    if( QVR_VOP_UNKNOWN_OFFSET == gQvrVopDescs[ indx ].offset )
+        return NULL;
+    
+    return *(VOPFUNC*)((vm_offset_t)QvrGetVnodeOpVector( vnode ) + gQvrVopDescs[ indx ].offset);
+}
+
+//--------------------------------------------------------------------
+
 VOPFUNC
 QvrGetOriginalVnodeOp(
                       __in vnode_t      vnode,
@@ -140,11 +253,23 @@ QvrGetOriginalVnodeOp(
     
     v_op = QvrGetVnodeOpVector( vnode );
     
-    QvrVnodeHooksHashTable::sVnodeHooksHashTable->LockShared();
-    {// start of the lock
-        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, true );
-    }// end of the lock
-    QvrVnodeHooksHashTable::sVnodeHooksHashTable->UnLockShared();
+    //
+    // the fast path, the published snapshot is read inside the epoch
+    // with no lock and no entry reference
+    //
+    if( QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveOriginalVop( v_op, indx, &original ) ){
+        
+        assert( original );
+        return original;
+    }
+    
+    //
+    // the v_op is not in the snapshot, the snapshot allocation has failed
+    // or a hooking or unhooking is in progress, the hash table is concurrent
+    // so the lookup takes only the lock of the v_op's bucket group, the entry
+    // is referenced under the group lock, an unhooked v_op is handled below
+    //
+    existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, true );
     
     if( !existingEntry ){
         
@@ -167,9 +292,7 @@ QvrGetOriginalVnodeOp(
             existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, true );
             if( !existingEntry ){
                 
-                VOPFUNC*                 v_op;
-                QvrVnodeOpvOffsetDesc*   offsetDescEntry;
-                vnodeopv_entry_desc*     enumDescEntry;
+                VOPFUNC*  v_op;
                 
                 //
                 // get the v_op vector's address
@@ -177,21 +300,10 @@ QvrGetOriginalVnodeOp(
                 v_op = QvrGetVnodeOpVector( vnode );
                 assert( v_op );
                 
-                //
-                // get the enum descriptor for the index
-                //
-                enumDescEntry = QvrRetriveVnodeOpvEntryDescByVnodeOp( gQvrVnodeVopEnumEntries, (VOPFUNC)indx );
-                assert( enumDescEntry );
-                
-                //
-                // get the offset descriptor using the operation descriptor from the retrieved enum descriptor
-                //
-                offsetDescEntry = QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc( enumDescEntry->opve_op );
-                assert( offsetDescEntry );
-                assert( QVR_VOP_UNKNOWN_OFFSET != offsetDescEntry->offset );
-                assert( enumDescEntry->opve_op == offsetDescEntry->opve_op );
+                assert( gQvrVopDescs[ indx ].opve_op );
+                assert( QVR_VOP_UNKNOWN_OFFSET != gQvrVopDescs[ indx ].offset );
                 
-                original =  *(VOPFUNC*)((vm_offset_t)v_op + offsetDescEntry->offset);
+                original =  *(VOPFUNC*)((vm_offset_t)v_op + gQvrVopDescs[ indx ].offset);
                 
             }// end if( !existingEntry )
             
@@ -289,18 +401,21 @@ QvrHookVnodeVop(
     {// start of the lock
         
         //
-        // get a referenced entry
+        // the entry is not referenced as it can't be removed while the lock
+        // is held, the removal requires the exclusive lock
         //
-        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, true );
+        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, false );
         if( existingEntry ){
             
             //
             // account for the new vnode, the increment is an atomic
             // operation, and the hash is protected by the shared lock, so
             // unhook can't sneak in and unhook the vop table as before
-            // unhooking reacquires the lock exclusive
+            // unhooking reacquires the lock exclusive, a pinned vector
+            // is not accounted
             //
-            existingEntry->incrementVnodeCounter();
+            if( !existingEntry->isPinned() )
+                existingEntry->incrementVnodeCounter();
         }
         
     }// end of the lock
@@ -309,14 +424,8 @@ QvrHookVnodeVop(
     if( existingEntry ){
         
         //
-        // already hooked
-        //
-        assert( 0x0 != existingEntry->getVnodeCounter() );
-        
-        //
-        // RetrieveEntry() returns a referenced entry
+        // already hooked, the entry must not be touched as the lock has been released
         //
-        existingEntry->release();
         *isVopHooked = true;
         
         return kIOReturnSuccess;
@@ -340,7 +449,8 @@ QvrHookVnodeVop(
             //
             // account for the new vnode
             //
-            existingEntry->incrementVnodeCounter();
+            if( !existingEntry->isPinned() )
+                existingEntry->incrementVnodeCounter();
             
             goto __exit_with_lock;
         }
@@ -373,44 +483,25 @@ QvrHookVnodeVop(
         //
         // iterate through the registered hooks
         //
-        for( int i = 0x0; NULL != gQvrVnodeVopHookEntries[ i ].opve_op; ++i ){
-            
-            QvrVnodeOpvOffsetDesc*   offsetDescEntry;
-            vnodeopv_entry_desc*     enumDescEntry;
-            
-            offsetDescEntry = QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc( gQvrVnodeVopHookEntries[ i ].opve_op );
-            assert( offsetDescEntry );
-            if( !offsetDescEntry ){
-                
-                DBG_PRINT_ERROR( ( "QvrHookVnodeVop()->QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc(%d) failed\n", i ) );
-                continue;
-            }
+        for( int i = 0x0; i < gQvrHookedVopsCount; ++i ){
             
-            enumDescEntry = QvrRetriveVnodeOpvEntryDescByVnodeOpDesc( gQvrVnodeVopEnumEntries, offsetDescEntry->opve_op );
-            assert( enumDescEntry );
-            if( !enumDescEntry ){
-                
-                DBG_PRINT_ERROR( ( "QvrHookVnodeVop()->QvrRetriveVnodeOpvEntryDescByVnodeOpDesc(%d) failed\n", i ) );
-                continue;
-            }
+            QvrVopEnum    indx = gQvrHookedVops[ i ];
+            QvrVopDesc*   desc = &gQvrVopDescs[ indx ];
             
-            assert( offsetDescEntry->opve_op == enumDescEntry->opve_op );
-            assert( QVR_VOP_UNKNOWN_OFFSET != offsetDescEntry->offset );
-            assert( gQvrVnodeVopHookEntries[ i ].opve_impl );
+            assert( QVR_VOP_UNKNOWN_OFFSET != desc->offset );
+            assert( desc->hook );
             
             VOPFUNC       original;
             VOPFUNC       hook;
-            QvrVopEnum    indx;
             unsigned int  bytes;
             
-            original = *(VOPFUNC*)((vm_offset_t)v_op + offsetDescEntry->offset);
-            hook = gQvrVnodeVopHookEntries[ i ].opve_impl;
-            indx = *(QvrVopEnum*)(&enumDescEntry->opve_impl);// just to calm the compiler
+            original = *(VOPFUNC*)((vm_offset_t)v_op + desc->offset);
+            hook = desc->hook;
             
             assert( hook && original );
             
             if( ( VREG != vnode_vtype( vnode ) && VDIR != vnode_vtype( vnode ) ) &&
-               &vnop_strategy_desc == gQvrVnodeVopHookEntries[ i ].opve_op ){
+               QvrVopEnum_strategy == indx ){
                 
                 //
                 // do not hook the device's vnode strategic routine as
@@ -455,7 +546,7 @@ QvrHookVnodeVop(
             // change to the hooking function
             //
             bytes = QvrWriteWiredSrcToWiredDst( (vm_offset_t)&hook,
-                                               (vm_offset_t)v_op + offsetDescEntry->offset,
+                                               (vm_offset_t)v_op + desc->offset,
                                                sizeof( VOPFUNC ) );
             
             assert( sizeof( VOPFUNC ) == bytes );
@@ -498,9 +589,10 @@ QvrUnHookVnodeVop(
     assert( NULL != QvrVnodeHooksHashTable::sVnodeHooksHashTable );
     
     //
-    // see QvrHookVnodeVop(), we are not hooking all vnodes
+    // see QvrHookVnodeVop(), we are not hooking all vnodes,
+    // the hooked flag is checked and cleared with a single map access
     //
-    if( VREG != vnode_vtype( vnode ) || !VNodeMap::isVnodeHooked( vnode ) ){
+    if( VREG != vnode_vtype( vnode ) || !VNodeMap::clearHookedVnode( vnode ) ){
         
         //
         // we are interested only in disk related vnodes
@@ -523,24 +615,40 @@ QvrUnHookVnodeVop(
     
     QvrVnodeHooksHashTable::sVnodeHooksHashTable->LockShared();
     {// start of the lock
-        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, true );
+        
+        //
+        // the entry is referenced only if it is going to be removed
+        //
+        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, false );
+        
+        //
+        // a pinned vector is not unhooked, the vnodes hooked before the vector
+        // was pinned are not accounted any longer
+        //
+        if( existingEntry && existingEntry->isPinned() )
+            existingEntry = NULL;
+        
+        if( existingEntry ){
+            
+            existingEntry->decrementVnodeCounter();
+            
+            //
+            // fast check, the per-CPU counters are summed, a concurrent hooking
+            // might make the sum not zero, in that case the hooking thread is
+            // responsible for the unhooking
+            //
+            if( 0x0 == existingEntry->getVnodeCounter() )
+                existingEntry->retain();
+            else
+                existingEntry = NULL;
+        }
+        
     }// end of the lock
     QvrVnodeHooksHashTable::sVnodeHooksHashTable->UnLockShared();
     
     if( !existingEntry )
         return;
     
-    VNodeMap::removeHookedVnode( vnode );
-    
-    //
-    // fast check
-    //
-    if( 0x1 != existingEntry->decrementVnodeCounter() ){
-        
-        existingEntry->release();
-        return;
-    }
-    
     QvrVnodeHooksHashTable::sVnodeHooksHashTable->LockExclusive();
     {// start of the lock
         
@@ -548,7 +656,7 @@ QvrUnHookVnodeVop(
         // the counter might have been incremented as the entry has not been removed
         // from the hash table
         //
-        if( 0x0 != existingEntry->getVnodeCounter() )
+        if( 0x0 != existingEntry->getVnodeCounter() || existingEntry->isPinned() )
             goto __exit_with_lock;
         
         existingEntry->release();
@@ -575,37 +683,17 @@ QvrUnHookVnodeVop(
         //
         // iterate through the registered hooks
         //
-        for( int i = 0x0; NULL != gQvrVnodeVopHookEntries[ i ].opve_op; ++i ){
-            
-            QvrVnodeOpvOffsetDesc*   offsetDescEntry;
-            vnodeopv_entry_desc*     enumDescEntry;
-            
-            offsetDescEntry = QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc( gQvrVnodeVopHookEntries[ i ].opve_op );
-            assert( offsetDescEntry );
-            if( !offsetDescEntry ){
-                
-                DBG_PRINT_ERROR( ( "QvrHookVnodeVop()->QvrRetriveVnodeOpvOffsetDescByVnodeOpDesc(%d) failed\n", i ) );
-                continue;
-            }
+        for( int i = 0x0; i < gQvrHookedVopsCount; ++i ){
             
-            enumDescEntry = QvrRetriveVnodeOpvEntryDescByVnodeOpDesc( gQvrVnodeVopEnumEntries, offsetDescEntry->opve_op );
-            assert( enumDescEntry );
-            if( !enumDescEntry ){
-                
-                DBG_PRINT_ERROR( ( "QvrHookVnodeVop()->QvrRetriveVnodeOpvEntryDescByVnodeOpDesc(%d) failed\n", i ) );
-                continue;
-            }
+            QvrVopEnum    indx = gQvrHookedVops[ i ];
+            QvrVopDesc*   desc = &gQvrVopDescs[ indx ];
             
-            assert( offsetDescEntry->opve_op == enumDescEntry->opve_op );
-            assert( QVR_VOP_UNKNOWN_OFFSET != offsetDescEntry->offset );
-            assert( gQvrVnodeVopHookEntries[ i ].opve_impl );
+            assert( QVR_VOP_UNKNOWN_OFFSET != desc->offset );
+            assert( desc->hook );
             
             VOPFUNC       original;
-            QvrVopEnum    indx;
             unsigned int  bytes;
             
-            indx = *(QvrVopEnum*)(&enumDescEntry->opve_impl);// just to calm the compiler
-            
             //
             // the hooking could have been deliberately skipped, as in the case of the
             // strategic routine for specfs
@@ -620,7 +708,7 @@ QvrUnHookVnodeVop(
             // restore to the original function
             //
             bytes = QvrWriteWiredSrcToWiredDst( (vm_offset_t)&original,
-                                               (vm_offset_t)v_op + offsetDescEntry->offset,
+                                               (vm_offset_t)v_op + desc->offset,
                                                sizeof( VOPFUNC ) );
             
             assert( sizeof( VOPFUNC ) == bytes );
@@ -642,6 +730,91 @@ QvrUnHookVnodeVop(
 
 //--------------------------------------------------------------------
 
+#if QVR_MOUNT_WIDE_HOOKING
+
+static
+int
+QvrMountWideTypeIndex(
+    __in vnode_t vnode
+    )
+{
+    mount_t  mp = vnode_mount( vnode );
+    int      typenum;
+    
+    if( !mp )
+        return (-1);
+    
+    typenum = vfs_typenum( mp );
+    if( typenum < 0x0 || typenum >= QVR_MOUNT_WIDE_TYPES )
+        return (-1);
+    
+    return typenum;
+}
+
+//
+// true if the vnode's v_op vector is pinned and the parent shares the
+// vnode's mount, the check takes no lock and no table lookup
+//
+static
+bool
+QvrIsVnodeOpVectorPinned(
+    __in vnode_t vnode
+    )
+{
+    int  indx = QvrMountWideTypeIndex( vnode );
+    
+    if( (-1) == indx )
+        return false;
+    
+    //
+    // the root's parent is on the covered file system
+    //
+    return ( QvrGetVnodeOpVector( vnode ) == gQvrMountWideVops[ indx ] && !vnode_isvroot( vnode ) );
+}
+
+//
+// pins the vnode's hooked v_op vector for the vnode's file system type
+//
+static
+void
+QvrPinVnodeOpVector(
+    __in vnode_t vnode
+    )
+{
+    VOPFUNC*            v_op;
+    QvrVnodeHookEntry*  existingEntry;
+    int                 indx = QvrMountWideTypeIndex( vnode );
+    
+    if( (-1) == indx || NULL != gQvrMountWideVops[ indx ] )
+        return;
+    
+    v_op = QvrGetVnodeOpVector( vnode );
+    
+    QvrVnodeHooksHashTable::sVnodeHooksHashTable->LockShared();
+    {// start of the lock
+        
+        //
+        // the entry can't be removed while the lock is held
+        //
+        existingEntry = QvrVnodeHooksHashTable::sVnodeHooksHashTable->RetrieveEntry( v_op, false );
+        if( existingEntry )
+            existingEntry->pin();
+        
+    }// end of the lock
+    QvrVnodeHooksHashTable::sVnodeHooksHashTable->UnLockShared();
+    
+    //
+    // the type's first vector is pinned, the other vectors of the type are hooked per vnode,
+    // the pinned flag is set before the vector is published
+    //
+    if( existingEntry )
+        OSCompareAndSwapPtr( NULL, v_op, (void* volatile*)&gQvrMountWideVops[ indx ] );
+}
+
+#endif // QVR_MOUNT_WIDE_HOOKING
+
+//--------------------------------------------------------------------
+
 void
 QvrHookVnodeVopAndParent(
     __inout vnode_t vnode
@@ -650,9 +823,19 @@ QvrHookVnodeVopAndParent(
     bool isHooked;
     IOReturn  RC;
     
+#if QVR_MOUNT_WIDE_HOOKING
+    if( QvrIsVnodeOpVectorPinned( vnode ) )
+        return;
+#endif // QVR_MOUNT_WIDE_HOOKING
+    
     RC = QvrHookVnodeVop( vnode, &isHooked );
     assert( kIOReturnSuccess == RC || kIOReturnNoDevice == RC );
     
+#if QVR_MOUNT_WIDE_HOOKING
+    if( kIOReturnSuccess == RC )
+        QvrPinVnodeOpVector( vnode );
+#endif // QVR_MOUNT_WIDE_HOOKING
+    
     vnode_t  parent = vnode_getparent( vnode );
     if( parent ){
         
@@ -668,6 +851,15 @@ QvrUnHookVnodeVopAndParent(
     __inout vnode_t vnode
     )
 {
+#if QVR_MOUNT_WIDE_HOOKING
+    //
+    // the same check as in QvrHookVnodeVopAndParent(), a vector is never unpinned
+    // so a vnode skipped on hooking is skipped on unhooking
+    //
+    if( QvrIsVnodeOpVectorPinned( vnode ) )
+        return;
+#endif // QVR_MOUNT_WIDE_HOOKING
+    
     QvrUnHookVnodeVop( vnode );
     
     vnode_t  parent = vnode_getparent( vnode );
@@ -700,7 +892,10 @@ QvrVnodeHooksHashTable::withSize( int size, bool non_block )
         return NULL;
     }
     
-    vNodeHooksHashTable->HashTable = ght_create( size, non_block );
+    //
+    // the key is a v_op vector address
+    //
+    vNodeHooksHashTable->HashTable = ght_create_fixed( size, non_block, sizeof( VOPFUNC* ) );
     assert( vNodeHooksHashTable->HashTable );
     if( !vNodeHooksHashTable->HashTable ){
         
@@ -711,6 +906,39 @@ QvrVnodeHooksHashTable::withSize( int size, bool non_block )
         return NULL;
     }
     
+    //
+    // the table grows with the number of hooked v_op vectors, the rehash is
+    // spread over the insertions and removals which are made under the exclusive
+    // lock, so a lookup on the hook path never waits for a whole table rehash
+    //
+    ght_set_rehash( vNodeHooksHashTable->HashTable, GHT_REHASH_INCREMENTAL );
+
+    //
+    // the buckets allocated for a burst of hooked vectors are released when
+    // the vectors are unhooked, the table doesn't shrink under its initial size
+    //
+    ght_set_shrink( vNodeHooksHashTable->HashTable, size );
+
+    //
+    // the table is looked up on each intercepted VOP, the lookups take the locks
+    // of the bucket groups and are not serialized with the RWLock, the RWLock
+    // serializes the hooking and unhooking which are made as a sequence of the
+    // table operations
+    //
+    if( !ght_set_concurrent( vNodeHooksHashTable->HashTable, GHT_LOCK_GROUPS, QvrVnodeHooksHashTable::ReferenceEntry ) ){
+        
+        DBG_PRINT_ERROR( ( "ght_set_concurrent() failed\n" ) );
+        
+        ght_finalize( vNodeHooksHashTable->HashTable );
+        vNodeHooksHashTable->HashTable = NULL;
+        
+        IORWLockFree( vNodeHooksHashTable->RWLock );
+        vNodeHooksHashTable->RWLock = NULL;
+        
+        delete vNodeHooksHashTable;
+        return NULL;
+    }
+    
     return vNodeHooksHashTable;
 }
 
@@ -732,8 +960,9 @@ bool QvrVnodeHookEntry::init()
         return false;
     }
     
-    this->vNodeCounter = 0x0;
+    bzero( this->vNodeCounter, sizeof( this->vNodeCounter ) );
     bzero( this->origVop, sizeof( this->origVop ) );
+    this->pinned = false;
     
 #if defined( DBG )
     this->inHash       = false;
@@ -745,7 +974,7 @@ bool QvrVnodeHookEntry::init()
 
 void QvrVnodeHookEntry::free()
 {
-    assert( 0x0 == this->vNodeCounter );
+    assert( 0x0 == this->getVnodeCounter() );
 #if defined( DBG )
     assert( !this->inHash );
 #endif
@@ -760,6 +989,9 @@ QvrVnodeHooksHashTable::CreateStaticTableWithSize( int size, bool non_block )
 {
     assert( !QvrVnodeHooksHashTable::sVnodeHooksHashTable );
     
+    if( ! SnapshotEpoch.init() )
+        return false;
+    
     QvrVnodeHooksHashTable::sVnodeHooksHashTable = QvrVnodeHooksHashTable::withSize( size, non_block );
     assert( QvrVnodeHooksHashTable::sVnodeHooksHashTable );
     
@@ -781,6 +1013,103 @@ QvrVnodeHooksHashTable::DeleteStaticTable()
 
 //--------------------------------------------------------------------
 
+//
+// a file system has separate v_op vectors for regular vnodes, fifos and devices,
+// the stacked file systems and the file systems with per-mount vectors add a vector
+// per mount
+//
+#define QVR_VOP_VECTORS_PER_FS_TYPE   3
+#define QVR_VOP_VECTORS_PER_MOUNT     1
+
+#define QVR_MIN_HOOKS_TABLE_SIZE      8
+#define QVR_MAX_HOOKS_TABLE_SIZE      1024
+
+typedef struct _QvrMountsCount{
+    int   mounts;
+    int   types;
+    int   typenums[ 64 ]; // the distinct types which have been counted
+} QvrMountsCount;
+
+static
+int
+QvrCountMountsCallback(
+    __in mount_t mp,
+    __in void*   arg
+    )
+{
+    QvrMountsCount*  count = (QvrMountsCount*)arg;
+    int              typenum = vfs_typenum( mp );
+    int              i;
+    
+    count->mounts += 1;
+    
+    for( i = 0x0; i < count->types; ++i ){
+        
+        if( typenum == count->typenums[ i ] )
+            break;
+    }// end for
+    
+    //
+    // the types that do not fit in the array are accounted as the mounts' vectors
+    //
+    if( i == count->types ){
+        
+        if( count->types < (int)__countof( count->typenums ) )
+            count->typenums[ count->types++ ] = typenum;
+        else
+            count->mounts += QVR_VOP_VECTORS_PER_FS_TYPE;
+    }
+    
+    return VFS_RETURNED;
+}
+
+int
+QvrVnodeHooksHashTable::EstimateStaticTableSize()
+{
+    QvrMountsCount  count;
+    int             vectors;
+    int             size;
+    
+    assert( preemption_enabled() );
+    
+    bzero( &count, sizeof( count ) );
+    
+    vfs_iterate( 0x0, QvrCountMountsCallback, &count );
+    
+    vectors = count.types * QVR_VOP_VECTORS_PER_FS_TYPE + count.mounts * QVR_VOP_VECTORS_PER_MOUNT;
+    
+    //
+    // a power of 2 not less than the number of vectors, i.e. a chain per vector
+    //
+    for( size = QVR_MIN_HOOKS_TABLE_SIZE; size < vectors && size < QVR_MAX_HOOKS_TABLE_SIZE; size <<= 1 );
+    
+    DBG_PRINT(( "QvrVnodeHooksHashTable::EstimateStaticTableSize() %d mounts, %d file system types, %d buckets\n",
+                count.mounts, count.types, size ));
+    
+    return size;
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVnodeHooksHashTable::GetStaticTableStatistics(
+    __out VFSTableStatistics* report
+    )
+{
+    bzero( report, sizeof( *report ) );
+    
+    if( NULL == QvrVnodeHooksHashTable::sVnodeHooksHashTable )
+        return;
+    
+    QvrVnodeHooksHashTable::sVnodeHooksHashTable->LockShared();
+    {// start of the lock
+        ght_get_statistics( QvrVnodeHooksHashTable::sVnodeHooksHashTable->HashTable, report );
+    }// end of the lock
+    QvrVnodeHooksHashTable::sVnodeHooksHashTable->UnLockShared();
+}
+
+//--------------------------------------------------------------------
+
 void
 QvrVnodeHooksHashTable::free()
 {
@@ -798,6 +1127,18 @@ QvrVnodeHooksHashTable::free()
     
     this->HashTable = NULL;
     
+    //
+    // the hooks are removed so there are no readers, the retired snapshots
+    // release their entries' references
+    //
+    if( this->Snapshot ){
+        
+        FreeSnapshot( this->Snapshot );
+        this->Snapshot = NULL;
+    }
+    
+    SnapshotEpoch.reclaim();
+    
     for( p_e = (ght_hash_entry_t*)ght_first( p_table, &iterator, (const void**)&p_key );
         NULL != p_e;
         p_e = (ght_hash_entry_t*)ght_next( p_table, &iterator, (const void**)&p_key ) ){
@@ -846,6 +1187,8 @@ QvrVnodeHooksHashTable::AddEntry(
 #if defined( DBG )
         entry->inHash = true;
 #endif//DBG
+        
+        this->PublishSnapshot();
     }
     
     return ( GHT_OK == RC );
@@ -877,6 +1220,9 @@ QvrVnodeHooksHashTable::RemoveEntry(
     }
 #endif//DBG
     
+    if( entry )
+        this->PublishSnapshot();
+    
     return entry;
 }
 
@@ -888,18 +1234,163 @@ QvrVnodeHooksHashTable::RetrieveEntry(
                                       __in bool reference
                                       )
 /*
- the returned entry is referenced if the refernce's value is "true"
+ the returned entry is referenced if the refernce's value is "true",
+ the entry can be retrieved with a reference without holding the RWLock
  */
 {
-    QvrVnodeHookEntry* entry;
+    if( reference )
+        return (QvrVnodeHookEntry*)ght_get_and_reference( this->HashTable, sizeof( v_op ), &v_op );
     
-    entry = (QvrVnodeHookEntry*)ght_get( this->HashTable, sizeof( v_op ), &v_op );
+    return (QvrVnodeHookEntry*)ght_get( this->HashTable, sizeof( v_op ), &v_op );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVnodeHooksHashTable::ReferenceEntry(
+                                       __in void* entry
+                                       )
+/*
+ called by the hash table under the bucket group lock
+ */
+{
+    ((QvrVnodeHookEntry*)entry)->retain();
+}
+
+//--------------------------------------------------------------------
+
+bool
+QvrVnodeHooksHashTable::RetrieveOriginalVop(
+                                            __in VOPFUNC* v_op,
+                                            __in QvrVopEnum indx,
+                                            __out VOPFUNC* original
+                                            )
+/*
+ called for each intercepted VOP, the snapshot and its entries
+ are not released until the reader leaves the epoch
+ */
+{
+    QvrVnodeHooksSnapshot*  snapshot;
+    QvrVnodeHookEntry*      entry = NULL;
+    UInt32                  token;
     
-    if( entry && reference )
-        entry->retain();
+    token = SnapshotEpoch.enter();
+    {// start of the epoch
+        
+        snapshot = this->Snapshot;
+        if( snapshot )
+            entry = snapshot->find( v_op );
+        
+        if( entry )
+            *original = entry->getOrignalVop( indx );
+        
+    }// end of the epoch
+    SnapshotEpoch.leave( token );
     
-    return entry;
+    return ( NULL != entry );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVnodeHooksHashTable::PublishSnapshot()
+/*
+ the RWLock must be held exclusive, if there is no memory the snapshot
+ is removed and the lookups use the hash table until the next change
+ */
+{
+    QvrVnodeHooksSnapshot*  snapshot = NULL;
+    QvrVnodeHooksSnapshot*  oldSnapshot;
+    UInt32                  count = ght_size( this->HashTable );
+    UInt32                  size = 0x4;
+    
+    assert( preemption_enabled() );
+    
+    while( size < 2*count )
+        size <<= 1;
+    
+    if( 0x0 != count ){
+        
+        snapshot = (QvrVnodeHooksSnapshot*)IOMalloc( QvrVnodeHooksSnapshot::allocationSize( size ) );
+        assert( snapshot );
+        if( !snapshot ){
+            
+            DBG_PRINT_ERROR( ( "QvrVnodeHooksHashTable::PublishSnapshot()->IOMalloc( %u ) failed\n",
+                               (unsigned int)QvrVnodeHooksSnapshot::allocationSize( size ) ) );
+        }
+    }
+    
+    if( snapshot ){
+        
+        ght_iterator_t      iterator;
+        const void*         p_key;
+        QvrVnodeHookEntry*  entry;
+        
+        bzero( snapshot, QvrVnodeHooksSnapshot::allocationSize( size ) );
+        snapshot->size = size;
+        
+        //
+        // the iteration is serialized with the modifications by the RWLock
+        //
+        for( entry = (QvrVnodeHookEntry*)ght_first( this->HashTable, &iterator, &p_key );
+             NULL != entry;
+             entry = (QvrVnodeHookEntry*)ght_next( this->HashTable, &iterator, &p_key ) ){
+            
+            VOPFUNC*  v_op = *(VOPFUNC**)p_key;
+            UInt32    i;
+            
+            for( i = QvrVnodeHooksSnapshot::slotIndex( v_op, size ); NULL != snapshot->slots[ i ].v_op; i = ( i + 1 ) & ( size - 1 ) ){
+                
+                assert( v_op != snapshot->slots[ i ].v_op );
+            }
+            
+            entry->retain();
+            snapshot->slots[ i ].v_op  = v_op;
+            snapshot->slots[ i ].entry = entry;
+            snapshot->count += 1;
+        } // end for
+        
+        assert( count == snapshot->count );
+    }
+    
+    oldSnapshot = this->Snapshot;
+    
+    //
+    // publish the initialized snapshot, the atomic operation is a barrier
+    //
+    OSCompareAndSwapPtr( oldSnapshot, snapshot, (void* volatile*)&this->Snapshot );
+    
+    if( oldSnapshot )
+        SnapshotEpoch.retire( RetiredSnapshotCallback, oldSnapshot );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVnodeHooksHashTable::FreeSnapshot(
+                                     __in QvrVnodeHooksSnapshot* snapshot
+                                     )
+{
+    for( UInt32 i = 0x0; i < snapshot->size; ++i ){
+        
+        if( snapshot->slots[ i ].entry )
+            snapshot->slots[ i ].entry->release();
+    }
+    
+    IOFree( snapshot, QvrVnodeHooksSnapshot::allocationSize( snapshot->size ) );
 }
 
 //--------------------------------------------------------------------
 
+void
+QvrVnodeHooksHashTable::RetiredSnapshotCallback(
+                                                __in void* snapshot
+                                                )
+/*
+ called after a grace period, no reader can see the snapshot
+ */
+{
+    FreeSnapshot( (QvrVnodeHooksSnapshot*)snapshot );
+}
+
+//--------------------------------------------------------------------
@@ -30,6 +30,7 @@ extern "C" {
 
 #include "Common.h"
 #include "CommonHashTable.h"
+#include "Epoch.h"
 
 //--------------------------------------------------------------------
 
@@ -37,6 +38,17 @@ extern "C" {
 
 //--------------------------------------------------------------------
 
+//
+// set to 0 to hook the v_op vectors per vnode, otherwise a v_op vector of a file system
+// type is hooked once by the first vnode and the following vnodes of the type are skipped
+// by QvrHookVnodeVopAndParent() and QvrUnHookVnodeVopAndParent()
+//
+#ifndef QVR_MOUNT_WIDE_HOOKING
+#define QVR_MOUNT_WIDE_HOOKING  1
+#endif
+
+//--------------------------------------------------------------------
+
 typedef enum _QvrVopEnum{
     QvrVopEnum_Unknown = 0x0,
     
@@ -109,9 +121,18 @@ class QvrVnodeHookEntry: public OSObject
 private:
     
     //
-    // the number of vnodes which we are aware of for this v_op vector
+    // the number of vnodes which we are aware of for this v_op vector,
+    // the counter is split in per-CPU slots so the hooking and unhooking
+    // on different CPUs do not contend for a cache line, a slot might be
+    // negative as a vnode can be unhooked on another CPU, only the sum
+    // of the slots is meaningful
     //
-    SInt32 vNodeCounter;
+    class CpuCounter{
+    public:
+        SInt32 volatile   count;
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+    CpuCounter   vNodeCounter[ QVR_CPU_SLOTS ];
     
     //
     // the value is used to mark the origVop's entry as
@@ -128,6 +149,12 @@ private:
     //
     VOPFUNC  origVop[ QvrVopEnum_Max ];
     
+    //
+    // a pinned v_op vector has been hooked for the whole file system type
+    // and is never unhooked, the vnode counter is not maintained for it
+    //
+    bool volatile  pinned;
+    
 #if defined( DBG )
     bool   inHash;
 #endif
@@ -193,36 +220,112 @@ public:
         return ( this->vopNotHooked != this->origVop[ (int)indx ] );
     }
     
-    //
-    // returns te value before the increment
-    //
-    SInt32
+    void
     incrementVnodeCounter(){
         
-        assert( this->vNodeCounter < 0x80000000 );
-        return OSIncrementAtomic( &this->vNodeCounter );
+        OSIncrementAtomic( &this->vNodeCounter[ QvrCurrentCpuSlot() ].count );
     }
     
     //
-    // returns te value before the decrement
+    // the atomic operation is a full barrier so the last of the concurrent
+    // decrementers sees all decrements in the getVnodeCounter() sum
     //
-    SInt32
+    void
     decrementVnodeCounter(){
         
-        assert( this->vNodeCounter > 0x0 && this->vNodeCounter < 0x80000000);
-        return OSDecrementAtomic( &this->vNodeCounter );
+        OSDecrementAtomic( &this->vNodeCounter[ QvrCurrentCpuSlot() ].count );
+    }
+    
+    //
+    // a pinned entry is never unhooked and its vnode counter is not maintained
+    //
+    void
+    pin(){
+        
+        this->pinned = true;
     }
     
+    bool
+    isPinned(){
+        
+        return this->pinned;
+    }
+    
+    //
+    // sums the slots, the value is exact only if there are no concurrent
+    // increments i.e. the caller holds the table lock, the increments are
+    // made under the table lock
+    //
     SInt32
     getVnodeCounter(){
         
-        return this->vNodeCounter;
+        SInt32  count = 0x0;
+        
+        for( int i = 0x0; i < QVR_CPU_SLOTS; ++i )
+            count += this->vNodeCounter[ i ].count;
+        
+        return count;
     }
     
 };
 
 //--------------------------------------------------------------------
 
+//
+// an immutable copy of the hooks table published for the lookups on the VOP path,
+// an open addressing array of the v_op to entry mappings, the snapshot holds
+// a reference to each entry, a new snapshot is built when the table changes
+// and the old one is released after the epoch's grace period
+//
+class QvrVnodeHooksSnapshot{
+    
+public:
+    
+    class Slot{
+    public:
+        VOPFUNC*            v_op;  // NULL for an empty slot
+        QvrVnodeHookEntry*  entry;
+    };
+    
+    UInt32   size;  // a power of 2, at least twice the number of entries
+    UInt32   count;
+    Slot     slots[ 1 ];
+    
+public:
+    
+    static vm_size_t allocationSize( __in UInt32 size ) { return sizeof( QvrVnodeHooksSnapshot ) + ( size - 1 )*sizeof( Slot ); }
+    
+    static UInt32 slotIndex( __in VOPFUNC* v_op, __in UInt32 size )
+    {
+        //
+        // a finalizer from the 64 bit MurmurHash3
+        //
+        UInt64 h = (UInt64)v_op;
+        
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        
+        return (UInt32)h & ( size - 1 );
+    }
+    
+    QvrVnodeHookEntry* find( __in VOPFUNC* v_op )
+    {
+        //
+        // there is always an empty slot so the loop ends
+        //
+        for( UInt32 i = slotIndex( v_op, size ); NULL != slots[ i ].v_op; i = ( i + 1 ) & ( size - 1 ) ){
+            
+            if( v_op == slots[ i ].v_op )
+                return slots[ i ].entry;
+        }
+        
+        return NULL;
+    }
+};
+
+//--------------------------------------------------------------------
+
 class QvrVnodeHooksHashTable
 {
     
@@ -231,6 +334,16 @@ private:
     ght_hash_table_t*  HashTable;
     IORWLock*          RWLock;
     
+    //
+    // NULL if there is no snapshot, the lookups then use the hash table
+    //
+    QvrVnodeHooksSnapshot* volatile  Snapshot;
+    
+    //
+    // the snapshot readers take no lock and no entry reference
+    //
+    static QvrEpoch    SnapshotEpoch;
+    
 #if defined(DBG)
     thread_t           ExclusiveThread;
 #endif//DBG
@@ -245,6 +358,20 @@ private:
     //
     void free();
     
+    //
+    // references an entry found by a lookup, a hash table callback
+    //
+    static void ReferenceEntry( __in void* entry );
+    
+    //
+    // replaces the snapshot with a copy of the hash table,
+    // the RWLock must be held exclusive
+    //
+    void PublishSnapshot();
+    
+    static void FreeSnapshot( __in QvrVnodeHooksSnapshot* snapshot );
+    static void RetiredSnapshotCallback( __in void* snapshot );
+    
     //
     // as usual for IOKit the desctructor and constructor do nothing
     // as it is impossible to return an error from the constructor
@@ -255,6 +382,7 @@ private:
         
         this->HashTable = NULL;
         this->RWLock = NULL;
+        this->Snapshot = NULL;
 #if defined(DBG)
         this->ExclusiveThread = NULL;
 #endif//DBG
@@ -267,7 +395,7 @@ private:
     ~QvrVnodeHooksHashTable()
     {
         
-        assert( !this->HashTable && !this->RWLock );
+        assert( !this->HashTable && !this->RWLock && !this->Snapshot );
     };
     
 public:
@@ -275,6 +403,17 @@ public:
     static bool CreateStaticTableWithSize( int size, bool non_block );
     static void DeleteStaticTable();
     
+    //
+    // returns an initial size for the static table estimated from the mounted
+    // file systems, the table grows online if the estimate is exceeded
+    //
+    static int EstimateStaticTableSize();
+    
+    //
+    // the lookup, rehash and lock counters for the static table
+    //
+    static void GetStaticTableStatistics( __out VFSTableStatistics* report );
+    
     //
     // adds an entry to the hash table, the entry is referenced so the caller must
     // dereference the entry if it has been referenced
@@ -289,17 +428,28 @@ public:
     
     //
     // returns an entry from the hash table, the returned entry is referenced
-    // if the refrence's value is "true"
+    // if the refrence's value is "true", a referenced entry can be retrieved
+    // without the lock as the hash table is concurrent
     //
     QvrVnodeHookEntry*   RetrieveEntry( __in VOPFUNC* v_op, __in bool reference = true );
     
+    //
+    // looks up the published snapshot without any lock or reference, returns
+    // false if the v_op is not in the snapshot, the caller then uses the table
+    //
+    bool   RetrieveOriginalVop( __in VOPFUNC* v_op, __in QvrVopEnum indx, __out VOPFUNC* original );
+    
     
     void
     LockShared()
     {   assert( this->RWLock );
         assert( preemption_enabled() );
         
+        UInt64 start = QvrTableStatistics::now();
+        
         IORWLockRead( this->RWLock );
+        
+        this->HashTable->stats.lockAcquired( QvrTableStatistics::now() - start );
     };
     
     
@@ -322,8 +472,12 @@ public:
         assert( current_thread() != this->ExclusiveThread );
 #endif//DBG
         
+        UInt64 start = QvrTableStatistics::now();
+        
         IORWLockWrite( this->RWLock );
         
+        this->HashTable->stats.lockAcquired( QvrTableStatistics::now() - start );
+        
 #if defined(DBG)
         assert( NULL == this->ExclusiveThread );
         this->ExclusiveThread = current_thread();
@@ -362,6 +516,24 @@ QvrHookVnodeVop(
                 __inout bool* isVopHooked
                 );
 
+//
+// builds the QvrVopEnum indexed descriptors, must be called before any vnode is hooked
+//
+extern
+void
+QvrVnodeHookInit();
+
+//
+// returns the current function in the vnode's v_op vector, a hooking function if
+// the vector is hooked, the same as QvrGetVnop() without a descriptor scan
+//
+extern
+VOPFUNC
+QvrGetVnodeOpByIndex(
+                     __in vnode_t      vnode,
+                     __in QvrVopEnum   indx
+                     );
+
 extern
 VOPFUNC
 QvrGetOriginalVnodeOp(
@@ -0,0 +1,76 @@
+//
+//  VopOriginal.h
+//  VFSFilter0
+//
+//  Created by slava on 31/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__VopOriginal__
+#define __VFSFilter0__VopOriginal__
+
+//
+// the header doesn't depend on the kernel headers so QvrVopTrampoline can be
+// built in user mode, see VFSFilter0Bench/VopTrampolineBench.cpp
+//
+#if defined( KERNEL )
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+#include <kern/clock.h>
+    
+#ifdef __cplusplus
+}
+#endif
+
+#include "Common.h"
+
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+//
+// the original function of a hooked VOP as it is passed to the VOP's handler,
+// a handler calls it as a function, if the timing is started by the caller
+// the time spent in the original function is accumulated, see QvrVopStatistics
+//
+template< class Args >
+class QvrVopOriginal{
+    
+private:
+    
+    int (*vnop)( Args* ap );
+    
+    bool     timed;
+    UInt32   calls;
+    UInt64   elapsed; // in absolute time units
+    
+public:
+    
+    QvrVopOriginal( __in int (*vnop)( Args* ap ) ) : vnop( vnop ), timed( false ), calls( 0x0 ), elapsed( 0x0 ) {}
+    
+    void startTiming() { this->timed = true; }
+    
+    UInt32 getCalls() const { return this->calls; }
+    UInt64 getElapsed() const { return this->elapsed; }
+    
+    int operator()( __inout Args* ap )
+    {
+        if( ! this->timed )
+            return this->vnop( ap );
+        
+        UInt64  start = mach_absolute_time();
+        int     error = this->vnop( ap );
+        
+        this->elapsed += mach_absolute_time() - start;
+        this->calls   += 0x1;
+        
+        return error;
+    }
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__VopOriginal__) */
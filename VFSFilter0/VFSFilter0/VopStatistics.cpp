@@ -0,0 +1,152 @@
+//
+//  VopStatistics.cpp
+//  VFSFilter0
+//
+//  Created by slava on 31/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "VopStatistics.h"
+
+//--------------------------------------------------------------------
+
+QvrVopStatistics   QvrVopStatistics::Instance;
+
+//
+// the names of the hooked VOPs in the QvrHookedVopEnum order
+//
+#define QVR_VOP_STATISTICS_NAME( _Name_, _Args_, _Vnode_, _Handler_, _Policy_ )  #_Name_,
+
+static const char*  gQvrHookedVopNames[] = {
+    QVR_HOOKED_VOPS( QVR_VOP_STATISTICS_NAME )
+};
+
+//--------------------------------------------------------------------
+
+unsigned int
+QvrVopStatistics::latencyBucket(
+    __in UInt64 time
+    )
+/*
+ returns the histogram bucket for a time in absolute time units,
+ see VFS_LATENCY_BUCKETS
+ */
+{
+    UInt64          ns;
+    unsigned int    bucket;
+    
+    absolutetime_to_nanoseconds( time, &ns );
+    
+    if( ns < ( 0x1ULL << VFS_LATENCY_SHIFT ) )
+        return 0x0;
+    
+    //
+    // the number of significant bits, ns is not zero
+    //
+    bucket = ( 64 - __builtin_clzll( ns ) ) - VFS_LATENCY_SHIFT;
+    
+    return ( bucket < VFS_LATENCY_BUCKETS ) ? bucket : ( VFS_LATENCY_BUCKETS - 1 );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVopStatistics::reset()
+{
+    bzero( (void*)this->cpus, sizeof( this->cpus ) );
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVopStatistics::enable(
+    __in bool enable
+    )
+/*
+ the calls that are in progress when the counters are reset are accounted
+ after the reset, so the first report might include a few calls started before
+ */
+{
+    if( enable ){
+        
+        //
+        // a repeated enabling also resets the counters
+        //
+        this->enabled = false;
+        this->reset();
+        OSMemoryBarrier();
+    }
+    
+    this->enabled = enable;
+}
+
+//--------------------------------------------------------------------
+
+void
+QvrVopStatistics::account(
+    __in QvrHookedVopEnum vop,
+    __in UInt64 time,
+    __in UInt32 originalCalls,
+    __in UInt64 originalTime
+    )
+{
+    assert( vop < QvrHookedVop_Max );
+    assert( time >= originalTime );
+    
+    CpuCounters*  counters = &this->cpus[ QvrCurrentCpuSlot() ][ vop ];
+    UInt64        filterTime = time - originalTime;
+    
+    OSIncrementAtomic64( &counters->calls );
+    OSAddAtomic64( filterTime, &counters->filterTime );
+    OSIncrementAtomic64( &counters->filterLatency[ latencyBucket( filterTime ) ] );
+    
+    if( 0x0 == originalCalls )
+        return;
+    
+    OSIncrementAtomic64( &counters->originalCalls );
+    OSAddAtomic64( originalTime, &counters->originalTime );
+    OSIncrementAtomic64( &counters->originalLatency[ latencyBucket( originalTime ) ] );
+}
+
+//--------------------------------------------------------------------
+
+bool
+QvrVopStatistics::getReport(
+    __in QvrHookedVopEnum vop,
+    __out VFSVopStatistics* report
+    )
+/*
+ the counters are read without synchronization, the report is a snapshot
+ */
+{
+    UInt64  filterTime = 0x0;
+    UInt64  originalTime = 0x0;
+    
+    assert( vop < QvrHookedVop_Max );
+    
+    bzero( report, sizeof( *report ) );
+    strlcpy( report->name, gQvrHookedVopNames[ vop ], sizeof( report->name ) );
+    
+    for( int i = 0x0; i < QVR_CPU_SLOTS; ++i ){
+        
+        CpuCounters*  counters = &this->cpus[ i ][ vop ];
+        
+        report->calls         += counters->calls;
+        report->originalCalls += counters->originalCalls;
+        filterTime            += counters->filterTime;
+        originalTime          += counters->originalTime;
+        
+        for( int j = 0x0; j < VFS_LATENCY_BUCKETS; ++j ){
+            
+            report->filterLatency[ j ]   += counters->filterLatency[ j ];
+            report->originalLatency[ j ] += counters->originalLatency[ j ];
+        }
+    }
+    
+    absolutetime_to_nanoseconds( filterTime, &report->filterNs );
+    absolutetime_to_nanoseconds( originalTime, &report->originalNs );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,119 @@
+//
+//  VopStatistics.h
+//  VFSFilter0
+//
+//  Created by slava on 31/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__VopStatistics__
+#define __VFSFilter0__VopStatistics__
+
+#include "Common.h"
+#include "VFSHooks.h"
+#include "VFSFilter0UserClientInterface.h"
+
+//--------------------------------------------------------------------
+
+//
+// set to 0 to compile the collection out
+//
+#ifndef QVR_VOP_STATISTICS
+#define QVR_VOP_STATISTICS  1
+#endif
+
+//--------------------------------------------------------------------
+
+//
+// the indices of the hooked VOPs in the QVR_HOOKED_VOPS order
+//
+#define QVR_VOP_STATISTICS_INDEX( _Name_, _Args_, _Vnode_, _Handler_, _Policy_ )  QvrHookedVop_##_Name_,
+
+typedef enum _QvrHookedVopEnum{
+    QVR_HOOKED_VOPS( QVR_VOP_STATISTICS_INDEX )
+    
+    //
+    // always the last
+    //
+    QvrHookedVop_Max
+} QvrHookedVopEnum;
+
+//--------------------------------------------------------------------
+
+//
+// the call counters and the latency histograms for the hooked VOPs, the collection
+// is switched at run time and a disabled collection costs a flag check per call,
+// a call is accounted in a slot of the current CPU, the slots are summed only
+// when a report is requested
+//
+class QvrVopStatistics{
+    
+public:
+    
+    static QvrVopStatistics   Instance;
+    
+private:
+    
+    class CpuCounters{
+    public:
+        SInt64 volatile   calls;
+        SInt64 volatile   originalCalls;
+        SInt64 volatile   filterTime;   // in absolute time units
+        SInt64 volatile   originalTime; // in absolute time units
+        SInt64 volatile   filterLatency[ VFS_LATENCY_BUCKETS ];
+        SInt64 volatile   originalLatency[ VFS_LATENCY_BUCKETS ];
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+    bool volatile   enabled;
+    
+    CpuCounters     cpus[ QVR_CPU_SLOTS ][ QvrHookedVop_Max ];
+    
+private:
+    
+    static unsigned int latencyBucket( __in UInt64 time );
+    
+    void reset();
+    void enable( __in bool enable );
+    void account( __in QvrHookedVopEnum vop, __in UInt64 time, __in UInt32 originalCalls, __in UInt64 originalTime );
+    bool getReport( __in QvrHookedVopEnum vop, __out VFSVopStatistics* report );
+    
+public:
+    
+    static bool IsEnabled()
+    {
+#if QVR_VOP_STATISTICS
+        return Instance.enabled;
+#else
+        return false;
+#endif
+    }
+    
+    //
+    // enabling resets the counters
+    //
+    static void Enable( __in bool enable ) { Instance.enable( enable ); }
+    
+    //
+    // time is the duration of a call, originalCalls and originalTime are
+    // the number of calls to the original function and the time spent there
+    //
+    static void Account( __in QvrHookedVopEnum vop, __in UInt64 time, __in UInt32 originalCalls, __in UInt64 originalTime )
+    {
+        Instance.account( vop, time, originalCalls, originalTime );
+    }
+    
+    //
+    // returns false for an invalid index
+    //
+    static bool GetReport( __in int vop, __out VFSVopStatistics* report )
+    {
+        if( vop < 0x0 || vop >= QvrHookedVop_Max )
+            return false;
+        
+        return Instance.getReport( (QvrHookedVopEnum)vop, report );
+    }
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__VopStatistics__) */
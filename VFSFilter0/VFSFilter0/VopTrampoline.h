@@ -0,0 +1,122 @@
+//
+//  VopTrampoline.h
+//  VFSFilter0
+//
+//  Created by slava on 30/07/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0__VopTrampoline__
+#define __VFSFilter0__VopTrampoline__
+
+//
+// a user mode build declares the vnode types, QvrGetOriginalVnodeOp(),
+// RecursionEngine, IsUserClient() and QvrVopStatistics before including
+// the header, see VFSFilter0Bench/VopTrampolineBench.cpp
+//
+#if defined( KERNEL )
+#include "Common.h"
+#include "VNodeHook.h"
+#include "VFSHooks.h"
+#include "VopStatistics.h"
+#include "RecursionEngine.h"
+#include "VFSFilter0.h"
+#else
+#include "VopOriginal.h"
+#endif // KERNEL
+
+//--------------------------------------------------------------------
+
+//
+// the passthrough policies for QvrVopTrampoline, a policy is checked after
+// the original function has been retrieved and before the hook's handler
+// is called, true means the call goes directly to the original function
+//
+
+//
+// the handler is always called
+//
+class QvrVopNoPassthrough{
+    
+public:
+    
+    template< class Args >
+    static bool passthrough( __in Args* ap ) { return false; }
+};
+
+//
+// the calls made by the driver itself or by its user client are not filtered
+//
+class QvrVopPassthroughOnRecursion{
+    
+public:
+    
+    template< class Args >
+    static bool passthrough( __in Args* ap ) { return RecursionEngine::IsRecursiveCall() || IsUserClient(); }
+};
+
+//--------------------------------------------------------------------
+
+//
+// a hooking function for a VOP, the index and the vnode's argument are
+// compile time constants so the original function lookup and the passthrough
+// check are inlined in the instance placed in the v_op vector, the handler
+// receives the original function, if the statistics collection is enabled
+// the call's duration and the time spent in the original function are accounted
+//
+template< QvrVopEnum Indx,
+          QvrHookedVopEnum Hooked,
+          class Args,
+          vnode_t Args::*Vnode,
+          int (*Handler)( Args* ap, QvrVopOriginal< Args >& origVnop ),
+          class Policy >
+int
+QvrVopTrampoline(
+    __inout Args* ap
+    )
+{
+    int (*vnop)( Args* ap );
+    UInt64  start;
+    int     error;
+    
+    vnop = (int (*)( Args* ))QvrGetOriginalVnodeOp( ap->*Vnode, Indx );
+    assert( vnop );
+    
+    QvrVopOriginal< Args >  origVnop( vnop );
+    
+    if( ! QvrVopStatistics::IsEnabled() ){
+        
+        if( Policy::passthrough( ap ) )
+            return origVnop( ap );
+        
+        return Handler( ap, origVnop );
+    }
+    
+    origVnop.startTiming();
+    start = mach_absolute_time();
+    
+    if( Policy::passthrough( ap ) )
+        error = origVnop( ap );
+    else
+        error = Handler( ap, origVnop );
+    
+    QvrVopStatistics::Account( Hooked, mach_absolute_time() - start, origVnop.getCalls(), origVnop.getElapsed() );
+    
+    return error;
+}
+
+//
+// a vnodeopv_entry_desc initializer for a QVR_HOOKED_VOPS entry
+//
+#define QVR_VOP_HOOK_ENTRY( _Name_, _Args_, _Vnode_, _Handler_, _Policy_ ) \
+    { &vnop_##_Name_##_desc, \
+      (VOPFUNC)QvrVopTrampoline< QvrVopEnum_##_Name_, QvrHookedVop_##_Name_, struct _Args_, &_Args_::_Vnode_, _Handler_, _Policy_ > },
+
+//
+// a QvrVopEnum initializer for a QVR_HOOKED_VOPS entry
+//
+#define QVR_VOP_HOOK_INDEX( _Name_, _Args_, _Vnode_, _Handler_, _Policy_ )  QvrVopEnum_##_Name_,
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0__VopTrampoline__) */
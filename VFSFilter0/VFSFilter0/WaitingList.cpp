@@ -9,4 +9,249 @@
 #include "WaitingList.h"
 
 
-WaitingList gFileOpenWaitingList;
\ No newline at end of file
+WaitingList gFileOpenWaitingList;
+
+//--------------------------------------------------------------------
+
+WaitingList::WaitingList()
+{
+    lock = IOLockAlloc();
+    assert( lock );
+    // TO DO , in kernel we can't through an exception if allocation failed
+    // redesign with init() function
+    
+    bzero( slots, sizeof( slots ) );
+    
+    //
+    // the generation starts from 1 so an id is never zero
+    //
+    for( UInt32 i = 0x0; i < SlotsNumber; ++i ){
+        
+        slots[ i ].generation = 0x1;
+        freeIndexes[ i ] = SlotsNumber - i - 1;
+    }
+    
+    freeCount = SlotsNumber;
+    slotWaitersCount = 0x0;
+    signalAllCount = 0x0;
+}
+
+//--------------------------------------------------------------------
+
+WaitingList::~WaitingList()
+{
+    signalAll();
+    IOLockFree( lock );
+}
+
+//--------------------------------------------------------------------
+
+void
+WaitingList::releaseSlot( __in UInt32 index )
+/*
+ the lock must be held, the generation is changed
+ so the block's id becomes stale
+ */
+{
+    assert( index < SlotsNumber );
+    assert( slots[ index ].block );
+    assert( freeCount < SlotsNumber );
+    
+    slots[ index ].block = NULL;
+    slots[ index ].generation += 0x1;
+    if( 0x0 == slots[ index ].generation )
+        slots[ index ].generation = 0x1;
+    
+    freeIndexes[ freeCount++ ] = index;
+    
+    if( slotWaitersCount )
+        thread_wakeup_one( &freeCount );
+}
+
+//--------------------------------------------------------------------
+
+bool
+WaitingList::enter(
+    __inout QvrWaitBlock* block,
+    __in_opt void* context
+    )
+{
+    bool    entered = false;
+    UInt32  signalAllCountOnEntry;
+    
+    assert( preemption_enabled() );
+    
+    block->id = 0x0;
+    block->context = context;
+    block->signalled = false;
+    
+    IOLockLock( lock );
+    {// start of the lock
+        
+        signalAllCountOnEntry = signalAllCount;
+        
+        //
+        // all slots are taken by the requests waiting for replies,
+        // wait for one of them being signalled or removed
+        //
+        while( 0x0 == freeCount && signalAllCountOnEntry == signalAllCount ){
+            
+            slotWaitersCount += 0x1;
+            
+            wait_result_t  waitResult = assert_wait( &freeCount, THREAD_UNINT );
+            
+            IOLockUnlock( lock );
+            
+            if( THREAD_WAITING == waitResult )
+                thread_block( THREAD_CONTINUE_NULL );
+            
+            IOLockLock( lock );
+            
+            slotWaitersCount -= 0x1;
+        } // end while
+        
+        if( freeCount && signalAllCountOnEntry == signalAllCount ){
+            
+            UInt32 index = freeIndexes[ --freeCount ];
+            
+            assert( NULL == slots[ index ].block );
+            
+            slots[ index ].block = block;
+            block->id = makeId( index, slots[ index ].generation );
+            entered = true;
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lock );
+    
+    if( ! entered ){
+        
+        DBG_PRINT_ERROR(( "WaitingList::enter() failed, the list has been signalled while waiting for a free slot\n" ));
+    }
+    
+    return entered;
+}
+
+//--------------------------------------------------------------------
+
+void
+WaitingList::wait( __in QvrWaitBlock* block )
+{
+    assert( preemption_enabled() );
+    assert( 0x0 != block->id );
+    
+    while( true ){
+        
+        bool wait = false;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            
+            if( ! block->signalled )
+                wait = ( THREAD_WAITING == assert_wait( block, THREAD_UNINT ) );
+            
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        if( ! wait )
+            break;
+        
+        thread_block( THREAD_CONTINUE_NULL );
+    } // end while
+}
+
+//--------------------------------------------------------------------
+
+void
+WaitingList::leave( __in QvrWaitBlock* block )
+{
+    UInt32  index = indexFromId( block->id );
+    
+    IOLockLock( lock );
+    {// start of the lock
+        
+        if( ! block->signalled ){
+            
+            assert( index < SlotsNumber && block == slots[ index ].block );
+            
+            block->signalled = true;
+            releaseSlot( index );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lock );
+}
+
+//--------------------------------------------------------------------
+
+bool
+WaitingList::signal(
+    __in UInt64 id,
+    __in_opt QvrWaitingListCallback callback,
+    __in_opt void* signalContext
+    )
+{
+    UInt32         index = indexFromId( id );
+    QvrWaitBlock*  block = NULL;
+    
+    if( index >= SlotsNumber )
+        return false;
+    
+    IOLockLock( lock );
+    {// start of the lock
+        
+        if( generationFromId( id ) == slots[ index ].generation && slots[ index ].block ){
+            
+            block = slots[ index ].block;
+            assert( id == block->id && ! block->signalled );
+            
+            if( callback )
+                callback( block->context, signalContext );
+            
+            block->signalled = true;
+            releaseSlot( index );
+            
+            //
+            // the block can't be used after the lock is released
+            // as the waiting thread might return, the address is
+            // used as an event
+            //
+            thread_wakeup( block );
+        }
+        
+    }// end of the lock
+    IOLockUnlock( lock );
+    
+    return ( NULL != block );
+}
+
+//--------------------------------------------------------------------
+
+void
+WaitingList::signalAll()
+{
+    IOLockLock( lock );
+    {// start of the lock
+        
+        for( UInt32 i = 0x0; i < SlotsNumber; ++i ){
+            
+            QvrWaitBlock* block = slots[ i ].block;
+            if( ! block )
+                continue;
+            
+            block->signalled = true;
+            releaseSlot( i );
+            thread_wakeup( block );
+        }
+        
+        //
+        // release the threads waiting for a free slot
+        //
+        signalAllCount += 0x1;
+        thread_wakeup( &freeCount );
+        
+    }// end of the lock
+    IOLockUnlock( lock );
+}
+
+//--------------------------------------------------------------------
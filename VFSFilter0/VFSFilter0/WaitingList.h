@@ -14,71 +14,98 @@
 
 //--------------------------------------------------------------------
 
+//
+// a waiting state embedded in a pending request, usually allocated on a waiting thread's stack
+//
+class QvrWaitBlock{
+    
+public:
+    UInt64   id;         // set by WaitingList::enter
+    void*    context;    // provided to the signal callback
+    bool     signalled;
+};
+
+//
+// called by WaitingList::signal with the list's lock being held before
+// the waiting thread is woken up, so the block's context is valid
+//
+typedef void (*QvrWaitingListCallback)( __in void* blockContext, __in void* signalContext );
+
+//--------------------------------------------------------------------
+
+//
+// a list of threads waiting for a reply, a wait block is registered in
+// a slot and addressed by an id made of the slot index and the slot generation,
+// so a reply finds its block in O(1) and a stale or a duplicate reply is detected
+// by a generation mismatch
+//
 class WaitingList{
 
+private:
+    
+    class Slot{
+    public:
+        QvrWaitBlock*  block;
+        UInt32         generation;
+    };
+    
+    enum{
+        SlotsNumber = 1024
+    };
+    
 public:
     
-    WaitingList()
-    {
-        lock = IOLockAlloc();
-        assert( lock );
-    }
-    
-    ~WaitingList()
-    {
-        while( ! list.isEmpty() )
-        {
-            void* key;
-            
-            if( list.removeFirstEntryAndReturnItsData( &key ) )
-                thread_wakeup(key);
-        }
-        
-        IOLockFree(lock);
-    }
-    
-    int enter( __in void* key )
-    {
-        return list.addDataByKey( key, this );
-    }
-    
-    void wait( __in void* key )
-    {
-        assert( preemption_enabled() );
-        
-        bool wait = false;
-        
-        IOLockLock( lock );
-        {// start of the lock
-            
-            if( list.getDataByKey(key) )
-                wait = (THREAD_WAITING == assert_wait( key, THREAD_UNINT ));
-            
-        }// end of the lock
-        IOLockUnlock( lock );
-        
-        if( wait )
-            thread_block( THREAD_CONTINUE_NULL );
-    }
-    
-    void signal( __in void* key )
-    {
-        IOLockLock( lock );
-        {// start of the lock
-            
-            if( list.getDataByKey(key) )
-            {
-                thread_wakeup(key);
-                list.removeKey(key);
-            }
-            
-        }// end of the lock
-        IOLockUnlock( lock );
-    }
+    WaitingList();
+    ~WaitingList();
+    
+    //
+    // registers the block and sets block->id, waits for a free slot if all slots
+    // are in use, returns false if signalAll() was called while waiting
+    //
+    bool enter( __inout QvrWaitBlock* block, __in_opt void* context );
+    
+    //
+    // waits for the block being signalled
+    //
+    void wait( __in QvrWaitBlock* block );
+    
+    //
+    // removes the block without waiting, the block might have been signalled
+    //
+    void leave( __in QvrWaitBlock* block );
+    
+    //
+    // returns false if there is no block for the id, i.e. the id is stale
+    // or the block has already been signalled
+    //
+    bool signal( __in UInt64 id, __in_opt QvrWaitingListCallback callback = NULL, __in_opt void* signalContext = NULL );
+    
+    //
+    // wakes up all waiting threads
+    //
+    void signalAll();
     
 private:
-    DataMap    list;
+    
+    static UInt64 makeId( __in UInt32 index, __in UInt32 generation ) { return ( (UInt64)generation << 32 ) | index; }
+    static UInt32 indexFromId( __in UInt64 id ) { return (UInt32)id; }
+    static UInt32 generationFromId( __in UInt64 id ) { return (UInt32)( id >> 32 ); }
+    
+    void releaseSlot( __in UInt32 index );
+    
+private:
+    
     IOLock*    lock;
+    Slot       slots[ SlotsNumber ];
+    UInt32     freeIndexes[ SlotsNumber ];
+    UInt32     freeCount;
+    
+    //
+    // the threads waiting for a free slot use &freeCount as an event,
+    // signalAllCount is changed by signalAll() to release them
+    //
+    UInt32     slotWaitersCount;
+    UInt32     signalAllCount;
 };
 
 //--------------------------------------------------------------------
@@ -0,0 +1,207 @@
+//
+//  BenchSupport.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+
+//--------------------------------------------------------------------
+
+static int volatile      gFailures = 0x0;
+static long volatile     gAllocationsBeforeFailure = -1;
+static int64_t volatile  gAllocatedBytes = 0x0;
+
+//--------------------------------------------------------------------
+
+void
+BenchCheckFailed(
+    __in const char* expression,
+    __in const char* file,
+    __in int line
+    )
+{
+    __sync_fetch_and_add( &gFailures, 1 );
+    fprintf( stderr, "%s:%d: check failed: %s\n", file, line, expression );
+}
+
+//--------------------------------------------------------------------
+
+int
+BenchFailures()
+{
+    return gFailures;
+}
+
+//--------------------------------------------------------------------
+
+void
+BenchReport(
+    __in const char* name,
+    __in uint64_t operations,
+    __in uint64_t ns
+    )
+{
+    double nsPerOperation = operations ? (double)ns / operations : 0.0;
+    double mops = ns ? (double)operations * 1000.0 / ns : 0.0;
+    
+    printf( "%-48s %10.2f ns/op %10.2f Mops/s\n", name, nsPerOperation, mops );
+}
+
+//--------------------------------------------------------------------
+
+uint64_t
+BenchScale(
+    __in uint64_t count
+    )
+{
+    if( ! getenv( "BENCH_QUICK" ) )
+        return count;
+    
+    return ( count / 64 ) ? ( count / 64 ) : 0x1;
+}
+
+//--------------------------------------------------------------------
+
+class BenchThreadContext{
+    
+public:
+    BenchThreadRoutine   routine;
+    void*                context;
+    int                  thread;
+    int volatile*        started;
+    int                  threads;
+    uint64_t             time;
+};
+
+static void* BenchThreadStart( __in void* parameter )
+{
+    BenchThreadContext* threadContext = (BenchThreadContext*)parameter;
+    
+    //
+    // wait for all threads to start
+    //
+    __sync_fetch_and_add( threadContext->started, 1 );
+    while( *threadContext->started < threadContext->threads )
+        sched_yield();
+    
+    uint64_t start = BenchNow();
+    threadContext->routine( threadContext->context, threadContext->thread );
+    threadContext->time = BenchNow() - start;
+    
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+uint64_t
+BenchRunThreads(
+    __in int threads,
+    __in BenchThreadRoutine routine,
+    __in void* context
+    )
+{
+    int volatile         started = 0x0;
+    uint64_t             time = 0x0;
+    pthread_t*           handles;
+    BenchThreadContext*  contexts;
+    
+    handles  = (pthread_t*)calloc( threads, sizeof( pthread_t ) );
+    contexts = (BenchThreadContext*)calloc( threads, sizeof( BenchThreadContext ) );
+    assert( handles && contexts );
+    
+    for( int i = 0x0; i < threads; ++i ){
+    
+        contexts[ i ].routine = routine;
+        contexts[ i ].context = context;
+        contexts[ i ].thread  = i;
+        contexts[ i ].started = &started;
+        contexts[ i ].threads = threads;
+        
+        int error = pthread_create( &handles[ i ], NULL, BenchThreadStart, &contexts[ i ] );
+        assert( 0x0 == error );
+        (void)error;
+    }
+    
+    for( int i = 0x0; i < threads; ++i ){
+    
+        pthread_join( handles[ i ], NULL );
+        if( time < contexts[ i ].time )
+            time = contexts[ i ].time;
+    }
+    
+    free( contexts );
+    free( handles );
+    
+    return time;
+}
+
+//--------------------------------------------------------------------
+
+void
+BenchFailAllocationsAfter(
+    __in long count
+    )
+{
+    gAllocationsBeforeFailure = count;
+}
+
+//--------------------------------------------------------------------
+
+int64_t
+BenchAllocatedBytes()
+{
+    return gAllocatedBytes;
+}
+
+//--------------------------------------------------------------------
+
+__BEGIN_DECLS
+
+void* mac_kalloc( __in vm_size_t size, __in int how )
+{
+    if( gAllocationsBeforeFailure >= 0x0 ){
+    
+        if( __sync_fetch_and_sub( &gAllocationsBeforeFailure, 1 ) <= 0x0 ){
+        
+            gAllocationsBeforeFailure = 0x0;
+            return NULL;
+        }
+    }
+    
+    void* data = NULL;
+    
+    //
+    // a table embeds the per-CPU statistics slots which must not share
+    // cache lines, the small allocations are left to malloc as entries
+    //
+    if( size >= QVR_CPU_SLOTS * QVR_CACHE_LINE_SIZE ){
+    
+        if( 0x0 != posix_memalign( &data, QVR_CACHE_LINE_SIZE, size ) )
+            data = NULL;
+        
+    } else {
+    
+        data = malloc( size );
+    }
+    
+    if( data )
+        __sync_fetch_and_add( &gAllocatedBytes, (int64_t)size );
+    
+    return data;
+}
+
+void mac_kfree( __in void* data, __in vm_size_t size )
+{
+    if( ! data )
+        return;
+    
+    __sync_fetch_and_sub( &gAllocatedBytes, (int64_t)size );
+    free( data );
+}
+
+__END_DECLS
+
+//--------------------------------------------------------------------
@@ -0,0 +1,96 @@
+//
+//  BenchSupport.h
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0Bench__BenchSupport__
+#define __VFSFilter0Bench__BenchSupport__
+
+//
+// the user mode tests and benchmarks for the kext data structures, the kext
+// sources are compiled without KERNEL and ConcurrentMapPlatform.h provides
+// the kernel API they use, the numbers are for comparing the implementations
+// on the same machine, the absolute values differ from the kernel ones
+//
+
+#include "ConcurrentMapPlatform.h"
+
+//--------------------------------------------------------------------
+
+//
+// the tests report a failed check and continue, main() returns BenchFailures()
+//
+#define BENCH_CHECK( _X_ )  do{ if( !( _X_ ) ) BenchCheckFailed( #_X_, __FILE__, __LINE__ ); }while( 0 )
+
+void BenchCheckFailed( __in const char* expression, __in const char* file, __in int line );
+int  BenchFailures();
+
+//--------------------------------------------------------------------
+
+//
+// a monotonic time in nanoseconds
+//
+inline uint64_t BenchNow() { return QvrMapStatistics::now(); }
+
+//
+// xorshift64*, the state must not be zero
+//
+inline uint64_t BenchRandom( __inout uint64_t* state )
+{
+    uint64_t x = *state;
+    
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+//
+// prints the time per operation and the throughput
+//
+void BenchReport( __in const char* name, __in uint64_t operations, __in uint64_t ns );
+
+//
+// the number of repetitions is scaled down if the BENCH_QUICK
+// environment variable is set, used by "make test" to run the benchmarks
+// as smoke tests
+//
+uint64_t BenchScale( __in uint64_t count );
+
+//--------------------------------------------------------------------
+
+//
+// runs the routine on the threads, the threads are released together
+// after they all have started, returns the wall time of the slowest thread
+//
+typedef void (*BenchThreadRoutine)( __in void* context, __in int thread );
+
+uint64_t BenchRunThreads( __in int threads, __in BenchThreadRoutine routine, __in void* context );
+
+//--------------------------------------------------------------------
+
+//
+// mac_kalloc and mac_kfree used by the ght hash table are implemented
+// with malloc and free, the allocated bytes are counted and allocations
+// can be made to fail
+//
+
+//
+// the number of allocations that succeed before all the following
+// ones fail, a negative value disables the failures
+//
+void BenchFailAllocationsAfter( __in long count );
+
+//
+// the bytes allocated by mac_kalloc and not freed
+//
+int64_t BenchAllocatedBytes();
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0Bench__BenchSupport__) */
@@ -0,0 +1,631 @@
+//
+//  CommonHashTableTest.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+typedef enum _GhtMode{
+    GhtModeIncremental,
+    GhtModeFull,
+    GhtModeConcurrent,
+    GhtModeOpen,
+    GhtModeMax
+} GhtMode;
+
+static const char*  gGhtModeNames[ GhtModeMax ] = { "incremental", "full", "concurrent", "open" };
+
+static ght_hash_table_t* CreateTable( __in GhtMode mode, __in unsigned int size )
+{
+    ght_hash_table_t*  table;
+    
+    if( GhtModeOpen == mode )
+        return ght_create_open( size, false, sizeof( UInt64 ) );
+    
+    table = ght_create( size, false );
+    if( ! table )
+        return NULL;
+    
+    ght_set_rehash( table, ( GhtModeFull == mode ) ? TRUE : GHT_REHASH_INCREMENTAL );
+    
+    if( GhtModeConcurrent == mode && ! ght_set_concurrent( table, GHT_LOCK_GROUPS, NULL ) ){
+    
+        ght_finalize( table );
+        return NULL;
+    }
+    
+    return table;
+}
+
+//--------------------------------------------------------------------
+
+//
+// a path key for the chained tables, an integer key for the open table
+//
+static unsigned int MakeKey( __in GhtMode mode, __in UInt64 i, __out char* key, __in unsigned int size )
+{
+    if( GhtModeOpen == mode ){
+    
+        memcpy( key, &i, sizeof( i ) );
+        return sizeof( i );
+    }
+    
+    return (unsigned int)snprintf( key, size, "/Users/test/Documents/%llu", (unsigned long long)i );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the memory report must match the entries found by an iteration
+//
+static void CheckMemoryReport( __in GhtMode mode, __in ght_hash_table_t* table )
+{
+    VFSTableStatistics  report;
+    ght_iterator_t      iterator;
+    const void*         key;
+    unsigned int        keySize;
+    UInt64              entryBytes = 0x0;
+    UInt64              keyBytes = 0x0;
+    unsigned int        count = 0x0;
+    
+    for( void* data = ght_first_keysize( table, &iterator, &key, &keySize );
+         data;
+         data = ght_next_keysize( table, &iterator, &key, &keySize ) ){
+        
+        ++count;
+        keyBytes += keySize;
+        if( GhtModeOpen != mode )
+            entryBytes += iterator.p_entry->size;
+    }
+    
+    ght_get_statistics( table, &report );
+    
+    BENCH_CHECK( report.entries == ght_size( table ) );
+    BENCH_CHECK( count == ght_size( table ) );
+    BENCH_CHECK( report.entryBytes == entryBytes );
+    BENCH_CHECK( report.keyBytes == keyBytes );
+    BENCH_CHECK( report.bucketBytes > 0x0 );
+}
+
+//--------------------------------------------------------------------
+
+static void TestShrinkAndMemoryReport( __in GhtMode mode )
+{
+    const UInt64        count = 100000;
+    const unsigned int  minSize = 64;
+    ght_hash_table_t*   table;
+    VFSTableStatistics  report;
+    char                key[ 64 ];
+    unsigned int        keySize;
+    unsigned int        grownSize;
+    
+    table = CreateTable( mode, minSize );
+    BENCH_CHECK( table );
+    if( ! table )
+        return;
+    
+    ght_set_shrink( table, minSize );
+    
+    for( UInt64 i = 0x1; i <= count; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    CheckMemoryReport( mode, table );
+    grownSize = ght_table_size( table );
+    
+    for( UInt64 i = 0x1; i <= count; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( (void*)i == ght_remove( table, keySize, key ) );
+        
+        if( count - 1000 == i )
+            CheckMemoryReport( mode, table );
+    }
+    
+    CheckMemoryReport( mode, table );
+    
+    //
+    // the buckets allocated for the burst are released
+    //
+    BENCH_CHECK( ght_table_size( table ) < grownSize / 64 );
+    
+    //
+    // a steady number of items must not resize the table back and forth
+    //
+    UInt64    random = 0x1234;
+    UInt64    rehashes;
+    
+    for( UInt64 i = 0x1; i <= 1000; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    ght_get_statistics( table, &report );
+    rehashes = report.rehashes;
+    
+    for( int j = 0x0; j < 100000; ++j ){
+    
+        UInt64 i = 0x1 + BenchRandom( &random ) % 1000;
+        
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        if( ght_remove( table, keySize, key ) )
+            BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    ght_get_statistics( table, &report );
+    BENCH_CHECK( report.rehashes - rehashes <= 0x1 );
+    
+    ght_finalize( table );
+    
+    printf( "shrink and memory report, %s: grown to %u buckets\n", gGhtModeNames[ mode ], grownSize );
+}
+
+//--------------------------------------------------------------------
+
+//
+// random inserts, replaces, lookups and removes checked against an array
+// indexed by the key, then an iteration that removes every other entry,
+// the data is ( index + 1 )*8 for an insert and ( index + 1 )*8 + 4 for a replace
+//
+template< typename T >
+static void TestRobinHoodAgainstReference()
+{
+    const uint32_t     range = 50000;
+    ght_hash_table_t*  table = ght_create_open( 8, false, sizeof( T ) );
+    void**             reference = (void**)calloc( range, sizeof( void* ) );
+    uint32_t*          seen = (uint32_t*)calloc( range, sizeof( uint32_t ) );
+    uint64_t           random = 0x3;
+    uint32_t           items = 0x0;
+    
+    BENCH_CHECK( table && reference && seen );
+    if( ! table || ! reference || ! seen )
+        return;
+    
+    for( uint32_t i = 0x0; i < 1000000; ++i ){
+    
+        uint32_t  index = (uint32_t)( BenchRandom( &random ) % range );
+        T         key = (T)( index * 0x9E3779B1ULL );
+        void*     data;
+        
+        switch( BenchRandom( &random ) % 4 ){
+        
+            case 0:
+                if( GHT_OK == ght_insert( table, (void*)( ( (uintptr_t)index + 1 ) * 8 ), sizeof( key ), &key ) ){
+                
+                    BENCH_CHECK( NULL == reference[ index ] );
+                    reference[ index ] = (void*)( ( (uintptr_t)index + 1 ) * 8 );
+                    ++items;
+                
+                } else {
+                
+                    BENCH_CHECK( NULL != reference[ index ] );
+                }
+                break;
+            
+            case 1:
+                BENCH_CHECK( reference[ index ] == ght_get( table, sizeof( key ), &key ) );
+                break;
+            
+            case 2:
+                data = ght_replace( table, (void*)( ( (uintptr_t)index + 1 ) * 8 + 4 ), sizeof( key ), &key );
+                BENCH_CHECK( reference[ index ] == data );
+                if( data )
+                    reference[ index ] = (void*)( ( (uintptr_t)index + 1 ) * 8 + 4 );
+                break;
+            
+            default:
+                data = ght_remove( table, sizeof( key ), &key );
+                BENCH_CHECK( reference[ index ] == data );
+                if( data )
+                    --items;
+                reference[ index ] = NULL;
+                break;
+        }
+    }
+    
+    BENCH_CHECK( items == ght_size( table ) );
+    
+    ght_iterator_t  iterator;
+    const void*     keyData;
+    uint32_t        iterated = 0x0;
+    
+    for( void* data = ght_first( table, &iterator, &keyData ); data; data = ght_next( table, &iterator, &keyData ) ){
+    
+        T         key;
+        uint32_t  index = (uint32_t)( (uintptr_t)data / 8 ) - 1;
+        
+        memcpy( &key, keyData, sizeof( key ) );
+        BENCH_CHECK( key == (T)( index * 0x9E3779B1ULL ) );
+        
+        BENCH_CHECK( index < range && reference[ index ] == data );
+        BENCH_CHECK( index < range && 0x0 == seen[ index ] );
+        if( index >= range )
+            continue;
+        
+        seen[ index ] = 0x1;
+        
+        //
+        // only the current entry can be removed during an iteration
+        //
+        if( iterated++ % 2 ){
+        
+            BENCH_CHECK( data == ght_remove( table, sizeof( key ), &key ) );
+            reference[ index ] = NULL;
+            --items;
+        }
+    }
+    
+    BENCH_CHECK( items == ght_size( table ) );
+    
+    for( uint32_t index = 0x0; index < range; ++index ){
+    
+        T key = (T)( index * 0x9E3779B1ULL );
+        
+        BENCH_CHECK( reference[ index ] == ght_get( table, sizeof( key ), &key ) );
+        if( reference[ index ] )
+            BENCH_CHECK( seen[ index ] );
+    }
+    
+    ght_finalize( table );
+    free( seen );
+    free( reference );
+    
+    printf( "Robin Hood against a reference, %u byte keys\n", (unsigned)sizeof( T ) );
+}
+
+//--------------------------------------------------------------------
+
+//
+// a failed growth returns GHT_ERROR and leaves the table intact
+//
+static void TestRobinHoodAllocationFailure()
+{
+    ght_hash_table_t*  table = ght_create_open( 64, false, sizeof( UInt64 ) );
+    UInt64             key;
+    UInt64             inserted = 0x0;
+    
+    BENCH_CHECK( table );
+    if( ! table )
+        return;
+    
+    BenchFailAllocationsAfter( 0x0 );
+    
+    for( key = 0x1; key <= 1000; ++key ){
+    
+        if( GHT_OK != ght_insert( table, (void*)key, sizeof( key ), &key ) )
+            break;
+        
+        ++inserted;
+    }
+    
+    //
+    // the table is full at 7/8 of 64 slots
+    //
+    BENCH_CHECK( inserted < 1000 );
+    BENCH_CHECK( inserted == ght_size( table ) );
+    
+    for( key = 0x1; key <= inserted; ++key )
+        BENCH_CHECK( (void*)key == ght_get( table, sizeof( key ), &key ) );
+    
+    BenchFailAllocationsAfter( -1 );
+    
+    for( key = inserted + 1; key <= 1000; ++key )
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)key, sizeof( key ), &key ) );
+    
+    for( key = 0x1; key <= 1000; ++key )
+        BENCH_CHECK( (void*)key == ght_get( table, sizeof( key ), &key ) );
+    
+    ght_finalize( table );
+    
+    printf( "Robin Hood allocation failure, grew after %u inserts\n", (unsigned)inserted );
+}
+
+//--------------------------------------------------------------------
+
+//
+// a full rehash that can't allocate the new table or the copies of the
+// entries leaves the table unchanged, so a failed shrink is a no-op, the
+// allocations fail only for the last removes that cross the shrink threshold
+//
+static void TestShrinkAllocationFailure( __in GhtMode mode, __in long allocations )
+{
+    const UInt64        count = 10000;
+    ght_hash_table_t*   table;
+    char                key[ 64 ];
+    unsigned int        keySize;
+    unsigned int        grownSize;
+    
+    table = CreateTable( mode, 64 );
+    BENCH_CHECK( table );
+    if( ! table )
+        return;
+    
+    //
+    // a concurrent table rehashes the whole table under the group locks
+    //
+    ght_set_rehash( table, TRUE );
+    ght_set_shrink( table, 64 );
+    
+    for( UInt64 i = 0x1; i <= count; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    grownSize = ght_table_size( table );
+    
+    UInt64 remaining = grownSize / GHT_SHRINK_LOAD - 10;
+    
+    for( UInt64 i = 0x1; i <= count - remaining; ++i ){
+    
+        if( GHT_SHRINK_LOAD * ght_size( table ) == grownSize )
+            BenchFailAllocationsAfter( allocations );
+        
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( (void*)i == ght_remove( table, keySize, key ) );
+    }
+    
+    BENCH_CHECK( grownSize == ght_table_size( table ) );
+    BENCH_CHECK( remaining == ght_size( table ) );
+    
+    for( UInt64 i = count - remaining + 1; i <= count; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( (void*)i == ght_get( table, keySize, key ) );
+    }
+    
+    CheckMemoryReport( mode, table );
+    
+    BenchFailAllocationsAfter( -1 );
+    
+    //
+    // the next remove shrinks the table
+    //
+    keySize = MakeKey( mode, count, key, sizeof( key ) );
+    BENCH_CHECK( (void*)count == ght_remove( table, keySize, key ) );
+    BENCH_CHECK( ght_table_size( table ) < grownSize );
+    
+    for( UInt64 i = count - remaining + 1; i < count; ++i ){
+    
+        keySize = MakeKey( mode, i, key, sizeof( key ) );
+        BENCH_CHECK( (void*)i == ght_get( table, keySize, key ) );
+    }
+    
+    CheckMemoryReport( mode, table );
+    
+    ght_finalize( table );
+    
+    printf( "shrink allocation failure, %s, %ld allocations\n", gGhtModeNames[ mode ], allocations );
+}
+
+//--------------------------------------------------------------------
+
+//
+// readers look up path keys of a concurrent table while a writer inserts
+// and removes other keys and rehashes the table, a lookup must not write
+// the table so a stable key is always found with its data and a key of
+// the writer is either not found or found with its data
+//
+class ConcurrentReadersContext{
+    
+public:
+    ght_hash_table_t*  table;
+    UInt64             stableKeys;
+    UInt64             writerKeys;
+    int volatile       readersRunning;
+};
+
+static void ConcurrentReadersRoutine( __in void* context, __in int thread )
+{
+    ConcurrentReadersContext*  readersContext = (ConcurrentReadersContext*)context;
+    ght_hash_table_t*          table = readersContext->table;
+    UInt64                     random = 0x5678 + thread;
+    char                       key[ 64 ];
+    unsigned int               keySize;
+    
+    if( 0x0 == thread ){
+    
+        //
+        // the writer
+        //
+        for( unsigned int round = 0x0; readersContext->readersRunning; ++round ){
+        
+            UInt64 first = readersContext->stableKeys + 0x1;
+            UInt64 last  = readersContext->stableKeys + readersContext->writerKeys;
+            
+            for( UInt64 i = first; i <= last; ++i ){
+            
+                keySize = MakeKey( GhtModeConcurrent, i, key, sizeof( key ) );
+                BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+            }
+            
+            if( 0x0 == round % 4 )
+                ght_rehash( table, ( round % 8 ) ? 64 : 4 * ght_size( table ) );
+            
+            for( UInt64 i = first; i <= last; ++i ){
+            
+                keySize = MakeKey( GhtModeConcurrent, i, key, sizeof( key ) );
+                BENCH_CHECK( (void*)i == ght_remove( table, keySize, key ) );
+            }
+        }
+        
+        return;
+    }
+    
+    for( int j = 0x0; j < 200000; ++j ){
+    
+        UInt64 i = 0x1 + BenchRandom( &random ) % ( readersContext->stableKeys + readersContext->writerKeys );
+        void*  data;
+        
+        keySize = MakeKey( GhtModeConcurrent, i, key, sizeof( key ) );
+        data = ght_get( table, keySize, key );
+        
+        if( i <= readersContext->stableKeys )
+            BENCH_CHECK( (void*)i == data );
+        else
+            BENCH_CHECK( NULL == data || (void*)i == data );
+    }
+    
+    __sync_fetch_and_sub( &readersContext->readersRunning, 1 );
+}
+
+static void TestConcurrentReaders()
+{
+    ConcurrentReadersContext  context;
+    char                      key[ 64 ];
+    unsigned int              keySize;
+    const int                 threads = 5;
+    
+    context.table = CreateTable( GhtModeConcurrent, 64 );
+    BENCH_CHECK( context.table );
+    if( ! context.table )
+        return;
+    
+    context.stableKeys = 4000;
+    context.writerKeys = 4000;
+    context.readersRunning = threads - 1;
+    
+    for( UInt64 i = 0x1; i <= context.stableKeys; ++i ){
+    
+        keySize = MakeKey( GhtModeConcurrent, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( context.table, (void*)i, keySize, key ) );
+    }
+    
+    BenchRunThreads( threads, ConcurrentReadersRoutine, &context );
+    
+    BENCH_CHECK( context.stableKeys == ght_size( context.table ) );
+    
+    ght_finalize( context.table );
+    
+    printf( "concurrent readers: %d readers and a writer\n", threads - 1 );
+}
+
+//--------------------------------------------------------------------
+
+static unsigned int volatile  gCacheEvictions;
+
+static void CountEviction( __in void* data, __in const void* key )
+{
+    ++gCacheEvictions;
+}
+
+//
+// the cache mode keeps the entry and byte budgets, gives the referenced
+// entries a second chance and reports each eviction to the callback
+// and to the statistics
+//
+static void TestCacheMode()
+{
+    const unsigned int  capacity = 1000;
+    ght_hash_table_t*   table;
+    VFSTableStatistics  report;
+    char                key[ 64 ];
+    unsigned int        keySize;
+    
+    table = CreateTable( GhtModeIncremental, 64 );
+    BENCH_CHECK( table );
+    if( ! table )
+        return;
+    
+    gCacheEvictions = 0x0;
+    ght_set_cache( table, capacity, 0x0, CountEviction );
+    
+    for( UInt64 i = 0x1; i <= 10 * capacity; ++i ){
+    
+        keySize = MakeKey( GhtModeIncremental, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+        BENCH_CHECK( ght_size( table ) <= capacity );
+    }
+    
+    ght_get_statistics( table, &report );
+    BENCH_CHECK( 9 * capacity == gCacheEvictions );
+    BENCH_CHECK( gCacheEvictions == report.evictions );
+    
+    //
+    // the first half of the cached keys is referenced, the inserts
+    // evict the second half
+    //
+    for( UInt64 i = 9 * capacity + 0x1; i <= 9 * capacity + capacity / 2; ++i ){
+    
+        keySize = MakeKey( GhtModeIncremental, i, key, sizeof( key ) );
+        BENCH_CHECK( (void*)i == ght_get( table, keySize, key ) );
+    }
+    
+    for( UInt64 i = 10 * capacity + 0x1; i <= 10 * capacity + capacity / 2; ++i ){
+    
+        keySize = MakeKey( GhtModeIncremental, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    for( UInt64 i = 9 * capacity + 0x1; i <= 10 * capacity; ++i ){
+    
+        keySize = MakeKey( GhtModeIncremental, i, key, sizeof( key ) );
+        if( i <= 9 * capacity + capacity / 2 )
+            BENCH_CHECK( (void*)i == ght_get( table, keySize, key ) );
+        else
+            BENCH_CHECK( NULL == ght_get( table, keySize, key ) );
+    }
+    
+    ght_finalize( table );
+    
+    //
+    // a byte budget
+    //
+    const vm_size_t  budget = 0x10000;
+    
+    table = CreateTable( GhtModeIncremental, 64 );
+    BENCH_CHECK( table );
+    if( ! table )
+        return;
+    
+    ght_set_cache( table, 0x0, budget, NULL );
+    
+    for( UInt64 i = 0x1; i <= 10 * capacity; ++i ){
+    
+        keySize = MakeKey( GhtModeIncremental, i, key, sizeof( key ) );
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)i, keySize, key ) );
+    }
+    
+    ght_get_statistics( table, &report );
+    BENCH_CHECK( report.entryBytes <= budget );
+    BENCH_CHECK( report.entries + report.evictions == 10 * capacity );
+    
+    ght_finalize( table );
+    
+    printf( "cache mode: %u entries, %u entries in %u bytes\n", capacity, (unsigned)report.entries, (unsigned)budget );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    for( int mode = 0x0; mode < GhtModeMax; ++mode )
+        TestShrinkAndMemoryReport( (GhtMode)mode );
+    
+    TestRobinHoodAgainstReference< UInt32 >();
+    TestRobinHoodAgainstReference< UInt64 >();
+    TestRobinHoodAllocationFailure();
+    TestShrinkAllocationFailure( GhtModeFull, 0x0 );
+    TestShrinkAllocationFailure( GhtModeFull, 8 );
+    TestShrinkAllocationFailure( GhtModeConcurrent, 0x0 );
+    TestShrinkAllocationFailure( GhtModeConcurrent, 8 );
+    TestConcurrentReaders();
+    TestCacheMode();
+    
+    //
+    // all entries and bucket arrays are freed
+    //
+    BENCH_CHECK( 0x0 == BenchAllocatedBytes() );
+    
+    printf( "CommonHashTableTest: %d failures\n", BenchFailures() );
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,315 @@
+//
+//  ConcurrentMapBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "LinkedListDataMap.h"
+#include "ConcurrentMap.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// QvrConcurrentMap against the ght tables for pointer keys on a single
+// thread, the map replaced DataMap, the ght tables stay on ght so the numbers
+// show what a migration of the vnode hooks table would gain or lose,
+// then the map against the DataMap's linked list at 1 to 32 threads
+//
+
+//--------------------------------------------------------------------
+
+template< typename Policy >
+class ConcurrentMapAdapter{
+    
+private:
+    QvrConcurrentMap< void*, void*, Policy >  map;
+    
+public:
+    
+    bool init() { return map.init(); }
+    bool insert( __in void* key ) { return map.insert( key, key ); }
+    bool get( __in void* key ) { return map.get( key, NULL ); }
+    bool remove( __in void* key ) { return map.remove( key ); }
+    
+    uint64_t memory()
+    {
+        QvrMapStatisticsReport report;
+        
+        map.getStatistics( &report );
+        return report.bucketBytes + report.entryBytes;
+    }
+};
+
+//--------------------------------------------------------------------
+
+//
+// the linked list DataMap, see LinkedListDataMap.h
+//
+class LinkedListDataMapAdapter{
+    
+private:
+    LinkedListDataMap  map;
+    
+public:
+    
+    bool init() { return map.init(); }
+    bool insert( __in void* key ) { return map.addDataByKey( key, key ); }
+    bool fill( __in void* key ) { return map.fill( key, key ); }
+    bool get( __in void* key ) { return NULL != map.getDataByKey( key ); }
+    bool remove( __in void* key ) { return NULL != map.removeKeyAndReturnItsData( key ); }
+};
+
+//--------------------------------------------------------------------
+
+typedef enum _GhtKind{
+    GhtKindChained,
+    GhtKindFixed,
+    GhtKindOpen
+} GhtKind;
+
+template< GhtKind Kind >
+class GhtAdapter{
+    
+private:
+    ght_hash_table_t*  table;
+    
+public:
+    
+    GhtAdapter() : table( NULL ) {}
+    ~GhtAdapter() { if( table ) ght_finalize( table ); }
+    
+    bool init()
+    {
+        switch( Kind ){
+            case GhtKindChained:
+                table = ght_create( 16, false );
+                if( table )
+                    ght_set_rehash( table, TRUE );
+                break;
+            case GhtKindFixed:
+                table = ght_create_fixed( 16, false, sizeof( void* ) );
+                if( table )
+                    ght_set_rehash( table, GHT_REHASH_INCREMENTAL );
+                break;
+            case GhtKindOpen:
+                table = ght_create_open( 16, false, sizeof( void* ) );
+                break;
+        }
+        
+        return NULL != table;
+    }
+    
+    bool insert( __in void* key ) { return GHT_OK == ght_insert( table, key, sizeof( key ), &key ); }
+    bool get( __in void* key ) { return NULL != ght_get( table, sizeof( key ), &key ); }
+    bool remove( __in void* key ) { return NULL != ght_remove( table, sizeof( key ), &key ); }
+    
+    uint64_t memory()
+    {
+        VFSTableStatistics report;
+        
+        ght_get_statistics( table, &report );
+        return report.bucketBytes + report.entryBytes;
+    }
+};
+
+//--------------------------------------------------------------------
+
+template< typename Adapter >
+static void RunPointerKeys( __in const char* name, __in void** keys, __in void** missingKeys, __in uint32_t count )
+{
+    Adapter   adapter;
+    char      title[ 128 ];
+    uint64_t  start;
+    uint32_t  found = 0x0;
+    
+    if( ! adapter.init() ){
+    
+        printf( "%s: init() failed\n", name );
+        return;
+    }
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        adapter.insert( keys[ i ] );
+    snprintf( title, sizeof( title ), "%s insert", name );
+    BenchReport( title, count, BenchNow() - start );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        found += adapter.get( keys[ ( i * 7919 ) % count ] );
+    snprintf( title, sizeof( title ), "%s get hit", name );
+    BenchReport( title, count, BenchNow() - start );
+    BENCH_CHECK( found == count );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        found -= adapter.get( missingKeys[ i ] );
+    snprintf( title, sizeof( title ), "%s get miss", name );
+    BenchReport( title, count, BenchNow() - start );
+    BENCH_CHECK( found == count );
+    
+    printf( "%-48s %10.2f bytes/entry\n", name, (double)adapter.memory() / count );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        adapter.remove( keys[ i ] );
+    snprintf( title, sizeof( title ), "%s remove", name );
+    BenchReport( title, count, BenchNow() - start );
+}
+
+//--------------------------------------------------------------------
+
+//
+// a thread looks up the shared keys, every 8th operation adds and removes
+// a key owned by the thread as RecursionEngine does for a call
+//
+template< typename Adapter >
+class ThreadedContext{
+    
+public:
+    Adapter*      adapter;
+    void**        keys;
+    void**        ownKeys;  // a key per thread, not in keys
+    uint32_t      count;
+    uint64_t      operations;  // per thread
+};
+
+template< typename Adapter >
+static void ThreadedRoutine( __in void* context, __in int thread )
+{
+    ThreadedContext< Adapter >*  threadedContext = (ThreadedContext< Adapter >*)context;
+    Adapter*                     adapter = threadedContext->adapter;
+    uint64_t                     random = 0x4321 + thread;
+    uint64_t                     lookups = 0x0;
+    uint64_t                     found = 0x0;
+    
+    for( uint64_t i = 0x0; i < threadedContext->operations; ++i ){
+    
+        uint64_t value = BenchRandom( &random );
+        
+        if( 0x0 == ( value & 0x7 ) ){
+        
+            void* key = threadedContext->ownKeys[ thread ];
+            
+            BENCH_CHECK( adapter->insert( key ) );
+            BENCH_CHECK( adapter->remove( key ) );
+            continue;
+        }
+        
+        ++lookups;
+        found += adapter->get( threadedContext->keys[ ( value >> 3 ) % threadedContext->count ] );
+    }
+    
+    BENCH_CHECK( found == lookups );
+}
+
+template< typename Adapter >
+static void RunThreaded( __in const char* name, __in Adapter* adapter, __in void** keys, __in void** ownKeys,
+                         __in uint32_t count, __in uint64_t operations )
+{
+    ThreadedContext< Adapter >  context;
+    char                        title[ 128 ];
+    
+    context.adapter = adapter;
+    context.keys = keys;
+    context.ownKeys = ownKeys;
+    context.count = count;
+    context.operations = operations;
+    
+    for( int threads = 0x1; threads <= 32; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, ThreadedRoutine< Adapter >, &context );
+        
+        snprintf( title, sizeof( title ), "%s, %d threads", name, threads );
+        BenchReport( title, context.operations * threads, time );
+    }
+}
+
+template< typename Policy >
+static void RunThreadedMap( __in const char* name, __in void** keys, __in void** ownKeys,
+                            __in uint32_t count, __in uint64_t operations )
+{
+    ConcurrentMapAdapter< Policy >  adapter;
+    
+    if( ! adapter.init() ){
+    
+        printf( "%s: init() failed\n", name );
+        return;
+    }
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( adapter.insert( keys[ i ] ) );
+    
+    RunThreaded( name, &adapter, keys, ownKeys, count, operations );
+}
+
+static void RunThreadedLinkedList( __in const char* name, __in void** keys, __in void** ownKeys,
+                                   __in uint32_t count, __in uint64_t operations )
+{
+    LinkedListDataMapAdapter  adapter;
+    
+    if( ! adapter.init() ){
+    
+        printf( "%s: init() failed\n", name );
+        return;
+    }
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( adapter.fill( keys[ i ] ) );
+    
+    RunThreaded( name, &adapter, keys, ownKeys, count, operations );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t  count = (uint32_t)BenchScale( 0x1 << 20 );
+    void**    keys = (void**)malloc( count * sizeof( void* ) );
+    void**    missingKeys = (void**)malloc( count * sizeof( void* ) );
+    uint64_t  random = 0x12345678;
+    
+    assert( keys && missingKeys );
+    
+    //
+    // the vnode addresses are 16 bytes aligned and spread over the heap
+    //
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        keys[ i ] = (void*)( ( (uint64_t)( i + 1 ) << 8 ) | ( ( BenchRandom( &random ) & 0xF ) << 4 ) );
+        missingKeys[ i ] = (void*)( (uint64_t)keys[ i ] + 0x8 );
+    }
+    
+    printf( "%u pointer keys\n", count );
+    
+    RunPointerKeys< ConcurrentMapAdapter< QvrMapPolicyNone > >( "QvrConcurrentMap none", keys, missingKeys, count );
+    RunPointerKeys< ConcurrentMapAdapter< QvrMapPolicyStriped > >( "QvrConcurrentMap striped", keys, missingKeys, count );
+    RunPointerKeys< ConcurrentMapAdapter< QvrMapPolicyReadMostly > >( "QvrConcurrentMap read mostly", keys, missingKeys, count );
+    RunPointerKeys< GhtAdapter< GhtKindChained > >( "ght chained", keys, missingKeys, count );
+    RunPointerKeys< GhtAdapter< GhtKindFixed > >( "ght fixed key", keys, missingKeys, count );
+    RunPointerKeys< GhtAdapter< GhtKindOpen > >( "ght Robin Hood", keys, missingKeys, count );
+    
+    //
+    // the threaded run uses the first 128k keys, the linked list walks the list
+    // for a lookup so it runs 1024 times fewer operations, the
+    // aggregate time per operation is reported, it scales only if the
+    // machine has as many cores as threads
+    //
+    uint32_t  threadedCount = (uint32_t)BenchScale( 0x1 << 17 );
+    uint64_t  operations = BenchScale( 0x1 << 18 );
+    
+    printf( "%u pointer keys, 1/8 of the operations add and remove a thread's key\n", threadedCount );
+    
+    RunThreadedMap< QvrMapPolicyStriped >( "QvrConcurrentMap striped", keys, missingKeys, threadedCount, operations );
+    RunThreadedMap< QvrMapPolicyReadMostly >( "QvrConcurrentMap read mostly", keys, missingKeys, threadedCount, operations );
+    RunThreadedLinkedList( "DataMap linked list", keys, missingKeys, threadedCount, ( operations >> 10 ) ? ( operations >> 10 ) : 0x1 );
+    
+    free( missingKeys );
+    free( keys );
+    
+    return BenchFailures() ? 1 : 0;
+}
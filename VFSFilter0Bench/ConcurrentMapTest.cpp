@@ -0,0 +1,159 @@
+//
+//  ConcurrentMapTest.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "ConcurrentMap.h"
+
+//--------------------------------------------------------------------
+
+template< typename Policy >
+static void TestPointerKeys()
+{
+    QvrConcurrentMap< void*, void*, Policy >  map;
+    const long  count = 100000;
+    void*       value;
+    
+    BENCH_CHECK( map.init() );
+    
+    for( long i = 0x1; i < count; ++i )
+        BENCH_CHECK( map.insert( (void*)( i * 16 ), (void*)i ) );
+    
+    BENCH_CHECK( (long)map.getCount() == count - 1 );
+    
+    for( long i = 0x1; i < count; ++i )
+        BENCH_CHECK( map.get( (void*)( i * 16 ), &value ) && value == (void*)i );
+    
+    //
+    // an insert of an existing key updates the value
+    //
+    BENCH_CHECK( map.insert( (void*)16, (void*)0x5 ) );
+    BENCH_CHECK( map.get( (void*)16, &value ) && value == (void*)0x5 );
+    BENCH_CHECK( (long)map.getCount() == count - 1 );
+    
+    for( long i = 0x1; i < count; i += 2 )
+        BENCH_CHECK( map.remove( (void*)( i * 16 ) ) );
+    
+    //
+    // the backward shift keeps the remaining entries reachable
+    //
+    for( long i = 0x2; i < count; i += 2 )
+        BENCH_CHECK( map.get( (void*)( i * 16 ), &value ) && value == (void*)i );
+    
+    for( long i = 0x1; i < count; i += 2 )
+        BENCH_CHECK( ! map.get( (void*)( i * 16 ), NULL ) );
+    
+    while( map.removeFirst( &value ) ) {}
+    
+    BENCH_CHECK( map.isEmpty() );
+}
+
+//--------------------------------------------------------------------
+
+static void TestCopyKeys()
+{
+    QvrConcurrentMap< void*, void*, QvrMapPolicyStriped >  map;
+    void*  keys[ 64 ];
+    
+    BENCH_CHECK( map.init() );
+    
+    for( long i = 0x1; i <= 32; ++i )
+        BENCH_CHECK( map.insert( (void*)( i * 16 ), (void*)i ) );
+    
+    BENCH_CHECK( 32 == map.copyKeys( keys, 64 ) );
+    BENCH_CHECK( 8 == map.copyKeys( keys, 8 ) );
+    
+    for( long i = 0x1; i <= 32; ++i )
+        BENCH_CHECK( map.remove( (void*)( i * 16 ) ) );
+}
+
+//--------------------------------------------------------------------
+
+static void TestByteStringKeys()
+{
+    QvrConcurrentMap< QvrMapByteString, int, QvrMapPolicyReadMostly >  map;
+    char  path[ 64 ];
+    int   value;
+    
+    BENCH_CHECK( map.init() );
+    
+    for( int i = 0x0; i < 10000; ++i ){
+    
+        int length = snprintf( path, sizeof( path ), "/Users/test/file%d", i );
+        BENCH_CHECK( map.insert( QvrMapByteString( path, length ), i ) );
+    }
+    
+    for( int i = 0x0; i < 10000; ++i ){
+    
+        //
+        // the map stores a copy of the key
+        //
+        int length = snprintf( path, sizeof( path ), "/Users/test/file%d", i );
+        BENCH_CHECK( map.get( QvrMapByteString( path, length ), &value ) && value == i );
+    }
+    
+    BENCH_CHECK( ! map.get( QvrMapByteString( "/Users", 6 ), NULL ) );
+    
+    for( int i = 0x0; i < 10000; ++i ){
+    
+        int length = snprintf( path, sizeof( path ), "/Users/test/file%d", i );
+        BENCH_CHECK( map.remove( QvrMapByteString( path, length ) ) );
+    }
+    
+    BENCH_CHECK( map.isEmpty() );
+}
+
+//--------------------------------------------------------------------
+
+static void TestKeyBytes()
+{
+    QvrConcurrentMap< QvrMapByteString, int, QvrMapPolicyStriped >  map;
+    QvrMapStatisticsReport  report;
+    char      path[ 64 ];
+    uint64_t  keyBytes = 0x0;
+    
+    BENCH_CHECK( map.init() );
+    
+    //
+    // the key lengths differ so a removal accounted with a shifted
+    // entry's key size is caught
+    //
+    for( int i = 0x0; i < 10000; ++i ){
+        
+        int length = snprintf( path, sizeof( path ), "/Users/test/%d%s", i, ( i % 3 ) ? "a" : "bbbbbbbbbbbbbbbb" );
+        BENCH_CHECK( map.insert( QvrMapByteString( path, length ), i ) );
+        keyBytes += length;
+    }
+    
+    map.getStatistics( &report );
+    BENCH_CHECK( report.keyBytes == keyBytes );
+    
+    for( int i = 0x0; i < 10000; ++i ){
+        
+        int length = snprintf( path, sizeof( path ), "/Users/test/%d%s", i, ( i % 3 ) ? "a" : "bbbbbbbbbbbbbbbb" );
+        BENCH_CHECK( map.remove( QvrMapByteString( path, length ) ) );
+    }
+    
+    map.getStatistics( &report );
+    BENCH_CHECK( 0x0 == report.entries );
+    BENCH_CHECK( 0x0 == report.keyBytes );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    TestPointerKeys< QvrMapPolicyNone >();
+    TestPointerKeys< QvrMapPolicyStriped >();
+    TestPointerKeys< QvrMapPolicyReadMostly >();
+    TestCopyKeys();
+    TestByteStringKeys();
+    TestKeyBytes();
+    
+    printf( "ConcurrentMapTest: %d failures\n", BenchFailures() );
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+//
+//  EpochReadBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "VNodeMocks.h"
+#include "LinkedListDataMap.h"
+#include "DataMap.h"
+#include "VNode.h"
+
+//--------------------------------------------------------------------
+
+//
+// the read path of VNodeMap::getVnodeIORef() at 1 to 32 threads, the
+// epoch bracket against the path it replaced, a DataMap lookup under
+// the map's IOLock, with the linked list DataMap and with the
+// QvrConcurrentMap based one, a read takes and releases the IO vnode's
+// reference, the associations are for 1024 vnodes
+//
+
+//--------------------------------------------------------------------
+
+template< typename Map >
+class LockedDataMapPath{
+    
+private:
+    IOLock*  lock;
+    Map      map;
+    
+public:
+    
+    LockedDataMapPath() : lock( NULL ) {}
+    ~LockedDataMapPath() { if( lock ) IOLockFree( lock ); }
+    
+    bool init()
+    {
+        lock = IOLockAlloc();
+        return lock && map.init();
+    }
+    
+    void addVnodeIO( __in vnode_t vn, __in vnode_t vnodeIO )
+    {
+        IOLockLock( lock );
+        {// start of the lock
+            if( map.addDataByKey( vn, vnodeIO ) )
+                vnode_get( vnodeIO );
+        }// end of the lock
+        IOLockUnlock( lock );
+    }
+    
+    void removeVnodeIO( __in vnode_t vn )
+    {
+        vnode_t vnodeIO;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            vnodeIO = (vnode_t)map.removeKeyAndReturnItsData( vn );
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        if( vnodeIO )
+            vnode_put( vnodeIO );
+    }
+    
+    vnode_t getVnodeIORef( __in vnode_t vn )
+    {
+        vnode_t vnodeIO;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            vnodeIO = (vnode_t)map.getDataByKey( vn );
+            if( vnodeIO )
+                vnode_get( vnodeIO );
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        return vnodeIO;
+    }
+};
+
+class EpochPath{
+    
+public:
+    
+    bool init() { return true; } // VNodeMap::Init() is called by main()
+    void addVnodeIO( __in vnode_t vn, __in vnode_t vnodeIO ) { VNodeMap::addVnodeIO( vn, vnodeIO ); }
+    void removeVnodeIO( __in vnode_t vn ) { VNodeMap::removeVnodeIO( vn ); }
+    vnode_t getVnodeIORef( __in vnode_t vn ) { return VNodeMap::getVnodeIORef( vn ); }
+};
+
+//--------------------------------------------------------------------
+
+template< typename Path >
+class ReadContext{
+    
+public:
+    Path*          path;
+    struct vnode*  vnodes;
+    UInt32         count;
+    uint64_t       reads;  // per thread
+};
+
+template< typename Path >
+static void ReadRoutine( __in void* context, __in int thread )
+{
+    ReadContext< Path >*  readContext = (ReadContext< Path >*)context;
+    uint64_t              random = 0x9876 + thread;
+    uint64_t              found = 0x0;
+    
+    for( uint64_t i = 0x0; i < readContext->reads; ++i ){
+    
+        vnode_t vnodeIO = readContext->path->getVnodeIORef( &readContext->vnodes[ BenchRandom( &random ) % readContext->count ] );
+        
+        if( vnodeIO ){
+        
+            ++found;
+            vnode_put( vnodeIO );
+        }
+    }
+    
+    BENCH_CHECK( found == readContext->reads );
+}
+
+template< typename Path >
+static void Run( __in const char* name, __in struct vnode* vnodes, __in struct vnode* ioVnodes, __in UInt32 count, __in uint64_t reads )
+{
+    Path                 path;
+    ReadContext< Path >  context;
+    char                 title[ 128 ];
+    
+    if( ! path.init() ){
+    
+        printf( "%s: init() failed\n", name );
+        return;
+    }
+    
+    for( UInt32 i = 0x0; i < count; ++i )
+        path.addVnodeIO( &vnodes[ i ], &ioVnodes[ i ] );
+    
+    context.path = &path;
+    context.vnodes = vnodes;
+    context.count = count;
+    context.reads = reads;
+    
+    for( int threads = 0x1; threads <= 32; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, ReadRoutine< Path >, &context );
+        
+        snprintf( title, sizeof( title ), "%s, %d threads", name, threads );
+        BenchReport( title, context.reads * threads, time );
+    }
+    
+    for( UInt32 i = 0x0; i < count; ++i )
+        path.removeVnodeIO( &vnodes[ i ] );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    const UInt32   count = 1024;
+    struct vnode*  vnodes = (struct vnode*)calloc( count, sizeof( struct vnode ) );
+    struct vnode*  ioVnodes = (struct vnode*)calloc( count, sizeof( struct vnode ) );
+    uint64_t       reads = BenchScale( 0x1 << 20 );
+    
+    assert( vnodes && ioVnodes );
+    
+    for( UInt32 i = 0x0; i < count; ++i ){
+    
+        MockVnodeInit( &vnodes[ i ] );
+        MockVnodeInit( &ioVnodes[ i ] );
+    }
+    
+    if( ! VNodeMap::Init() ){
+    
+        printf( "VNodeMap::Init() failed\n" );
+        return 1;
+    }
+    
+    //
+    // the linked list walks half of the list for a read so it makes
+    // 16 times fewer reads, the aggregate time per read is reported,
+    // it scales only if the machine has as many cores as threads
+    //
+    Run< LockedDataMapPath< LinkedListDataMap > >( "IOLock + DataMap linked list", vnodes, ioVnodes, count, ( reads >> 4 ) ? ( reads >> 4 ) : 0x1 );
+    Run< LockedDataMapPath< DataMap > >( "IOLock + DataMap", vnodes, ioVnodes, count, reads );
+    Run< EpochPath >( "epoch, VNodeMap", vnodes, ioVnodes, count, reads );
+    
+    //
+    // the map's references are released by the epoch's thread call
+    //
+    for( int wait = 0x0; wait < 100 && 0x1 != ioVnodes[ count - 1 ].references; ++wait )
+        IOSleep( 20 );
+    
+    for( UInt32 i = 0x0; i < count; ++i )
+        BENCH_CHECK( 0x1 == ioVnodes[ i ].references );
+    
+    free( ioVnodes );
+    free( vnodes );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,419 @@
+//
+//  EpochTest.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "VNodeMocks.h"
+#include "VNode.h"
+
+//--------------------------------------------------------------------
+
+//
+// the epoch stress tests, the readers check inside an enter()/leave()
+// bracket that the objects they fetched are alive while the writers
+// replace and retire them, a retired object is poisoned by its callback
+// and never freed while the threads run, so a reader that sees a poisoned
+// object has found a use after retire
+//
+
+//--------------------------------------------------------------------
+
+#define OBJECT_ALIVE  0x600DF00D
+#define OBJECT_DEAD   0xDEADBEEF
+
+class EpochObject{
+    
+public:
+    UInt32 volatile  magic;
+    UInt64           value;
+    EpochObject*     next;  // the graveyard list
+};
+
+class EpochContext{
+    
+public:
+    QvrEpoch*                epoch;
+    EpochObject* volatile    published;
+    EpochObject* volatile    graveyard;
+    SInt32 volatile          writersRunning;
+    SInt64 volatile          retired;
+    SInt64 volatile          reclaimed;
+    SInt64 volatile          reads;
+    int                      writers;
+    uint64_t                 replacements;  // per writer
+};
+
+static EpochContext*  gEpochContext;
+
+static void PoisonObject( __in EpochContext* context, __in EpochObject* object )
+{
+    object->magic = OBJECT_DEAD;
+    
+    while( true ){
+    
+        EpochObject* head = context->graveyard;
+        
+        object->next = head;
+        if( __sync_bool_compare_and_swap( &context->graveyard, head, object ) )
+            break;
+    }
+}
+
+static void RetiredObjectCallback( __in void* object )
+{
+    PoisonObject( gEpochContext, (EpochObject*)object );
+    __sync_fetch_and_add( &gEpochContext->reclaimed, 1 );
+}
+
+static EpochObject* CreateObject( __in UInt64 value )
+{
+    EpochObject* object = (EpochObject*)malloc( sizeof( *object ) );
+    
+    assert( object );
+    object->magic = OBJECT_ALIVE;
+    object->value = value;
+    object->next = NULL;
+    
+    return object;
+}
+
+//--------------------------------------------------------------------
+
+static void EpochStressRoutine( __in void* context, __in int thread )
+{
+    EpochContext*  epochContext = (EpochContext*)context;
+    QvrEpoch*      epoch = epochContext->epoch;
+    
+    if( thread < epochContext->writers ){
+    
+        //
+        // the first writer retires the replaced objects, the others
+        // wait for a grace period and poison the objects themselves,
+        // a grace period sleeps while there are readers so they make
+        // fewer replacements
+        //
+        uint64_t replacements = ( 0x0 == thread ) ? epochContext->replacements : ( epochContext->replacements >> 6 ) + 1;
+        
+        for( uint64_t i = 0x0; i < replacements; ++i ){
+        
+            EpochObject* object = CreateObject( ( (UInt64)thread << 32 ) | i );
+            EpochObject* old = __sync_lock_test_and_set( &epochContext->published, object );
+            
+            if( 0x0 == thread ){
+            
+                __sync_fetch_and_add( &epochContext->retired, 1 );
+                epoch->retire( RetiredObjectCallback, old );
+            
+            } else {
+            
+                epoch->synchronize();
+                PoisonObject( epochContext, old );
+            }
+        }
+        
+        __sync_fetch_and_sub( &epochContext->writersRunning, 1 );
+        return;
+    }
+    
+    uint64_t reads = 0x0;
+    
+    while( epochContext->writersRunning ){
+    
+        UInt32 token = epoch->enter();
+        {// start of the epoch
+        
+            EpochObject* object = epochContext->published;
+            
+            BENCH_CHECK( OBJECT_ALIVE == object->magic );
+            
+            //
+            // stay inside the bracket for a while so a premature
+            // reclaim poisons the object before the second check
+            //
+            for( int i = 0x0; i < 64; ++i )
+                __asm__ __volatile__( "" ::: "memory" );
+            
+            if( 0x0 == ( reads & 0xFF ) )
+                sched_yield();
+            
+            BENCH_CHECK( OBJECT_ALIVE == object->magic );
+        
+        }// end of the epoch
+        epoch->leave( token );
+        
+        ++reads;
+    }
+    
+    __sync_fetch_and_add( &epochContext->reads, reads );
+}
+
+static void TestEpochStress()
+{
+    QvrEpoch      epoch;
+    EpochContext  context;
+    const int     readers = 4;
+    
+    BENCH_CHECK( epoch.init() );
+    
+    context.epoch = &epoch;
+    context.published = CreateObject( 0x0 );
+    context.graveyard = NULL;
+    context.writers = 2;
+    context.writersRunning = context.writers;
+    context.retired = 0x0;
+    context.reclaimed = 0x0;
+    context.reads = 0x0;
+    context.replacements = BenchScale( 0x1 << 14 );
+    
+    gEpochContext = &context;
+    
+    BenchRunThreads( context.writers + readers, EpochStressRoutine, &context );
+    
+    //
+    // all retired objects are reclaimed after a grace period
+    //
+    epoch.reclaim();
+    BENCH_CHECK( context.retired == context.reclaimed );
+    BENCH_CHECK( context.reads > 0x0 );
+    BENCH_CHECK( epoch.getGracePeriodsCount() > 0x0 );
+    
+    free( (void*)context.published );
+    
+    while( context.graveyard ){
+    
+        EpochObject* next = context.graveyard->next;
+        
+        free( (void*)context.graveyard );
+        context.graveyard = next;
+    }
+    
+    gEpochContext = NULL;
+}
+
+//--------------------------------------------------------------------
+
+class SynchronizeContext{
+    
+public:
+    QvrEpoch*        epoch;
+    SInt32 volatile  entered;
+    SInt32 volatile  leaving;
+};
+
+static void SynchronizeRoutine( __in void* context, __in int thread )
+{
+    SynchronizeContext*  synchronizeContext = (SynchronizeContext*)context;
+    
+    if( 0x0 == thread ){
+    
+        UInt32 token = synchronizeContext->epoch->enter();
+        
+        synchronizeContext->entered = 0x1;
+        usleep( 20000 );
+        synchronizeContext->leaving = 0x1;
+        
+        synchronizeContext->epoch->leave( token );
+        return;
+    }
+    
+    while( ! synchronizeContext->entered )
+        sched_yield();
+    
+    //
+    // the grace period ends after the reader has left
+    //
+    synchronizeContext->epoch->synchronize();
+    BENCH_CHECK( synchronizeContext->leaving );
+}
+
+static void TestSynchronizeWaitsForReaders()
+{
+    QvrEpoch            epoch;
+    SynchronizeContext  context;
+    
+    BENCH_CHECK( epoch.init() );
+    
+    context.epoch = &epoch;
+    context.entered = 0x0;
+    context.leaving = 0x0;
+    
+    BenchRunThreads( 2, SynchronizeRoutine, &context );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the readers take the references returned by VNodeMap::getVnodeInfo while
+// the writers replace, detach and remove the associations, a map's reference
+// dropped before a grace period makes a reader's vnode_get() hit a released
+// vnode, the vnodes are checked for leaked and doubly released references
+//
+class VNodeMapContext{
+    
+public:
+    struct vnode*    vnodes;       // the map's keys
+    UInt32           vnodesCount;
+    struct vnode*    ioVnodes;     // the associated vnodes, never reused
+    SInt64 volatile  ioVnodesUsed;
+    UInt32           ioVnodesCount;
+    int              writers;
+    SInt32 volatile  writersRunning;
+    uint64_t         updates;  // per writer
+};
+
+static vnode_t NewIoVnode( __in VNodeMapContext* context )
+{
+    SInt64 index = __sync_fetch_and_add( &context->ioVnodesUsed, 1 );
+    
+    assert( index < context->ioVnodesCount );
+    MockVnodeInit( &context->ioVnodes[ index ] );
+    
+    return &context->ioVnodes[ index ];
+}
+
+static void VNodeMapRoutine( __in void* context, __in int thread )
+{
+    VNodeMapContext*  mapContext = (VNodeMapContext*)context;
+    uint64_t          random = 0x5678 + thread;
+    
+    if( thread < mapContext->writers ){
+    
+        //
+        // a key is updated by a single writer as addVnodeIO() requires
+        // the existing association to be the same vnode
+        //
+        for( uint64_t i = 0x0; i < mapContext->updates; ++i ){
+        
+            UInt32   indx = (UInt32)( BenchRandom( &random ) % ( mapContext->vnodesCount / mapContext->writers ) );
+            vnode_t  vn = &mapContext->vnodes[ indx * mapContext->writers + thread ];
+            vnode_t  io = NewIoVnode( mapContext );
+            vnode_t  shadow = NewIoVnode( mapContext );
+            
+            VNodeMap::removeVnodeIO( vn );
+            VNodeMap::addVnodeIO( vn, io );
+            VNodeMap::addVnodeShadowReverse( vn, shadow );
+            
+            //
+            // the map holds its own references
+            //
+            vnode_put( io );
+            vnode_put( shadow );
+            
+            switch( i & 0x3 ){
+            
+                case 0x0:
+                    VNodeMap::removeVnode( vn );
+                    break;
+                
+                case 0x1:
+                {
+                    vnode_t detached = VNodeMap::detachVnodeIO( vn );
+                    
+                    //
+                    // releaseAllReferences() of the first writer might have dropped it
+                    //
+                    BENCH_CHECK( io == detached || ( NULLVP == detached && 0x0 != thread ) );
+                    if( detached )
+                        vnode_put( detached );
+                    break;
+                }
+                
+                case 0x2:
+                    VNodeMap::removeShadowReverse( vn );
+                    break;
+                
+                default:
+                    break;
+            }
+            
+            if( 0x0 == thread && 0x0 == ( i & 0xFF ) )
+                VNodeMap::releaseAllReferences( QvrVnodeInfoIORef | QvrVnodeInfoShadowReverseRef );
+        }
+        
+        __sync_fetch_and_sub( &mapContext->writersRunning, 1 );
+        return;
+    }
+    
+    while( mapContext->writersRunning ){
+    
+        QvrVnodeInfo  info;
+        vnode_t       vn = &mapContext->vnodes[ BenchRandom( &random ) % mapContext->vnodesCount ];
+        
+        VNodeMap::getVnodeInfo( vn, &info, QvrVnodeInfoIORef | QvrVnodeInfoShadowReverseRef );
+        
+        if( info.vnodeIO )
+            BENCH_CHECK( MockVnodeIsAlive( info.vnodeIO ) );
+        
+        if( info.shadowReverse )
+            BENCH_CHECK( MockVnodeIsAlive( info.shadowReverse ) );
+        
+        VNodeMap::putVnodeInfo( &info );
+    }
+}
+
+static void TestVNodeMapStress()
+{
+    VNodeMapContext  context;
+    const int        readers = 4;
+    
+    context.writers = 2;
+    context.writersRunning = context.writers;
+    context.updates = BenchScale( 0x1 << 14 );
+    context.vnodesCount = 64;
+    context.vnodes = (struct vnode*)calloc( context.vnodesCount, sizeof( struct vnode ) );
+    context.ioVnodesCount = (UInt32)( 2 * context.writers * context.updates );
+    context.ioVnodes = (struct vnode*)calloc( context.ioVnodesCount, sizeof( struct vnode ) );
+    context.ioVnodesUsed = 0x0;
+    
+    assert( context.vnodes && context.ioVnodes );
+    
+    for( UInt32 i = 0x0; i < context.vnodesCount; ++i )
+        MockVnodeInit( &context.vnodes[ i ] );
+    
+    BenchRunThreads( context.writers + readers, VNodeMapRoutine, &context );
+    
+    for( UInt32 i = 0x0; i < context.vnodesCount; ++i )
+        VNodeMap::removeVnode( &context.vnodes[ i ] );
+    
+    //
+    // the last references are released by the epoch's thread call
+    //
+    for( int wait = 0x0; wait < 100; ++wait ){
+    
+        SInt64 referenced = 0x0;
+        
+        for( SInt64 i = 0x0; i < context.ioVnodesUsed; ++i )
+            referenced += ( 0x0 != context.ioVnodes[ i ].references );
+        
+        if( 0x0 == referenced )
+            break;
+        
+        IOSleep( 20 );
+    }
+    
+    for( SInt64 i = 0x0; i < context.ioVnodesUsed; ++i ){
+    
+        BENCH_CHECK( 0x0 == context.ioVnodes[ i ].references );
+        BENCH_CHECK( ! MockVnodeIsAlive( &context.ioVnodes[ i ] ) );
+    }
+    
+    free( context.ioVnodes );
+    free( context.vnodes );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    BENCH_CHECK( VNodeMap::Init() );
+    
+    TestSynchronizeWaitsForReaders();
+    TestEpochStress();
+    TestVNodeMapStress();
+    
+    printf( "EpochTest: %d failures\n", BenchFailures() );
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+//
+//  GhtBatchBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// ght_get_batch() and ght_insert_batch() against a loop of ght_get() and
+// ght_insert() at the batch sizes of 8 to 256, the table is larger than the
+// cache and the keys are in a random order so each key is a cache miss
+//
+
+//--------------------------------------------------------------------
+
+static ght_hash_table_t* CreateTable( __in bool open, __in uint32_t count )
+{
+    //
+    // the tables are sized for all keys so the inserts don't rehash
+    //
+    if( open )
+        return ght_create_open( 2 * count, false, sizeof( UInt64 ) );
+    
+    return ght_create_fixed( count, false, sizeof( UInt64 ) );
+}
+
+//--------------------------------------------------------------------
+
+static void RunLookups( __in bool open, __in const UInt64* keys, __in uint32_t count, __in const UInt64* order, __in uint32_t lookups )
+{
+    const char*        name = open ? "Robin Hood" : "chained";
+    ght_hash_table_t*  table = CreateTable( open, count );
+    void*              data[ 256 ];
+    uint64_t           found = 0x0;
+    uint64_t           start;
+    uint64_t           singleTime;
+    char               title[ 128 ];
+    
+    assert( table );
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)( keys + i ), sizeof( UInt64 ), &keys[ i ] ) );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < lookups; ++i )
+        found += ( NULL != ght_get( table, sizeof( UInt64 ), &order[ i ] ) );
+    singleTime = BenchNow() - start;
+    
+    BENCH_CHECK( found == lookups );
+    
+    snprintf( title, sizeof( title ), "%s ght_get", name );
+    BenchReport( title, lookups, singleTime );
+    
+    for( uint32_t batch = 8; batch <= 256; batch *= 2 ){
+    
+        found = 0x0;
+        start = BenchNow();
+        
+        for( uint32_t i = 0x0; i + batch <= lookups; i += batch ){
+        
+            ght_get_batch( table, batch, sizeof( UInt64 ), &order[ i ], data );
+            
+            for( uint32_t j = 0x0; j < batch; ++j )
+                found += ( NULL != data[ j ] );
+        }
+        
+        uint64_t time = BenchNow() - start;
+        
+        BENCH_CHECK( found == lookups - lookups % batch );
+        
+        snprintf( title, sizeof( title ), "%s ght_get_batch %u", name, batch );
+        BenchReport( title, found, time );
+        printf( "%-48s %10.2fx\n", "", time ? (double)singleTime * found / ( (double)time * lookups ) : 0.0 );
+    }
+    
+    ght_finalize( table );
+}
+
+//--------------------------------------------------------------------
+
+static void RunInserts( __in bool open, __in const UInt64* order, __in uint32_t count )
+{
+    const char*        name = open ? "Robin Hood" : "chained";
+    ght_hash_table_t*  table = CreateTable( open, count );
+    void*              data[ 256 ];
+    uint64_t           start;
+    uint64_t           singleTime;
+    char               title[ 128 ];
+    
+    assert( table );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        ght_insert( table, (void*)( order + i ), sizeof( UInt64 ), &order[ i ] );
+    singleTime = BenchNow() - start;
+    
+    ght_finalize( table );
+    
+    snprintf( title, sizeof( title ), "%s ght_insert", name );
+    BenchReport( title, count, singleTime );
+    
+    for( uint32_t batch = 8; batch <= 256; batch *= 2 ){
+    
+        uint32_t inserted = 0x0;
+        
+        table = CreateTable( open, count );
+        assert( table );
+        
+        start = BenchNow();
+        
+        for( uint32_t i = 0x0; i + batch <= count; i += batch ){
+        
+            for( uint32_t j = 0x0; j < batch; ++j )
+                data[ j ] = (void*)( order + i + j );
+            
+            inserted += ght_insert_batch( table, batch, data, sizeof( UInt64 ), &order[ i ], NULL );
+        }
+        
+        uint64_t time = BenchNow() - start;
+        
+        BENCH_CHECK( inserted == count - count % batch );
+        
+        ght_finalize( table );
+        
+        snprintf( title, sizeof( title ), "%s ght_insert_batch %u", name, batch );
+        BenchReport( title, inserted, time );
+        printf( "%-48s %10.2fx\n", "", time ? (double)singleTime * inserted / ( (double)time * count ) : 0.0 );
+    }
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t  count = (uint32_t)BenchScale( 1 << 20 );
+    uint32_t  lookups = (uint32_t)BenchScale( 1 << 21 );
+    UInt64*   keys = (UInt64*)malloc( count * sizeof( UInt64 ) );
+    UInt64*   order = (UInt64*)malloc( lookups * sizeof( UInt64 ) );
+    UInt64*   shuffled = (UInt64*)malloc( count * sizeof( UInt64 ) );
+    uint64_t  random = 0xB;
+    
+    assert( keys && order && shuffled );
+    
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        keys[ i ] = 0xffffff8012340000ULL + (UInt64)i * 0xE0;
+        shuffled[ i ] = keys[ i ];
+    }
+    
+    for( uint32_t i = 0x0; i < lookups; ++i )
+        order[ i ] = keys[ BenchRandom( &random ) % count ];
+    
+    for( uint32_t i = count - 1; i > 0x0; --i ){
+    
+        uint32_t j = (uint32_t)( BenchRandom( &random ) % ( i + 1 ) );
+        UInt64   key = shuffled[ i ];
+        
+        shuffled[ i ] = shuffled[ j ];
+        shuffled[ j ] = key;
+    }
+    
+    //
+    // the speedup against the single key calls is printed under each batch size
+    //
+    RunLookups( false, keys, count, order, lookups );
+    RunLookups( true, keys, count, order, lookups );
+    RunInserts( false, shuffled, count );
+    RunInserts( true, shuffled, count );
+    
+    free( shuffled );
+    free( order );
+    free( keys );
+    
+    return BenchFailures() ? 1 : 0;
+}
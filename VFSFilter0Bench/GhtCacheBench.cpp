@@ -0,0 +1,228 @@
+//
+//  GhtCacheBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include <math.h>
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the hit ratio of the ght cache mode with the CLOCK eviction against the
+// bounded buckets at the same capacity, a miss inserts the key as the path
+// memoization of the filter would do, the traces are synthetic as there are
+// no recorded file system traces in the tree, the keys are paths drawn from
+// a Zipf distribution, a trace can be mixed with a sequential scan of keys
+// that are never accessed again
+//
+
+#define BENCH_PATH_SIZE  96
+
+//--------------------------------------------------------------------
+
+class Trace{
+    
+public:
+    const char*  name;
+    uint32_t*    keys;    // indices of gPaths
+    uint32_t     length;
+};
+
+static ght_hash_key_t*  gPaths;
+static uint32_t         gPathCount;
+
+//--------------------------------------------------------------------
+
+static void MakePaths( __in uint32_t count )
+{
+    char* paths = (char*)malloc( (size_t)count * BENCH_PATH_SIZE );
+    
+    gPaths = (ght_hash_key_t*)malloc( count * sizeof( ght_hash_key_t ) );
+    gPathCount = count;
+    assert( paths && gPaths );
+    
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        char* path = paths + (size_t)i * BENCH_PATH_SIZE;
+        
+        gPaths[ i ].i_size = (unsigned int)snprintf( path, BENCH_PATH_SIZE, "/Users/someone/Documents/%u/%u.txt",
+                                                     (unsigned)( i % 251 ), (unsigned)i );
+        gPaths[ i ].p_key  = path;
+    }
+}
+
+//--------------------------------------------------------------------
+
+//
+// the ranks of the first distinct keys follow the Zipf distribution with the
+// exponent s, the keys after them are the scan keys, scanPercent of the
+// accesses go to the next scan key
+//
+static void MakeTrace( __in Trace* trace, __in const char* name, __in uint32_t distinct, __in double s,
+                       __in unsigned int scanPercent, __in uint32_t length, __in uint64_t seed )
+{
+    double*   cdf = (double*)malloc( distinct * sizeof( double ) );
+    uint32_t  scanKey = distinct;
+    double    sum = 0.0;
+    
+    trace->name = name;
+    trace->keys = (uint32_t*)malloc( length * sizeof( uint32_t ) );
+    trace->length = length;
+    assert( cdf && trace->keys );
+    
+    for( uint32_t i = 0x0; i < distinct; ++i ){
+    
+        sum += 1.0 / pow( (double)( i + 1 ), s );
+        cdf[ i ] = sum;
+    }
+    
+    for( uint32_t i = 0x0; i < length; ++i ){
+    
+        if( BenchRandom( &seed ) % 100 < scanPercent && scanKey < gPathCount ){
+        
+            trace->keys[ i ] = scanKey++;
+            continue;
+        }
+        
+        double    u = (double)( BenchRandom( &seed ) >> 11 ) / (double)( 0x1ULL << 53 ) * sum;
+        uint32_t  low = 0x0;
+        uint32_t  high = distinct - 1;
+        
+        while( low < high ){
+        
+            uint32_t middle = ( low + high ) / 2;
+            
+            if( cdf[ middle ] < u )
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        
+        //
+        // spread the popular keys over the key space
+        //
+        trace->keys[ i ] = (uint32_t)( ( (uint64_t)low * 0x9E3779B1 ) % distinct );
+    }
+    
+    free( cdf );
+}
+
+//--------------------------------------------------------------------
+
+static uint64_t volatile  gEvictions;
+
+static void CountEviction( __in void* data, __in const void* key )
+{
+    ++gEvictions;
+}
+
+//--------------------------------------------------------------------
+
+static void Replay( __in const Trace* trace, __in bool clock, __in unsigned int capacity )
+{
+    const unsigned int  bucketLimit = 4;
+    ght_hash_table_t*   table;
+    uint64_t            hits = 0x0;
+    char                title[ 128 ];
+    
+    if( clock ){
+    
+        table = ght_create( capacity, false );
+        assert( table );
+        
+        ght_set_rehash( table, GHT_REHASH_INCREMENTAL );
+        ght_set_cache( table, capacity, 0x0, CountEviction );
+    
+    } else {
+    
+        //
+        // the bucket limit bounds the capacity, the table is not rehashed,
+        // the capacity is a power of 2 so it is the number of buckets times
+        // the limit
+        //
+        table = ght_create( capacity / bucketLimit, false );
+        assert( table );
+        
+        ght_set_bounded_buckets( table, bucketLimit, CountEviction );
+    }
+    
+    gEvictions = 0x0;
+    
+    uint64_t start = BenchNow();
+    
+    for( uint32_t i = 0x0; i < trace->length; ++i ){
+    
+        ght_hash_key_t*  path = &gPaths[ trace->keys[ i ] ];
+        void*            data = (void*)( (uintptr_t)trace->keys[ i ] + 1 );
+        void*            found = ght_get( table, path->i_size, path->p_key );
+        
+        if( found ){
+        
+            BENCH_CHECK( found == data );
+            ++hits;
+        
+        } else {
+        
+            ght_insert( table, data, path->i_size, path->p_key );
+        }
+    }
+    
+    uint64_t time = BenchNow() - start;
+    
+    BENCH_CHECK( ght_size( table ) <= capacity );
+    
+    if( clock ){
+    
+        VFSTableStatistics report;
+        
+        ght_get_statistics( table, &report );
+        BENCH_CHECK( report.evictions == gEvictions );
+        BENCH_CHECK( report.misses == trace->length - hits );
+    }
+    
+    snprintf( title, sizeof( title ), "%s, %u entries, %s", trace->name, capacity, clock ? "CLOCK" : "bounded" );
+    BenchReport( title, trace->length, time );
+    printf( "%-48s %10.2f%% hits %10llu evictions\n", "", 100.0 * hits / trace->length, (unsigned long long)gEvictions );
+    
+    ght_finalize( table );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t  distinct = (uint32_t)BenchScale( 0x1 << 20 );
+    uint32_t  length = (uint32_t)BenchScale( 0x1 << 21 );
+    Trace     traces[ 4 ];
+    
+    MakePaths( distinct + length / 4 );
+    
+    MakeTrace( &traces[ 0 ], "zipf 0.8", distinct, 0.8, 0, length, 0x11 );
+    MakeTrace( &traces[ 1 ], "zipf 1.0", distinct, 1.0, 0, length, 0x12 );
+    MakeTrace( &traces[ 2 ], "zipf 1.2", distinct, 1.2, 0, length, 0x13 );
+    MakeTrace( &traces[ 3 ], "zipf 1.0, 20% scan", distinct, 1.0, 20, length, 0x14 );
+    
+    for( size_t t = 0x0; t < sizeof( traces ) / sizeof( traces[ 0 ] ); ++t ){
+    
+        //
+        // about 1% and 6% of the distinct keys
+        //
+        for( unsigned int capacity = distinct / 128; capacity <= distinct / 16; capacity *= 8 ){
+        
+            Replay( &traces[ t ], true, capacity );
+            Replay( &traces[ t ], false, capacity );
+        }
+        
+        free( traces[ t ].keys );
+    }
+    
+    free( (void*)gPaths[ 0 ].p_key );
+    free( gPaths );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+//
+//  GhtConcurrentReadBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the read throughput of a ght table at 1 to 64 threads, a table protected
+// by a single IORWLock taken as shared for each lookup as QvrVnodeHooksHashTable
+// did before against the concurrent mode with the bucket group locks,
+// the VOP table is small so the keys are the addresses of 4096 functions
+//
+
+//--------------------------------------------------------------------
+
+class ReadContext{
+    
+public:
+    ght_hash_table_t*  table;
+    IORWLock*          lock;  // NULL for a concurrent table
+    const UInt64*      keys;
+    uint32_t           count;
+    uint64_t           lookups;  // per thread
+};
+
+static void ReadRoutine( __in void* context, __in int thread )
+{
+    ReadContext*  readContext = (ReadContext*)context;
+    uint64_t      random = 0x1234 + thread;
+    uint64_t      found = 0x0;
+    
+    for( uint64_t i = 0x0; i < readContext->lookups; ++i ){
+    
+        UInt64 key = readContext->keys[ BenchRandom( &random ) % readContext->count ];
+        
+        //
+        // the single lock is timed as in QvrVnodeHooksHashTable, the concurrent
+        // table times its group lock
+        //
+        if( readContext->lock ){
+            
+            UInt64 start = QvrTableStatistics::now();
+            IORWLockRead( readContext->lock );
+            readContext->table->stats.lockAcquired( QvrTableStatistics::now() - start );
+        }
+        
+        found += ( NULL != ght_get( readContext->table, sizeof( key ), &key ) );
+        
+        if( readContext->lock )
+            IORWLockUnlock( readContext->lock );
+    }
+    
+    BENCH_CHECK( found == readContext->lookups );
+}
+
+//--------------------------------------------------------------------
+
+static void Run( __in const char* name, __in bool concurrent, __in const UInt64* keys, __in uint32_t count )
+{
+    ReadContext  context;
+    char         title[ 128 ];
+    
+    context.table = ght_create_fixed( count, false, sizeof( UInt64 ) );
+    assert( context.table );
+    
+    ght_set_rehash( context.table, GHT_REHASH_INCREMENTAL );
+    
+    if( concurrent ){
+    
+        bool created = ght_set_concurrent( context.table, GHT_LOCK_GROUPS, NULL );
+        assert( created );
+        (void)created;
+        context.lock = NULL;
+    
+    } else {
+    
+        context.lock = IORWLockAlloc();
+        assert( context.lock );
+    }
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( GHT_OK == ght_insert( context.table, (void*)( keys + i ), sizeof( UInt64 ), &keys[ i ] ) );
+    
+    context.keys = keys;
+    context.count = count;
+    context.lookups = BenchScale( 0x1 << 20 );
+    
+    for( int threads = 0x1; threads <= 64; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, ReadRoutine, &context );
+        
+        snprintf( title, sizeof( title ), "%s, %d threads", name, threads );
+        BenchReport( title, context.lookups * threads, time );
+    }
+    
+    if( context.lock )
+        IORWLockFree( context.lock );
+    
+    ght_finalize( context.table );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    const uint32_t  count = 4096;
+    UInt64          keys[ count ];
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        keys[ i ] = 0xffffff8000200000ULL + i * 0x40;
+    
+    //
+    // the aggregate throughput is reported, it scales only if
+    // the machine has as many cores as threads
+    //
+    Run( "single IORWLock", false, keys, count );
+    Run( "concurrent, 32 group locks", true, keys, count );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+//
+//  GhtFixedKeyBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the lookup with the fixed key specialization of ght_create_fixed() against
+// the generic path of ght_create() that hashes the key with the byte loop
+// and compares it with memcmp(), for 4 and 8 byte keys
+//
+
+//--------------------------------------------------------------------
+
+template< typename T >
+static uint64_t RunLookups( __in ght_hash_table_t* table, __in const T* keys, __in uint32_t count, __in uint32_t rounds )
+{
+    uint64_t  start;
+    uint32_t  found = 0x0;
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)( keys + i ), sizeof( T ), &keys[ i ] ) );
+    
+    start = BenchNow();
+    
+    for( uint32_t r = 0x0; r < rounds; ++r ){
+    
+        for( uint32_t i = 0x0; i < count; ++i ){
+        
+            T key = keys[ ( i * 7919 ) % count ];
+            found += ( NULL != ght_get( table, sizeof( key ), &key ) );
+        }
+    }
+    
+    uint64_t time = BenchNow() - start;
+    
+    BENCH_CHECK( found == count * rounds );
+    return time;
+}
+
+//--------------------------------------------------------------------
+
+template< typename T >
+static void Compare( __in uint32_t count, __in uint32_t rounds )
+{
+    T*                 keys = (T*)malloc( count * sizeof( T ) );
+    uint64_t           random = 0x9E3779B9;
+    ght_hash_table_t*  generic;
+    ght_hash_table_t*  fixed;
+    uint64_t           genericTime;
+    uint64_t           fixedTime;
+    char               title[ 128 ];
+    
+    assert( keys );
+    
+    //
+    // pointer-like keys, 16 bytes aligned and unique
+    //
+    for( uint32_t i = 0x0; i < count; ++i )
+        keys[ i ] = (T)( ( (uint64_t)( i + 1 ) << 8 ) | ( ( BenchRandom( &random ) & 0xF ) << 4 ) );
+    
+    generic = ght_create( 1024, false );
+    fixed   = ght_create_fixed( 1024, false, sizeof( T ) );
+    assert( generic && fixed );
+    
+    ght_set_rehash( generic, GHT_REHASH_INCREMENTAL );
+    ght_set_rehash( fixed, GHT_REHASH_INCREMENTAL );
+    
+    genericTime = RunLookups( generic, keys, count, rounds );
+    fixedTime   = RunLookups( fixed, keys, count, rounds );
+    
+    snprintf( title, sizeof( title ), "%u byte keys, %u entries, generic", (unsigned)sizeof( T ), count );
+    BenchReport( title, (uint64_t)count * rounds, genericTime );
+    
+    snprintf( title, sizeof( title ), "%u byte keys, %u entries, fixed", (unsigned)sizeof( T ), count );
+    BenchReport( title, (uint64_t)count * rounds, fixedTime );
+    
+    printf( "%-48s %10.2fx\n", "speedup", fixedTime ? (double)genericTime / fixedTime : 0.0 );
+    
+    ght_finalize( fixed );
+    ght_finalize( generic );
+    free( keys );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    //
+    // a cache resident table and a table that misses the cache
+    //
+    Compare< UInt32 >( 20000, (uint32_t)BenchScale( 200 ) );
+    Compare< UInt64 >( 20000, (uint32_t)BenchScale( 200 ) );
+    Compare< UInt32 >( 1 << 20, (uint32_t)BenchScale( 8 ) );
+    Compare< UInt64 >( 1 << 20, (uint32_t)BenchScale( 8 ) );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+//
+//  GhtHashBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the throughput and the bucket distribution of the ght hash functions on
+// vnode pointers and on paths of up to MAXPATHLEN bytes, the distribution is
+// measured for a power of 2 number of buckets as the tables mask the hash,
+// a chi-square per bucket close to 1.0 is the uniform distribution
+//
+
+//
+// MAXPATHLEN on Mac OS X, Linux defines a larger value
+//
+#define BENCH_MAXPATHLEN  1024
+
+//--------------------------------------------------------------------
+
+class HashFunction{
+    
+public:
+    const char*    name;
+    ght_fn_hash_t  function;
+};
+
+static const HashFunction  gHashFunctions[] = {
+    { "one_at_a_time", ght_one_at_a_time_hash },
+    { "rotating",      ght_rotating_hash },
+    { "crc",           ght_crc_hash },
+    { "word",          ght_word_hash },
+    { "crc32c",        ght_crc32c_hash },
+    { "mix64",         ght_mix64_hash }
+};
+
+//--------------------------------------------------------------------
+
+class KeySet{
+    
+public:
+    const char*      name;
+    ght_hash_key_t*  keys;
+    uint32_t         count;
+    uint64_t         bytes;
+};
+
+//--------------------------------------------------------------------
+
+static void Measure( __in const HashFunction* hash, __in const KeySet* set, __in uint32_t rounds )
+{
+    uint32_t   buckets = 0x1;
+    uint32_t*  counts;
+    uint32_t   accumulator = 0x0;
+    uint32_t   maxCount = 0x0;
+    uint32_t   empty = 0x0;
+    double     chiSquare = 0.0;
+    char       title[ 128 ];
+    
+    while( buckets < set->count )
+        buckets <<= 1;
+    
+    counts = (uint32_t*)calloc( buckets, sizeof( uint32_t ) );
+    assert( counts );
+    
+    uint64_t start = BenchNow();
+    
+    for( uint32_t r = 0x0; r < rounds; ++r ){
+    
+        for( uint32_t i = 0x0; i < set->count; ++i )
+            accumulator += hash->function( &set->keys[ i ] );
+    }
+    
+    uint64_t time = BenchNow() - start;
+    
+    for( uint32_t i = 0x0; i < set->count; ++i )
+        counts[ hash->function( &set->keys[ i ] ) & ( buckets - 1 ) ] += 1;
+    
+    double expected = (double)set->count / buckets;
+    
+    for( uint32_t i = 0x0; i < buckets; ++i ){
+    
+        chiSquare += ( counts[ i ] - expected ) * ( counts[ i ] - expected ) / expected;
+        
+        if( maxCount < counts[ i ] )
+            maxCount = counts[ i ];
+        
+        if( 0x0 == counts[ i ] )
+            ++empty;
+    }
+    
+    snprintf( title, sizeof( title ), "%s, %s", hash->name, set->name );
+    BenchReport( title, (uint64_t)set->count * rounds, time );
+    
+    printf( "%-48s %10.2f MB/s chi2/bucket %.3f max %u empty %.1f%% (%u)\n",
+            "",
+            time ? (double)set->bytes * rounds * 1000.0 / time : 0.0,
+            chiSquare / buckets,
+            maxCount,
+            100.0 * empty / buckets,
+            accumulator & 0x1 );
+    
+    free( counts );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t         count = (uint32_t)BenchScale( 200000 );
+    uint64_t         random = 0x5DEECE66D;
+    void**           pointers = (void**)malloc( count * sizeof( void* ) );
+    char*            paths = (char*)malloc( (size_t)count * BENCH_MAXPATHLEN );
+    ght_hash_key_t*  pointerKeys = (ght_hash_key_t*)malloc( count * sizeof( ght_hash_key_t ) );
+    ght_hash_key_t*  pathKeys = (ght_hash_key_t*)malloc( count * sizeof( ght_hash_key_t ) );
+    KeySet           sets[ 2 ];
+    
+    assert( pointers && paths && pointerKeys && pathKeys );
+    
+    //
+    // the crc32 instruction and the table give the same CRC-32C
+    //
+    ght_hash_key_t check = { 9, "123456789" };
+    BENCH_CHECK( 0xE3069283 == ght_crc32c_hash( &check ) );
+    
+    //
+    // vnodes are allocated from a zone, the addresses are close
+    // to each other with the stride of the vnode size
+    //
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        pointers[ i ] = (void*)( 0xffffff8012340000ULL + (uint64_t)i * 0xF8 );
+        pointerKeys[ i ].i_size = sizeof( void* );
+        pointerKeys[ i ].p_key  = &pointers[ i ];
+    }
+    
+    sets[ 0 ].name  = "vnode pointers";
+    sets[ 0 ].keys  = pointerKeys;
+    sets[ 0 ].count = count;
+    sets[ 0 ].bytes = (uint64_t)count * sizeof( void* );
+    
+    //
+    // the paths share long prefixes, most are short and some
+    // are nested up to MAXPATHLEN
+    //
+    sets[ 1 ].bytes = 0x0;
+    
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        char*  path = paths + (size_t)i * BENCH_MAXPATHLEN;
+        int    length = snprintf( path, BENCH_MAXPATHLEN, "/Users/someone/Library/Application Support/Product/cache/%u/file-%u.dat",
+                                  (unsigned)( i % 97 ), (unsigned)i );
+        
+        uint64_t depth = ( 0x0 == i % 16 ) ? BenchRandom( &random ) % 48 : 0x0;
+        
+        for( uint64_t d = 0x0; d < depth && length < BENCH_MAXPATHLEN - 32; ++d )
+            length += snprintf( path + length, BENCH_MAXPATHLEN - length, "/directory%u", (unsigned)d );
+        
+        pathKeys[ i ].i_size = (unsigned int)length;
+        pathKeys[ i ].p_key  = path;
+        sets[ 1 ].bytes += length;
+    }
+    
+    sets[ 1 ].name  = "MAXPATHLEN paths";
+    sets[ 1 ].keys  = pathKeys;
+    sets[ 1 ].count = count;
+    
+    printf( "%u keys, %.1f bytes per path\n", count, (double)sets[ 1 ].bytes / count );
+    
+    for( size_t s = 0x0; s < sizeof( sets ) / sizeof( sets[ 0 ] ); ++s ){
+    
+        for( size_t h = 0x0; h < sizeof( gHashFunctions ) / sizeof( gHashFunctions[ 0 ] ); ++h )
+            Measure( &gHashFunctions[ h ], &sets[ s ], 5 );
+    }
+    
+    free( pathKeys );
+    free( pointerKeys );
+    free( paths );
+    free( pointers );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+//
+//  GhtRehashLatencyBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include <algorithm>
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the latency of each ght_insert() and ght_get() while a table grows from
+// 64 buckets through many rehashes, the incremental rehash migrates
+// GHT_REHASH_STEP buckets per insert so no operation pays for the whole
+// table, the full rehash of ght_set_rehash( TRUE ) moves all entries in
+// the insert that crosses the load, the max, p99.9 and p99 are reported
+// with the number of rehashes, an insert is followed by a lookup of
+// a random inserted key
+//
+
+//--------------------------------------------------------------------
+
+static void ReportLatency( __in const char* name, __in uint32_t* latencies, __in uint32_t count, __in uint64_t rehashes )
+{
+    std::sort( latencies, latencies + count );
+    
+    uint64_t sum = 0x0;
+    for( uint32_t i = 0x0; i < count; ++i )
+        sum += latencies[ i ];
+    
+    BenchReport( name, count, sum );
+    
+    printf( "%-48s max %8u ns p99.9 %6u ns p99 %6u ns, %llu rehashes\n",
+            "",
+            latencies[ count - 1 ],
+            latencies[ (uint64_t)count * 999 / 1000 ],
+            latencies[ (uint64_t)count * 99 / 100 ],
+            (unsigned long long)rehashes );
+}
+
+//--------------------------------------------------------------------
+
+static void Run( __in const char* name, __in int rehash, __in const UInt64* keys, __in uint32_t count,
+                 __in uint32_t* insertLatencies, __in uint32_t* getLatencies )
+{
+    ght_hash_table_t*   table = ght_create_fixed( 64, false, sizeof( UInt64 ) );
+    VFSTableStatistics  report;
+    uint64_t            random = 0x21;
+    char                title[ 128 ];
+    
+    assert( table );
+    ght_set_rehash( table, rehash );
+    
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        uint64_t start = BenchNow();
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)( keys + i ), sizeof( UInt64 ), &keys[ i ] ) );
+        uint64_t middle = BenchNow();
+        
+        const UInt64* key = &keys[ BenchRandom( &random ) % ( i + 1 ) ];
+        
+        BENCH_CHECK( key == ght_get( table, sizeof( UInt64 ), key ) );
+        uint64_t end = BenchNow();
+        
+        insertLatencies[ i ] = (uint32_t)( middle - start );
+        getLatencies[ i ]    = (uint32_t)( end - middle );
+    }
+    
+    ght_get_statistics( table, &report );
+    ght_finalize( table );
+    
+    snprintf( title, sizeof( title ), "%s, insert", name );
+    ReportLatency( title, insertLatencies, count, report.rehashes );
+    
+    snprintf( title, sizeof( title ), "%s, get", name );
+    ReportLatency( title, getLatencies, count, report.rehashes );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t   count = (uint32_t)BenchScale( 0x1 << 21 );
+    UInt64*    keys = (UInt64*)malloc( count * sizeof( UInt64 ) );
+    uint32_t*  insertLatencies = (uint32_t*)malloc( count * sizeof( uint32_t ) );
+    uint32_t*  getLatencies = (uint32_t*)malloc( count * sizeof( uint32_t ) );
+    
+    assert( keys && insertLatencies && getLatencies );
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        keys[ i ] = 0xffffff8012340000ULL + (UInt64)i * 0xE0;
+    
+    //
+    // the timer's own cost is in every sample
+    //
+    uint64_t start = BenchNow();
+    for( int i = 0x0; i < 1000; ++i )
+        BenchNow();
+    printf( "%u keys, %.1f ns per timer read\n", count, (double)( BenchNow() - start ) / 1000 );
+    
+    Run( "incremental rehash", GHT_REHASH_INCREMENTAL, keys, count, insertLatencies, getLatencies );
+    Run( "full rehash", TRUE, keys, count, insertLatencies, getLatencies );
+    
+    free( getLatencies );
+    free( insertLatencies );
+    free( keys );
+    
+    return BenchFailures() ? 1 : 0;
+}
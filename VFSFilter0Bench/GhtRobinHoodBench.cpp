@@ -0,0 +1,105 @@
+//
+//  GhtRobinHoodBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the memory per entry and the lookup latency of the Robin Hood backend of
+// ght_create_open() against the chained ght_create_fixed() table for vnode
+// pointer keys, the memory is what mac_kalloc() has allocated for the table
+// so it includes the chained entries and the bucket arrays
+//
+
+//--------------------------------------------------------------------
+
+static void Run( __in bool open, __in const UInt64* keys, __in const UInt64* order, __in uint32_t count, __in uint32_t lookups )
+{
+    const char*        name = open ? "Robin Hood" : "chained";
+    ght_hash_table_t*  table;
+    int64_t            allocated = BenchAllocatedBytes();
+    uint64_t           start;
+    uint64_t           found = 0x0;
+    char               title[ 128 ];
+    
+    //
+    // the tables start small and grow as in the filter
+    //
+    table = open ? ght_create_open( 64, false, sizeof( UInt64 ) ) : ght_create_fixed( 64, false, sizeof( UInt64 ) );
+    assert( table );
+    
+    if( ! open )
+        ght_set_rehash( table, GHT_REHASH_INCREMENTAL );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)( keys + i ), sizeof( UInt64 ), &keys[ i ] ) );
+    snprintf( title, sizeof( title ), "%s, %u entries, insert", name, count );
+    BenchReport( title, count, BenchNow() - start );
+    
+    printf( "%-48s %10.2f bytes/entry, %u buckets\n", "",
+            (double)( BenchAllocatedBytes() - allocated ) / count, ght_table_size( table ) );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < lookups; ++i )
+        found += ( NULL != ght_get( table, sizeof( UInt64 ), &order[ i ] ) );
+    snprintf( title, sizeof( title ), "%s, %u entries, get hit", name, count );
+    BenchReport( title, lookups, BenchNow() - start );
+    
+    BENCH_CHECK( found == lookups );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < lookups; ++i ){
+    
+        UInt64 key = order[ i ] + 0x8;
+        found -= ( NULL == ght_get( table, sizeof( key ), &key ) );
+    }
+    snprintf( title, sizeof( title ), "%s, %u entries, get miss", name, count );
+    BenchReport( title, lookups, BenchNow() - start );
+    
+    BENCH_CHECK( 0x0 == found );
+    
+    ght_finalize( table );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    const uint32_t  sizes[] = { 1000, 100000, 1000000 };
+    uint32_t        lookups = (uint32_t)BenchScale( 2000000 );
+    uint64_t        random = 0x7;
+    
+    for( size_t s = 0x0; s < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++s ){
+    
+        uint32_t  count = sizes[ s ];
+        UInt64*   keys = (UInt64*)malloc( count * sizeof( UInt64 ) );
+        UInt64*   order = (UInt64*)malloc( lookups * sizeof( UInt64 ) );
+        
+        assert( keys && order );
+        
+        for( uint32_t i = 0x0; i < count; ++i )
+            keys[ i ] = 0xffffff8012340000ULL + (UInt64)i * 0xE0;
+        
+        //
+        // a random order defeats the hardware prefetcher
+        //
+        for( uint32_t i = 0x0; i < lookups; ++i )
+            order[ i ] = keys[ BenchRandom( &random ) % count ];
+        
+        Run( false, keys, order, count, lookups );
+        Run( true, keys, order, count, lookups );
+        
+        free( order );
+        free( keys );
+    }
+    
+    return BenchFailures() ? 1 : 0;
+}
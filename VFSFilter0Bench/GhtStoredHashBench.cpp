@@ -0,0 +1,201 @@
+//
+//  GhtStoredHashBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "CommonHashTable.h"
+
+//--------------------------------------------------------------------
+
+//
+// the effect of the hash stored in each entry of a generic table, path keys
+// share a long prefix and have the same length so a chain entry of another
+// key is rejected by the hash compare before memcmp(), the load factor is
+// raised by disabling the rehash, a full rehash places the entries by the
+// stored hash so its time doesn't include the hashing of the keys printed
+// next to it, the lookup throughput of the concurrent table is measured at
+// 1 to 8 readers as a lookup doesn't write the table
+//
+
+//
+// all paths have the same length
+//
+#define BENCH_PATH_SIZE  96
+
+//--------------------------------------------------------------------
+
+static ght_hash_key_t*  gKeys;
+
+static void MakeKeys( __in uint32_t count )
+{
+    char* paths = (char*)malloc( (size_t)count * BENCH_PATH_SIZE );
+    
+    gKeys = (ght_hash_key_t*)malloc( count * sizeof( ght_hash_key_t ) );
+    assert( paths && gKeys );
+    
+    for( uint32_t i = 0x0; i < count; ++i ){
+    
+        char* path = paths + (size_t)i * BENCH_PATH_SIZE;
+        
+        gKeys[ i ].i_size = (unsigned int)snprintf( path, BENCH_PATH_SIZE,
+                                                    "/Users/someone/Library/Application Support/Product/cache/file-%08u.dat", i );
+        gKeys[ i ].p_key  = path;
+    }
+}
+
+static void FreeKeys()
+{
+    free( (void*)gKeys[ 0 ].p_key );
+    free( gKeys );
+}
+
+//--------------------------------------------------------------------
+
+static ght_hash_table_t* CreateTable( __in uint32_t count, __in unsigned int load, __in ght_fn_hash_t hash )
+{
+    ght_hash_table_t* table = ght_create( count / load, false );
+    assert( table );
+    
+    ght_set_hash( table, hash );
+    
+    for( uint32_t i = 0x0; i < count; ++i )
+        BENCH_CHECK( GHT_OK == ght_insert( table, (void*)( (uintptr_t)i + 1 ), gKeys[ i ].i_size, gKeys[ i ].p_key ) );
+    
+    return table;
+}
+
+//--------------------------------------------------------------------
+
+static void RunLookups( __in uint32_t count, __in unsigned int load, __in uint32_t lookups )
+{
+    ght_hash_table_t*   table = CreateTable( count, load, ght_one_at_a_time_hash );
+    VFSTableStatistics  report;
+    uint64_t            random = 0x3;
+    uint64_t            found = 0x0;
+    uint64_t            start;
+    char                title[ 128 ];
+    
+    start = BenchNow();
+    
+    for( uint32_t i = 0x0; i < lookups; ++i ){
+    
+        uint32_t index = (uint32_t)( BenchRandom( &random ) % count );
+        
+        found += ( (void*)( (uintptr_t)index + 1 ) == ght_get( table, gKeys[ index ].i_size, gKeys[ index ].p_key ) );
+    }
+    
+    uint64_t time = BenchNow() - start;
+    
+    BENCH_CHECK( found == lookups );
+    
+    ght_get_statistics( table, &report );
+    
+    snprintf( title, sizeof( title ), "get, load %u", load );
+    BenchReport( title, lookups, time );
+    printf( "%-48s %10.2f probes/lookup\n", "", report.lookups ? (double)report.lookupProbes / report.lookups : 0.0 );
+    
+    ght_finalize( table );
+}
+
+//--------------------------------------------------------------------
+
+static void RunRehash( __in const char* name, __in ght_fn_hash_t hash, __in uint32_t count )
+{
+    ght_hash_table_t*  table = CreateTable( count, 4, hash );
+    ght_uint32_t       accumulator = 0x0;
+    char               title[ 128 ];
+    
+    uint64_t start = BenchNow();
+    ght_rehash( table, 2 * count );
+    uint64_t time = BenchNow() - start;
+    
+    snprintf( title, sizeof( title ), "full rehash, %s", name );
+    BenchReport( title, count, time );
+    
+    start = BenchNow();
+    for( uint32_t i = 0x0; i < count; ++i )
+        accumulator += hash( &gKeys[ i ] );
+    time = BenchNow() - start;
+    
+    snprintf( title, sizeof( title ), "%s of the keys (%u)", name, accumulator & 0x1 );
+    BenchReport( title, count, time );
+    
+    ght_finalize( table );
+}
+
+//--------------------------------------------------------------------
+
+class ReadContext{
+    
+public:
+    ght_hash_table_t*  table;
+    uint32_t           count;
+    uint64_t           lookups;  // per thread
+};
+
+static void ReadRoutine( __in void* context, __in int thread )
+{
+    ReadContext*  readContext = (ReadContext*)context;
+    uint64_t      random = 0x9 + thread;
+    uint64_t      found = 0x0;
+    
+    for( uint64_t i = 0x0; i < readContext->lookups; ++i ){
+    
+        uint32_t index = (uint32_t)( BenchRandom( &random ) % readContext->count );
+        
+        found += ( NULL != ght_get( readContext->table, gKeys[ index ].i_size, gKeys[ index ].p_key ) );
+    }
+    
+    BENCH_CHECK( found == readContext->lookups );
+}
+
+static void RunConcurrentReaders( __in uint32_t count )
+{
+    ReadContext  context;
+    char         title[ 128 ];
+    
+    context.table = CreateTable( count, 4, ght_one_at_a_time_hash );
+    context.count = count;
+    context.lookups = BenchScale( 0x1 << 19 );
+    
+    bool created = ght_set_concurrent( context.table, GHT_LOCK_GROUPS, NULL );
+    assert( created );
+    (void)created;
+    
+    for( int threads = 0x1; threads <= 8; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, ReadRoutine, &context );
+        
+        snprintf( title, sizeof( title ), "concurrent get, %d readers", threads );
+        BenchReport( title, context.lookups * threads, time );
+    }
+    
+    ght_finalize( context.table );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint32_t  count = (uint32_t)BenchScale( 200000 );
+    uint32_t  lookups = (uint32_t)BenchScale( 2000000 );
+    
+    MakeKeys( count );
+    printf( "%u path keys\n", count );
+    
+    RunLookups( count, 1, lookups );
+    RunLookups( count, 4, lookups );
+    RunLookups( count, 16, lookups );
+    
+    RunRehash( "crc32c", ght_crc32c_hash, count );
+    RunRehash( "one_at_a_time", ght_one_at_a_time_hash, count );
+    
+    RunConcurrentReaders( count );
+    FreeKeys();
+    
+    return BenchFailures() ? 1 : 0;
+}
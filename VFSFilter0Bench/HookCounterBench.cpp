@@ -0,0 +1,140 @@
+//
+//  HookCounterBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+
+//--------------------------------------------------------------------
+
+//
+// the counter updates of QvrHookVnodeVop and QvrUnHookVnodeVop for a vnode
+// whose v_op is already hooked at 1 to 64 threads, the entry of the VOP
+// table is shared by all vnodes of a file system, a thread hooks and
+// unhooks a vnode in a loop, the shared table lock is taken by both
+// versions and is not included,
+//
+// the shared version is the entry before the per-CPU counters, the entry
+// is retained by RetrieveEntry() and released for each call and the vnode
+// counter is next to the OSObject retain count, the per-CPU version is
+// QvrVnodeHookEntry::vNodeCounter, the unhooking sums the slots
+//
+
+//--------------------------------------------------------------------
+
+class SharedHookEntry{
+    
+public:
+    SInt32 volatile   retainCount;
+    SInt32 volatile   vNodeCounter;
+} __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+
+class PerCpuHookEntry{
+    
+public:
+    class CpuCounter{
+    public:
+        SInt32 volatile   count;
+    } __attribute__(( aligned( QVR_CACHE_LINE_SIZE ) ));
+    
+    CpuCounter   vNodeCounter[ QVR_CPU_SLOTS ];
+    
+    SInt32 getVnodeCounter()
+    {
+        SInt32  count = 0x0;
+        
+        for( int i = 0x0; i < QVR_CPU_SLOTS; ++i )
+            count += this->vNodeCounter[ i ].count;
+        
+        return count;
+    }
+};
+
+static SharedHookEntry  gSharedEntry;
+static PerCpuHookEntry  gPerCpuEntry;
+static uint64_t         gIterations;
+
+//--------------------------------------------------------------------
+
+static void SharedRoutine( __in void* context, __in int thread )
+{
+    SharedHookEntry*  entry = &gSharedEntry;
+    
+    for( uint64_t i = 0x0; i < gIterations; ++i ){
+    
+        //
+        // QvrHookVnodeVop
+        //
+        OSIncrementAtomic( &entry->retainCount );
+        OSIncrementAtomic( &entry->vNodeCounter );
+        OSDecrementAtomic( &entry->retainCount );
+        
+        //
+        // QvrUnHookVnodeVop
+        //
+        OSIncrementAtomic( &entry->retainCount );
+        BENCH_CHECK( 0x1 != OSDecrementAtomic( &entry->vNodeCounter ) );
+        OSDecrementAtomic( &entry->retainCount );
+    }
+}
+
+//--------------------------------------------------------------------
+
+static void PerCpuRoutine( __in void* context, __in int thread )
+{
+    PerCpuHookEntry*  entry = &gPerCpuEntry;
+    
+    for( uint64_t i = 0x0; i < gIterations; ++i ){
+    
+        //
+        // QvrHookVnodeVop
+        //
+        OSIncrementAtomic( &entry->vNodeCounter[ QvrCurrentCpuSlot() ].count );
+        
+        //
+        // QvrUnHookVnodeVop
+        //
+        OSDecrementAtomic( &entry->vNodeCounter[ QvrCurrentCpuSlot() ].count );
+        BENCH_CHECK( 0x0 != entry->getVnodeCounter() );
+    }
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    char  title[ 128 ];
+    
+    gIterations = BenchScale( 0x1 << 20 );
+    
+    //
+    // a vnode that stays hooked keeps the counters above zero
+    //
+    gSharedEntry.retainCount = 0x1;
+    gSharedEntry.vNodeCounter = 0x1;
+    gPerCpuEntry.vNodeCounter[ 0 ].count = 0x1;
+    
+    //
+    // the scaling is visible only if the machine has as many cores as threads
+    //
+    for( int threads = 0x1; threads <= 64; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, SharedRoutine, NULL );
+        
+        snprintf( title, sizeof( title ), "shared counter, %d threads", threads );
+        BenchReport( title, gIterations * threads, time );
+        
+        time = BenchRunThreads( threads, PerCpuRoutine, NULL );
+        
+        snprintf( title, sizeof( title ), "per-CPU counter, %d threads", threads );
+        BenchReport( title, gIterations * threads, time );
+    }
+    
+    BENCH_CHECK( 0x1 == gSharedEntry.vNodeCounter && 0x1 == gSharedEntry.retainCount );
+    BENCH_CHECK( 0x1 == gPerCpuEntry.getVnodeCounter() );
+    
+    return BenchFailures() ? 1 : 0;
+}
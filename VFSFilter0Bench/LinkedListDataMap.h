@@ -0,0 +1,167 @@
+//
+//  LinkedListDataMap.h
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0Bench__LinkedListDataMap__
+#define __VFSFilter0Bench__LinkedListDataMap__
+
+#include "BenchSupport.h"
+
+//--------------------------------------------------------------------
+
+//
+// DataMap before it was built on QvrConcurrentMap, a list under a single
+// IOLock, a lookup walks the whole list, the benchmarks use it as the reference
+//
+class LinkedListDataMap{
+    
+private:
+    
+    class Entry{
+    public:
+        Entry*  next;
+        Entry*  prev;
+        void*   key;
+        void*   data;
+    };
+    
+private:
+    Entry    head;
+    IOLock*  lock;
+    
+private:
+    
+    Entry* findEntryByKey( __in void* key )
+    {
+        for( Entry* entry = head.next; entry != &head; entry = entry->next ){
+        
+            if( entry->key == key )
+                return entry;
+        }
+        
+        return NULL;
+    }
+    
+    void insertHead( __in Entry* entry )
+    {
+        entry->next = head.next;
+        entry->prev = &head;
+        head.next->prev = entry;
+        head.next = entry;
+    }
+    
+public:
+    
+    LinkedListDataMap() : lock( NULL ) { head.next = head.prev = &head; }
+    
+    ~LinkedListDataMap()
+    {
+        while( head.next != &head ){
+        
+            Entry* entry = head.next;
+            
+            head.next = entry->next;
+            free( entry );
+        }
+        
+        if( lock )
+            IOLockFree( lock );
+    }
+    
+    bool init() { lock = IOLockAlloc(); return NULL != lock; }
+    
+    bool addDataByKey( __in void* key, __in void* data )
+    {
+        Entry*  entry = (Entry*)malloc( sizeof( *entry ) );
+        bool    freeEntry;
+        
+        if( ! entry )
+            return false;
+        
+        entry->key = key;
+        entry->data = data;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            Entry* existingEntry = findEntryByKey( key );
+            if( existingEntry )
+                existingEntry->data = data;
+            else
+                insertHead( entry );
+            
+            freeEntry = ( NULL != existingEntry );
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        if( freeEntry )
+            free( entry );
+        
+        return true;
+    }
+    
+    //
+    // the keys are unique so the fill skips the duplicate search,
+    // with the search a fill is quadratic
+    //
+    bool fill( __in void* key, __in void* data )
+    {
+        Entry* entry = (Entry*)malloc( sizeof( *entry ) );
+        
+        if( ! entry )
+            return false;
+        
+        entry->key = key;
+        entry->data = data;
+        insertHead( entry );
+        
+        return true;
+    }
+    
+    void* getDataByKey( __in void* key )
+    {
+        void* data = NULL;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            Entry* entry = findEntryByKey( key );
+            if( entry )
+                data = entry->data;
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        return data;
+    }
+    
+    void* removeKeyAndReturnItsData( __in void* key )
+    {
+        Entry*  entry;
+        void*   data = NULL;
+        
+        IOLockLock( lock );
+        {// start of the lock
+            entry = findEntryByKey( key );
+            if( entry ){
+            
+                entry->prev->next = entry->next;
+                entry->next->prev = entry->prev;
+            }
+        }// end of the lock
+        IOLockUnlock( lock );
+        
+        if( entry ){
+        
+            data = entry->data;
+            free( entry );
+        }
+        
+        return data;
+    }
+};
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0Bench__LinkedListDataMap__) */
@@ -0,0 +1,248 @@
+//
+//  ObjectPoolTest.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "ObjectPool.h"
+
+//--------------------------------------------------------------------
+
+//
+// the pool's CacheBatch and CacheLimit, a cache refill moves CacheBatch objects
+// from the global list, a cache with more than CacheLimit objects drains
+// CacheBatch objects to the global list
+//
+#define POOL_CACHE_BATCH  16
+#define POOL_CACHE_LIMIT  32
+
+//--------------------------------------------------------------------
+
+static void TestAllocateFree()
+{
+    QvrObjectPool            pool( 20, 64 );
+    QvrObjectPoolStatistics  stats;
+    const int                count = 1000;
+    UInt8*                   objects[ count ];
+    
+    //
+    // the size is rounded up to a pointer size
+    //
+    BENCH_CHECK( 24 == pool.getObjectSize() );
+    
+    for( int i = 0x0; i < count; ++i ){
+    
+        objects[ i ] = (UInt8*)pool.allocate();
+        BENCH_CHECK( objects[ i ] );
+        BENCH_CHECK( 0x0 == ( (uintptr_t)objects[ i ] & ( sizeof( void* ) - 1 ) ) );
+        memset( objects[ i ], i & 0xFF, pool.getObjectSize() );
+    }
+    
+    //
+    // the objects don't overlap
+    //
+    for( int i = 0x0; i < count; ++i ){
+    
+        for( vm_size_t j = 0x0; j < pool.getObjectSize(); ++j )
+            BENCH_CHECK( ( i & 0xFF ) == objects[ i ][ j ] );
+    }
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 24 == stats.objectSize );
+    BENCH_CHECK( count == stats.inUse );
+    BENCH_CHECK( count == stats.highWatermark );
+    BENCH_CHECK( count == stats.allocations );
+    BENCH_CHECK( ( count + 63 ) / 64 == stats.slabs );
+    BENCH_CHECK( stats.bytes >= (UInt64)stats.slabs * 64 * 24 );
+    
+    for( int i = 0x0; i < count; ++i )
+        pool.free( objects[ i ] );
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 0x0 == stats.inUse );
+    BENCH_CHECK( count == stats.highWatermark );
+    
+    //
+    // the freed objects are reused, the pool doesn't grow
+    //
+    for( int i = 0x0; i < count; ++i )
+        objects[ i ] = (UInt8*)pool.allocate();
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( ( count + 63 ) / 64 == stats.slabs );
+    BENCH_CHECK( count == stats.highWatermark );
+    BENCH_CHECK( 2 * count == stats.allocations );
+    
+    for( int i = 0x0; i < count; ++i )
+        pool.free( objects[ i ] );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the CPU caches are observed through the fallbacks counter, the thread
+// is bound to its CPU so all the calls use the same cache
+//
+static void TestCpuCache()
+{
+    QvrObjectPool            pool( 32, 64 );
+    QvrObjectPoolStatistics  stats;
+    const int                count = 2 * ( POOL_CACHE_BATCH + 1 );
+    void*                    objects[ count ];
+    cpu_set_t                cpus;
+    cpu_set_t                boundCpus;
+    
+    pthread_getaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+    
+    CPU_ZERO( &boundCpus );
+    CPU_SET( sched_getcpu(), &boundCpus );
+    if( 0x0 != pthread_setaffinity_np( pthread_self(), sizeof( boundCpus ), &boundCpus ) ){
+    
+        printf( "TestCpuCache: the thread can't be bound to a CPU, skipped\n" );
+        return;
+    }
+    
+    //
+    // the first allocation refills the empty cache, the next CacheBatch
+    // allocations are served by the cache
+    //
+    objects[ 0 ] = pool.allocate();
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 1 == stats.fallbacks );
+    BENCH_CHECK( 1 == stats.slabs );
+    
+    for( int i = 0x1; i <= POOL_CACHE_BATCH; ++i )
+        objects[ i ] = pool.allocate();
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 1 == stats.fallbacks );
+    
+    objects[ POOL_CACHE_BATCH + 1 ] = pool.allocate();
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 2 == stats.fallbacks );
+    
+    for( int i = POOL_CACHE_BATCH + 2; i < count; ++i )
+        objects[ i ] = pool.allocate();
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 2 == stats.fallbacks );
+    BENCH_CHECK( 1 == stats.slabs );
+    
+    //
+    // a cache keeps up to CacheLimit objects
+    //
+    for( int i = 0x0; i < POOL_CACHE_LIMIT; ++i )
+        pool.free( objects[ i ] );
+    
+    for( int i = 0x0; i < POOL_CACHE_LIMIT; ++i )
+        objects[ i ] = pool.allocate();
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 2 == stats.fallbacks );
+    
+    //
+    // the cache drains a batch when it exceeds CacheLimit so it keeps
+    // count - CacheBatch objects
+    //
+    for( int i = 0x0; i < count; ++i )
+        pool.free( objects[ i ] );
+    
+    for( int i = 0x0; i < count - POOL_CACHE_BATCH; ++i )
+        objects[ i ] = pool.allocate();
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 2 == stats.fallbacks );
+    
+    //
+    // the drained batch is on the global list, no slab is allocated
+    //
+    objects[ count - POOL_CACHE_BATCH ] = pool.allocate();
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 3 == stats.fallbacks );
+    BENCH_CHECK( 1 == stats.slabs );
+    BENCH_CHECK( count == stats.highWatermark );
+    
+    for( int i = 0x0; i <= count - POOL_CACHE_BATCH; ++i )
+        pool.free( objects[ i ] );
+    
+    pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+}
+
+//--------------------------------------------------------------------
+
+class ThreadsContext{
+    
+public:
+    QvrObjectPool*  pool;
+    int             objects;  // held by a thread at once
+    int             rounds;
+};
+
+static void ThreadsRoutine( __in void* context, __in int thread )
+{
+    ThreadsContext*  threadsContext = (ThreadsContext*)context;
+    UInt64*          objects[ 64 ];
+    
+    assert( threadsContext->objects <= 64 );
+    
+    for( int round = 0x0; round < threadsContext->rounds; ++round ){
+    
+        for( int i = 0x0; i < threadsContext->objects; ++i ){
+        
+            objects[ i ] = (UInt64*)threadsContext->pool->allocate();
+            BENCH_CHECK( objects[ i ] );
+            objects[ i ][ 0 ] = ( (UInt64)thread << 32 ) | i;
+            objects[ i ][ 1 ] = round;
+        }
+        
+        //
+        // an object given to two threads is overwritten by the other one
+        //
+        for( int i = 0x0; i < threadsContext->objects; ++i ){
+        
+            BENCH_CHECK( ( ( (UInt64)thread << 32 ) | i ) == objects[ i ][ 0 ] );
+            BENCH_CHECK( (UInt64)round == objects[ i ][ 1 ] );
+            threadsContext->pool->free( objects[ i ] );
+        }
+    }
+}
+
+static void TestThreads()
+{
+    QvrObjectPool            pool( 2 * sizeof( UInt64 ), 128 );
+    QvrObjectPoolStatistics  stats;
+    ThreadsContext           context;
+    const int                threads = 8;
+    
+    context.pool = &pool;
+    context.objects = 64;
+    context.rounds = 2000;
+    
+    BenchRunThreads( threads, ThreadsRoutine, &context );
+    
+    pool.getStatistics( &stats );
+    BENCH_CHECK( 0x0 == stats.inUse );
+    BENCH_CHECK( (UInt64)threads * context.objects * context.rounds == stats.allocations );
+    BENCH_CHECK( stats.highWatermark >= (UInt32)context.objects );
+    BENCH_CHECK( stats.highWatermark <= (UInt32)( threads * context.objects ) );
+    
+    //
+    // the slabs are bounded by the high watermark and the objects in the caches
+    //
+    BENCH_CHECK( stats.slabs * 128 <= stats.highWatermark + QVR_CPU_SLOTS * ( POOL_CACHE_LIMIT + POOL_CACHE_BATCH ) + 128 );
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    TestAllocateFree();
+    TestCpuCache();
+    TestThreads();
+    
+    printf( "ObjectPoolTest: %d failures\n", BenchFailures() );
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+//
+//  RecursionEngineBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include "BenchSupport.h"
+#include "LinkedListDataMap.h"
+#include "RecursionEngine.h"
+
+//--------------------------------------------------------------------
+
+//
+// RecursionEngine at 1 to 32 threads against the trackers it replaced,
+// a DataMap keyed by current_thread(), both the linked list DataMap and
+// the QvrConcurrentMap based one, an iteration is the sequence of a hook
+// that calls the file system on behalf of the filter, IsRecursiveCall()
+// outside of the call, EnterRecursiveCall(), IsRecursiveCall() and
+// CookieForRecursiveCall() inside, LeaveRecursiveCall()
+//
+
+//--------------------------------------------------------------------
+
+template< typename Map >
+class DataMapTracker{
+    
+private:
+    Map  map;
+    
+public:
+    
+    bool  init() { return map.init(); }
+    void* cookie() { return map.getDataByKey( current_thread() ); }
+    bool  isRecursive() { return NULL != map.getDataByKey( current_thread() ); }
+    void  enter( __in void* cookie ) { map.addDataByKey( current_thread(), cookie ); }
+    void  leave() { map.removeKeyAndReturnItsData( current_thread() ); }
+};
+
+class RecursionEngineTracker{
+    
+public:
+    
+    bool  init() { return RecursionEngine::Init(); }
+    void* cookie() { return RecursionEngine::CookieForRecursiveCall(); }
+    bool  isRecursive() { return RecursionEngine::IsRecursiveCall(); }
+    void  enter( __in void* cookie ) { RecursionEngine::EnterRecursiveCall( cookie ); }
+    void  leave() { RecursionEngine::LeaveRecursiveCall(); }
+};
+
+//--------------------------------------------------------------------
+
+template< typename Tracker >
+class TrackerContext{
+    
+public:
+    Tracker*  tracker;
+    uint64_t  iterations;  // per thread
+};
+
+template< typename Tracker >
+static void TrackerRoutine( __in void* context, __in int thread )
+{
+    TrackerContext< Tracker >*  trackerContext = (TrackerContext< Tracker >*)context;
+    Tracker*                    tracker = trackerContext->tracker;
+    uint64_t                    failures = 0x0;
+    
+    for( uint64_t i = 0x0; i < trackerContext->iterations; ++i ){
+    
+        void* cookie = (void*)( ( i << 8 ) | ( thread << 1 ) | 0x1 );
+        
+        failures += tracker->isRecursive();
+        
+        tracker->enter( cookie );
+        
+        failures += ! tracker->isRecursive();
+        failures += ( cookie != tracker->cookie() );
+        
+        tracker->leave();
+    }
+    
+    //
+    // a thread must see only its own state
+    //
+    BENCH_CHECK( 0x0 == failures );
+}
+
+template< typename Tracker >
+static void Run( __in const char* name, __in Tracker* tracker )
+{
+    TrackerContext< Tracker >  context;
+    char                       title[ 128 ];
+    
+    if( ! tracker->init() ){
+    
+        printf( "%s: init() failed\n", name );
+        return;
+    }
+    
+    context.tracker = tracker;
+    context.iterations = BenchScale( 0x1 << 20 );
+    
+    for( int threads = 0x1; threads <= 32; threads *= 2 ){
+    
+        uint64_t time = BenchRunThreads( threads, TrackerRoutine< Tracker >, &context );
+        
+        snprintf( title, sizeof( title ), "%s, %d threads", name, threads );
+        BenchReport( title, context.iterations * threads, time );
+    }
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    DataMapTracker< LinkedListDataMap >  linkedList;
+    DataMapTracker< DataMap >            dataMap;
+    RecursionEngineTracker               engine;
+    
+    //
+    // the aggregate time per iteration is reported, it scales only if
+    // the machine has as many cores as threads
+    //
+    Run( "DataMap linked list", &linkedList );
+    Run( "DataMap", &dataMap );
+    Run( "RecursionEngine", &engine );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+//
+//  VNodeMocks.h
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#ifndef __VFSFilter0Bench__VNodeMocks__
+#define __VFSFilter0Bench__VNodeMocks__
+
+//
+// the declarations VNode.h expects from a user mode build, VNode.cpp is
+// compiled with the header forced in by the Makefile
+//
+
+#include <errno.h>
+#include "BenchSupport.h"
+
+//--------------------------------------------------------------------
+
+#define MOCK_VNODE_ALIVE  0x600DF00D
+#define MOCK_VNODE_DEAD   0xDEADBEEF
+
+//
+// a vnode counts its references, the last vnode_put() poisons it,
+// a reference taken on a poisoned vnode means the vnode was used after
+// its last reference had been dropped, the vnodes are never freed while
+// a test is running so the check itself reads a valid memory
+//
+typedef struct vnode{
+    SInt32 volatile  references;
+    UInt32 volatile  magic;
+}* vnode_t;
+
+#define NULLVP  ( (vnode_t)NULL )
+
+inline void MockVnodeInit( __in vnode_t vp )
+{
+    vp->references = 0x1;
+    vp->magic = MOCK_VNODE_ALIVE;
+}
+
+inline bool MockVnodeIsAlive( __in vnode_t vp ) { return MOCK_VNODE_ALIVE == vp->magic; }
+
+inline int vnode_get( __in vnode_t vp )
+{
+    static __thread UInt32  calls;
+    
+    //
+    // a caller has fetched the pointer, a yield lets the other threads
+    // drop the references that the caller relies on, without it a race
+    // is rarely seen on a machine with few CPUs
+    //
+    if( 0x0 == ( ++calls & 0x3F ) )
+        sched_yield();
+    
+    if( ! MockVnodeIsAlive( vp ) ){
+    
+        BENCH_CHECK( ! "vnode_get() of a released vnode" );
+        return ENOENT;
+    }
+    
+    SInt32 references = __sync_fetch_and_add( &vp->references, 1 );
+    BENCH_CHECK( references > 0x0 );
+    
+    return 0x0;
+}
+
+inline int vnode_put( __in vnode_t vp )
+{
+    SInt32 references = __sync_fetch_and_sub( &vp->references, 1 );
+    BENCH_CHECK( references > 0x0 );
+    
+    if( 0x1 == references )
+        vp->magic = MOCK_VNODE_DEAD;
+    
+    return 0x0;
+}
+
+//--------------------------------------------------------------------
+
+class ApplicationData{
+    
+public:
+    const char*   redirectTo;
+    const char*   applicationShortName;
+    bool          redirectIO;
+};
+
+//--------------------------------------------------------------------
+
+inline UInt64 mach_absolute_time() { return BenchNow(); }
+
+inline void absolutetime_to_nanoseconds( __in UInt64 abstime, __out UInt64* result ) { *result = abstime; }
+
+//--------------------------------------------------------------------
+
+#endif /* defined(__VFSFilter0Bench__VNodeMocks__) */
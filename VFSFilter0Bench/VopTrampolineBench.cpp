@@ -0,0 +1,246 @@
+//
+//  VopTrampolineBench.cpp
+//  VFSFilter0Bench
+//
+//  Created by slava on 03/08/2015.
+//  Copyright (c) 2015 Slava Imameev. All rights reserved.
+//
+
+#include <errno.h>
+#include "BenchSupport.h"
+
+//--------------------------------------------------------------------
+
+//
+// the passthrough overhead of the QvrVopTrampoline instances for the vnodes
+// that are not tracked, a VOP is called through the v_op vector of a mock
+// vnode as VNOP_READ() and others do and compared with a call of the original
+// function through the same vector, the kernel declarations used by
+// VopTrampoline.h are replaced with the mocks below,
+//
+// QvrGetOriginalVnodeOp() is a noinline array read, it doesn't include the
+// snapshot lookup of VNodeHook.cpp, the handlers pass the untracked vnodes
+// to the original function as the filter's handlers do
+//
+
+//--------------------------------------------------------------------
+
+typedef int (*VOPFUNC)( void* );
+
+typedef struct vnode{
+    VOPFUNC*  v_op;
+    bool      tracked;
+}* vnode_t;
+
+struct vnodeop_desc{
+    int  vdesc_offset;
+};
+
+struct vnodeopv_entry_desc{
+    struct vnodeop_desc*  opve_op;
+    VOPFUNC               opve_impl;
+};
+
+typedef enum _QvrVopEnum{
+    QvrVopEnum_Unknown = 0x0,
+    QvrVopEnum_read,
+    QvrVopEnum_write,
+    QvrVopEnum_lookup,
+    QvrVopEnum_create,
+    QvrVopEnum_close,
+    QvrVopEnum_getattr,
+    QvrVopEnum_Max
+} QvrVopEnum;
+
+struct vnodeop_desc  vnop_read_desc    = { QvrVopEnum_read };
+struct vnodeop_desc  vnop_write_desc   = { QvrVopEnum_write };
+struct vnodeop_desc  vnop_lookup_desc  = { QvrVopEnum_lookup };
+struct vnodeop_desc  vnop_create_desc  = { QvrVopEnum_create };
+struct vnodeop_desc  vnop_close_desc   = { QvrVopEnum_close };
+struct vnodeop_desc  vnop_getattr_desc = { QvrVopEnum_getattr };
+
+struct vnop_read_args    { struct vnodeop_desc* a_desc; vnode_t a_vp;  void* a_uio; int a_ioflag; };
+struct vnop_write_args   { struct vnodeop_desc* a_desc; vnode_t a_vp;  void* a_uio; int a_ioflag; };
+struct vnop_lookup_args  { struct vnodeop_desc* a_desc; vnode_t a_dvp; vnode_t* a_vpp; void* a_cnp; };
+struct vnop_create_args  { struct vnodeop_desc* a_desc; vnode_t a_dvp; vnode_t* a_vpp; void* a_cnp; };
+struct vnop_close_args   { struct vnodeop_desc* a_desc; vnode_t a_vp;  int a_fflag; };
+struct vnop_getattr_args { struct vnodeop_desc* a_desc; vnode_t a_vp;  void* a_vap; };
+
+//--------------------------------------------------------------------
+
+static VOPFUNC   gOriginalVops[ QvrVopEnum_Max ];
+static VOPFUNC   gHookedVops[ QvrVopEnum_Max ];
+static bool      gRecursiveCall;
+static bool      gStatisticsEnabled;
+static uint64_t  gStatisticsCalls;
+
+inline UInt64 mach_absolute_time() { return BenchNow(); }
+
+__attribute__(( noinline )) VOPFUNC QvrGetOriginalVnodeOp( __in vnode_t vnode, __in QvrVopEnum indx )
+{
+    assert( gHookedVops == vnode->v_op );
+    return gOriginalVops[ indx ];
+}
+
+class RecursionEngine{
+    
+public:
+    static bool IsRecursiveCall() { return gRecursiveCall; }
+};
+
+inline bool IsUserClient() { return false; }
+
+#define QVR_HOOKED_VOPS( _X_ ) \
+    _X_( read,    vnop_read_args,    a_vp,  BenchReadHook,    QvrVopNoPassthrough ) \
+    _X_( write,   vnop_write_args,   a_vp,  BenchWriteHook,   QvrVopNoPassthrough ) \
+    _X_( lookup,  vnop_lookup_args,  a_dvp, BenchLookupHook,  QvrVopNoPassthrough ) \
+    _X_( create,  vnop_create_args,  a_dvp, BenchCreateHook,  QvrVopPassthroughOnRecursion ) \
+    _X_( close,   vnop_close_args,   a_vp,  BenchCloseHook,   QvrVopNoPassthrough ) \
+    _X_( getattr, vnop_getattr_args, a_vp,  BenchGetattrHook, QvrVopPassthroughOnRecursion )
+
+#define QVR_VOP_STATISTICS_INDEX( _Name_, _Args_, _Vnode_, _Handler_, _Policy_ )  QvrHookedVop_##_Name_,
+
+typedef enum _QvrHookedVopEnum{
+    QVR_HOOKED_VOPS( QVR_VOP_STATISTICS_INDEX )
+    QvrHookedVop_Max
+} QvrHookedVopEnum;
+
+class QvrVopStatistics{
+    
+public:
+    static bool IsEnabled() { return gStatisticsEnabled; }
+    
+    static void Account( __in QvrHookedVopEnum vop, __in UInt64 time, __in UInt32 originalCalls, __in UInt64 originalTime )
+    {
+        gStatisticsCalls += originalCalls;
+    }
+};
+
+#include "VopTrampoline.h"
+
+//--------------------------------------------------------------------
+
+//
+// the handlers pass the untracked vnodes to the original function
+//
+#define BENCH_VOP_HANDLER( _Handler_, _Args_, _Vnode_ ) \
+    static int _Handler_( __inout struct _Args_* ap, __in QvrVopOriginal< struct _Args_ >& origVnop ) \
+    { \
+        if( ! ap->_Vnode_->tracked ) \
+            return origVnop( ap ); \
+        return EPERM; \
+    }
+
+BENCH_VOP_HANDLER( BenchReadHook,    vnop_read_args,    a_vp )
+BENCH_VOP_HANDLER( BenchWriteHook,   vnop_write_args,   a_vp )
+BENCH_VOP_HANDLER( BenchLookupHook,  vnop_lookup_args,  a_dvp )
+BENCH_VOP_HANDLER( BenchCreateHook,  vnop_create_args,  a_dvp )
+BENCH_VOP_HANDLER( BenchCloseHook,   vnop_close_args,   a_vp )
+BENCH_VOP_HANDLER( BenchGetattrHook, vnop_getattr_args, a_vp )
+
+static struct vnodeopv_entry_desc  gBenchVnodeVopHookEntries[] = {
+    QVR_HOOKED_VOPS( QVR_VOP_HOOK_ENTRY )
+    { (struct vnodeop_desc*)NULL, (VOPFUNC)NULL }
+};
+
+//--------------------------------------------------------------------
+
+__attribute__(( noinline )) static int BenchOriginalVop( __in void* ap )
+{
+    return 0x0;
+}
+
+//--------------------------------------------------------------------
+
+//
+// calls the VOP as VNOP_READ() does, the vector is read for each call
+//
+static uint64_t CallVop( __in VOPFUNC* volatile* vector, __in struct vnodeop_desc* desc, __in void* ap, __in uint64_t calls )
+{
+    int errors = 0x0;
+    
+    uint64_t start = BenchNow();
+    for( uint64_t i = 0x0; i < calls; ++i )
+        errors += (*vector)[ desc->vdesc_offset ]( ap );
+    uint64_t time = BenchNow() - start;
+    
+    BENCH_CHECK( 0x0 == errors );
+    return time;
+}
+
+//--------------------------------------------------------------------
+
+int main()
+{
+    uint64_t          calls = BenchScale( 0x1 << 24 );
+    struct vnode      vnode = { gHookedVops, false };
+    VOPFUNC           originals[ QvrVopEnum_Max ];
+    VOPFUNC* volatile vector;
+    char              title[ 128 ];
+    
+    for( int i = 0x0; i < QvrVopEnum_Max; ++i ){
+    
+        gOriginalVops[ i ] = BenchOriginalVop;
+        originals[ i ] = BenchOriginalVop;
+    }
+    
+    //
+    // the hooked vector is built as QvrVnodeHookInit() does from the hook entries
+    //
+    for( int i = 0x0; gBenchVnodeVopHookEntries[ i ].opve_op; ++i )
+        gHookedVops[ gBenchVnodeVopHookEntries[ i ].opve_op->vdesc_offset ] = gBenchVnodeVopHookEntries[ i ].opve_impl;
+    
+    struct vnop_read_args     readArgs    = { &vnop_read_desc, &vnode, NULL, 0x0 };
+    struct vnop_write_args    writeArgs   = { &vnop_write_desc, &vnode, NULL, 0x0 };
+    struct vnop_lookup_args   lookupArgs  = { &vnop_lookup_desc, &vnode, NULL, NULL };
+    struct vnop_create_args   createArgs  = { &vnop_create_desc, &vnode, NULL, NULL };
+    struct vnop_close_args    closeArgs   = { &vnop_close_desc, &vnode, 0x0 };
+    struct vnop_getattr_args  getattrArgs = { &vnop_getattr_desc, &vnode, NULL };
+    
+    struct{
+        const char*           name;
+        struct vnodeop_desc*  desc;
+        void*                 ap;
+    } vops[] = {
+        { "read",    &vnop_read_desc,    &readArgs },
+        { "write",   &vnop_write_desc,   &writeArgs },
+        { "lookup",  &vnop_lookup_desc,  &lookupArgs },
+        { "create",  &vnop_create_desc,  &createArgs },
+        { "close",   &vnop_close_desc,   &closeArgs },
+        { "getattr", &vnop_getattr_desc, &getattrArgs }
+    };
+    
+    for( size_t v = 0x0; v < sizeof( vops ) / sizeof( vops[ 0 ] ); ++v ){
+    
+        vector = originals;
+        uint64_t directTime = CallVop( &vector, vops[ v ].desc, vops[ v ].ap, calls );
+        
+        vector = gHookedVops;
+        uint64_t hookedTime = CallVop( &vector, vops[ v ].desc, vops[ v ].ap, calls );
+        
+        snprintf( title, sizeof( title ), "%s, original", vops[ v ].name );
+        BenchReport( title, calls, directTime );
+        
+        snprintf( title, sizeof( title ), "%s, trampoline", vops[ v ].name );
+        BenchReport( title, calls, hookedTime );
+        
+        printf( "%-48s %10.2f ns/call overhead\n", "", (double)( (int64_t)hookedTime - (int64_t)directTime ) / calls );
+    }
+    
+    //
+    // the recursion policy skips the handler, the statistics add the timing
+    //
+    vector = gHookedVops;
+    
+    gRecursiveCall = true;
+    BenchReport( "getattr, trampoline, recursive call", calls, CallVop( &vector, &vnop_getattr_desc, &getattrArgs, calls ) );
+    gRecursiveCall = false;
+    
+    gStatisticsEnabled = true;
+    BenchReport( "read, trampoline, statistics enabled", calls, CallVop( &vector, &vnop_read_desc, &readArgs, calls ) );
+    gStatisticsEnabled = false;
+    
+    BENCH_CHECK( calls == gStatisticsCalls );
+    
+    return BenchFailures() ? 1 : 0;
+}
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/acl.h>
+#include <unistd.h>
 
 #include "../../VFSFilter0/VFSFilter0/VFSFilter0UserClientInterface.h"
 
@@ -46,6 +47,155 @@ OpcodeToString(
     return "Wrong Opcode Value";
 }
 
+const char*
+TableToString(
+    int table
+    )
+{
+    switch( table ){
+        case VFSTable_RecursionOverflowMap:
+            return "recursion overflow map";
+        case VFSTable_VnodeHooks:
+            return "vnode hooks table";
+    }
+    
+    return "Wrong Table Value";
+}
+
+int
+PrintStatistics(
+    io_connect_t connection
+    )
+{
+    VFSFilter0Statistics  statistics = {0};
+    size_t                size = sizeof(statistics);
+    
+    kern_return_t status = IOConnectCallStructMethod(connection,
+                                                     kt_kVnodeWatcherUserClientGetStatistics,
+                                                     NULL,
+                                                     0x0,
+                                                     &statistics,
+                                                     &size);
+    if (status != KERN_SUCCESS) {
+        
+        fprintf(stderr, "*** IOConnectCallStructMethod returned an error (%d)\n", status);
+        return -1;
+    }
+    
+    if (VFS_STATISTICS_VER != statistics.Version) {
+        
+        fprintf(stderr, "*** unknown statistics version (%d)\n", statistics.Version);
+        return -1;
+    }
+    
+    for (int i = 0; i < statistics.TablesCount && i < VFSTable_Count; ++i) {
+        
+        VFSTableStatistics* table = &statistics.Tables[i];
+        
+        printf("%s:\n", TableToString(i));
+        printf("    entries %llu, buckets %llu, rehashes %llu\n",
+               table->entries, table->buckets, table->rehashes);
+        printf("    lookups %llu, average chain %.2f, max chain %llu\n",
+               table->lookups,
+               table->lookups ? (double)table->lookupProbes/table->lookups : 0.0,
+               table->maxProbes);
+        printf("    lock acquisitions %llu, waiting %llu ns\n",
+               table->lockAcquisitions, table->lockWaitNs);
+        printf("    hits %llu, misses %llu, evictions %llu\n",
+               table->lookups - table->misses, table->misses, table->evictions);
+        printf("    memory %llu bytes: buckets %llu, entries %llu (keys %llu)\n",
+               table->bucketBytes + table->entryBytes,
+               table->bucketBytes, table->entryBytes, table->keyBytes);
+        
+        if (table->maxChain) {
+            
+            printf("    bucket chains, longest %llu:", table->maxChain);
+            for (int j = 0; j < VFS_CHAIN_LENGTHS; ++j)
+                printf(" %d%s:%llu", j, (VFS_CHAIN_LENGTHS - 1 == j) ? "+" : "", table->chainLengths[j]);
+            printf("\n");
+        }
+    }
+    
+    return 0;
+}
+
+void
+PrintLatencyHistogram(
+    const char* title,
+    const uint64_t* latency
+    )
+{
+    int last = VFS_LATENCY_BUCKETS - 1;
+    
+    while (last > 0 && 0 == latency[last])
+        --last;
+    
+    printf("    %s:", title);
+    for (int i = 0; i <= last; ++i) {
+        
+        if (VFS_LATENCY_BUCKETS - 1 == i)
+            printf(" %lluns+:%llu", 1ULL << (i + VFS_LATENCY_SHIFT - 1), latency[i]);
+        else
+            printf(" <%lluns:%llu", 1ULL << (i + VFS_LATENCY_SHIFT), latency[i]);
+    }
+    printf("\n");
+}
+
+int
+PrintVopStatistics(
+    io_connect_t connection
+    )
+{
+    int32_t  vopsCount = 1;
+    
+    for (int32_t vop = 0; vop < vopsCount; ++vop) {
+        
+        VFSFilter0VopStatistics  statistics = {0};
+        size_t                   size = sizeof(statistics);
+        
+        kern_return_t status = IOConnectCallStructMethod(connection,
+                                                         kt_kVnodeWatcherUserClientGetVopStatistics,
+                                                         &vop,
+                                                         sizeof(vop),
+                                                         &statistics,
+                                                         &size);
+        if (status != KERN_SUCCESS) {
+            
+            fprintf(stderr, "*** IOConnectCallStructMethod returned an error (%d)\n", status);
+            return -1;
+        }
+        
+        if (VFS_VOP_STATISTICS_VER != statistics.Version) {
+            
+            fprintf(stderr, "*** unknown VOP statistics version (%d)\n", statistics.Version);
+            return -1;
+        }
+        
+        if (0 == vop)
+            printf("VOP statistics collection is %s\n", statistics.Enabled ? "enabled" : "disabled");
+        
+        vopsCount = statistics.VopsCount;
+        
+        VFSVopStatistics* stat = &statistics.Statistics;
+        
+        printf("%.*s:\n", (int)sizeof(stat->name), stat->name);
+        printf("    calls %llu, filter %llu ns (average %.0f ns)\n",
+               stat->calls, stat->filterNs,
+               stat->calls ? (double)stat->filterNs/stat->calls : 0.0);
+        printf("    original calls %llu, original %llu ns (average %.0f ns)\n",
+               stat->originalCalls, stat->originalNs,
+               stat->originalCalls ? (double)stat->originalNs/stat->originalCalls : 0.0);
+        
+        if (stat->calls)
+            PrintLatencyHistogram("filter latency", stat->filterLatency);
+        
+        if (stat->originalCalls)
+            PrintLatencyHistogram("original latency", stat->originalLatency);
+    }
+    
+    return 0;
+}
+
 void
 VFSFilter0NotificationHandler(void* ctx)
 {
@@ -218,6 +368,40 @@ int main(int argc, const char * argv[])
         return  -1;
     }
     
+    //
+    // -s prints the driver's tables statistics and exits,
+    // -v prints the VOP statistics and exits,
+    // -e 1 enables and resets the VOP statistics collection, -e 0 disables it
+    //
+    while ((opt = getopt(argc, (char* const*)argv, "sve:")) != -1) {
+        
+        if ('s' == opt) {
+            
+            ret = PrintStatistics(connection);
+            (void)IOServiceClose(connection);
+            return ret;
+        }
+        
+        if ('v' == opt) {
+            
+            ret = PrintVopStatistics(connection);
+            (void)IOServiceClose(connection);
+            return ret;
+        }
+        
+        if ('e' == opt) {
+            
+            uint64_t enable = strtoull(optarg, NULL, 0);
+            
+            kr = IOConnectCallScalarMethod(connection, kt_kVnodeWatcherUserClientEnableVopStatistics, &enable, 1, NULL, NULL);
+            if (kr != KERN_SUCCESS)
+                fprintf(stderr, "*** IOConnectCallScalarMethod returned an error (%d)\n", kr);
+            
+            (void)IOServiceClose(connection);
+            return (kr == KERN_SUCCESS) ? 0 : -1;
+        }
+    }
+    
     kr = IOConnectCallScalarMethod(connection, kt_kVnodeWatcherUserClientOpen, NULL, 0, NULL, NULL);
     if (kr != KERN_SUCCESS) {
         IOServiceClose(connection);